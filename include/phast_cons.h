@@ -37,6 +37,8 @@
 struct phastCons_struct {
   MSA *msa;		/**< Multiple Sequence Alignment */
   int post_probs,	/**< Whether to use posterior probabilities */
+    post_probs_binary,	/**< Whether to write posterior probabilities as
+			   a binary track (see WigWriter) */
     score,		/**< Whether to calculate a score */
     quiet,		/**< Whether to display warnings/errors on stderr */
     gff,		/**< Feature Set */
@@ -58,6 +60,10 @@ struct phastCons_struct {
   int nrates,		/**< Number of rates for first tree model */
     nrates2,		/**< Number of rates for second tree model */
     refidx,		/**< Index of reference sequence */
+    window_size,	/**< If positive, compute posterior probabilities and
+			   Viterbi path in windows of this many sites */
+    window_overlap,	/**< Extra sites on each side of a window used in its
+			   computation, but not in its results */
     max_micro_indel;	/**< Maximum length of an alignment gap, any gap longer is treated as missing data*/
   double lambda,	/**< Lambda parameter value */ 
     mu,			/**< Transitions mu value */
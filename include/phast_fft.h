@@ -0,0 +1,82 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/** @file fft.h
+    Linear convolution of real arrays by fast Fourier transform.
+
+    Used by the convolution routines in prob_vector.h and
+    prob_matrix.h when the operands are large enough that the direct
+    nested-loop sum becomes expensive.  Arrays are zero-padded to a
+    power of two and transformed with an iterative radix-2 FFT; both
+    real operands are packed into a single complex transform, so each
+    convolution costs one forward and one inverse transform.
+
+    Round-off error in an FFT convolution is spread evenly over the
+    output, at roughly DBL_EPSILON times its largest value, so small
+    entries -- the tails of a distribution, which is where p-values
+    come from -- would be swamped by it.  Entries below
+    FFT_CONV_NOISE_FACTOR * N * DBL_EPSILON times the largest entry,
+    where N is the transform size, are therefore recomputed by direct
+    sum; the FFT saves work only on the bulk of the distribution.
+    \ingroup base
+*/
+
+#ifndef PHAST_FFT_H
+#define PHAST_FFT_H
+
+/** Smallest amount of direct-sum work (multiply-adds) for which
+    fft_conv_worthwhile will ever choose the FFT */
+#define FFT_CONV_MIN_WORK 16384
+
+/** Output entries smaller than FFT_CONV_NOISE_FACTOR * N *
+    DBL_EPSILON times the largest entry (N = number of points in the
+    transform) are recomputed by direct sum */
+#define FFT_CONV_NOISE_FACTOR 4096
+
+/** Approximate cost of an FFT convolution of N points, in units of
+    direct-sum multiply-adds, is FFT_CONV_COST * N * log2(N) */
+#define FFT_CONV_COST 5
+
+/** Decide whether a convolution should be done by FFT.
+    @param direct_work Number of multiply-adds the direct sum would take
+    @param npoints Total number of points in the padded transform
+    (product of padded dimensions)
+    @result TRUE if the FFT is expected to be faster
+ */
+int fft_conv_worthwhile(double direct_work, long npoints);
+
+/** Return smallest power of two greater than or equal to n */
+int fft_size(int n);
+
+/** Compute the linear convolution of two real arrays by FFT.
+    @param a First operand, length na
+    @param na Length of a
+    @param b Second operand, length nb
+    @param nb Length of b
+    @param c Output array, length nc.  Element x receives sum_j a[j]
+    * b[x-j] for x < nc; elements beyond na + nb - 2 are set to zero.
+    Entries near the round-off level are computed directly (see
+    above).  Inputs are assumed nonnegative.  May not alias a or b.
+    @param nc Length of c
+ */
+void fft_convolve(double *a, int na, double *b, int nb, double *c, int nc);
+
+/** Compute the linear convolution of two real matrices by 2-D FFT.
+    Element [x][y] of the output receives sum_{j,k} a[j][k] * b[x-j][y-k].
+    @param a First operand, nra x nca
+    @param b Second operand, nrb x ncb
+    @param c Output, nrc x ncc; entries outside the support of the
+    full convolution are set to zero and entries near the round-off
+    level are computed directly (see above).  Inputs are assumed
+    nonnegative.  May not alias a or b.
+ */
+void fft_convolve_2d(double **a, int nra, int nca, double **b, int nrb,
+                     int ncb, double **c, int nrc, int ncc);
+
+#endif
@@ -68,7 +68,8 @@ typedef struct {
   double deriv2;                /**< second derivative for 1d case. */
 } ColFitData;
 
-/* data for grid of pre-computed Fisher Information Matrices */
+/* data for grid of pre-computed Fisher Information Matrices (default
+   resolution; see col_set_fim_grid) */
 #define GRIDSIZE1 0.02
 #define GRIDSIZE2 0.05
 #define GRIDMAXLOG 3
@@ -81,6 +82,10 @@ typedef struct {
   int ngrid2;                   /**< Number of grid points above 1 (log
                                    linear) */
   int ngrid;                    /**< Total number of grid points */
+  double gridsize1;             /**< Spacing of grid points between 0
+                                   and 1 */
+  double gridsize2;             /**< Spacing of logs of grid points
+                                   above 1 */
   Matrix **fim;                 /**< Pre-computed FIMs */
 } FimGrid;
 
@@ -104,6 +109,109 @@ ColFitData *col_init_fit_data(TreeModel *mod, MSA *msa, scale_type stype,
    @param d Column Fit Data to free */
 void col_free_fit_data(ColFitData *d);
 
+/** \name Threaded per-tuple computation functions
+ \{ */
+
+/** State of one worker in a threaded per-tuple computation (see
+    col_foreach_tuple).  Fitting a scale factor to a column changes
+    the scale and substitution matrices of the tree model, so each
+    worker needs its own tree model and ColFitData.  Worker 0 uses the
+    caller's tree model; the others use private copies. */
+typedef struct {
+  TreeModel *mod;               /**< Tree model used by this worker */
+  TreeModel *modcpy;            /**< (SUBTREE only) Copy of mod without
+                                   subtree, for the null model */
+  ColFitData *d;                /**< Fit data for mod (ALL), or for
+                                   modcpy (SUBTREE) */
+  ColFitData *d2;               /**< (SUBTREE only) Fit data for mod */
+} ColWorker;
+
+/** Function to be applied to a single column tuple by
+    col_foreach_tuple.
+    @param data Arbitrary data passed through from col_foreach_tuple
+    @param tupleidx Index of column tuple
+    @param thread Index of worker, in [0, col_nworkers(msa))
+ */
+typedef void (*col_tuple_fun)(void *data, int tupleidx, int thread);
+
+/** Return the number of workers col_foreach_tuple will use for an
+    alignment.
+    @param msa Alignment (sufficient statistics required)
+    @result Number of workers, between 1 and thr_get_nthreads()
+ */
+int col_nworkers(MSA *msa);
+
+/** Create state for workers in a threaded per-tuple computation.
+    @param mod Tree model.  Used by worker 0; other workers get copies
+    @param msa Alignment
+    @param stype If ALL, each worker has fit data d for its model.  If
+    SUBTREE, each worker has fit data d2 for its model (which must
+    define a subtree), and fit data d (ALL, NNEUT) for a copy of its
+    model without the subtree, as used for null models
+    @param mode Mode of fit data d (ALL) or d2 (SUBTREE)
+    @param nworkers Number of workers (see col_nworkers)
+    @result Array of nworkers workers
+ */
+ColWorker **col_new_workers(TreeModel *mod, MSA *msa, scale_type stype,
+                            mode_type mode, int nworkers);
+
+/** Free workers created by col_new_workers, including their copies
+    of the tree model.
+    @param w Array of workers
+    @param nworkers Number of workers
+ */
+void col_free_workers(ColWorker **w, int nworkers);
+
+/** Apply a function to each column tuple of an alignment, using up
+    to thr_get_nthreads() threads.  The function is given the index of
+    the calling worker, and must write only to results for its own
+    tuple and to state belonging to that worker.  Results therefore do
+    not depend on the number of threads.
+    @param msa Alignment (sufficient statistics required)
+    @param fun Function to apply to each tuple
+    @param data Passed through to fun
+ */
+void col_foreach_tuple(MSA *msa, col_tuple_fun fun, void *data);
+
+/** Use a persistent cache of per-tuple results (see tuple_cache.h)
+    in col_lrts, col_lrts_sub, col_score_tests, col_score_tests_sub
+    and col_gerp.  Tuples found in the cache are not scored again, and
+    newly scored tuples are added to it.  Results are cached under the
+    tree model, test and mode.  Note that the score tests depend on a
+    sampled estimate of the Fisher information, so their cached
+    results reflect the estimate made by the run that stored them.
+    @param dir Cache directory, or NULL to stop using a cache (the
+    default)
+ */
+void col_set_cache_dir(const char *dir);
+
+/** Keep estimates of Fisher information (see col_estimate_fim and
+    col_fim_grid_sub) in files, so that they need only be computed
+    once for a given tree model.  Files are named
+    <prefix>.<fingerprint>.fim and <prefix>.<fingerprint>.fimgrid,
+    where the fingerprint identifies the tree model (see
+    tm_fingerprint); grids of other than the default resolution (see
+    col_set_fim_grid) are named
+    <prefix>.<fingerprint>.grid<step1>,<step2>,<maxlog>.fimgrid.
+    Because the estimates are made by sampling, results
+    reflect the estimate made by the run that stored them.
+    @param prefix Prefix of file names (typically the name of the
+    tree model file), or NULL to stop using files (the default)
+ */
+void col_set_fim_cache(const char *prefix);
+
+/** Set the resolution of grids computed by col_fim_grid_sub.  Coarser
+    grids are faster to compute but interpolate less accurately.
+    @param gridsize1 Spacing of grid points for scales between 0 and 1
+    (default GRIDSIZE1)
+    @param gridsize2 Spacing of logs of grid points for scales above 1
+    (default GRIDSIZE2)
+    @param maxlog Log of largest scale in grid (default GRIDMAXLOG)
+ */
+void col_set_fim_grid(double gridsize1, double gridsize2, double maxlog);
+
+/** \} */
+
 /** \name Column Fit Data likelihood calculation functions
  \{ */
 
@@ -317,15 +425,34 @@ Matrix *col_estimate_fim_sub(TreeModel *mod);
 
 
 /** Pre-compute estimates of Fisher Information Matrix for a grid of
-   possible scale parameters (subtree case) */
+   possible scale parameters (subtree case), at the resolution set by
+   col_set_fim_grid.  If a FIM cache is in use (see col_set_fim_cache),
+   the grid is read from it if possible, and stored in it otherwise. */
 FimGrid *col_fim_grid_sub(TreeModel *mod);
 
 /** Free FimGrid object  */
 void col_free_fim_grid(FimGrid *g);
 
+/** Write a FimGrid object to a file, in a text format that can be
+    read by col_read_fim_grid.  Values are written with full
+    precision.
+    @param F File to write to
+    @param g Grid to write
+ */
+void col_write_fim_grid(FILE *F, FimGrid *g);
+
+/** Read a FimGrid object written by col_write_fim_grid.
+    @param F File to read from
+    @result Newly allocated grid, or NULL if the file is not in the
+    expected format
+ */
+FimGrid *col_read_fim_grid(FILE *F);
+
 /** Estimate Fisher Information Matrix for the non-subtree case.
    This version does not depend on any free parameters, so no grid is
-   required.  Estimation is done by sampling */
+   required.  Estimation is done by sampling.  If a FIM cache is in
+   use (see col_set_fim_cache), the estimate is read from it if
+   possible, and stored in it otherwise. */
 double col_estimate_fim(TreeModel *mod);
 
 /** Retrieve estimated Fisher Information Matrix for given scale
@@ -36,6 +36,15 @@
 #define BEGIN_STATE -99
 /** Used to identify finished state */
 #define END_STATE -98
+/** HMMs with up to this many states use scaled probabilities rather
+    than logs to compute posterior probabilities (see
+    hmm_posterior_probs_scaled) */
+#define HMM_SCALED_MAX_STATES 16
+/** By default, hmm_viterbi and hmm_posterior_probs switch to
+    checkpointed dynamic programming (see hmm_viterbi_checkpointed)
+    when the number of states times the sequence length exceeds this
+    number of cells (see hmm_set_checkpoint_cells) */
+#define HMM_CHECKPOINT_MIN_CELLS 33554432
 
 #define BEGIN_TRANSITIONS_TAG "BEGIN_TRANSITIONS:"
 #define END_TRANSITIONS_TAG "END_TRANSITIONS:"
@@ -48,10 +57,32 @@ typedef enum {VITERBI, /**< Viterbi for speedy HMM solving */
 	      BACKWARD /**< Backward method of posterior decoding*/
 } hmm_mode;
 
-/* NOTE: eventually need to be able to support an "adjacency list"
- * rather than an "adjacency matrix" representation of an HMM, for
- * better efficiency when there are many states and they are not fully
- * connected  */
+/** Compact, adjacency-list (compressed sparse row) representation of
+    the transitions of an HMM, used by the dynamic programming
+    routines.  It is derived from the predecessor and successor lists
+    and the transition scores, built on demand, and discarded by
+    hmm_reset.  Lists exclude BEGIN_STATE and END_STATE and preserve
+    the order of hmm->predecessors and hmm->successors. */
+typedef struct {
+  int *pred_start;              /**< Predecessors of state i are
+                                   pred[pred_start[i]] through
+                                   pred[pred_start[i+1]-1] */
+  int *pred;                    /**< Predecessor states */
+  double *pred_score;           /**< Log transition probabilities from
+                                   each predecessor */
+  int *succ_start;              /**< Successors of state i are
+                                   succ[succ_start[i]] through
+                                   succ[succ_start[i+1]-1] */
+  int *succ;                    /**< Successor states */
+  double *succ_score;           /**< Log transition probabilities to
+                                   each successor */
+  int max_degree;               /**< Largest number of predecessors
+                                   or successors of any state */
+  int dense2;                   /**< TRUE if the HMM has two states
+                                   and all four transitions between
+                                   them have nonzero probability */
+} HMMTransitionTable;
+
 /** Hidden Markov Model and meta data  */
 typedef struct {
   int nstates;  /**< Number of current states in model */
@@ -67,6 +98,8 @@ typedef struct {
   **successors;			/**< List of successor states in HMM, for each state i, the list of states that state i has a transition to */
   List *begin_successors, /**< List of states for which the begin state has a transition to */
  *end_predecessors;	  /**< List of states that have a transition to the end state */
+  HMMTransitionTable *trans_table; /**< (Optional) Adjacency-list form of
+                                      transitions; see hmm_transition_table */
 } HMM;
 
 
@@ -137,6 +170,15 @@ HMM* hmm_new_from_file(FILE *F);
 */
 void hmm_print(FILE *F, HMM *hmm);
 
+/** Set the number of cells (number of states times sequence length)
+   above which hmm_viterbi and hmm_posterior_probs use checkpointed
+   dynamic programming.
+   @param ncells Number of cells; 0 forces checkpointing for all
+   sequences (default HMM_CHECKPOINT_MIN_CELLS)
+   @note Affects all HMMs; should be called before any threads are started
+*/
+void hmm_set_checkpoint_cells(size_t ncells);
+
 /**
   Finds most probable path, according to the Viterbi algorithm.
 
@@ -144,6 +186,9 @@ void hmm_print(FILE *F, HMM *hmm);
   @param emission_scores Output scores, 2D array, hmm->nstates rows & columns
   @param[in] seqlen Length of path
   @param[out] path Array of integers indicating state numbers in the HMM
+  @note If the number of states times seqlen exceeds
+  HMM_CHECKPOINT_MIN_CELLS (see hmm_set_checkpoint_cells),
+  hmm_viterbi_checkpointed is used
 */
 void hmm_viterbi(HMM *hmm, double **emission_scores, int seqlen, int *path);
 
@@ -176,14 +221,107 @@ double hmm_backward(HMM *hmm, double **emission_scores, int seqlen,
    @param seqlen Number of columns in emission_scores and posterior_probs
    @param posterior_probs  (Optional) Must be allocated to same size as emission_scores
    @result Total log probability of sequence
+   @note For HMMs with at most HMM_SCALED_MAX_STATES states,
+   hmm_posterior_probs_scaled is used; otherwise (or if it fails) the
+   forward and backward algorithms are run in log space.  If the
+   number of states times seqlen exceeds HMM_CHECKPOINT_MIN_CELLS
+   (see hmm_set_checkpoint_cells), hmm_posterior_probs_checkpointed is
+   used instead
 */
 double hmm_posterior_probs(HMM *hmm, double **emission_scores, int seqlen,
                            double **posterior_probs);
 
+/** Fills matrix of posterior probabilities using the forward and
+   backward algorithms on probabilities rather than logs, with
+   the forward probabilities normalized to sum to one in each
+   column (Rabiner's scaling).  Avoids nearly all calls to exp and
+   log, and is much faster than the log-space version for HMMs with
+   few states.  Results agree with the log-space version up to
+   rounding error.
+   @param[in] hmm Model to use
+   @param[in] emission_scores Emission scores (logs, base 2), 2D array, hmm->nstates rows & seqlen columns
+   @param[in] seqlen Number of columns in emission_scores and posterior_probs
+   @param[out] posterior_probs Must be allocated to same size as
+   emission_scores, except that rows may be NULL for states whose
+   posterior probabilities are not needed
+   @param[out] logp Total log probability of sequence (base 2)
+   @result TRUE on success, FALSE if scaling failed (a column with
+   probability zero), in which case the log-space version should be
+   used instead
+*/
+int hmm_posterior_probs_scaled(HMM *hmm, double **emission_scores,
+                               int seqlen, double **posterior_probs,
+                               double *logp);
+
+/** Run the Viterbi algorithm in bounded memory.  Viterbi scores are
+   saved only at the first column of each block of columns
+   (checkpoints), and scores and back pointers are recomputed one
+   block at a time during the traceback.  Uses O(nstates *
+   (seqlen/block_size + block_size)) memory, and about twice the time
+   of hmm_viterbi.  The path is identical to that of hmm_viterbi.
+   @param[in] hmm Model to use
+   @param[in] emission_scores Emission scores, hmm->nstates rows & seqlen columns
+   @param[in] seqlen Number of columns in emission_scores
+   @param[out] path Most likely path; must be allocated to length seqlen
+   @param[in] block_size Number of columns per block, or -1 for
+   about sqrt(seqlen)
+*/
+void hmm_viterbi_checkpointed(HMM *hmm, double **emission_scores, int seqlen,
+                              int *path, int block_size);
+
+/** Compute posterior probabilities in bounded memory.  Like
+   hmm_viterbi_checkpointed, forward scores are saved only at
+   checkpoints and recomputed one block at a time during the backward
+   pass.  Uses O(nstates * (seqlen/block_size + block_size)) memory
+   (besides emission_scores and posterior_probs), and gives the same
+   posterior probabilities as the log-space version of
+   hmm_posterior_probs.
+   @param[in] hmm Model to use
+   @param[in] emission_scores Emission scores, hmm->nstates rows & seqlen columns
+   @param[in] seqlen Number of columns in emission_scores and posterior_probs
+   @param[out] posterior_probs Must be allocated to same size as
+   emission_scores, except that rows may be NULL for states whose
+   posterior probabilities are not needed
+   @param[in] block_size Number of columns per block, or -1 for
+   about sqrt(seqlen)
+   @result Total log probability of sequence
+*/
+double hmm_posterior_probs_checkpointed(HMM *hmm, double **emission_scores,
+                                        int seqlen, double **posterior_probs,
+                                        int block_size);
+
+/** Core dynamic programming routine used by hmm_viterbi and
+   hmm_forward (not intended to be called directly).  Visits only
+   allowed transitions, using hmm_transition_table, and has a special
+   case for fully connected two-state HMMs.
+   @param[in] hmm Model to use
+   @param[in] emission_scores Emission scores, hmm->nstates rows & seqlen columns
+   @param[in] seqlen Number of columns
+   @param[in] mode VITERBI or FORWARD
+   @param[out] full_scores Viterbi or forward scores, same size as emission_scores
+   @param[out] backptr Back pointers (Viterbi only), same size as emission_scores
+*/
 void hmm_do_dp_forward(HMM *hmm, double **emission_scores, int seqlen, 
                        hmm_mode mode, double **full_scores, int **backptr);
+
+/** Core dynamic programming routine used by hmm_backward (not
+   intended to be called directly).  See hmm_do_dp_forward.
+   @param[in] hmm Model to use
+   @param[in] emission_scores Emission scores, hmm->nstates rows & seqlen columns
+   @param[in] seqlen Number of columns
+   @param[out] full_scores Backward scores, same size as emission_scores
+*/
 void hmm_do_dp_backward(HMM *hmm, double **emission_scores, int seqlen, 
                         double **full_scores);
+
+/** Get the adjacency-list representation of the transitions of an
+   HMM, building it (and the transition scores) if necessary.
+   @param hmm Model to use
+   @result Transition table, owned by hmm
+   @note Like the transition scores, the table is not rebuilt until
+   hmm_reset is called
+*/
+HMMTransitionTable *hmm_transition_table(HMM *hmm);
 /** 
     Finds max or sum of score/transition combination over all previous
    states (max for Viterbi, sum for forward/backward).
@@ -347,7 +485,8 @@ void hmm_renormalize(HMM *hmm);
 void hmm_stochastic_traceback(HMM *hmm, double **forward_scores, 
 			      int seqlen, int *path);
 
-/** Set the transition_score_matrix in an hmm object. 
+/** Set the transition_score_matrix (and transition table; see
+  hmm_transition_table) in an hmm object. 
   @param hmm Model to prepare
   @warning This must be done before calling any functions that use hmm_get_transition_score in a multithreaded context.
 */
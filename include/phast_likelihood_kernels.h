@@ -0,0 +1,59 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/** @file likelihood_kernels.h
+    Inner-loop kernels for Felsenstein's pruning algorithm.
+
+    The basic step of the pruning algorithm computes, for each state i
+    at an internal node, the product over the two children of
+    sum_j P[i][j] L[j], where P is the substitution probability matrix
+    for the child's branch and L is the child's vector of partial
+    likelihoods.  Specialized versions of this step are provided for
+    4-state (nucleotide) and 16-state (dinucleotide) models.  They
+    expect substitution matrices to be packed into a contiguous array
+    by lk_pack_matrix, and use SSE2 or AVX2 instructions on x86
+    processors when available (selected at run time).  Other cases,
+    and other processors, use portable C.
+
+    Each sum is accumulated in the same order as in the plain nested
+    loop, so all versions give identical results.
+    \ingroup phylo
+*/
+
+#ifndef PHAST_LIKELIHOOD_KERNELS_H
+#define PHAST_LIKELIHOOD_KERNELS_H
+
+#include <phast_matrix.h>
+
+/** Whether specialized kernels exist for a given number of states.
+    If not, lk_prune still works but is no faster than a simple loop,
+    and it is usually better not to bother packing matrices. */
+#define lk_has_kernel(nstates) ((nstates) == 4 || (nstates) == 16)
+
+/** Pack a square matrix into the layout expected by lk_prune.
+    @param dest Destination array of size P->nrows * P->nrows
+    @param P Substitution probability matrix
+ */
+void lk_pack_matrix(double *dest, Matrix *P);
+
+/** Compute the partial likelihoods at an internal node from those at
+    its children.  Sets partial[i] = (sum_j lpartial[j] * lP[i][j]) *
+    (sum_k rpartial[k] * rP[i][k]) for all i.
+    @param nstates Number of states
+    @param partial Partial likelihoods at node (output)
+    @param lpartial Partial likelihoods at left child
+    @param lP Substitution matrix for left branch, packed by lk_pack_matrix
+    @param rpartial Partial likelihoods at right child
+    @param rP Substitution matrix for right branch, packed by lk_pack_matrix
+ */
+void lk_prune(int nstates, double *partial,
+              const double *lpartial, const double *lP,
+              const double *rpartial, const double *rP);
+
+#endif
@@ -31,6 +31,7 @@
 #include "phast_msa.h"
 #include "phast_hashtable.h"
 #include "phast_gff.h"
+#include "phast_maf_block.h"
 
 /** Hold data for a single block within a MAF file */
 typedef struct {
@@ -275,6 +276,56 @@ MSA *maf_read(FILE *F, FILE *REFSEQF, int tuple_size, char *alphabet,
 	      GFF_Set *gff, CategoryMap *cm, int cycle_size, int store_order, 
 	      char *reverse_groups, int gap_strip_mode, int keep_overlapping);
 
+/** Read an Alignment from a MAF file block by block, with bounded memory.
+   Sufficient statistics (tuple size 1) are built directly from each
+   block as it is read, and the block is discarded immediately.
+   Distinct column tuples are stored only once, so memory use is
+   proportional to the number of distinct tuples, plus one tuple index
+   per alignment column if store_order == TRUE.
+   @pre The MAF file must be sorted with respect to the reference
+   sequence if store_order == TRUE, and must be seekable.
+   @param[in] F MAF file
+   @param[in] alphabet (Optional) alphabet for alignment; if NULL, DEFAULT_ALPHABET is assumed
+   @param[in] store_order Whether to store order in which tuples
+                      occur.  Positions in the reference sequence
+                      between blocks are represented as Ns
+   @param[in] seqnames (Optional) If non-NULL, keep only these
+                      sequences, in this order (the reference sequence
+                      is moved to the front)
+   @result New alignment, equivalent to that returned by
+   maf_read_cats_subset with REFSEQF == NULL, tuple_size == 1, no
+   features, gap_strip_mode == NO_STRIP, keep_overlapping == FALSE,
+   and seq_keep == TRUE
+   @warning Any blocks falling out of order (if store_order == TRUE), or
+   which are redundant with previous blocks, will be discarded.
+ */
+MSA *maf_read_ss_stream(FILE *F, char *alphabet, int store_order,
+                        List *seqnames);
+
+/** Read the part of an Alignment overlapping a region of the
+   reference sequence from a MAF file, with bounded memory.  Like
+   maf_read_ss_stream, but uses an index to seek directly to the
+   blocks overlapping the region, without parsing the rest of the
+   file.  Blocks partially overlapping the region are included in
+   their entirety.  If store_order == TRUE, blocks that a sequential
+   read would ignore as out of order (see mafIndex_in_order) are
+   ignored here too, so the result for the region does not depend on
+   where the region starts.
+   @param[in] F MAF file
+   @param[in] idx (Optional) Index of F (see mafIndex_open).  If NULL,
+                      the entire file is read, as in maf_read_ss_stream
+   @param[in] start Start of region (0-based)
+   @param[in] end End of region (0-based, exclusive)
+   @param[in] alphabet (Optional) alphabet for alignment; if NULL, DEFAULT_ALPHABET is assumed
+   @param[in] store_order Whether to store order in which tuples occur
+   @param[in] seqnames (Optional) If non-NULL, keep only these sequences
+   @result New alignment.  If store_order == TRUE, its idx_offset is
+   the start of the first block read.
+ */
+MSA *maf_read_ss_stream_region(FILE *F, MafIndex *idx, long start, long end,
+                               char *alphabet, int store_order,
+                               List *seqnames);
+
 /** Read a subset Alignment from a MAF file; subset selected by feature name; not necessarily read in order wrt reference sequence.
    @pre The MAF file must be sorted with respect to the reference sequence.  
    @param[in] F MAF file
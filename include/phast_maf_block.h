@@ -55,6 +55,48 @@ typedef struct MAFBLOCK {
   struct MAFBLOCK *prev, *next; /**< Pointers to other Maf blocks in a MAF file */
 } MafBlock;
 
+/** Suffix appended to the name of a MAF file to obtain the name of
+    its index file */
+#define MAF_INDEX_SUFFIX ".idx"
+
+/** Version of index file format */
+#define MAF_INDEX_VERSION 2
+
+/** Number of characters at the start of each line examined when
+    building an index */
+#define MAF_INDEX_LINE_PREFIX 1024
+
+/** Index of the blocks of a MAF file by reference-sequence
+    coordinates.  Maps the interval of the reference sequence spanned
+    by each block to the byte offset of the block in the file, so that
+    the blocks overlapping a region can be read without parsing the
+    rest of the file.  Entries are sorted by start coordinate. */
+typedef struct {
+  String *refseq;  /**< Name of reference species (first sequence of
+                      first block) */
+  long fsize;      /**< Size of MAF file when index was built (used to
+                      detect stale index files) */
+  int nblocks;     /**< Number of blocks */
+  int alloc_nblocks; /**< Allocated size of arrays */
+  long *start,     /**< Start of each block in reference sequence
+                      (0-based) */
+    *end,          /**< End of each block in reference sequence
+                      (0-based, exclusive) */
+    *offset,       /**< Byte offset of each block ('a' line) in file */
+    *maxend;       /**< maxend[i] is maximum of end[0..i] */
+} MafIndex;
+
+/** Size of the chunks of text handed to worker threads by a
+    MafBlockReader (chunks are extended to end at a block boundary) */
+#define MAF_READER_CHUNK_SIZE (1 << 20)
+
+/** Reader for the blocks of a MAF file that parses blocks in
+    parallel.  One thread reads the file and splits it into chunks
+    at the 'a' lines that begin blocks, worker threads parse the
+    chunks into MafBlocks, and the blocks are returned to the caller
+    in their order in the file.  See mafBlockReader_new. */
+typedef struct maf_block_reader MafBlockReader;
+
 /** \name MAF block read/write file functions 
  \{ */
 
@@ -220,6 +262,113 @@ int mafBlock_numSpec(MafBlock *block);
 int mafBlock_all_gaps(MafBlock *block);
 
 
+/** \} \name MAF index functions
+   \{ */
+
+/** Build an index of a MAF file by scanning it.
+    @param mfile MAF file, positioned at the beginning of the data to
+    be indexed.  Must be seekable
+    @result New index (fsize is not set)
+*/
+MafIndex *mafIndex_build(FILE *mfile);
+
+/** Write an index to a file.  The entries are followed by a trailer
+    line giving their number, so that truncated files can be detected.
+    @param outfile File to write to
+    @param idx Index to write
+*/
+void mafIndex_write(FILE *outfile, MafIndex *idx);
+
+/** Read an index written by mafIndex_write.
+    @param infile File to read from
+    @result New index, or NULL if file is not a valid index file
+    (including one that is truncated)
+*/
+MafIndex *mafIndex_read(FILE *infile);
+
+/** Obtain an index for a MAF file.  The index file
+    <maf_fname>MAF_INDEX_SUFFIX is used if it exists and is up to date;
+    otherwise the MAF is scanned to build the index.  A newly built
+    index is written to a temporary file which is then renamed, so
+    concurrent processes never read a partial index.
+    @param maf_fname Name of MAF file
+    @param save If TRUE, save a newly built index to the index file
+    (where possible), so that it need only be built once
+    @result Index, or NULL if maf_fname is not a regular file (e.g., "-"
+    for stdin)
+*/
+MafIndex *mafIndex_open(char *maf_fname, int save);
+
+/** Find the blocks overlapping a region of the reference sequence.
+    @param idx Index of MAF file
+    @param start Start of region (0-based)
+    @param end End of region (0-based, exclusive)
+    @result List of indices of blocks (in idx) whose reference
+    sequence overlaps [start, end), in order of appearance in the file
+*/
+List *mafIndex_query(MafIndex *idx, long start, long end);
+
+/** Find the blocks of a MAF file that are out of order with respect
+    to the reference sequence.  Blocks are considered in file order,
+    and a block is out of order if it starts before the end of an
+    earlier block that is not itself out of order.  These are the
+    blocks ignored when a MAF file is read sequentially with
+    store_order == TRUE (see maf_read_ss_stream).
+    @param idx Index of MAF file
+    @result Array of idx->nblocks flags, TRUE for each block (in idx)
+    that is in order
+*/
+int *mafIndex_in_order(MafIndex *idx);
+
+/** Read a block of a MAF file using its index.
+    @param idx Index of MAF file
+    @param mfile MAF file
+    @param i Index of block (as returned by mafIndex_query)
+    @result Block
+*/
+MafBlock *mafIndex_read_block(MafIndex *idx, FILE *mfile, int i);
+
+/** Free an index.
+    @param idx Index to free
+*/
+void mafIndex_free(MafIndex *idx);
+
+/** \} */
+
+/** \name MAF parallel reader functions
+ \{ */
+
+/** Create a reader that parses the blocks of a MAF file in parallel.
+    Reading starts at the current position of mfile, which must not
+    be read by other means until the reader is freed.  The number of
+    chunks held in memory at once is bounded, so memory use does not
+    depend on the size of the file.
+    @param mfile MAF file
+    @param nthreads Number of threads to use for parsing.  If
+    nthreads <= 1 (or threads are not supported in this build), blocks
+    are parsed one at a time with mafBlock_read_next, without any
+    additional threads
+    @result New reader
+*/
+MafBlockReader *mafBlockReader_new(FILE *mfile, int nthreads);
+
+/** Return the next block from a reader.  Equivalent to
+    mafBlock_read_next, but blocks may have been parsed in advance by
+    other threads.
+    @param reader Reader created with mafBlockReader_new
+    @param specHash  (Optional) Any new species encountered added to this hash
+    @param numspec   (Optional) Number of species added to specHash
+    @result Next MafBlock in file, OR NULL if EOF
+*/
+MafBlock *mafBlockReader_next(MafBlockReader *reader, Hashtable *specHash,
+                              int *numspec);
+
+/** Free a reader, stopping its threads.  Blocks that have been
+    parsed but not returned are discarded.  Does not close the file.
+    @param reader Reader to free
+*/
+void mafBlockReader_free(MafBlockReader *reader);
+
 /** \} */
 
 #endif
@@ -20,6 +20,7 @@
 #include <phast_complex_matrix.h>
 #include <phast_complex_vector.h>
 #include <phast_external_libs.h>
+#include <phast_workspace.h>
 
 /** Size of invariant states char array. */
 #define NCHARS 256
@@ -184,6 +185,17 @@ double mm_get_by_state(MarkovMatrix *M, char from, char to);
 */
 void mm_exp(MarkovMatrix *P, MarkovMatrix *Q, double t);
 
+/** Computes discrete matrix P by the formula P = exp(Qt), using a
+    given workspace for temporary storage.  Safe to call concurrently
+    from several threads as long as each uses its own workspace and Q
+    has already been diagonalized.
+    @param[in] ws Workspace for temporary storage
+    @param[out] P Result Markov Matrix
+    @param[in] Q Input Markov matrix
+    @param[in] t Amount to scale Q by
+*/
+void mm_exp_ws(PhastWorkspace *ws, MarkovMatrix *P, MarkovMatrix *Q, double t);
+
 /** Copy a Markov Matrix into another existing Markov Matrix
     @param dest Where to copy the Markov Matrix to
     @param src Where to copy the Markov Matrix from
@@ -196,6 +208,13 @@ void mm_cpy(MarkovMatrix *dest, MarkovMatrix *src);
 */
 void mm_diagonalize(MarkovMatrix *M);
 
+/** Diagonalize a Markov Matrix, using a given workspace for temporary
+    storage.
+    @param ws Workspace for temporary storage
+    @param M Matrix to diagonalize
+*/
+void mm_diagonalize_ws(PhastWorkspace *ws, MarkovMatrix *M);
+
 /** Scale a Markov Matrix.
     @param M Matrix to scale
     @param scale Amount to scale matrix M by
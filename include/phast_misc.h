@@ -310,15 +310,19 @@ void get_tuple_str(char *tuple_str, int tuple_idx, int tuple_size,
 Matrix* read_subst_mat(FILE *F, char *alph);
 
 /** Open a file by filename and get file descriptor.
-    @param fname Full path to file
+    @param fname Full path to file, or "-" for stdin or stdout
     @param mode Open mode i.e. w, r, r+, w+, etc.
     @result File descriptor
     @note Exits with error message if open unsuccessful
+    @note gzip-compressed files opened for reading are decompressed
+    transparently, and files opened for writing whose names end in
+    ".gz" or ".bgz" are compressed (see phast_zfile.h)
  */
 FILE* phast_fopen(const char *fname, const char *mode);
 
-/** Open a file by filename and get file descriptor.
-    @param fname Full path to file
+/** Open a file by filename and get file descriptor.  Like
+    phast_fopen, but returns NULL if unsuccessful.
+    @param fname Full path to file, or "-" for stdin or stdout
     @param mode Open mode i.e. w, r, r+, w+, etc.
     @result File descriptor
  */
@@ -326,6 +330,10 @@ FILE* phast_fopen_no_exit(const char *fname, const char *mode);
 
 
 void phast_fclose(FILE *f);
+
+/** Set by die before exiting, so that exit handlers can distinguish a
+    failed run from a successful one */
+extern int phast_error_exit;
 #ifdef RPHAST
 #undef Rf_error
 #undef die
@@ -766,6 +774,8 @@ int file_exists(char *filename);
    retval['R'] = "AG";
    retval['Y'] = "CT";
    @endcode
+   The map is built on first use; this function may be called from
+   several threads at once.
    @result Ambiguity characters -> bases map
 */
 char **get_iupac_map();
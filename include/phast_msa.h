@@ -83,6 +83,10 @@ typedef enum {PHYLIP,           /**< PHYLIP format  */
               LAV,              /**< lav format, used by BLASTZ */
               MAF,              /**< Multiple Alignment Format (MAF)
 				    used by MULTIZ and TBA  */
+              BSS,              /**< Binary version of SS format (see
+                                   ss_write_binary).  Used for
+                                   output; on input, binary SS
+                                   files are read as SS */
 	      UNKNOWN_FORMAT    /**< Format unknown */
 } msa_format_type; 
 
@@ -617,7 +621,7 @@ char msa_get_char(MSA *msa, int seq, int pos);
 
 /** Translate format type into char*.
     @param format An msa format
-    @result A char* describing the format (either "SS", "MAF", "FASTA", "PHYLIP", "MPM", or "UNKNOWN")
+    @result A char* describing the format (either "SS", "BSS", "MAF", "FASTA", "PHYLIP", "MPM", or "UNKNOWN")
  */
 char *msa_format_to_str(msa_format_type format);
 
@@ -638,6 +642,8 @@ msa_format_type msa_format_for_suffix(const char *fname);
     @param F File descriptor to file (or stdin) containing file data
     @param die_if_unknown If TRUE, then exit with an error message if the format cannot be detected
     @result File format determined by file contents
+    @note Binary sufficient statistics files are reported as SS, since
+    ss_read reads either kind
 */
 msa_format_type msa_format_for_content(FILE *F, int die_if_unknown);
 
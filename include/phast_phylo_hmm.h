@@ -102,6 +102,17 @@ typedef struct {
   **t;        		        /**< Branch-length factor used in
                                    Parametric indel model */
   EmData *em_data;              /**< Used in parameter estimation by EM  */
+  int window_size,              /**< If positive, the Viterbi path and
+                                   posterior probabilities are
+                                   computed separately in windows of
+                                   this many sites (see
+                                   phmm_predict_viterbi and
+                                   phmm_postprobs).  Emissions are
+                                   still computed for all sites */
+    window_overlap;             /**< Number of additional sites on each
+                                   side of a window included in its
+                                   computation, but not in its
+                                   results */
 } PhyloHmm;
 
 /** Package of data used in estimation of indel parameters */
@@ -204,6 +215,14 @@ void phmm_compute_emissions(PhyloHmm *phmm, MSA *msa, int quiet);
 double phmm_fit_lambda(PhyloHmm *phmm, double *lambda, FILE *logf);
 
 /** Calculate predictions based on the Viterbi algorithm.
+    If phmm->window_size is positive and smaller than the alignment,
+    the Viterbi path is computed separately (and in parallel, if
+    multiple threads are allowed; see thr_set_nthreads) in windows of
+    phmm->window_size sites, each extended by phmm->window_overlap
+    sites on either side, and the paths for the windows are joined.
+    The result can differ from the unwindowed path near window
+    boundaries unless phmm->window_overlap is long compared with the
+    expected lengths of the segments of the path.
     @pre  Emissions must have already been computed
     @param phmm Initialized Phylo-HMM  
     @param seqname Sequence name for feature set (e.g., "chr1")
@@ -240,10 +259,13 @@ GFF_Set* phmm_predict_viterbi_cats(PhyloHmm *phmm, List *cats, char *seqname,
 double phmm_lnl(PhyloHmm *phmm);
 
 /** Computes posterior probabilities for a PhyloHmm. 
+    Windows are used as in phmm_predict_viterbi if phmm->window_size
+    is positive.
     @pre Emissions must have already been computed 
     @param[in] phmm PhyloHMM object
     @param[out] post_probs Calculated post probabilities
-    @result Log likelihod. 
+    @result Log likelihod (INFTY if computed in windows, in which case
+    the likelihood is not available). 
     @see phmm_compute_emissions
     @see phmm_new_postprobs
 */
@@ -35,7 +35,7 @@ typedef enum{SPH, LRT, SCORE, GERP} method_type;
 struct phyloP_struct {
   MSA *msa;
   int prior_only, post_only, quantiles_only;
-  int output_wig, output_gff;
+  int output_wig, output_gff, output_binary;
   int nsites, fit_model, base_by_base, default_epsilon, refidx, refidx_feat;
   double ci, epsilon;
   char *subtree_name, *chrom;
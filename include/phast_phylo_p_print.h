@@ -48,10 +48,11 @@ void print_feats_sph_subtree(FILE *outfile, p_value_joint_stats *stats,
 			     GFF_Set *gff, mode_type mode, double epsilon, 
 			     int output_gff, ListOfLists *result);
 void print_quantiles(FILE *outfile, Vector *distrib, ListOfLists *result);
-void print_wig(FILE *outfile, MSA *msa, double *tuple_pvals, char *chrom, 
-	       int refidx, int log_trans, ListOfLists *result);
-void print_base_by_base(FILE *outfile, char *header, char *chrom, MSA *msa, 
-                        char **formatstr, int refidx, ListOfLists *result,
+void print_wig(FILE *outfile, int binary, MSA *msa, double *tuple_pvals,
+	       char *chrom, int refidx, int log_trans, ListOfLists *result);
+void print_base_by_base(FILE *outfile, int binary, char *header, char *chrom,
+                        MSA *msa, char **formatstr, int refidx,
+                        ListOfLists *result,
 			int log_trans_outfile, int log_trans_results, int ncols, ...);
 void print_feats_generic(FILE *outfile, char *header, GFF_Set *gff, 
 			 char **formatstr, ListOfLists *result, 
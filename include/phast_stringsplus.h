@@ -58,6 +58,22 @@ typedef struct {
 
 /** PCRE is another name for Regex */
 typedef pcre Regex;
+
+/** Initial size of the buffer used by a LineBuffer */
+#define LINE_BUFFER_SIZE (1 << 20)
+
+/** Buffer for fast line-by-line reading of large files.  Data is read
+    from the file in large blocks, and lines are returned as pointers
+    into the buffer, so that no memory is allocated or copied for each
+    line.  See lb_readline. */
+typedef struct {
+  FILE *F;			/**< File being read */
+  char *buf;			/**< Buffered data */
+  size_t alloc,			/**< Allocated size of buf */
+    start,			/**< Start of next line in buf */
+    end;			/**< End of buffered data */
+  int eof;			/**< Whether end of file has been reached */
+} LineBuffer;
 				
 /** \name String Allocate/Cleanup functions 
 \{ */
@@ -254,6 +270,33 @@ int str_readline(String *s, FILE *F);
  */
 void str_slurp(String *s, FILE *F); 
 
+/** \name Buffered line reading functions
+\{ */
+
+/** Create a LineBuffer for reading a file.
+   @param F File to read from.  Data is read from F in large blocks, so
+   F should not be read by other means while the LineBuffer is in use
+   (afterward, its position is undefined)
+   @result Newly allocated LineBuffer
+*/
+LineBuffer *lb_new(FILE *F);
+
+/** Read the next line of a file using a LineBuffer.
+   @param lb LineBuffer
+   @param len (Optional) If non-NULL, set to the length of the line
+   @result Pointer to the line, without its newline character and
+   null-terminated, or NULL at end of file.  The line may be modified
+   by the caller, but is valid only until the next call.
+*/
+char *lb_readline(LineBuffer *lb, int *len);
+
+/** Free a LineBuffer.  Does not close the file.
+   @param lb LineBuffer to free
+*/
+void lb_free(LineBuffer *lb);
+
+/** \} */
+
 /** \name String comparison functions 
 \{ */
 
@@ -26,6 +26,18 @@ typedef struct {
   Matrix *M;
   Matrix ***branch_distrib;
   double epsilon;
+  int *subst_max;               /* max no. substitutions considered
+                                   beneath each node, capped by the
+                                   number of jumps likely in the tree */
+  int *subst_max_full;          /* same, without the cap */
+  int subst_capped;             /* whether any node is capped */
+  int *partials_offset;         /* offset of each node's partials in
+                                   the per-thread buffer; element nnodes
+                                   is the offset of scratch space */
+  int partials_width;           /* width of scratch rows */
+  int partials_size;            /* required size of buffer */
+  double *branch_marg;          /* p(b | a) for each branch, summed
+                                   over numbers of substitutions */
 } JumpProcess;
 /* note: a jump process is defined wrt a whole tree model, not just a
    rate matrix */
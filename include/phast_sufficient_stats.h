@@ -20,6 +20,34 @@
 #include "phast_msa.h"
 #include "phast_external_libs.h"
 
+/** First bytes of a binary sufficient statistics file (see
+    ss_write_binary).  The first byte cannot begin a text SS file, so
+    the two can be told apart by it */
+#define SS_BINARY_MAGIC "\211PHSS\r\n\032"
+/** Version of the binary sufficient statistics format */
+#define SS_BINARY_VERSION 1
+
+/** Maximum number of distinct characters in packed column tuples */
+#define SS_PACKED_NCODES 16
+
+/** Column tuples packed at 4 bits per character into one contiguous
+    array (see ss_pack_tuples).  Each character is replaced by a code
+    in [0, SS_PACKED_NCODES), which accommodates the alphabet, gaps,
+    missing data, and IUPAC ambiguity characters of typical
+    alignments.  Character i of tuple t is in the low (i even) or high
+    (i odd) half of byte data[t * tuple_bytes + i/2]. */
+typedef struct {
+  int tuple_len;                /**< Characters per tuple (nseqs *
+                                   tuple_size) */
+  int tuple_bytes;              /**< Bytes per packed tuple */
+  int ntuples;                  /**< Number of tuples stored */
+  int alloc_ntuples;            /**< Number of tuples allocated */
+  unsigned char *data;          /**< Packed tuples */
+  int ncodes;                   /**< Number of codes assigned */
+  char code_to_char[SS_PACKED_NCODES]; /**< Character for each code */
+  signed char char_to_code[256]; /**< Code for each character, or -1 */
+} SSPackedTuples;
+
 /** Sufficient Statistics object for an alignment. 
   @note For now, allow only one tuple_size per object */
 struct msa_ss_struct {
@@ -28,7 +56,11 @@ struct msa_ss_struct {
   int ntuples;                  /**< Number of distinct tuples */
   char **col_tuples;            /**< The actual column tuples;
                                    col_tuples[i] is string of length
-                                   ss->nseqs * tuple_size */
+                                   ss->nseqs * tuple_size.  NULL if
+                                   the tuples are packed (see
+                                   ss_pack_tuples) */
+  SSPackedTuples *packed;       /**< Packed column tuples, or NULL if
+                                   col_tuples is in use */
   int *tuple_idx;               /**< Defines order of column tuples in
                                    alignment; tuple_idx[i] is the
                                    index in col_tuples of the tuple
@@ -169,14 +201,16 @@ PooledMSA *ss_pooled_from_msas(List *source_msas, int tuple_size,
    @param tuple_size  Number of columns that make up a tuple  (e.g., if tuple_size==1, then each column is considered individually, and if tuple_size==2, then each is considered wrt its predecessor)
    @param cats_to_do (Optional) List of category numbers to generate sufficient statistics for; defaults to all
    @param cycle_size (Optional) If cycle_size > 0, site categories will be labeled 1,2,...,<cycle_size>,...,1,2,...,<cycle_size>. 
+   @param quiet If TRUE, do not report the files read on stderr; otherwise they are reported in order
    @note Missing sequences will be replaced with missing data.  
    @note All source MSAs must share the same alphabet, and each must contain a subset of the names in 'seqnames'.      
    @note No direct representation of the source or tuple order is retained 
+   @note If more than one thread is available (see thr_set_nthreads), files are read and aggregated in parallel in contiguous subsets, which are merged in order; the result does not depend on the number of threads
    
  */
 MSA *ss_aggregate_from_files(List *fnames, 
                              List *seqnames, int tuple_size, 
-                             List *cats_to_do, int cycle_size);
+                             List *cats_to_do, int cycle_size, int quiet);
 
 /** \} */
 
@@ -215,13 +249,40 @@ void msa_read_AXT(MSA *msa, List *axt_fnames);
 */
 void ss_write(MSA *msa, FILE *F, int show_order);
 
-/** Read MSA from file as sufficient statistics.
+/** Write MSA to file as sufficient statistics, in binary form.  The
+    file consists of a fixed-size header (magic number, version, byte
+    order check and dimensions), the alphabet, the sequence names, and
+    then the counts, category counts, tuple order and column tuples,
+    each as a contiguous block in the in-memory representation of
+    MSA_SS.  Numbers are written in native byte order.  Such files can
+    be read by ss_read with no parsing.
+    @param msa MSA to save as sufficient statistics
+    @param F File descriptor to save to
+    @param show_order Keep track of tuple order
+*/
+void ss_write_binary(MSA *msa, FILE *F, int show_order);
+
+/** Read MSA from file as sufficient statistics.  Binary files
+    written by ss_write_binary are recognized automatically and read
+    with ss_read_binary.
     @param F File descriptor to read sufficient statistics from
     @param alphabet Alphabet of MSA being read in
     @result MSA reconstructed from sufficient statistics
 */
 MSA* ss_read(FILE *F, char *alphabet);
 
+/** Read MSA from a binary sufficient statistics file (see
+    ss_write_binary).  When F is a regular file, it is mapped into
+    memory and the blocks are copied directly into the MSA_SS object;
+    otherwise the stream is read to the end.
+    @param F File descriptor to read sufficient statistics from,
+    positioned at the start of the binary data
+    @param alphabet Alphabet of MSA being read in; if NULL, the
+    alphabet stored in the file is used
+    @result MSA reconstructed from sufficient statistics
+*/
+MSA* ss_read_binary(FILE *F, char *alphabet);
+
 /** \} */
 
 /**  Update category count according to 'categories' attribute of MSA
@@ -274,6 +335,64 @@ void ss_free_pooled_msa(PooledMSA *pmsa);
 */
 void ss_compact(MSA_SS *ss);
 
+/** \name Packed column tuple functions
+\{ */
+
+/** Replace the column tuples of an alignment's sufficient statistics
+    (msa->ss->col_tuples) with a packed representation using 4 bits
+    per character (msa->ss->packed).  This reduces the memory used by
+    the tuples severalfold and places them in a single block of
+    memory.  Characters can still be accessed with ss_get_char_tuple
+    and related functions; functions that need the string
+    representation restore it automatically (see ss_unpack_tuples).
+   @param msa MSA with sufficient statistics
+   @result TRUE if the tuples were packed, FALSE (leaving them
+   unchanged) if they contain more than SS_PACKED_NCODES distinct
+   characters
+ */
+int ss_pack_tuples(MSA *msa);
+
+/** Restore the string representation of column tuples packed by
+    ss_pack_tuples.  Does nothing if the tuples are not packed.  Must
+    be called before accessing msa->ss->col_tuples directly if the
+    tuples may be packed.
+   @param msa MSA with sufficient statistics (or NULL msa->ss)
+ */
+void ss_unpack_tuples(MSA *msa);
+
+/** Create an empty store of packed column tuples.
+   @param tuple_len Number of characters per tuple (nseqs * tuple_size)
+   @param symbols (Optional) Characters to which the first codes will
+   be assigned, in order; other characters are assigned codes as they
+   are encountered
+   @result New SSPackedTuples object
+ */
+SSPackedTuples *ss_packed_new(int tuple_len, const char *symbols);
+
+/** Free a store of packed column tuples.
+   @param pt Packed column tuples
+ */
+void ss_packed_free(SSPackedTuples *pt);
+
+/** Append a column tuple to a packed store, whether or not an equal
+    tuple is already present.
+   @param pt Packed column tuples
+   @param coltuple_str Column tuple as a string of tuple_len characters
+   @result Index of new tuple, or -1 if it contains a character for
+   which no code is available
+ */
+int ss_packed_push(SSPackedTuples *pt, const char *coltuple_str);
+
+/** Convert a packed column tuple to a string.
+   @param pt Packed column tuples
+   @param tupleidx Index of tuple
+   @param[out] str Externally allocated string with room for
+   tuple_len + 1 characters
+ */
+void ss_packed_unpack(SSPackedTuples *pt, int tupleidx, char *str);
+
+/** \} */
+
 /** Create copy of MSA with different tuple size.
    @param orig_msa Original MSA to be copied from
    @param new_tuple_size Tuple size for the new MSA being returned
@@ -466,6 +585,19 @@ void set_col_char_in_string(MSA *msa, char *str, int seqidx, int tuple_size, int
   str[tuple_size*seqidx + tuple_size - 1 + col_offset] = c;
 }
 
+/** Return a character of a packed column tuple.
+   @param pt Packed column tuples
+   @param tupleidx Index of tuple
+   @param pos Position of character in tuple, as in the string
+   representation (see col_string_to_char)
+   @result Character at position pos of tuple tupleidx
+ */
+static PHAST_INLINE
+char ss_packed_get_char(SSPackedTuples *pt, int tupleidx, int pos) {
+  unsigned char b = pt->data[(size_t)tupleidx * pt->tuple_bytes + (pos >> 1)];
+  return pt->code_to_char[(pos & 1) ? (b >> 4) : (b & 0xf)];
+}
+
 /** \name Get character of tuple from alignment 
 \{ */
 
@@ -481,6 +613,10 @@ void set_col_char_in_string(MSA *msa, char *str, int seqidx, int tuple_size, int
 static PHAST_INLINE
 char ss_get_char_tuple(MSA *msa, int tupleidx, int seqidx, 
                        int col_offset) {
+  if (msa->ss->packed != NULL)
+    return ss_packed_get_char(msa->ss->packed, tupleidx,
+                              msa->ss->tuple_size * (seqidx + 1) - 1 +
+                              col_offset);
   return col_string_to_char(msa, msa->ss->col_tuples[tupleidx], seqidx, 
                             msa->ss->tuple_size, col_offset);
 }
@@ -501,9 +637,8 @@ char ss_get_char_pos(MSA *msa, int position, int seqidx,
                      int col_offset) {
   if (msa->ss->tuple_idx == NULL)
     die("ERROR ss_get_char_pos: msa->ss->tuple_idx is NULL\n");
-  return col_string_to_char(msa, 
-                            msa->ss->col_tuples[msa->ss->tuple_idx[position]], 
-                            seqidx, msa->ss->tuple_size, col_offset);
+  return ss_get_char_tuple(msa, msa->ss->tuple_idx[position], seqidx,
+                           col_offset);
 }
 /** \} */
 /** Produce a printable representation of the specified tuple. 
@@ -518,8 +653,7 @@ void tuple_to_string_pretty(char *str, MSA *msa, int tupleidx) {
   int stridx = 0, offset, j;
   for (offset = -1 * (msa->ss->tuple_size-1); offset <= 0; offset++) {
     for (j = 0; j < msa->nseqs; j++) {
-      str[stridx++] = col_string_to_char(msa, msa->ss->col_tuples[tupleidx], 
-                                         j, msa->ss->tuple_size, offset);
+      str[stridx++] = ss_get_char_tuple(msa, tupleidx, j, offset);
     }
     if (offset < 0) str[stridx++] = ' ';
   }
@@ -543,8 +677,7 @@ void ss_get_tuple_of_chars(MSA *msa, int tupleidx, int seqidx,
   int offset;
   for (offset = -1 * (msa->ss->tuple_size-1); offset <= 0; offset++) {
     tuplestr[msa->ss->tuple_size + offset - 1] =
-      col_string_to_char(msa, msa->ss->col_tuples[tupleidx],
-                         seqidx, msa->ss->tuple_size, offset);
+      ss_get_char_tuple(msa, tupleidx, seqidx, offset);
   }
 }
 
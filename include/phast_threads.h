@@ -0,0 +1,108 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/** @file threads.h
+    Simple support for data-parallel loops using POSIX threads.
+
+    A process-wide thread count is set once (usually from a --threads
+    command-line option) and is consulted by the routines that know
+    how to split their work.  Work is described as a range of indices
+    [0, n), which is handed out to worker threads in contiguous blocks.
+    Each worker is given a stable index in [0, nthreads) so that it can
+    use private scratch space.  Reductions across workers are left to
+    the caller, which allows results to be combined in a fixed order
+    and therefore to be independent of the number of threads.
+
+    If PHAST is compiled with SKIP_PTHREADS or with the memory handler
+    (RPHAST), all work is done serially in the calling thread.
+    \ingroup base
+*/
+
+#ifndef PHAST_THREADS_H
+#define PHAST_THREADS_H
+
+/* threads can't be used safely when all allocations go through the
+   memory handler, which keeps global (unlocked) state */
+#if defined(USE_PHAST_MEMORY_HANDLER) && !defined(SKIP_PTHREADS)
+#define SKIP_PTHREADS
+#endif
+
+/** Function to be applied to a block of indices.
+    @param data Arbitrary data passed through from thr_foreach
+    @param start First index in block
+    @param end One past the last index in block
+    @param thread Index of worker thread, in [0, nthreads)
+ */
+typedef void (*thr_block_fun)(void *data, int start, int end, int thread);
+
+/** Set the number of threads to be used by multithreaded routines.
+    @param nthreads Number of threads (must be >= 1)
+ */
+void thr_set_nthreads(int nthreads);
+
+/** Get the number of threads to be used by multithreaded routines.
+    @result Number of threads (1 unless changed with thr_set_nthreads, or
+    if threads are not supported in this build)
+ */
+int thr_get_nthreads();
+
+/** Return the number of worker threads thr_foreach would use for a
+    range of a given size.  Useful for allocating per-thread scratch
+    space.
+    @param n Number of indices in range
+    @param grain Number of indices handed to a worker at a time
+    @result Number of workers, between 1 and thr_get_nthreads()
+ */
+int thr_nworkers(int n, int grain);
+
+/** Apply a function to all indices in [0, n), in blocks of 'grain'
+    consecutive indices, using up to thr_get_nthreads() threads.
+    Blocks are assigned to workers dynamically; the function must
+    therefore write only to locations that are owned by the indices
+    in its block, or to scratch space private to its worker.  Returns
+    when all blocks have been processed.
+    @param n Number of indices
+    @param grain Number of indices per block (must be >= 1)
+    @param fun Function to apply to each block
+    @param data Passed through to fun
+ */
+void thr_foreach(int n, int grain, thr_block_fun fun, void *data);
+
+/** Pool of worker threads that stay alive across several loops.
+    Useful when a series of short loops would otherwise create and
+    join threads for each one (thr_foreach does exactly that).  The
+    calling thread acts as worker 0. */
+typedef struct thr_pool ThrPool;
+
+/** Create a pool of worker threads.
+    @param nworkers Number of workers, including the calling thread
+    (at least 1; reduced to 1 if threads are not supported)
+    @result New pool
+ */
+ThrPool *thr_pool_new(int nworkers);
+
+/** Return the number of workers in a pool.  Worker indices passed to
+    the block function by thr_pool_foreach are in [0, nworkers). */
+int thr_pool_nworkers(ThrPool *pool);
+
+/** Like thr_foreach, but use the workers of an existing pool.  Must
+    be called from the thread that created the pool.
+    @param pool Pool of workers
+    @param n Number of indices
+    @param grain Number of indices per block (must be >= 1)
+    @param fun Function to apply to each block
+    @param data Passed through to fun
+ */
+void thr_pool_foreach(ThrPool *pool, int n, int grain, thr_block_fun fun,
+                      void *data);
+
+/** Stop the workers of a pool and free it. */
+void thr_pool_free(ThrPool *pool);
+
+#endif
@@ -105,12 +105,42 @@ typedef struct tp_struct TreePosteriors;
 #define NULL_LOG_LIKELIHOOD 1   /** Safe value for null when dealing with
                                    log likelihoods (should always be <= 0) FIXME? */
 
+/** When a tree model's rescale_partials attribute is TRUE, the
+    partial likelihoods at a node are rescaled (by a power of two) if
+    all of them fall below this value */
+#define TL_RESCALE_THRESHOLD 0x1p-256
+
 /* does not appear to be implemented */
 void tl_dump_matrices(TreeModel *mod, double **inside_vals, 
                       double **outside_vals, double **posterior_probs);
 
+/** Rescale a vector of partial likelihoods, if necessary, to avoid
+    underflow.  If the largest element is below TL_RESCALE_THRESHOLD,
+    all elements are multiplied by a power of two, so that the largest
+    is in [0.5, 1).  Scaling by a power of two is exact.
+    @param[in,out] partial Partial likelihoods
+    @param[in] nstates Number of elements
+    @result Base 2 exponent e such that the original vector is 2^e
+    times the new one (0 if unchanged)
+ */
+int tl_rescale(double *partial, int nstates);
+
+/** Put quantities with separate scale exponents on a common scale.
+    On return, prob[i] is replaced by prob[i] * 2^(exp[i] - E), where
+    E is the common exponent, chosen as the largest exponent among
+    nonzero elements.
+    @param[in,out] prob Scaled quantities (e.g., probabilities of
+    rate categories)
+    @param[in] exp Base 2 exponent of each element
+    @param[in] n Number of elements
+    @result Common exponent E
+ */
+int tl_common_scale(double *prob, int *exp, int n);
+
 /** Compute the likelihood of a tree model with respect to an
    alignment; Optionally retain column-by-column likelihoods and/or posterior probabilities.  
+   If mod->rescale_partials is TRUE, partial likelihoods are rescaled
+   where necessary to avoid underflow (see tl_rescale).
    @param[in] mod Tree Model to compute likelihood for
    @param[in] msa Multiple Alignment containing data related to tree model
    @param[out] col_scores (Optional) Log likelihood score per column
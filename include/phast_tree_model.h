@@ -112,6 +112,42 @@ typedef struct alt_subst_mod {
 
 
 
+/** Flat (array-based) representation of the tree of a tree model,
+    for use in the inner loops of likelihood computations.  Arrays
+    indexed by node id use -1 for a missing relative. */
+typedef struct {
+  int nnodes;                   /**< Number of nodes in tree */
+  int nleaves;                  /**< Number of leaves */
+  int ninternal;                /**< Number of internal nodes */
+  int *leaves;                  /**< Ids of leaves, in postorder */
+  int *internal;                /**< Ids of internal nodes, in postorder */
+  int *preorder;                /**< Ids of all nodes, in preorder */
+  int *lchild, *rchild;         /**< Ids of children, by node id */
+  int *parent, *sibling;        /**< Ids of parent and sibling, by node id */
+} FlatTraversal;
+
+/** Record of the inputs from which the substitution probability
+    matrices of a tree model were last computed, so that
+    tm_set_subst_matrices can skip matrices that have not changed.
+    Entries are indexed by node id * nratecats + rate category. */
+typedef struct {
+  int nnodes;                   /**< Number of nodes when allocated */
+  int nratecats;                /**< Number of rate categories when
+                                   allocated */
+  MarkovMatrix **P;             /**< Matrix computed for each entry, or
+                                   NULL if entry is not valid */
+  double *t;                    /**< Branch length (including scale
+                                   factors and rate constant) used for
+                                   each entry */
+  int *ignored;                 /**< Whether branch was ignored for
+                                   each entry */
+  MarkovMatrix *rate_matrix;    /**< Rate matrix used */
+  Matrix *Q;                    /**< Copy of rate matrix contents */
+  Vector *backgd_freqs;         /**< Copy of background frequencies */
+  subst_mod_type subst_mod;     /**< Substitution model used */
+  double selection;             /**< Selection parameter used */
+} SubstMatCache;
+
 /** Tree model object */
 struct tm_struct {
   TreeNode *tree;		/**< Root node of tree (used to traverse tree node by node) */
@@ -155,6 +191,14 @@ struct tm_struct {
 				   penalized NOTE: not used */
   int inform_reqd;              /**< If TRUE, only "informative" sites
                                    will be given non-zero probability */
+  int rescale_partials;         /**< If TRUE, partial likelihoods are
+                                   rescaled where necessary during
+                                   pruning, to avoid underflow with
+                                   large trees (see tl_rescale) */
+  int analytic_grad;            /**< If TRUE, tm_fit computes
+                                   derivatives with respect to branch
+                                   lengths analytically, where possible
+                                   (see tm_compute_grad_branchlens) */
   int estimate_backgd;          /**< Estimate background frequencies as free
                                    parameters in the optimization */
   blen_estim_type estimate_branchlens; 
@@ -219,6 +263,15 @@ struct tm_struct {
 				 Normally 0, but 1 if TM_BRANCHLENS_NONE, or
 				 if TM_SCALE and alt_subst_mods!=NULL */
   int **iupac_inv_map;          /**< Inverse map for IUPAC ambiguity characters */
+  double *tip_lookup;           /**< (Optional) Partial likelihoods at
+                                   a leaf for each alignment
+                                   character; see
+                                   tl_compute_log_likelihood */
+  FlatTraversal *flat_trav;     /**< (Optional) Flat representation of
+                                   tree; see tm_build_flat_traversal */
+  SubstMatCache *P_cache;       /**< (Optional) Inputs from which
+                                   substitution matrices were last
+                                   computed; see tm_set_subst_matrices */
 };
 
 typedef struct tm_struct TreeModel;
@@ -319,11 +372,28 @@ TreeModel *tm_create_copy(TreeModel *src);
 /** \name Tree Model substitution matrix functions 
 \{ */
 
-/** Setup the substitution matrices on a Tree Model.
+/** Setup the substitution matrices on a Tree Model.  Matrices whose
+   inputs (branch length, scale factors, rate constant, rate matrix,
+   background frequencies, substitution model and selection) are
+   unchanged since the previous call are not recomputed, so this is
+   cheap when, e.g., only one branch length has changed.  The
+   eigensystem of the rate matrix is cached on tm->rate_matrix by
+   mm_diagonalize and reused for each branch.
    @param tm Tree Model to setup substitution matrix for
+   @note Caching is not used for models with alternative
+   substitution models (tm->alt_subst_mods != NULL).
 */
 void tm_set_subst_matrices(TreeModel *tm);
 
+/** Forget which substitution matrices are up to date, so that all
+   of them are recomputed by the next call to tm_set_subst_matrices.
+   Needed only if the matrices or their inputs are modified by means
+   that are not otherwise detected (e.g., the eigensystem of the rate
+   matrix is changed without changing the rate matrix itself).
+   @param tm Tree Model
+*/
+void tm_invalidate_subst_matrices(TreeModel *tm);
+
 /** Setup the substitution matrices on a Tree Model with custom probability matrix and branch length.
    @param P Probability matrix to use
    @param t Branch length to use
@@ -420,6 +490,9 @@ void tm_scale_params(TreeModel *mod, Vector *params, double scale_factor);
    @param error_file If non-NULL, write estimate, variance, and 95% 
    confidence interval for each parameter to this file.
    @returns 0 on success, 1 on failure
+   @note If mod->analytic_grad is TRUE and tm_can_compute_grad_branchlens
+   allows it, gradients are computed by tm_compute_grad_branchlens
+   rather than entirely by finite differences
  */
 int tm_fit(TreeModel *mod, MSA *msa, Vector *params, int cat, 
            opt_precision_type precision, FILE *logf, int quiet,
@@ -440,6 +513,39 @@ int tm_fit_multi(TreeModel **mod, int nmod, MSA **msa, int nmsa,
 		 opt_precision_type precision,
 		 FILE *logf, int quiet);
 
+/** Test whether tm_compute_grad_branchlens can be used for a tree
+   model.  Requires that all branch lengths are estimated separately
+   (no molecular clock or scale-only estimation), that there are no
+   alternative substitution models or selection parameters, that
+   substitution probabilities are obtained by exponentiating the rate
+   matrix (i.e., the model is not JC69 or F81), and that columns are
+   not treated as Markov-dependent.
+   @param mod Tree Model
+   @result TRUE if analytic gradients are supported
+ */
+int tm_can_compute_grad_branchlens(TreeModel *mod);
+
+/** Compute the gradient of the function minimized by tm_fit (the
+   negative log likelihood, in bits) using an analytic expression for
+   derivatives with respect to branch lengths.  A single
+   inside/outside pass (tl_compute_log_likelihood with
+   mod->tree_posteriors) yields the expected number of substitutions
+   of each type on each branch, from which dlnL/dt = sum_{ij}
+   E[n_ij] (QP(t))_ij / P(t)_ij follows for every branch.  Derivatives
+   with respect to other parameters (rate matrix, equilibrium
+   frequencies, rate variation) are still computed by finite
+   differences.  Has the signature expected by opt_bfgs.
+   @param[out] grad Gradient (must be allocated to size of params)
+   @param[in] params Current parameters, in optimization order
+   @param[in] data Tree Model, with msa, category, and
+   tree_posteriors (including expected_nsubst_tot) set
+   @param[in] lb Lower bounds of parameters, or NULL
+   @param[in] ub Upper bounds of parameters, or NULL
+   @note mod->tree_posteriors is overwritten
+ */
+void tm_compute_grad_branchlens(Vector *grad, Vector *params, void *data,
+                                Vector *lb, Vector *ub);
+
 /** Set specified TreeModel according to specified parameter vector.
    Exact behavior depends on substitution model.
    @param mod Tree Model to adjust parameter vector for
@@ -631,6 +737,34 @@ TreeModel *tm_induced_aa(TreeModel *codon_mod);
 */
 void tm_build_seq_idx(TreeModel *mod, MSA *msa);
 
+/** Build (or rebuild) the flat, array-based representation of the
+    tree of a tree model (mod->flat_trav).  Must be called again
+    whenever the tree is changed.
+    @param mod Tree model
+ */
+void tm_build_flat_traversal(TreeModel *mod);
+
+/** Free a flat representation of a tree.
+    @param ft Object to free
+ */
+void tm_free_flat_traversal(FlatTraversal *ft);
+
+/** Number of characters in a tree model fingerprint (see
+    tm_fingerprint), not including the terminating null */
+#define TM_FINGERPRINT_LEN 16
+
+/** Compute a fingerprint of a tree model, for use in naming files of
+    results derived from it.  Covers the alphabet, substitution model,
+    rate variation, background frequencies, rate matrix, tree
+    (topology, names and exact branch lengths), subtree or branch
+    selection, and lineage-specific models.  Models that differ in any
+    of these have different fingerprints, barring hash collisions.
+    @param mod Tree model
+    @param fp Output; receives TM_FINGERPRINT_LEN hexadecimal digits
+    and a terminating null
+ */
+void tm_fingerprint(TreeModel *mod, char *fp);
+
 /**  Prune away leaves in tree that don't correspond to sequences in a
     given alignment.
     @param[in,out] mod Tree Model to prune
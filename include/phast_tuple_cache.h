@@ -0,0 +1,115 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/** @file tuple_cache.h
+    Persistent cache of per-column-tuple results.
+
+    Tests that score alignment columns one tuple at a time (see
+    fit_column.h) give the same result for a given tuple whenever the
+    model and test are the same, and the same tuples recur across
+    alignments (constant columns and single substitutions dominate).
+    A tuple cache stores such results on disk so that later runs need
+    only compute results for tuples they have not seen before.
+
+    A cache lives in a directory, with one file for each combination
+    of model (see tm_fingerprint) and test; the test name should
+    include anything besides the model that affects results, such as
+    the mode.  Within a file, tuples are keyed by their characters for
+    the leaves of the tree, in order of node id (see tc_tuple_key), so
+    keys do not depend on the order or number of sequences in the
+    alignment.
+
+    Files are text, with one record per line.  They are only ever
+    replaced whole, by writing a temporary file and renaming it, so
+    concurrent readers always see a complete file.  When two runs
+    save to the same file at once, the records added by one of them
+    may be lost; they will simply be computed again later.
+    \ingroup phylo
+*/
+
+#ifndef PHAST_TUPLE_CACHE_H
+#define PHAST_TUPLE_CACHE_H
+
+#include <phast_tree_model.h>
+#include <phast_msa.h>
+#include <phast_hashtable.h>
+#include <phast_lists.h>
+
+/** Persistent cache of per-tuple results for one model and test */
+typedef struct {
+  char *fname;                  /**< File backing the cache */
+  char *header;                 /**< Expected first line of file */
+  int nvals;                    /**< Number of values per record */
+  Hashtable *index;             /**< Maps keys to record indices */
+  List *keys;                   /**< Keys, in order of record index */
+  double *vals;                 /**< Values, nvals per record */
+  int nrecords;                 /**< Number of records */
+  int capacity;                 /**< Number of records allocated */
+  int nadded;                   /**< Records added by tc_add since the
+                                   cache was opened or last saved */
+} TupleCache;
+
+/** Open the cache for a model and test, loading any existing records.
+    The file need not exist.
+    @param dir Cache directory (must exist when the cache is saved)
+    @param mod Tree model, as used by the test
+    @param test Name of test, including anything besides the model
+    that affects results.  Must not contain white space or '/'
+    @param nvals Number of values stored per tuple
+    @result New cache
+ */
+TupleCache *tc_open(const char *dir, TreeModel *mod, const char *test,
+                    int nvals);
+
+/** Free a cache, without saving it (see tc_save).
+    @param tc Cache to free
+ */
+void tc_free(TupleCache *tc);
+
+/** Return the length of the keys tc_tuple_key produces for a model.
+    @param mod Tree model
+    @result Number of leaves in the tree
+ */
+int tc_key_len(TreeModel *mod);
+
+/** Build the cache key for a column tuple.  The key consists of the
+    tuple's character for each leaf of the tree, in order of node id,
+    with '*' for leaves that have no sequence in the alignment.
+    @param mod Tree model; mod->msa_seq_idx must be built for msa
+    @param msa Alignment, with sufficient statistics of tuple size 1
+    @param tupleidx Index of tuple
+    @param key Output, at least tc_key_len(mod) + 1 chars
+ */
+void tc_tuple_key(TreeModel *mod, MSA *msa, int tupleidx, char *key);
+
+/** Look up a key.
+    @param tc Cache
+    @param key Key of tuple (see tc_tuple_key)
+    @param vals Output; receives tc->nvals values if key is found
+    @result TRUE if key was found
+ */
+int tc_lookup(TupleCache *tc, const char *key, double *vals);
+
+/** Add a record to the cache in memory.  Does nothing if the key is
+    already present.
+    @param tc Cache
+    @param key Key of tuple (see tc_tuple_key)
+    @param vals Values to store (tc->nvals of them)
+ */
+void tc_add(TupleCache *tc, const char *key, double *vals);
+
+/** Write the cache to its file, if any records have been added.
+    Records that other processes have saved since the cache was opened
+    are merged in first.  Failure to write the file is not fatal; a
+    warning is printed and the cache is left as it was.
+    @param tc Cache
+ */
+void tc_save(TupleCache *tc);
+
+#endif
@@ -18,8 +18,65 @@
 #ifndef WIG_H
 #define WIG_H
 
+#include <stdio.h>
 #include <phast_gff.h>
 
+/** Size of the output buffer of a WigWriter */
+#define WIG_WRITER_BUFSIZE (1 << 20)
+
+/** Magic string at the start of a binary score track */
+#define WIG_BINARY_MAGIC "PHASTF32"
+
+/** Version number of the binary score track format */
+#define WIG_BINARY_VERSION 1
+
+/** Buffered writer for per-base scores in fixedStep wig format.
+
+    Scores are converted to text with a fast fixed-precision
+    formatter, which produces exactly the same output as printf's
+    "%.Nf", and accumulated in a large buffer.
+
+    Alternatively, scores can be written as a binary track of 32-bit
+    floats, so that downstream tools can avoid parsing text.  A binary
+    track consists of a header:
+    - the 8 characters of WIG_BINARY_MAGIC
+    - int32 version (WIG_BINARY_VERSION)
+    - int32 byte order mark, 0x01020304 as written by the host
+    .
+    followed by any number of blocks, each describing consecutive
+    positions on one chromosome:
+    - int32 length of chromosome name, followed by the name (not null
+      terminated)
+    - int32 start (1-based coordinate of first position)
+    - int32 ncols (number of values per position)
+    - int32 nrows (number of positions)
+    - nrows * ncols float32 values, position by position
+    .
+    All integers and floats are in host byte order; the byte order
+    mark allows readers to detect files written on other machines.  A
+    new block is started with each fixedStep header, and long sections
+    are split into blocks of at most WIG_WRITER_BUFSIZE bytes.  Text
+    passed to ww_text is omitted from binary output.
+*/
+typedef struct {
+  FILE *F;                      /**< Output stream */
+  int binary;                   /**< Whether to write a binary track */
+  char *buf;                    /**< Text output buffer */
+  int len;                      /**< Number of bytes in buf */
+  char *chrom;                  /**< Chromosome of current block (binary) */
+  int start;                    /**< Start of current block (binary) */
+  int ncols;                    /**< Values per position in current
+                                   block (binary) */
+  int nrows;                    /**< Complete positions in current
+                                   block (binary) */
+  int rowcols;                  /**< Values so far in current position
+                                   (binary) */
+  float *vals;                  /**< Values of current block (binary) */
+  int maxvals;                  /**< Allocated size of vals */
+  int wrote_header;             /**< Whether the binary header has
+                                   been written */
+} WigWriter;
+
 
 /** Check if a string is a wig file header and parse the arguments.
     @param line[in] A string which may be a wig header file (fixed or variable step)
@@ -52,5 +109,62 @@ GFF_Set *gff_read_wig(FILE *F);
  */
 void wig_print(FILE *outfile, GFF_Set *set);
 
+/** Create a buffered writer for per-base scores.
+  @param F Stream to write to
+  @param binary If TRUE, write a binary track of 32-bit floats (see
+  WigWriter); otherwise write text
+  @return Newly allocated WigWriter
+ */
+WigWriter *ww_new(FILE *F, int binary);
+
+/** Start a new fixedStep section with step 1.
+  @param w WigWriter
+  @param chrom Chromosome name
+  @param start 1-based coordinate of the next position written
+ */
+void ww_fixed_step(WigWriter *w, const char *chrom, int start);
+
+/** Write a value with a fixed number of digits after the decimal
+    point, as printf("%.*f", prec, val) would.
+  @param w WigWriter
+  @param val Value to write
+  @param prec Number of digits after the decimal point (ignored in
+  binary mode)
+ */
+void ww_dbl(WigWriter *w, double val, int prec);
+
+/** Write a value using an arbitrary printf format.
+  @param w WigWriter
+  @param format printf format with a single double conversion
+  (ignored in binary mode)
+  @param val Value to write
+ */
+void ww_dbl_fmt(WigWriter *w, const char *format, double val);
+
+/** Write literal text, such as a column separator.  Nothing is
+    written in binary mode.
+  @param w WigWriter
+  @param str Text to write
+ */
+void ww_text(WigWriter *w, const char *str);
+
+/** End the current position (writes a newline in text mode).  In
+    binary mode, all positions in a section should have the same
+    number of values; a position with a different number starts a new
+    block.
+  @param w WigWriter
+ */
+void ww_end_row(WigWriter *w);
+
+/** Write all buffered output to the stream.
+  @param w WigWriter
+ */
+void ww_flush(WigWriter *w);
+
+/** Flush and free a WigWriter.  The stream is not closed.
+  @param w WigWriter
+ */
+void ww_free(WigWriter *w);
+
 #endif
 
@@ -0,0 +1,122 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/** @file workspace.h
+    Reusable scratch space for numerical kernels.
+
+    Routines such as mm_exp, mm_diagonalize, hmm_max_or_sum,
+    col_compute_likelihood and sub_posterior_distrib_site are called
+    many times in inner loops and keep temporary storage around between
+    calls.  That storage lives in a PhastWorkspace rather than in
+    function-level static variables, so that two computations can
+    run at the same time in different threads, each with its own
+    workspace.
+
+    Each thread has a "current" workspace, returned by ws_current().
+    Unless another one is installed with ws_set_current(), this is a
+    process-wide default workspace, so single-threaded code does not
+    need to know about workspaces at all.  Worker threads started by
+    thr_foreach are each given a private workspace.
+
+    Buffers in the default workspace are registered with the memory
+    handler as static variables (see set_static_var), so that they are
+    reset when phast_free_all() is called.  Buffers in other workspaces
+    belong to the workspace and are released by ws_free().
+    \ingroup base
+*/
+
+#ifndef PHAST_WORKSPACE_H
+#define PHAST_WORKSPACE_H
+
+#include <phast_vector.h>
+#include <phast_matrix.h>
+#include <phast_complex_matrix.h>
+#include <phast_complex_vector.h>
+#include <phast_lists.h>
+
+/** Scratch space for numerical kernels.  Buffers are allocated on
+    demand and reallocated when a different size is needed. */
+typedef struct {
+  Zmatrix *exp_tmp_z;           /**< Used by mm_exp (complex case) */
+  Vector *exp_evals;            /**< Used by mm_exp (real case) */
+  Zmatrix *diag_evecs_z,        /**< Used by mm_diagonalize (real case) */
+    *diag_evecs_inv_z;          /**< Used by mm_diagonalize (real case) */
+  Zvector *diag_evals_z;        /**< Used by mm_diagonalize (real case) */
+  List *hmm_terms;              /**< Used by hmm_max_or_sum */
+  Vector *col_partials;         /**< Used by col_compute_likelihood */
+  Vector *sub_partials;         /**< Used by sub_posterior_distrib_site
+                                   and sub_joint_distrib_site */
+  int is_default;               /**< Whether this is the process-wide
+                                   default workspace, whose buffers are
+                                   registered with the memory handler */
+} PhastWorkspace;
+
+/** Create a new, empty workspace.
+    @result Newly allocated workspace
+ */
+PhastWorkspace *ws_new();
+
+/** Free a workspace and all of its buffers.
+    @param ws Workspace to free (may not be the default workspace)
+ */
+void ws_free(PhastWorkspace *ws);
+
+/** Get the workspace of the calling thread.
+    @result Workspace installed by ws_set_current, or the default
+    workspace if none has been installed
+ */
+PhastWorkspace *ws_current();
+
+/** Install a workspace for the calling thread.
+    @param ws Workspace to use; if NULL, revert to the default
+    workspace
+ */
+void ws_set_current(PhastWorkspace *ws);
+
+/** \name Buffer access
+    Return the buffer held in the given slot of a workspace, first
+    (re)allocating it if it is NULL or has the wrong size.  Contents
+    are not initialized.
+ \{ */
+
+/** Get a complex matrix buffer.
+    @param ws Workspace
+    @param slot Address of buffer field in ws
+    @param size Number of rows and columns
+    @result Buffer of requested size
+ */
+Zmatrix *ws_zmat(PhastWorkspace *ws, Zmatrix **slot, int size);
+
+/** Get a complex vector buffer.
+    @param ws Workspace
+    @param slot Address of buffer field in ws
+    @param size Number of elements
+    @result Buffer of requested size
+ */
+Zvector *ws_zvec(PhastWorkspace *ws, Zvector **slot, int size);
+
+/** Get a real vector buffer.
+    @param ws Workspace
+    @param slot Address of buffer field in ws
+    @param size Number of elements
+    @result Buffer of requested size
+ */
+Vector *ws_vec(PhastWorkspace *ws, Vector **slot, int size);
+
+/** Get an (emptied) list of doubles.
+    @param ws Workspace
+    @param slot Address of buffer field in ws
+    @param size Initial capacity, if a list has to be created
+    @result Empty list
+ */
+List *ws_dbl_list(PhastWorkspace *ws, List **slot, int size);
+
+/** \} */
+
+#endif
@@ -0,0 +1,70 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/** @file zfile.h
+    Transparent reading and writing of gzip-compressed files.
+
+    Compressed files are presented as ordinary FILE streams, so that
+    code using fgets, fread, fprintf, etc. does not need to know about
+    compression.  phast_fopen uses these functions automatically: files
+    opened for reading are checked for the gzip magic number, and files
+    opened for writing whose names end in ".gz" or ".bgz" are
+    compressed.
+
+    Output is written in BGZF format (a series of gzip members of at
+    most 64KB each, as used by samtools and tabix), which can be read
+    by any gzip decoder.  When reading, the start of each gzip member
+    is remembered, so that seeking backward in a BGZF file only
+    requires decompressing from the nearest preceding block.  Plain
+    (single-member) gzip files can be read and seeked as well, but a
+    backward seek requires decompressing from the start of the file.
+    Seeking relative to the end of a compressed file is not supported.
+
+    These functions are unavailable when PHAST is compiled with
+    -DSKIP_ZLIB (e.g., for Windows), in which case compressed files
+    cause an error.
+    \ingroup base
+*/
+
+#ifndef PHAST_ZFILE_H
+#define PHAST_ZFILE_H
+
+#include <stdio.h>
+
+/** Size of uncompressed data in each BGZF block written */
+#define BGZF_BLOCK_INPUT 0xff00
+
+/** Wrap a stream for reading, decompressing if necessary.
+    @param F Stream opened for reading, positioned at the start of the
+    data
+    @result If F begins with the gzip magic number, a new stream that
+    returns the decompressed data (closing it also closes F, unless F
+    is stdin); otherwise F itself, with nothing consumed
+ */
+FILE *zf_wrap_reader(FILE *F);
+
+/** Open a stream that compresses everything written to it in BGZF
+    format.
+    @param F Stream opened for writing, to which compressed data will
+    be written (closing the new stream also closes F, unless F is
+    stdout)
+    @result New stream
+    @note Streams still open when the program exits are completed
+    automatically, unless it exits through die, in which case they are
+    deliberately truncated, so that decoders report an error
+ */
+FILE *zf_open_writer(FILE *F);
+
+/** Test whether a filename indicates compressed output.
+    @param fname Filename
+    @result TRUE if fname ends in ".gz" or ".bgz", otherwise FALSE
+ */
+int zf_compressed_fname(const char *fname);
+
+#endif
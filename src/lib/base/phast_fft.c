@@ -0,0 +1,198 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/* Linear convolution of real arrays by FFT.  See phast_fft.h */
+
+#include <math.h>
+#include <float.h>
+#include <phast_fft.h>
+#include <phast_misc.h>
+
+int fft_conv_worthwhile(double direct_work, long npoints) {
+  if (direct_work < FFT_CONV_MIN_WORK || npoints < 2)
+    return FALSE;
+  return (direct_work > FFT_CONV_COST * (double)npoints * log2(npoints));
+}
+
+int fft_size(int n) {
+  int size = 1;
+  while (size < n) size <<= 1;
+  return size;
+}
+
+/* table of n/2 twiddle factors exp(-2 pi i j / n), interleaved as
+   (re, im) pairs */
+static double *fft_twiddles(int n) {
+  double *tw = smalloc(max(n, 2) * sizeof(double));
+  int j;
+  for (j = 0; j < n/2; j++) {
+    tw[2*j] = cos(2 * M_PI * j / n);
+    tw[2*j+1] = -sin(2 * M_PI * j / n);
+  }
+  return tw;
+}
+
+/* in-place iterative radix-2 transform of n complex values stored as
+   interleaved (re, im) pairs; element k is at z[2*k*stride].  If
+   inverse is TRUE, computes the unscaled inverse transform */
+static void fft_transform(double *z, int n, int stride, double *tw,
+                          int inverse) {
+  int i, j, k, len, half, step;
+  double wr, wi, tr, ti, *u, *v;
+
+  /* bit-reversal permutation */
+  for (i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      u = &z[2*i*stride]; v = &z[2*j*stride];
+      tr = u[0]; ti = u[1];
+      u[0] = v[0]; u[1] = v[1];
+      v[0] = tr; v[1] = ti;
+    }
+  }
+
+  for (len = 2; len <= n; len <<= 1) {
+    half = len >> 1;
+    step = n / len;
+    for (i = 0; i < n; i += len) {
+      for (k = 0; k < half; k++) {
+        wr = tw[2*k*step];
+        wi = inverse ? -tw[2*k*step+1] : tw[2*k*step+1];
+        u = &z[2*(i+k)*stride];
+        v = &z[2*(i+k+half)*stride];
+        tr = v[0] * wr - v[1] * wi;
+        ti = v[0] * wi + v[1] * wr;
+        v[0] = u[0] - tr; v[1] = u[1] - ti;
+        u[0] += tr; u[1] += ti;
+      }
+    }
+  }
+}
+
+/* Given the transform z of (a + i b), where a and b are real, store
+   in w the transform of the convolution of a and b.  Uses A[k] =
+   (Z[k] + conj(Z[-k])) / 2 and B[k] = (Z[k] - conj(Z[-k])) / 2i, so
+   that A[k] B[k] = -i (Z[k]^2 - conj(Z[-k])^2) / 4 */
+static void fft_packed_product(double *z, double *w, int k, int m) {
+  double ar = z[2*k], ai = z[2*k+1], mr = z[2*m], mi = -z[2*m+1];
+  double dr = (ar*ar - ai*ai) - (mr*mr - mi*mi);
+  double di = 2*ar*ai - 2*mr*mi;
+  w[2*k] = di / 4;
+  w[2*k+1] = -dr / 4;
+}
+
+void fft_convolve(double *a, int na, double *b, int nb, double *c, int nc) {
+  int n, k, x, j;
+  double *z, *w, *tw, cmax = 0, floor_val;
+
+  /* elements beyond nc cannot contribute to the output */
+  na = min(na, nc);
+  nb = min(nb, nc);
+  n = fft_size(na + nb - 1);
+
+  z = smalloc(2 * n * sizeof(double));
+  w = smalloc(2 * n * sizeof(double));
+  tw = fft_twiddles(n);
+
+  for (k = 0; k < n; k++) {
+    z[2*k] = (k < na ? a[k] : 0);
+    z[2*k+1] = (k < nb ? b[k] : 0);
+  }
+  fft_transform(z, n, 1, tw, FALSE);
+  for (k = 0; k < n; k++)
+    fft_packed_product(z, w, k, (n - k) % n);
+  fft_transform(w, n, 1, tw, TRUE);
+
+  for (x = 0; x < nc; x++) {
+    double val = (x < na + nb - 1 ? w[2*x] / n : 0);
+    c[x] = (val < 0 ? 0 : val);
+    if (c[x] > cmax) cmax = c[x];
+  }
+
+  /* recompute entries at the level of round-off by direct sum */
+  floor_val = FFT_CONV_NOISE_FACTOR * n * DBL_EPSILON * cmax;
+  for (x = 0; x < nc && x < na + nb - 1; x++) {
+    if (c[x] >= floor_val) continue;
+    c[x] = 0;
+    for (j = max(0, x - nb + 1); j <= min(x, na - 1); j++)
+      c[x] += a[j] * b[x - j];
+  }
+
+  sfree(z);
+  sfree(w);
+  sfree(tw);
+}
+
+void fft_convolve_2d(double **a, int nra, int nca, double **b, int nrb,
+                     int ncb, double **c, int nrc, int ncc) {
+  int nr, nc, r, s, x, y, j, k;
+  double *z, *w, *twr, *twc, cmax = 0, floor_val;
+
+  nra = min(nra, nrc); nca = min(nca, ncc);
+  nrb = min(nrb, nrc); ncb = min(ncb, ncc);
+  nr = fft_size(nra + nrb - 1);
+  nc = fft_size(nca + ncb - 1);
+
+  z = smalloc(2 * nr * nc * sizeof(double));
+  w = smalloc(2 * nr * nc * sizeof(double));
+  twr = fft_twiddles(nr);
+  twc = fft_twiddles(nc);
+
+  for (r = 0; r < nr; r++) {
+    for (s = 0; s < nc; s++) {
+      z[2*(r*nc+s)] = (r < nra && s < nca ? a[r][s] : 0);
+      z[2*(r*nc+s)+1] = (r < nrb && s < ncb ? b[r][s] : 0);
+    }
+  }
+
+  /* transform rows, then columns */
+  for (r = 0; r < nr; r++)
+    fft_transform(&z[2*r*nc], nc, 1, twc, FALSE);
+  for (s = 0; s < nc; s++)
+    fft_transform(&z[2*s], nr, nc, twr, FALSE);
+
+  for (r = 0; r < nr; r++)
+    for (s = 0; s < nc; s++)
+      fft_packed_product(z, w, r*nc + s,
+                         ((nr - r) % nr) * nc + (nc - s) % nc);
+
+  for (s = 0; s < nc; s++)
+    fft_transform(&w[2*s], nr, nc, twr, TRUE);
+  for (r = 0; r < nr; r++)
+    fft_transform(&w[2*r*nc], nc, 1, twc, TRUE);
+
+  for (x = 0; x < nrc; x++) {
+    for (y = 0; y < ncc; y++) {
+      double val = 0;
+      if (x < nra + nrb - 1 && y < nca + ncb - 1)
+        val = w[2*(x*nc+y)] / ((double)nr * nc);
+      c[x][y] = (val < 0 ? 0 : val);
+      if (c[x][y] > cmax) cmax = c[x][y];
+    }
+  }
+
+  /* recompute entries at the level of round-off by direct sum */
+  floor_val = FFT_CONV_NOISE_FACTOR * (double)nr * nc * DBL_EPSILON * cmax;
+  for (x = 0; x < nrc && x < nra + nrb - 1; x++) {
+    for (y = 0; y < ncc && y < nca + ncb - 1; y++) {
+      if (c[x][y] >= floor_val) continue;
+      c[x][y] = 0;
+      for (j = max(0, x - nrb + 1); j <= min(x, nra - 1); j++)
+        for (k = max(0, y - ncb + 1); k <= min(y, nca - 1); k++)
+          c[x][y] += a[j][k] * b[x - j][y - k];
+    }
+  }
+
+  sfree(z);
+  sfree(w);
+  sfree(twr);
+  sfree(twc);
+}
@@ -462,11 +462,9 @@ void mm_exp_higham(MarkovMatrix *P, MarkovMatrix *Q, double t, int do_mu) {
 
 
 /* general version allowing for complex eigenvalues/eigenvectors */
-void mm_exp_complex(MarkovMatrix *P, MarkovMatrix *Q, double t) {
-
-  static Zmatrix *Eexp = NULL; /* reuse these if possible */
-  static Zmatrix *tmp = NULL;
-  static int last_size = 0;
+void mm_exp_complex(PhastWorkspace *ws, MarkovMatrix *P, MarkovMatrix *Q,
+                    double t) {
+  Zmatrix *tmp;
   int n = Q->size;
   int i, j;
 
@@ -479,24 +477,11 @@ void mm_exp_complex(MarkovMatrix *P, MarkovMatrix *Q, double t) {
     return;
   }
 
-  if (last_size != Q->size && Eexp != NULL) {
-    zmat_free(Eexp);
-    zmat_free(tmp);
-    Eexp = NULL;
-  }
-
-  if (Eexp == NULL) {
-    Eexp = zmat_new(Q->size, Q->size);
-    set_static_var((void**)&Eexp);
-    tmp = zmat_new(Q->size, Q->size);
-    last_size = Q->size;
-  }
-
   /* Diagonalize (if necessary) */
   if (Q->diagonalize_error != 1 &&
       (Q->evec_matrix_z == NULL || Q->evals_z == NULL ||
        Q->evec_matrix_inv_z == NULL))
-    mm_diagonalize(Q);
+    mm_diagonalize_ws(ws, Q);
 
   /* Diagonalization failed: use higham expansion instead */
   if (Q->evec_matrix_z == NULL || Q->evals_z == NULL ||
@@ -505,6 +490,8 @@ void mm_exp_complex(MarkovMatrix *P, MarkovMatrix *Q, double t) {
     return;
   }
 
+  tmp = ws_zmat(ws, &ws->exp_tmp_z, n);
+
   /* Compute P(t) = S exp(Dt) S^-1.  Start by computing exp(Dt) S^-1 */
   for (i = 0; i < n; i++) {
     Complex exp_dt_i =
@@ -519,9 +506,9 @@ void mm_exp_complex(MarkovMatrix *P, MarkovMatrix *Q, double t) {
 }
 
 /* version that assumes real eigenvalues/eigenvectors */
-void mm_exp_real(MarkovMatrix *P, MarkovMatrix *Q, double t) {
-  static Vector *exp_evals = NULL; /* reuse if possible */
-  static int last_size = -1;
+void mm_exp_real(PhastWorkspace *ws, MarkovMatrix *P, MarkovMatrix *Q,
+                 double t) {
+  Vector *exp_evals;
   int n = Q->size;
   int i;
 
@@ -534,20 +521,11 @@ void mm_exp_real(MarkovMatrix *P, MarkovMatrix *Q, double t) {
     return;
   }
 
-  if (exp_evals == NULL || last_size != Q->size) {
-    if (exp_evals != NULL)
-      vec_free(exp_evals);
-
-    exp_evals = vec_new(Q->size);
-    set_static_var((void**)&exp_evals);
-    last_size = Q->size;
-  }
-
   /* Diagonalize (if necessary) */
   if (Q->diagonalize_error != 1 &&
       (Q->evec_matrix_r == NULL || Q->evals_r == NULL ||
        Q->evec_matrix_inv_r == NULL))
-    mm_diagonalize(Q);
+    mm_diagonalize_ws(ws, Q);
 
   if (Q->evec_matrix_r == NULL || Q->evals_r == NULL ||
       Q->evec_matrix_inv_r == NULL) {
@@ -555,6 +533,8 @@ void mm_exp_real(MarkovMatrix *P, MarkovMatrix *Q, double t) {
     return;
   }
 
+  exp_evals = ws_vec(ws, &ws->exp_evals, n);
+
   /* Compute P(t) = S exp(Dt) S^-1 */
   for (i = 0; i < n; i++)
     exp_evals->data[i] = exp(Q->evals_r->data[i] * t);
@@ -563,12 +543,20 @@ void mm_exp_real(MarkovMatrix *P, MarkovMatrix *Q, double t) {
 }
 
 /* computes discrete matrix P by the formula P = exp(Qt),
-   given Q and t */
-void mm_exp(MarkovMatrix *dest, MarkovMatrix *src, double t) {
+   given Q and t, using the specified workspace for temporary
+   storage */
+void mm_exp_ws(PhastWorkspace *ws, MarkovMatrix *dest, MarkovMatrix *src,
+               double t) {
   if (src->eigentype == REAL_NUM)
-    mm_exp_real(dest, src, t);
+    mm_exp_real(ws, dest, src, t);
   else
-    mm_exp_complex(dest, src, t);
+    mm_exp_complex(ws, dest, src, t);
+}
+
+/* computes discrete matrix P by the formula P = exp(Qt),
+   given Q and t */
+void mm_exp(MarkovMatrix *dest, MarkovMatrix *src, double t) {
+  mm_exp_ws(ws_current(), dest, src, t);
 }
 
 /* given a state, draw the next state from the multinomial
@@ -658,30 +646,14 @@ void mm_diagonalize_complex(MarkovMatrix *M) {
   else M->diagonalize_error = 0;
 }
 
-void mm_diagonalize_real(MarkovMatrix *M) {
+void mm_diagonalize_real(PhastWorkspace *ws, MarkovMatrix *M) {
   /* use existing routines then "cast" complex matrices/vectors as real */
 
-  /* keep temp storage around -- this function will be called many
-     times repeatedly */
-  static Zmatrix *evecs_z = NULL;
-  static Zmatrix *evecs_inv_z = NULL;
-  static Zvector *evals_z = NULL;
-  static int size = -1;
-
-  if (evecs_z == NULL || size != M->size) {
-    if (evecs_z != NULL) {
-      zmat_free(evecs_z);
-      zmat_free(evecs_inv_z);
-      zvec_free(evals_z);
-      evecs_z = NULL;
-    }
-
-    evecs_z = zmat_new(M->size, M->size);
-    set_static_var((void**)&evecs_z);
-    evecs_inv_z = zmat_new(M->size, M->size);
-    evals_z = zvec_new(M->size);
-    size = M->size;
-  }
+  /* temp storage is kept in the workspace -- this function will be
+     called many times repeatedly */
+  Zmatrix *evecs_z = ws_zmat(ws, &ws->diag_evecs_z, M->size);
+  Zmatrix *evecs_inv_z = ws_zmat(ws, &ws->diag_evecs_inv_z, M->size);
+  Zvector *evals_z = ws_zvec(ws, &ws->diag_evals_z, M->size);
 
   if (1 == mat_diagonalize(M->matrix, evals_z, evecs_z, evecs_inv_z))
     goto mm_diagonalize_real_fail;
@@ -713,11 +685,15 @@ void mm_diagonalize_real(MarkovMatrix *M) {
   M->diagonalize_error = 1;
 }
 
-void mm_diagonalize(MarkovMatrix *M) {
+void mm_diagonalize_ws(PhastWorkspace *ws, MarkovMatrix *M) {
   if (M->eigentype == COMPLEX_NUM)
     mm_diagonalize_complex(M);
   else
-    mm_diagonalize_real(M);
+    mm_diagonalize_real(ws, M);
+}
+
+void mm_diagonalize(MarkovMatrix *M) {
+  mm_diagonalize_ws(ws_current(), M);
 }
 
 void mm_scale(MarkovMatrix *M, double scale) {
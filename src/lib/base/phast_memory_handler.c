@@ -578,6 +578,20 @@ void tm_protect(TreeModel *tm) {
       if (tm->iupac_inv_map[i] != NULL) phast_mem_protect(tm->iupac_inv_map[i]);
     phast_mem_protect(tm->iupac_inv_map);
   }
+  if (tm->tip_lookup != NULL)
+    phast_mem_protect(tm->tip_lookup);
+  if (tm->flat_trav != NULL) {
+    phast_mem_protect(tm->flat_trav->leaves);
+    phast_mem_protect(tm->flat_trav);
+  }
+  if (tm->P_cache != NULL) {
+    phast_mem_protect(tm->P_cache->P);
+    phast_mem_protect(tm->P_cache->t);
+    phast_mem_protect(tm->P_cache->ignored);
+    mat_protect(tm->P_cache->Q);
+    vec_protect(tm->P_cache->backgd_freqs);
+    phast_mem_protect(tm->P_cache);
+  }
 }
 
 void tm_register_protect(TreeModel *tm) {
@@ -662,6 +676,12 @@ void msa_protect_ss(MSA_SS *ss) {
       if (ss->col_tuples[i] != NULL)
 	phast_mem_protect(ss->col_tuples[i]);
   }
+  if (ss->packed != NULL) {
+    phast_mem_protect(ss->packed);
+    phast_mem_protect(ss->packed->data);
+    if (ss->packed->slots != NULL)
+      phast_mem_protect(ss->packed->slots);
+  }
   if (ss->tuple_idx != NULL)
     phast_mem_protect(ss->tuple_idx);
   if (ss->counts != NULL)
@@ -752,6 +772,15 @@ void hmm_protect(HMM *hmm) {
   phast_mem_protect(hmm->successors);
   lst_protect(hmm->begin_successors);
   lst_protect(hmm->end_predecessors);
+  if (hmm->trans_table != NULL) {
+    phast_mem_protect(hmm->trans_table->pred_start);
+    phast_mem_protect(hmm->trans_table->succ_start);
+    phast_mem_protect(hmm->trans_table->pred);
+    phast_mem_protect(hmm->trans_table->succ);
+    phast_mem_protect(hmm->trans_table->pred_score);
+    phast_mem_protect(hmm->trans_table->succ_score);
+    phast_mem_protect(hmm->trans_table);
+  }
 }
 
 
@@ -16,8 +16,12 @@
 #include <phast_stringsplus.h>
 #include <stdarg.h>
 #include <phast_hashtable.h>
+#include <phast_zfile.h>
 #include <unistd.h>
 #include <assert.h>
+#ifndef SKIP_PTHREADS
+#include <pthread.h>
+#endif
 
 #define NCODONS 64
 
@@ -274,17 +278,28 @@ Matrix* read_subst_mat(FILE *F, char *alph) {
 /* simple wrapper for fopen that opens specified filename or aborts
    with appropriate error message.  Saves typing in mains for
    command-line programs */
+/* Files opened for reading are decompressed if they begin with the
+   gzip magic number, and files opened for writing are compressed if
+   their names end in ".gz" or ".bgz" (see phast_zfile.h) */
 FILE* phast_fopen_no_exit(const char *fname, const char *mode) {
   FILE *F = NULL;
   if (!strcmp(fname, "-")) {
-    if (mode[0]=='r') 
-      return stdin;
+    if (mode[0]=='r') {
+      F = zf_wrap_reader(stdin);
+      if (F != stdin) register_open_file(F);
+      return F;
+    }
     else if (mode[0]=='w')
       return stdout;
     else die("ERROR: bad args to phast_fopen.\n");
   }
   F = fopen(fname, mode);
-  if (F != NULL) register_open_file(F);
+  if (F == NULL) return NULL;
+  if (mode[0] == 'r' && strchr(mode, '+') == NULL)
+    F = zf_wrap_reader(F);
+  else if ((mode[0] == 'w' || mode[0] == 'a') && zf_compressed_fname(fname))
+    F = zf_open_writer(F);
+  register_open_file(F);
   return F;
 }
 
@@ -302,11 +317,14 @@ void phast_fclose(FILE *f) {
   }
 }
 
+int phast_error_exit = FALSE;
+
 /* print error message and die with exit 1; saves typing in mains */
 #ifndef RPHAST
 void die(const char *warnfmt, ...) {
   va_list args;
 
+  phast_error_exit = TRUE;
   va_start(args, warnfmt);
   vfprintf(stderr, warnfmt, args);
   va_end(args);
@@ -1108,36 +1126,42 @@ int file_exists(char *filename) {
  return (access(filename, F_OK) == 0);
 }
 
-/* build static mapping from IUPAC ambiguity characters to the bases
-   that they represent */
-static char **build_iupac_map() {
-  char **retval = smalloc(256 * sizeof(char*));
+/* static mapping from IUPAC ambiguity characters to the bases that
+   they represent.  It is filled in only once, and not allocated from
+   the heap, so that it is safe to use from several threads (e.g. the
+   parallel MAF readers) and survives the memory handler */
+static char *iupac_map[256];
+
+static void build_iupac_map() {
   int i;
 
   for (i = 0; i < 256; i++) 
-    retval[i] = NULL;
-
-  retval['R'] = "AG";
-  retval['Y'] = "CT";
-  retval['S'] = "CG";
-  retval['W'] = "AT";
-  retval['K'] = "GT";
-  retval['M'] = "AC";
-  retval['D'] = "AGT";
-  retval['H'] = "ACT";
-  retval['B'] = "CGT";
-  retval['V'] = "ACG";  
+    iupac_map[i] = NULL;
 
-  return(retval);
+  iupac_map['R'] = "AG";
+  iupac_map['Y'] = "CT";
+  iupac_map['S'] = "CG";
+  iupac_map['W'] = "AT";
+  iupac_map['K'] = "GT";
+  iupac_map['M'] = "AC";
+  iupac_map['D'] = "AGT";
+  iupac_map['H'] = "ACT";
+  iupac_map['B'] = "CGT";
+  iupac_map['V'] = "ACG";  
 }
 
 /* accessor for static mapping */
 char **get_iupac_map() {
-  static char **iupac_map = NULL;
-  if (iupac_map == NULL) {
-    iupac_map = build_iupac_map();
-    set_static_var((void**)(&iupac_map));
-  }    
+#ifdef SKIP_PTHREADS
+  static int iupac_map_built = FALSE;
+  if (!iupac_map_built) {
+    build_iupac_map();
+    iupac_map_built = TRUE;
+  }
+#else
+  static pthread_once_t iupac_map_once = PTHREAD_ONCE_INIT;
+  pthread_once(&iupac_map_once, build_iupac_map);
+#endif
   return iupac_map;
 }
 
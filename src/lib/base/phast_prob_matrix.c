@@ -19,6 +19,7 @@
 #include <phast_prob_matrix.h>
 #include <phast_prob_vector.h>
 #include <phast_misc.h>
+#include <phast_fft.h>
 
 void pm_mean(Matrix *p, double *mean_x, double *mean_y) {
   int x, y;
@@ -112,9 +113,34 @@ void pm_normalize(Matrix *p) {
   mat_scale(p, 1/sum);
 }
 
+/* store in c the first nrc x ncc elements of the convolution of a
+   (nra x nca) and b (nrb x ncb).  Large convolutions are done by FFT
+   (see phast_fft.h); otherwise uses the direct sum */
+static void pm_convolve_pair(double **a, int nra, int nca, double **b, 
+                             int nrb, int ncb, double **c, int nrc,
+                             int ncc) {
+  int x, y, j, k;
+  nra = min(nra, nrc); nca = min(nca, ncc);
+  nrb = min(nrb, nrc); ncb = min(ncb, ncc);
+  if (fft_conv_worthwhile((double)nra * nca * nrb * ncb,
+                          (long)fft_size(nra + nrb - 1) * 
+                          fft_size(nca + ncb - 1))) {
+    fft_convolve_2d(a, nra, nca, b, nrb, ncb, c, nrc, ncc);
+    return;
+  }
+  for (x = 0; x < nrc; x++) {
+    for (y = 0; y < ncc; y++) {
+      c[x][y] = 0;
+      for (j = max(0, x - nrb + 1); j <= min(x, nra - 1); j++) 
+        for (k = max(0, y - ncb + 1); k <= min(y, nca - 1); k++) 
+          c[x][y] += a[j][k] * b[x - j][y - k];
+    }
+  }
+}
+
 /* convolve distribution n times */
 Matrix *pm_convolve(Matrix *p, int n, double epsilon) {
-  int i, j, k, x, y;
+  int i, x, y, cur_nrows, cur_ncols, new_nrows, new_ncols;
   Matrix *q_i, *q_i_1;
   double mean, var, max_nsd;
   int max_nrows = p->nrows * n, max_ncols = p->ncols * n;
@@ -147,15 +173,17 @@ Matrix *pm_convolve(Matrix *p, int n, double epsilon) {
   for (x = 0; x < p->nrows; x++)
     for (y = 0; y < p->ncols; y++)
       q_i_1->data[x][y] = p->data[x][y];
+  cur_nrows = p->nrows;         /* extent of nonzero elements */
+  cur_ncols = p->ncols;
 
   for (i = 1; i < n; i++) {
     mat_zero(q_i);
-    for (x = 0; x < q_i->nrows; x++) {
-      for (y = 0; y < q_i->ncols; y++) 
-        for (j = max(0, x - p->nrows + 1); j <= x; j++) 
-          for (k = max(0, y - p->ncols + 1); k <= y; k++) 
-            q_i->data[x][y] += q_i_1->data[j][k] * p->data[x - j][y - k];
-    }
+    new_nrows = min(max_nrows, cur_nrows + p->nrows - 1);
+    new_ncols = min(max_ncols, cur_ncols + p->ncols - 1);
+    pm_convolve_pair(q_i_1->data, cur_nrows, cur_ncols, p->data, p->nrows,
+                     p->ncols, q_i->data, new_nrows, new_ncols);
+    cur_nrows = new_nrows;
+    cur_ncols = new_ncols;
     mat_copy(q_i_1, q_i);
   }
 
@@ -181,7 +209,7 @@ Matrix *pm_convolve(Matrix *p, int n, double epsilon) {
    distributions.  Return value is an array q such that q[i] (1 <= i
    <= n) is the ith convolution of p (q[0] will be NULL) */
 Matrix **pm_convolve_save(Matrix *p, int n, double epsilon) {
-  int i, j, k, x, y;
+  int i, x, y, cur_nrows, cur_ncols, new_nrows, new_ncols;
   double mean, var, max_nsd;
   int max_nrows = p->nrows * n, max_ncols = p->ncols * n;
   Matrix **q = smalloc((n+1) * sizeof(void*));
@@ -216,15 +244,18 @@ Matrix **pm_convolve_save(Matrix *p, int n, double epsilon) {
   for (x = 0; x < p->nrows; x++)
     for (y = 0; y < p->ncols; y++)
       q[1]->data[x][y] = p->data[x][y];
+  cur_nrows = p->nrows;
+  cur_ncols = p->ncols;
 
   for (i = 2; i <= n; i++) {
     q[i] = mat_new(max_nrows, max_ncols);
     mat_zero(q[i]);
-    for (x = 0; x < q[i]->nrows; x++) 
-      for (y = 0; y < q[i]->ncols; y++) 
-        for (j = max(0, x - p->nrows + 1); j <= x; j++) 
-          for (k = max(0, y - p->ncols + 1); k <= y; k++) 
-            q[i]->data[x][y] += q[i-1]->data[j][k] * p->data[x - j][y - k];
+    new_nrows = min(max_nrows, cur_nrows + p->nrows - 1);
+    new_ncols = min(max_ncols, cur_ncols + p->ncols - 1);
+    pm_convolve_pair(q[i-1]->data, cur_nrows, cur_ncols, p->data, p->nrows,
+                     p->ncols, q[i]->data, new_nrows, new_ncols);
+    cur_nrows = new_nrows;
+    cur_ncols = new_ncols;
   }
 
   /* trim dimension before returning */
@@ -248,7 +279,7 @@ Matrix **pm_convolve_save(Matrix *p, int n, double epsilon) {
 /* take convolution of a set of probability matrices.  If counts is
    NULL, then each distrib is assumed to have multiplicity 1 */
 Matrix *pm_convolve_many(Matrix **p, int *counts, int n, double epsilon) {
-  int i, j, k, l, x, y, max_nrows, max_ncols, count, tot_count = 0,
+  int i, l, x, y, max_nrows, max_ncols, count, tot_count = 0,
     this_max_nrows, this_max_ncols;
   Matrix *q_i, *q_i_1;
   double max_nsd;
@@ -308,12 +339,9 @@ Matrix *pm_convolve_many(Matrix **p, int *counts, int n, double epsilon) {
     this_max_ncols = min(max_ncols, this_max_ncols + p[i]->ncols);
     for (l = 0; l < count; l++) {
       mat_zero(q_i);
-      for (x = 0; x < this_max_nrows; x++) {
-        for (y = 0; y < this_max_ncols; y++) 
-          for (j = max(0, x - p[i]->nrows + 1); j <= x; j++) 
-            for (k = max(0, y - p[i]->ncols + 1); k <= y; k++) 
-              q_i->data[x][y] += q_i_1->data[j][k] * p[i]->data[x - j][y - k];
-      }
+      pm_convolve_pair(q_i_1->data, this_max_nrows, this_max_ncols, 
+                       p[i]->data, p[i]->nrows, p[i]->ncols, q_i->data,
+                       this_max_nrows, this_max_ncols);
       mat_copy(q_i_1, q_i);
     }
   }
@@ -343,7 +371,7 @@ Matrix *pm_convolve_many(Matrix **p, int *counts, int n, double epsilon) {
    normalize, does not trim dimension, allows max size to be
    specified */
 Matrix *pm_convolve_many_fast(Matrix **p, int n, int max_nrows, int max_ncols) {
-  int i, j, k, x, y, this_max_nrows, this_max_ncols;
+  int i, x, y, this_max_nrows, this_max_ncols;
   Matrix *q_i, *q_i_1;
 
   if (n == 1)
@@ -367,12 +395,9 @@ Matrix *pm_convolve_many_fast(Matrix **p, int n, int max_nrows, int max_ncols) {
     this_max_nrows = min(max_nrows, this_max_nrows + p[i]->nrows);
     this_max_ncols = min(max_ncols, this_max_ncols + p[i]->ncols);
     mat_zero(q_i);
-    for (x = 0; x < this_max_nrows; x++) {
-      for (y = 0; y < this_max_ncols; y++) 
-        for (j = max(0, x - p[i]->nrows + 1); j <= x; j++) 
-          for (k = max(0, y - p[i]->ncols + 1); k <= y; k++) 
-            q_i->data[x][y] += q_i_1->data[j][k] * p[i]->data[x - j][y - k];
-    }
+    pm_convolve_pair(q_i_1->data, this_max_nrows, this_max_ncols, 
+                     p[i]->data, p[i]->nrows, p[i]->ncols, q_i->data,
+                     this_max_nrows, this_max_ncols);
     mat_copy(q_i_1, q_i);
   }
 
@@ -17,6 +17,7 @@
 
 #include <phast_prob_vector.h>
 #include <phast_misc.h>
+#include <phast_fft.h>
 
 /* compute mean and variance */
 void pv_stats(Vector *p, double *mean, double *var) {  
@@ -141,9 +142,28 @@ void pv_normalize(Vector *p) {
   vec_scale(p, 1/sum);
 }
 
+/* store in c the first nc elements of the convolution of a (length
+   na) and b (length nb).  Large convolutions are done by FFT (see
+   phast_fft.h); otherwise uses the direct sum */
+static void pv_convolve_pair(double *a, int na, double *b, int nb,
+                             double *c, int nc) {
+  int x, j;
+  na = min(na, nc);
+  nb = min(nb, nc);
+  if (fft_conv_worthwhile((double)na * nb, fft_size(na + nb - 1))) {
+    fft_convolve(a, na, b, nb, c, nc);
+    return;
+  }
+  for (x = 0; x < nc; x++) {
+    c[x] = 0;
+    for (j = max(0, x - nb + 1); j <= min(x, na - 1); j++) 
+      c[x] += a[j] * b[x - j];
+  }
+}
+
 /* convolve distribution n times */
 Vector *pv_convolve(Vector *p, int n, double epsilon) {
-  int i, j, x;
+  int i, x, cur_x;
   Vector *q_i, *q_i_1;
   double mean, var, max_nsd;
   int max_x = p->size * n;
@@ -169,13 +189,13 @@ Vector *pv_convolve(Vector *p, int n, double epsilon) {
   vec_zero(q_i_1);
   for (x = 0; x < p->size; x++)
     q_i_1->data[x] = p->data[x];
+  cur_x = p->size;              /* extent of nonzero elements */
 
   for (i = 1; i < n; i++) {
     vec_zero(q_i);
-    for (x = 0; x < q_i->size; x++) {
-      for (j = max(0, x - p->size + 1); j <= x; j++) 
-        q_i->data[x] += q_i_1->data[j] * p->data[x - j];
-    }
+    x = min(max_x, cur_x + p->size - 1);
+    pv_convolve_pair(q_i_1->data, cur_x, p->data, p->size, q_i->data, x);
+    cur_x = x;
     if (i < n - 1) vec_copy(q_i_1, q_i);
   }
 
@@ -197,7 +217,7 @@ Vector *pv_convolve(Vector *p, int n, double epsilon) {
    distributions.  Return value is an array q such that q[i] (1 <= i <=
    n) is the ith convolution of p (q[0] will be NULL) */
 Vector **pv_convolve_save(Vector *p, int n, double epsilon) {
-  int i, j, x;
+  int i, x, cur_x;
   double mean, var, max_nsd;
   int max_x = p->size * n, newsize;
   Vector **q = smalloc((n+1) * sizeof(void*));
@@ -227,13 +247,14 @@ Vector **pv_convolve_save(Vector *p, int n, double epsilon) {
   vec_zero(q[1]);
   for (x = 0; x < p->size; x++)
     q[1]->data[x] = p->data[x];
+  cur_x = p->size;
 
   for (i = 2; i <= n; i++) {
     q[i] = vec_new(max_x);
     vec_zero(q[i]);
-    for (x = 0; x < q[i]->size; x++) 
-      for (j = max(0, x - p->size + 1); j <= x; j++) 
-        q[i]->data[x] += q[i-1]->data[j] * p->data[x - j];
+    x = min(max_x, cur_x + p->size - 1);
+    pv_convolve_pair(q[i-1]->data, cur_x, p->data, p->size, q[i]->data, x);
+    cur_x = x;
   }
 
   /* trim very small values off tail before returning */
@@ -252,7 +273,7 @@ Vector **pv_convolve_save(Vector *p, int n, double epsilon) {
 /* take convolution of a set of probability vectors.  If counts is
    NULL, then each distrib is assumed to have multiplicity 1 */
 Vector *pv_convolve_many(Vector **p, int *counts, int n, double epsilon) {
-  int i, j, k, x, max_x = 0, tot_count = 0, count, thismax;
+  int i, k, x, max_x = 0, tot_count = 0, count, thismax;
   Vector *q_i, *q_i_1;
   double mean, var, max_nsd;
 
@@ -299,10 +320,8 @@ Vector *pv_convolve_many(Vector **p, int *counts, int n, double epsilon) {
     thismax = min(max_x, thismax + p[i]->size);
     for (k = 0; k < count; k++) {
       vec_zero(q_i);
-      for (x = 0; x < thismax; x++) {
-        for (j = max(0, x - p[i]->size + 1); j <= x; j++) 
-          q_i->data[x] += q_i_1->data[j] * p[i]->data[x - j];
-      }
+      pv_convolve_pair(q_i_1->data, thismax, p[i]->data, p[i]->size, 
+                       q_i->data, thismax);
       vec_copy(q_i_1, q_i);
     }
   }
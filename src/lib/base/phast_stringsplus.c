@@ -268,6 +268,55 @@ void str_slurp(String *s, FILE *F) {
   str_free(line);
 }
 
+LineBuffer *lb_new(FILE *F) {
+  LineBuffer *lb = smalloc(sizeof(LineBuffer));
+  lb->F = F;
+  lb->alloc = LINE_BUFFER_SIZE;
+  lb->buf = smalloc(lb->alloc * sizeof(char));
+  lb->start = lb->end = 0;
+  lb->eof = 0;
+  return lb;
+}
+
+char *lb_readline(LineBuffer *lb, int *len) {
+  char *line, *nl;
+  size_t n;
+
+  while ((nl = memchr(lb->buf + lb->start, '\n', lb->end - lb->start))
+         == NULL) {
+    if (lb->eof) {
+      if (lb->start == lb->end) return NULL;
+      nl = lb->buf + lb->end;   /* last line has no newline */
+      break;
+    }
+    /* move partial line to front of buffer and read more, leaving
+       room for a null terminator */
+    if (lb->start > 0) {
+      memmove(lb->buf, lb->buf + lb->start, lb->end - lb->start);
+      lb->end -= lb->start;
+      lb->start = 0;
+    }
+    if (lb->end + 1 >= lb->alloc) {
+      lb->alloc *= 2;
+      lb->buf = srealloc(lb->buf, lb->alloc * sizeof(char));
+    }
+    n = fread(lb->buf + lb->end, sizeof(char), lb->alloc - lb->end - 1, lb->F);
+    if (n == 0) lb->eof = 1;
+    lb->end += n;
+  }
+
+  line = lb->buf + lb->start;
+  *nl = '\0';
+  if (len != NULL) *len = (int)(nl - line);
+  lb->start = (nl == lb->buf + lb->end ? lb->end : (size_t)(nl - lb->buf) + 1);
+  return line;
+}
+
+void lb_free(LineBuffer *lb) {
+  sfree(lb->buf);
+  sfree(lb);
+}
+
 int str_equals(String *s1, String *s2) {
   return (str_compare(s1, s2) == 0);
 }
@@ -0,0 +1,222 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/* Simple data-parallel loops with POSIX threads.  See phast_threads.h */
+
+#include <phast_threads.h>
+#include <phast_misc.h>
+#include <phast_workspace.h>
+
+#ifndef SKIP_PTHREADS
+#include <pthread.h>
+#endif
+
+static int thr_nthreads = 1;
+
+void thr_set_nthreads(int nthreads) {
+  if (nthreads < 1)
+    die("ERROR thr_set_nthreads: number of threads must be >= 1 (got %i)\n",
+        nthreads);
+#ifdef SKIP_PTHREADS
+  if (nthreads > 1)
+    phast_warning("WARNING: threads not supported in this build; running with one thread.\n");
+#else
+  thr_nthreads = nthreads;
+#endif
+}
+
+int thr_get_nthreads() {
+  return thr_nthreads;
+}
+
+int thr_nworkers(int n, int grain) {
+  int nblocks = (n + grain - 1) / grain;
+  if (nblocks < 1) return 1;
+  return nblocks < thr_nthreads ? nblocks : thr_nthreads;
+}
+
+struct thr_worker {
+  struct thr_pool *pool;
+  int idx;
+};
+
+struct thr_pool {
+  int nworkers;
+  /* current loop */
+  int n, grain, next;
+  thr_block_fun fun;
+  void *data;
+#ifndef SKIP_PTHREADS
+  int generation;               /* incremented to start each loop */
+  int nbusy;                    /* helpers still working on the loop */
+  int shutdown;
+  pthread_mutex_t lock;
+  pthread_cond_t start, done;
+  pthread_t *threads;
+  struct thr_worker *workers;
+#endif
+};
+
+#ifndef SKIP_PTHREADS
+
+/* process blocks of the current loop until there are none left */
+static void thr_run_blocks(struct thr_pool *pool, int idx) {
+  int start, end;
+  while (1) {
+    pthread_mutex_lock(&pool->lock);
+    start = pool->next;
+    pool->next += pool->grain;
+    pthread_mutex_unlock(&pool->lock);
+    if (start >= pool->n) break;
+    end = start + pool->grain;
+    if (end > pool->n) end = pool->n;
+    pool->fun(pool->data, start, end, idx);
+  }
+}
+
+/* main function of workers other than the calling thread: wait for
+   each loop, take part in it, and report when done */
+static void *thr_worker_main(void *arg) {
+  struct thr_worker *w = arg;
+  struct thr_pool *pool = w->pool;
+  int seen = 0;
+
+  /* new threads get private scratch space for mm_exp etc. */
+  ws_set_current(ws_new());
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (pool->generation == seen)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    seen = pool->generation;
+    if (pool->shutdown) break;
+    pthread_mutex_unlock(&pool->lock);
+    thr_run_blocks(pool, w->idx);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->nbusy == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  ws_free(ws_current());
+  ws_set_current(NULL);
+  return NULL;
+}
+
+#endif
+
+ThrPool *thr_pool_new(int nworkers) {
+  ThrPool *pool = smalloc(sizeof(ThrPool));
+
+  if (nworkers < 1)
+    die("ERROR thr_pool_new: number of workers must be >= 1 (got %i)\n",
+        nworkers);
+#ifdef SKIP_PTHREADS
+  nworkers = 1;
+#endif
+  pool->nworkers = nworkers;
+
+#ifndef SKIP_PTHREADS
+  {
+    int i;
+    pool->generation = 0;
+    pool->nbusy = 0;
+    pool->shutdown = FALSE;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->threads = smalloc(nworkers * sizeof(pthread_t));
+    pool->workers = smalloc(nworkers * sizeof(struct thr_worker));
+    for (i = 0; i < nworkers; i++) {
+      pool->workers[i].pool = pool;
+      pool->workers[i].idx = i;
+    }
+    /* the calling thread acts as worker 0 */
+    for (i = 1; i < nworkers; i++)
+      if (pthread_create(&pool->threads[i], NULL, thr_worker_main,
+                         &pool->workers[i]) != 0)
+        die("ERROR thr_pool_new: unable to create thread\n");
+  }
+#endif
+  return pool;
+}
+
+int thr_pool_nworkers(ThrPool *pool) {
+  return pool->nworkers;
+}
+
+void thr_pool_foreach(ThrPool *pool, int n, int grain, thr_block_fun fun,
+                      void *data) {
+  if (grain < 1)
+    die("ERROR thr_pool_foreach: grain must be >= 1 (got %i)\n", grain);
+  if (n <= 0) return;
+
+  if (pool->nworkers == 1 || n <= grain) {
+    fun(data, 0, n, 0);
+    return;
+  }
+
+#ifndef SKIP_PTHREADS
+  pthread_mutex_lock(&pool->lock);
+  pool->n = n;
+  pool->grain = grain;
+  pool->next = 0;
+  pool->fun = fun;
+  pool->data = data;
+  pool->nbusy = pool->nworkers - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  thr_run_blocks(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->nbusy > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+void thr_pool_free(ThrPool *pool) {
+#ifndef SKIP_PTHREADS
+  int i;
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = TRUE;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 1; i < pool->nworkers; i++)
+    pthread_join(pool->threads[i], NULL);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  sfree(pool->threads);
+  sfree(pool->workers);
+#endif
+  sfree(pool);
+}
+
+void thr_foreach(int n, int grain, thr_block_fun fun, void *data) {
+  int nworkers;
+  ThrPool *pool;
+
+  if (grain < 1)
+    die("ERROR thr_foreach: grain must be >= 1 (got %i)\n", grain);
+  if (n <= 0) return;
+
+  nworkers = thr_nworkers(n, grain);
+  if (nworkers == 1) {
+    fun(data, 0, n, 0);
+    return;
+  }
+
+  pool = thr_pool_new(nworkers);
+  thr_pool_foreach(pool, n, grain, fun, data);
+  thr_pool_free(pool);
+}
@@ -0,0 +1,110 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/* Reusable scratch space for numerical kernels.  See phast_workspace.h */
+
+#include <phast_workspace.h>
+#include <phast_misc.h>
+
+static PhastWorkspace ws_default = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                       TRUE};
+
+#ifdef SKIP_PTHREADS
+static PhastWorkspace *ws_thread = NULL;
+#else
+static __thread PhastWorkspace *ws_thread = NULL;
+#endif
+
+PhastWorkspace *ws_new() {
+  PhastWorkspace *ws = smalloc(sizeof(PhastWorkspace));
+  ws->exp_tmp_z = NULL;
+  ws->exp_evals = NULL;
+  ws->diag_evecs_z = ws->diag_evecs_inv_z = NULL;
+  ws->diag_evals_z = NULL;
+  ws->hmm_terms = NULL;
+  ws->col_partials = NULL;
+  ws->sub_partials = NULL;
+  ws->is_default = FALSE;
+  return ws;
+}
+
+void ws_free(PhastWorkspace *ws) {
+  if (ws->is_default)
+    die("ERROR ws_free: cannot free default workspace\n");
+  if (ws->exp_tmp_z != NULL) zmat_free(ws->exp_tmp_z);
+  if (ws->exp_evals != NULL) vec_free(ws->exp_evals);
+  if (ws->diag_evecs_z != NULL) zmat_free(ws->diag_evecs_z);
+  if (ws->diag_evecs_inv_z != NULL) zmat_free(ws->diag_evecs_inv_z);
+  if (ws->diag_evals_z != NULL) zvec_free(ws->diag_evals_z);
+  if (ws->hmm_terms != NULL) lst_free(ws->hmm_terms);
+  if (ws->col_partials != NULL) vec_free(ws->col_partials);
+  if (ws->sub_partials != NULL) vec_free(ws->sub_partials);
+  sfree(ws);
+}
+
+PhastWorkspace *ws_current() {
+  return ws_thread != NULL ? ws_thread : &ws_default;
+}
+
+void ws_set_current(PhastWorkspace *ws) {
+  ws_thread = ws;
+}
+
+/* buffers in the default workspace must be forgotten (not freed) when
+   the memory handler frees everything */
+static void ws_register(PhastWorkspace *ws, void **slot) {
+  if (ws->is_default)
+    set_static_var(slot);
+}
+
+Zmatrix *ws_zmat(PhastWorkspace *ws, Zmatrix **slot, int size) {
+  if (*slot != NULL && (*slot)->nrows != size) {
+    zmat_free(*slot);
+    *slot = NULL;
+  }
+  if (*slot == NULL) {
+    *slot = zmat_new(size, size);
+    ws_register(ws, (void**)slot);
+  }
+  return *slot;
+}
+
+Zvector *ws_zvec(PhastWorkspace *ws, Zvector **slot, int size) {
+  if (*slot != NULL && (*slot)->size != size) {
+    zvec_free(*slot);
+    *slot = NULL;
+  }
+  if (*slot == NULL) {
+    *slot = zvec_new(size);
+    ws_register(ws, (void**)slot);
+  }
+  return *slot;
+}
+
+Vector *ws_vec(PhastWorkspace *ws, Vector **slot, int size) {
+  if (*slot != NULL && (*slot)->size != size) {
+    vec_free(*slot);
+    *slot = NULL;
+  }
+  if (*slot == NULL) {
+    *slot = vec_new(size);
+    ws_register(ws, (void**)slot);
+  }
+  return *slot;
+}
+
+List *ws_dbl_list(PhastWorkspace *ws, List **slot, int size) {
+  if (*slot == NULL) {
+    *slot = lst_new_dbl(size);
+    ws_register(ws, (void**)slot);
+  }
+  else
+    lst_clear(*slot);
+  return *slot;
+}
@@ -0,0 +1,422 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/* Transparent reading and writing of gzip-compressed files.  See
+   phast_zfile.h */
+
+#define _GNU_SOURCE             /* for fopencookie */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <phast_zfile.h>
+#include <phast_misc.h>
+
+/* compressed streams are built on fopencookie (glibc) or funopen
+   (BSD, Mac OS X) */
+#if !defined(SKIP_ZLIB) && !defined(__GLIBC__) && !defined(__APPLE__) && \
+  !defined(__FreeBSD__)
+#define SKIP_ZLIB
+#endif
+
+#ifndef SKIP_ZLIB
+#include <zlib.h>
+
+#define ZF_BUFSIZE 65536        /* size of input and output buffers */
+#define BGZF_MAX_BLOCK 65536    /* maximum size of compressed block */
+#define BGZF_HEADER_LEN 18
+#define BGZF_FOOTER_LEN 8
+#define ZF_MIN_RESTART_GAP 32768
+                                /* minimum spacing (in uncompressed
+                                   bytes) of remembered restart points */
+
+/* empty block marking the end of a BGZF file */
+static const unsigned char bgzf_eof[28] =
+  {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 66, 67, 2, 0, 27, 0, 3, 0,
+   0, 0, 0, 0, 0, 0, 0, 0};
+
+typedef struct zfile_struct {
+  FILE *raw;                    /* underlying (compressed) stream */
+  int writing;
+  z_stream strm;
+  unsigned char *in, *out;
+  size_t in_len;                /* (writing) bytes waiting in 'in' */
+  size_t out_pos, out_len;      /* (reading) position in and amount
+                                   of decompressed data in 'out' */
+  off_t upos;                   /* uncompressed offset of out[0]
+                                   (reading) or bytes written so far
+                                   (writing) */
+  int member_start;             /* next input begins a gzip member */
+  int done;                     /* no more compressed data */
+  int seekable;                 /* whether raw supports fseeko */
+  off_t *restart_coff, *restart_uoff;
+                                /* compressed and uncompressed offsets
+                                   of gzip members at which
+                                   decompression can be restarted */
+  int nrestarts, alloc_restarts;
+  FILE *stream;                 /* (writing) stream wrapping this
+                                   object */
+  int finished;                 /* (writing) end-of-file marker
+                                   written */
+  struct zfile_struct *next_writer;
+                                /* list of open writers */
+} ZFile;
+
+/* writers that have not been closed; they are finished at exit, since
+   streams that are never closed are flushed but not closed by exit */
+static ZFile *zf_open_writers = NULL;
+
+static void zf_add_restart(ZFile *zf, off_t coff, off_t uoff) {
+  if (!zf->seekable || coff < 0) return;
+  if (zf->nrestarts > 0 &&
+      uoff < zf->restart_uoff[zf->nrestarts-1] + ZF_MIN_RESTART_GAP)
+    return;
+  if (zf->nrestarts == zf->alloc_restarts) {
+    zf->alloc_restarts = zf->alloc_restarts == 0 ? 64 : 2 * zf->alloc_restarts;
+    zf->restart_coff = srealloc(zf->restart_coff,
+                                zf->alloc_restarts * sizeof(off_t));
+    zf->restart_uoff = srealloc(zf->restart_uoff,
+                                zf->alloc_restarts * sizeof(off_t));
+  }
+  zf->restart_coff[zf->nrestarts] = coff;
+  zf->restart_uoff[zf->nrestarts++] = uoff;
+}
+
+/* decompress more data into zf->out, which must be empty.  Returns
+   number of bytes available (0 at end of file) */
+static size_t zf_fill(ZFile *zf) {
+  int ret;
+  while (!zf->done) {
+    if (zf->strm.avail_in == 0) {
+      zf->strm.next_in = zf->in;
+      zf->strm.avail_in = fread(zf->in, 1, ZF_BUFSIZE, zf->raw);
+    }
+    if (zf->member_start) {
+      if (zf->strm.avail_in == 0) {
+        zf->done = TRUE;
+        break;
+      }
+      zf_add_restart(zf, zf->seekable ?
+                     ftello(zf->raw) - (off_t)zf->strm.avail_in : -1,
+                     zf->upos + zf->out_len);
+      zf->member_start = FALSE;
+    }
+    zf->strm.next_out = zf->out + zf->out_len;
+    zf->strm.avail_out = ZF_BUFSIZE - zf->out_len;
+    ret = inflate(&zf->strm, Z_NO_FLUSH);
+    zf->out_len = ZF_BUFSIZE - zf->strm.avail_out;
+    if (ret == Z_STREAM_END) {  /* another member may follow */
+      inflateReset(&zf->strm);
+      zf->member_start = TRUE;
+    }
+    else if (ret == Z_BUF_ERROR && zf->strm.avail_in == 0) {
+      if (feof(zf->raw) || ferror(zf->raw))
+        die("ERROR: unexpected end of compressed file.\n");
+    }
+    else if (ret != Z_OK)
+      die("ERROR: cannot decompress file (%s).\n",
+          zf->strm.msg != NULL ? zf->strm.msg : "bad data");
+    if (zf->out_len > 0) break;
+  }
+  return zf->out_len;
+}
+
+static ssize_t zf_read(void *cookie, char *buf, size_t size) {
+  ZFile *zf = cookie;
+  size_t copied = 0, n;
+  while (copied < size) {
+    if (zf->out_pos == zf->out_len) {
+      zf->upos += zf->out_len;
+      zf->out_pos = zf->out_len = 0;
+      if (zf_fill(zf) == 0) break;
+    }
+    n = min(size - copied, zf->out_len - zf->out_pos);
+    memcpy(buf + copied, zf->out + zf->out_pos, n);
+    zf->out_pos += n;
+    copied += n;
+  }
+  return copied;
+}
+
+/* compress data (at most BGZF_BLOCK_INPUT bytes) as one BGZF block,
+   or more if it does not compress enough to fit */
+static void zf_write_block(ZFile *zf, unsigned char *data, size_t len) {
+  unsigned char *hdr = zf->out, *ftr;
+  size_t bsize;
+  uLong crc;
+
+  deflateReset(&zf->strm);
+  zf->strm.next_in = data;
+  zf->strm.avail_in = len;
+  zf->strm.next_out = zf->out + BGZF_HEADER_LEN;
+  zf->strm.avail_out = BGZF_MAX_BLOCK - BGZF_HEADER_LEN - BGZF_FOOTER_LEN;
+  if (deflate(&zf->strm, Z_FINISH) != Z_STREAM_END) {
+    if (len < 2) die("ERROR: cannot compress output.\n");
+    zf_write_block(zf, data, len / 2);
+    zf_write_block(zf, data + len / 2, len - len / 2);
+    return;
+  }
+
+  bsize = BGZF_HEADER_LEN + zf->strm.total_out + BGZF_FOOTER_LEN;
+  memcpy(hdr, bgzf_eof, BGZF_HEADER_LEN);
+  hdr[16] = (unsigned char)((bsize - 1) & 0xff);
+  hdr[17] = (unsigned char)((bsize - 1) >> 8);
+  ftr = zf->out + bsize - BGZF_FOOTER_LEN;
+  crc = crc32(crc32(0L, Z_NULL, 0), data, len);
+  ftr[0] = crc & 0xff; ftr[1] = (crc >> 8) & 0xff;
+  ftr[2] = (crc >> 16) & 0xff; ftr[3] = (crc >> 24) & 0xff;
+  ftr[4] = len & 0xff; ftr[5] = (len >> 8) & 0xff;
+  ftr[6] = (len >> 16) & 0xff; ftr[7] = (len >> 24) & 0xff;
+  if (fwrite(zf->out, 1, bsize, zf->raw) != bsize)
+    die("ERROR: cannot write compressed output.\n");
+}
+
+static ssize_t zf_write(void *cookie, const char *buf, size_t size) {
+  ZFile *zf = cookie;
+  size_t copied = 0, n;
+  while (copied < size) {
+    n = min(size - copied, BGZF_BLOCK_INPUT - zf->in_len);
+    memcpy(zf->in + zf->in_len, buf + copied, n);
+    zf->in_len += n;
+    copied += n;
+    if (zf->in_len == BGZF_BLOCK_INPUT) {
+      zf_write_block(zf, zf->in, zf->in_len);
+      zf->in_len = 0;
+    }
+  }
+  zf->upos += size;
+  return size;
+}
+
+static int zf_seek(void *cookie, off_t *offset, int whence) {
+  ZFile *zf = cookie;
+  off_t target, cur = zf->upos + (zf->writing ? 0 : (off_t)zf->out_pos);
+  int lo, hi;
+
+  if (whence == SEEK_SET) target = *offset;
+  else if (whence == SEEK_CUR) target = cur + *offset;
+  else target = -1;             /* SEEK_END not supported */
+  if (target < 0 || (zf->writing && target != cur)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (zf->writing) {
+    *offset = cur;
+    return 0;
+  }
+
+  if (target < zf->upos) {      /* restart from preceding member */
+    if (zf->nrestarts == 0) {
+      errno = ESPIPE;
+      return -1;
+    }
+    for (lo = 0, hi = zf->nrestarts - 1; lo < hi; ) {
+      int mid = (lo + hi + 1) / 2;
+      if (zf->restart_uoff[mid] <= target) lo = mid;
+      else hi = mid - 1;
+    }
+    if (fseeko(zf->raw, zf->restart_coff[lo], SEEK_SET) != 0) return -1;
+    inflateReset(&zf->strm);
+    zf->strm.avail_in = 0;
+    zf->upos = zf->restart_uoff[lo];
+    zf->out_pos = zf->out_len = 0;
+    zf->member_start = TRUE;
+    zf->done = FALSE;
+  }
+
+  while (target > zf->upos + (off_t)zf->out_len) {     /* skip forward */
+    zf->upos += zf->out_len;
+    zf->out_pos = zf->out_len = 0;
+    if (zf_fill(zf) == 0) break;
+  }
+  zf->out_pos = min(target - zf->upos, (off_t)zf->out_len);
+  *offset = zf->upos + zf->out_pos;
+  return 0;
+}
+
+/* compress any pending data and write the end-of-file marker */
+static int zf_finish(ZFile *zf) {
+  if (zf->finished) return 0;
+  zf->finished = TRUE;
+  if (zf->in_len > 0) zf_write_block(zf, zf->in, zf->in_len);
+  zf->in_len = 0;
+  if (fwrite(bgzf_eof, 1, sizeof(bgzf_eof), zf->raw) != sizeof(bgzf_eof))
+    return EOF;
+  return fflush(zf->raw);
+}
+
+/* finish writers left open at exit.  After an error (see die), end
+   each output instead with the header of a block that never arrives,
+   so that it is recognizably truncated: complete BGZF blocks are
+   valid gzip members on their own, so simply omitting the end-of-file
+   marker would go unnoticed by most tools */
+static void zf_finish_all() {
+  ZFile *zf;
+  for (zf = zf_open_writers; zf != NULL; zf = zf->next_writer) {
+    fflush(zf->stream);
+    if (phast_error_exit) {
+      zf->finished = TRUE;
+      fwrite(bgzf_eof, 1, BGZF_HEADER_LEN, zf->raw);
+      fflush(zf->raw);
+    }
+    else zf_finish(zf);
+  }
+}
+
+static int zf_close(void *cookie) {
+  ZFile *zf = cookie, **p;
+  int retval = 0;
+  if (zf->writing) {
+    if (zf_finish(zf) != 0) retval = EOF;
+    deflateEnd(&zf->strm);
+    for (p = &zf_open_writers; *p != NULL; p = &(*p)->next_writer)
+      if (*p == zf) {
+        *p = zf->next_writer;
+        break;
+      }
+  }
+  else
+    inflateEnd(&zf->strm);
+  if (zf->raw != stdin && zf->raw != stdout) {
+    if (fclose(zf->raw) != 0) retval = EOF;
+  }
+  else if (zf->writing && fflush(zf->raw) != 0) retval = EOF;
+  sfree(zf->in);
+  sfree(zf->out);
+  if (zf->restart_coff != NULL) {
+    sfree(zf->restart_coff);
+    sfree(zf->restart_uoff);
+  }
+  sfree(zf);
+  return retval;
+}
+
+#if defined(__GLIBC__)
+static int zf_seek64(void *cookie, off64_t *offset, int whence) {
+  off_t off = *offset;
+  int retval = zf_seek(cookie, &off, whence);
+  *offset = off;
+  return retval;
+}
+
+static FILE *zf_new_stream(ZFile *zf) {
+  cookie_io_functions_t io;
+  io.read = zf->writing ? NULL : zf_read;
+  io.write = zf->writing ? zf_write : NULL;
+  io.seek = zf_seek64;
+  io.close = zf_close;
+  return fopencookie(zf, zf->writing ? "w" : "r", io);
+}
+#else
+static int zf_read_bsd(void *cookie, char *buf, int size) {
+  return (int)zf_read(cookie, buf, size);
+}
+
+static int zf_write_bsd(void *cookie, const char *buf, int size) {
+  return (int)zf_write(cookie, buf, size);
+}
+
+static fpos_t zf_seek_bsd(void *cookie, fpos_t offset, int whence) {
+  off_t off = offset;
+  if (zf_seek(cookie, &off, whence) != 0) return -1;
+  return off;
+}
+
+static FILE *zf_new_stream(ZFile *zf) {
+  return funopen(zf, zf->writing ? NULL : zf_read_bsd,
+                 zf->writing ? zf_write_bsd : NULL, zf_seek_bsd, zf_close);
+}
+#endif
+
+static ZFile *zf_new(FILE *raw, int writing) {
+  ZFile *zf = smalloc(sizeof(ZFile));
+  struct stat st;
+  memset(zf, 0, sizeof(ZFile));
+  zf->raw = raw;
+  zf->writing = writing;
+  zf->in = smalloc(ZF_BUFSIZE);
+  zf->out = smalloc(ZF_BUFSIZE);
+  zf->member_start = TRUE;
+  zf->seekable = (!writing && fstat(fileno(raw), &st) == 0 &&
+                  S_ISREG(st.st_mode) && ftello(raw) >= 0);
+  zf->restart_coff = zf->restart_uoff = NULL;
+  zf->strm.zalloc = Z_NULL;
+  zf->strm.zfree = Z_NULL;
+  zf->strm.opaque = Z_NULL;
+  return zf;
+}
+
+FILE *zf_wrap_reader(FILE *F) {
+  ZFile *zf;
+  FILE *retval;
+  int c1, c2;
+
+  if ((c1 = getc(F)) != 0x1f) { /* not gzip; the usual case */
+    if (c1 != EOF) ungetc(c1, F);
+    return F;
+  }
+  if ((c2 = getc(F)) != 0x8b) { /* can only push back one char */
+    if (fseek(F, -1 - (c2 != EOF), SEEK_CUR) != 0)
+      die("ERROR: cannot reread start of input.\n");
+    return F;
+  }
+
+  zf = zf_new(F, FALSE);
+  zf->in[0] = (unsigned char)c1;
+  zf->in[1] = (unsigned char)c2;
+  zf->strm.next_in = zf->in;
+  zf->strm.avail_in = 2;
+  if (inflateInit2(&zf->strm, 15 + 16) != Z_OK) /* gzip decoding */
+    die("ERROR: cannot initialize decompression.\n");
+  if ((retval = zf_new_stream(zf)) == NULL)
+    die("ERROR: cannot open compressed stream.\n");
+  return retval;
+}
+
+FILE *zf_open_writer(FILE *F) {
+  static int registered = FALSE;
+  ZFile *zf = zf_new(F, TRUE);
+  if (deflateInit2(&zf->strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) /* raw deflate */
+    die("ERROR: cannot initialize compression.\n");
+  if ((zf->stream = zf_new_stream(zf)) == NULL)
+    die("ERROR: cannot open compressed stream.\n");
+  if (!registered) {
+    atexit(zf_finish_all);
+    registered = TRUE;
+  }
+  zf->next_writer = zf_open_writers;
+  zf_open_writers = zf;
+  return zf->stream;
+}
+
+#else  /* SKIP_ZLIB */
+
+FILE *zf_wrap_reader(FILE *F) {
+  int c = getc(F);
+  if (c == 0x1f)
+    die("ERROR: compressed input is not supported in this build.\n");
+  if (c != EOF) ungetc(c, F);
+  return F;
+}
+
+FILE *zf_open_writer(FILE *F) {
+  die("ERROR: compressed output is not supported in this build.\n");
+  return F;
+}
+
+#endif
+
+int zf_compressed_fname(const char *fname) {
+  size_t len = strlen(fname);
+  return ((len > 3 && !strcmp(fname + len - 3, ".gz")) ||
+          (len > 4 && !strcmp(fname + len - 4, ".bgz")));
+}
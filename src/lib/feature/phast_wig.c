@@ -9,6 +9,8 @@
 
 /* $Id: wig.c,v 1.37 2008-11-12 02:07:59 acs Exp $ */
 
+#include <stdarg.h>
+#include <math.h>
 #include <phast_misc.h>
 #include <phast_wig.h>
 #include <phast_gff.h>
@@ -194,3 +196,217 @@ void wig_print(FILE *outfile, GFF_Set *set) {
 }
 
 	
+
+
+/* powers of ten used by ww_format_fixed */
+static const double ww_pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                  1e8, 1e9};
+
+/* Format val as printf("%.*f", prec, val) would, without the
+   overhead of printf.  Writes at most 32 characters (including the
+   terminating null) to dest if prec <= 9 and |val| * 10^prec < 1e9;
+   otherwise, or if val is too close to a rounding boundary to be sure
+   of the result, returns -1 so that the caller can fall back on
+   printf.  Otherwise returns the number of characters written. */
+static int ww_format_fixed(char *dest, double val, int prec) {
+  double scaled, fl, frac;
+  unsigned long n;
+  char digits[24];
+  int nd = 0, len = 0, i;
+
+  if (prec < 0 || prec > 9 || !isfinite(val)) return -1;
+  scaled = fabs(val) * ww_pow10[prec];
+  if (scaled >= 1e9) return -1;
+
+  /* scaled is within 1e-7 of the exact value, so rounding is
+     unambiguous unless the fraction is very close to one half */
+  fl = floor(scaled);
+  frac = scaled - fl;
+  if (fabs(frac - 0.5) < 1e-6) return -1;
+  n = (unsigned long)fl + (frac > 0.5);
+
+  do {
+    digits[nd++] = (char)('0' + n % 10);
+    n /= 10;
+  } while (n > 0 || nd <= prec);
+
+  if (signbit(val)) dest[len++] = '-'; /* printf gives "-0.000", too */
+  for (i = nd - 1; i >= 0; i--) {
+    dest[len++] = digits[i];
+    if (i == prec && prec > 0) dest[len++] = '.';
+  }
+  dest[len] = '\0';
+  return len;
+}
+
+WigWriter *ww_new(FILE *F, int binary) {
+  WigWriter *w = smalloc(sizeof(WigWriter));
+  w->F = F;
+  w->binary = binary;
+  w->buf = binary ? NULL : smalloc(WIG_WRITER_BUFSIZE * sizeof(char));
+  w->len = 0;
+  w->chrom = NULL;
+  w->start = 0;
+  w->ncols = -1;
+  w->nrows = 0;
+  w->rowcols = 0;
+  w->maxvals = binary ? WIG_WRITER_BUFSIZE / (int)sizeof(float) : 0;
+  w->vals = binary ? smalloc(w->maxvals * sizeof(float)) : NULL;
+  w->wrote_header = FALSE;
+  return w;
+}
+
+/* make room for at least n more characters in the text buffer */
+static void ww_reserve(WigWriter *w, int n) {
+  if (w->len + n > WIG_WRITER_BUFSIZE) {
+    fwrite(w->buf, sizeof(char), w->len, w->F);
+    w->len = 0;
+  }
+}
+
+/* write the complete positions of the current block to the stream
+   (preceded by the file header, the first time) and start a new block
+   at the following position */
+static void ww_write_block(WigWriter *w) {
+  int hdr[3], clen;
+  if (!w->wrote_header) {
+    int version = WIG_BINARY_VERSION, bom = 0x01020304;
+    fwrite(WIG_BINARY_MAGIC, sizeof(char), strlen(WIG_BINARY_MAGIC), w->F);
+    fwrite(&version, sizeof(int), 1, w->F);
+    fwrite(&bom, sizeof(int), 1, w->F);
+    w->wrote_header = TRUE;
+  }
+  if (w->nrows == 0) return;
+  clen = w->chrom == NULL ? 0 : (int)strlen(w->chrom);
+  fwrite(&clen, sizeof(int), 1, w->F);
+  if (clen > 0) fwrite(w->chrom, sizeof(char), clen, w->F);
+  hdr[0] = w->start;
+  hdr[1] = w->ncols;
+  hdr[2] = w->nrows;
+  fwrite(hdr, sizeof(int), 3, w->F);
+  fwrite(w->vals, sizeof(float), (size_t)w->nrows * w->ncols, w->F);
+
+  /* carry over any values of an incomplete position */
+  if (w->rowcols > 0)
+    memmove(w->vals, &w->vals[w->nrows * w->ncols],
+            w->rowcols * sizeof(float));
+  w->start += w->nrows;
+  w->nrows = 0;
+}
+
+void ww_fixed_step(WigWriter *w, const char *chrom, int start) {
+  if (chrom == NULL) chrom = "(null)"; /* as printed by fprintf */
+  if (w->binary) {
+    ww_write_block(w);
+    if (w->rowcols > 0)
+      die("ERROR ww_fixed_step: previous position not ended\n");
+    if (w->chrom == NULL || strcmp(w->chrom, chrom) != 0) {
+      sfree(w->chrom);
+      w->chrom = copy_charstr(chrom);
+    }
+    w->start = start;
+    w->ncols = -1;
+    return;
+  }
+  if (strlen(chrom) + 64 > WIG_WRITER_BUFSIZE) {
+    ww_flush(w);
+    fprintf(w->F, "fixedStep chrom=%s start=%d step=1\n", chrom, start);
+    return;
+  }
+  ww_reserve(w, (int)strlen(chrom) + 64);
+  w->len += sprintf(&w->buf[w->len], "fixedStep chrom=%s start=%d step=1\n",
+                    chrom, start);
+}
+
+/* add a value to the current position of a binary track */
+static void ww_push_binary(WigWriter *w, double val) {
+  if (w->nrows * max(w->ncols, 0) + w->rowcols >= w->maxvals) {
+    ww_write_block(w);
+    if (w->rowcols >= w->maxvals) {
+      w->maxvals *= 2;
+      w->vals = srealloc(w->vals, w->maxvals * sizeof(float));
+    }
+  }
+  w->vals[w->nrows * max(w->ncols, 0) + w->rowcols++] = (float)val;
+}
+
+/* append printf-formatted text to the text buffer */
+static void ww_printf(WigWriter *w, const char *format, ...) {
+  va_list ap;
+  int n;
+  va_start(ap, format);
+  n = vsnprintf(&w->buf[w->len], WIG_WRITER_BUFSIZE - w->len, format, ap);
+  va_end(ap);
+  if (n >= WIG_WRITER_BUFSIZE - w->len) { /* didn't fit; flush and retry */
+    ww_flush(w);
+    va_start(ap, format);
+    if (n >= WIG_WRITER_BUFSIZE)
+      vfprintf(w->F, format, ap);
+    else n = vsprintf(w->buf, format, ap);
+    va_end(ap);
+    if (n >= WIG_WRITER_BUFSIZE) return;
+  }
+  w->len += n;
+}
+
+void ww_dbl(WigWriter *w, double val, int prec) {
+  int n;
+  if (w->binary) {
+    ww_push_binary(w, val);
+    return;
+  }
+  ww_reserve(w, 32);
+  n = ww_format_fixed(&w->buf[w->len], val, prec);
+  if (n >= 0) w->len += n;
+  else ww_printf(w, "%.*f", prec, val);
+}
+
+void ww_dbl_fmt(WigWriter *w, const char *format, double val) {
+  if (w->binary) ww_push_binary(w, val);
+  else ww_printf(w, format, val);
+}
+
+void ww_text(WigWriter *w, const char *str) {
+  int n;
+  if (w->binary) return;
+  n = (int)strlen(str);
+  if (n > WIG_WRITER_BUFSIZE) {
+    ww_flush(w);
+    fputs(str, w->F);
+    return;
+  }
+  ww_reserve(w, n);
+  memcpy(&w->buf[w->len], str, n);
+  w->len += n;
+}
+
+void ww_end_row(WigWriter *w) {
+  if (!w->binary) {
+    ww_reserve(w, 1);
+    w->buf[w->len++] = '\n';
+    return;
+  }
+  if (w->ncols != w->rowcols) {
+    if (w->nrows > 0) ww_write_block(w);
+    w->ncols = w->rowcols;
+  }
+  w->nrows++;
+  w->rowcols = 0;
+}
+
+void ww_flush(WigWriter *w) {
+  if (w->binary) ww_write_block(w);
+  else if (w->len > 0) {
+    fwrite(w->buf, sizeof(char), w->len, w->F);
+    w->len = 0;
+  }
+  fflush(w->F);
+}
+
+void ww_free(WigWriter *w) {
+  ww_flush(w);
+  if (w->buf != NULL) sfree(w->buf);
+  if (w->vals != NULL) sfree(w->vals);
+  if (w->chrom != NULL) sfree(w->chrom);
+  sfree(w);
+}
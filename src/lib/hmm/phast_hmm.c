@@ -16,8 +16,14 @@
 #include "phast_stacks.h"
 #include <phast_vector.h>
 #include <phast_prob_vector.h>
+#include <phast_workspace.h>
 #include <time.h>
 
+static void hmm_free_transition_table(HMM *hmm);
+static double hmm_log_sum(double *vals, int n);
+static double **hmm_new_score_rows(int nrows, int ncols);
+static void hmm_free_score_rows(double **rows);
+
 /* Library of functions for manipulation of hidden Markov models.
    Includes simple reading and writing routines, as well as
    implementations of the Viterbi algorithm, the forward algorithm,
@@ -53,6 +59,7 @@ HMM* hmm_new(MarkovMatrix *mm, Vector *eq_freqs,
   hmm->begin_transition_scores = hmm->end_transition_scores = NULL;
   hmm->predecessors = hmm->successors = NULL;
   hmm->begin_successors = hmm->end_predecessors = NULL;
+  hmm->trans_table = NULL;
 
   /* if begin_transitions are NULL, make them uniform */
   if (begin_transitions == NULL) {
@@ -139,6 +146,7 @@ void hmm_free(HMM *hmm) {
   lst_free(hmm->end_predecessors);
   sfree(hmm->predecessors);
   sfree(hmm->successors);
+  hmm_free_transition_table(hmm);
   sfree(hmm);
 }
 
@@ -266,11 +274,21 @@ double hmm_get_transition_score(HMM *hmm, int from_state, int to_state) {
   return (mat_get(hmm->transition_score_matrix, from_state, to_state));
 }
 
+/* number of cells above which dynamic programming is checkpointed
+   (see hmm_set_checkpoint_cells) */
+static size_t hmm_checkpoint_cells = HMM_CHECKPOINT_MIN_CELLS;
+
+void hmm_set_checkpoint_cells(size_t ncells) {
+  hmm_checkpoint_cells = ncells;
+}
+
 /* Finds most probable path, according to the Viterbi algorithm.
    Emission scores must be passed in as a two dimensional matrix, with
    hmm->nstates rows and seqlen columns.  The array "path" must be
    allocated externally and be of length seqlen.  This array will be
-   filled with integers indicating state numbers in the HMM. */
+   filled with integers indicating state numbers in the HMM.  Very long
+   sequences are handled by hmm_viterbi_checkpointed (see
+   hmm_set_checkpoint_cells). */
 void hmm_viterbi(HMM *hmm, double **emission_scores, int seqlen, int *path) {
 
   double **full_scores;
@@ -278,15 +296,19 @@ void hmm_viterbi(HMM *hmm, double **emission_scores, int seqlen, int *path) {
   int i, j, len, bestidx;
   double besttran;
 
-  /* set up necessary arrays */
-  full_scores = (double**)smalloc(hmm->nstates * sizeof(double*));
-  backptr = (int**)smalloc(hmm->nstates * sizeof(int*));
-  len = seqlen;
-  for (i = 0; i < hmm->nstates; i++) {
-    full_scores[i] = (double*)smalloc(len * sizeof(double));
-    backptr[i] = (int*)smalloc(len * sizeof(int));
+  if ((size_t)hmm->nstates * seqlen > hmm_checkpoint_cells) {
+    hmm_viterbi_checkpointed(hmm, emission_scores, seqlen, path, -1);
+    return;
   }
 
+  /* set up necessary arrays (each in a single block) */
+  len = seqlen;
+  full_scores = hmm_new_score_rows(hmm->nstates, len);
+  backptr = (int**)smalloc(hmm->nstates * sizeof(int*));
+  backptr[0] = (int*)smalloc((size_t)hmm->nstates * len * sizeof(int));
+  for (i = 1; i < hmm->nstates; i++) 
+    backptr[i] = backptr[0] + (size_t)i * len;
+
   /* fill array using DP */
   hmm_do_dp_forward(hmm, emission_scores, seqlen, VITERBI, full_scores, 
                     backptr);
@@ -316,11 +338,8 @@ void hmm_viterbi(HMM *hmm, double **emission_scores, int seqlen, int *path) {
     j--;
   }
 
-  for (i = 0; i < hmm->nstates; i++) {
-    sfree(full_scores[i]);
-    sfree(backptr[i]);
-  }
-  sfree(full_scores);
+  hmm_free_score_rows(full_scores);
+  sfree(backptr[0]);
   sfree(backptr);
 }
 
@@ -366,23 +385,30 @@ double hmm_backward(HMM *hmm, double **emission_scores, int seqlen,
    hmm_backward, but it transparently handles the management of the
    arrays used by those routines.  NOTE: if the posterior probs for
    any state i are not desired, set posterior_probs[i] = NULL.  The
-   return value is the log likelihood.  */
+   return value is the log likelihood.  Small HMMs use
+   hmm_posterior_probs_scaled instead, unless it fails, and very long
+   sequences use hmm_posterior_probs_checkpointed.  */
 double hmm_posterior_probs(HMM *hmm, double **emission_scores, int seqlen,
                          double **posterior_probs) {
   int i, j, len;
   double logp_fw, logp_bw;
   double **forward_scores, **backward_scores;
-  List *val_list;
+  double *vals;
+
+  if ((size_t)hmm->nstates * seqlen > hmm_checkpoint_cells)
+    return hmm_posterior_probs_checkpointed(hmm, emission_scores, seqlen,
+                                            posterior_probs, -1);
+
+  if (hmm->nstates <= HMM_SCALED_MAX_STATES &&
+      hmm_posterior_probs_scaled(hmm, emission_scores, seqlen,
+                                 posterior_probs, &logp_fw))
+    return logp_fw;
 
   len = seqlen;
 
   /* allocate arrays for forward and backward algs */
-  forward_scores = (double**)smalloc(hmm->nstates * sizeof(double*));
-  backward_scores = (double**)smalloc(hmm->nstates * sizeof(double*));
-  for (i = 0; i < hmm->nstates; i++) {
-    forward_scores[i] = (double*)smalloc(len * sizeof(double));
-    backward_scores[i] = (double*)smalloc(len * sizeof(double));
-  }
+  forward_scores = hmm_new_score_rows(hmm->nstates, len);
+  backward_scores = hmm_new_score_rows(hmm->nstates, len);
 
   /* run forward and backward algs */
   logp_fw = hmm_forward(hmm, emission_scores, seqlen, forward_scores); 
@@ -392,17 +418,16 @@ double hmm_posterior_probs(HMM *hmm, double **emission_scores, int seqlen,
     fprintf(stderr, "WARNING: forward and backward algorithms returned different total log\nprobabilities (%f and %f, respectively).\n", logp_fw, logp_bw);
 
   /* compute posterior probs */
-  val_list = lst_new_dbl(hmm->nstates);
+  vals = smalloc(hmm->nstates * sizeof(double));
   for (j = 0; j < len; j++) {
     double this_logp;
     checkInterruptN(i, 1000);
 
     /* to avoid rounding errors, estimate total log prob
        separately for each column */
-    lst_clear(val_list);
     for (i = 0; i < hmm->nstates; i++) 
-      lst_push_dbl(val_list, (forward_scores[i][j] + backward_scores[i][j]));
-    this_logp = log_sum(val_list);
+      vals[i] = forward_scores[i][j] + backward_scores[i][j];
+    this_logp = hmm_log_sum(vals, hmm->nstates);
 
     for (i = 0; i < hmm->nstates; i++) 
       if (posterior_probs[i] != NULL) /* indicates probs for this
@@ -411,29 +436,506 @@ double hmm_posterior_probs(HMM *hmm, double **emission_scores, int seqlen,
                                      backward_scores[i][j] - this_logp);
   }
 
+  hmm_free_score_rows(forward_scores);
+  hmm_free_score_rows(backward_scores);
+  sfree(vals);
+
+  return logp_fw;
+}
+
+/* Build adjacency lists for the transitions of an HMM, with
+   corresponding scores.  Ordering follows hmm->predecessors and
+   hmm->successors, so that ties are broken (in Viterbi) and sums
+   accumulated (in forward/backward) exactly as in hmm_max_or_sum */
+HMMTransitionTable *hmm_transition_table(HMM *hmm) {
+  HMMTransitionTable *tt = hmm->trans_table;
+  int i, k, n, npred = 0, nsucc = 0;
+
+  if (tt != NULL) return tt;
+
   for (i = 0; i < hmm->nstates; i++) {
-    sfree(forward_scores[i]);
-    sfree(backward_scores[i]);
+    npred += lst_size(hmm->predecessors[i]);
+    nsucc += lst_size(hmm->successors[i]);
   }
-  sfree(forward_scores);
-  sfree(backward_scores);
-  lst_free(val_list);
 
-  return logp_fw;
+  tt = smalloc(sizeof(HMMTransitionTable));
+  tt->pred_start = smalloc((hmm->nstates + 1) * sizeof(int));
+  tt->succ_start = smalloc((hmm->nstates + 1) * sizeof(int));
+  tt->pred = smalloc(max(npred, 1) * sizeof(int));
+  tt->succ = smalloc(max(nsucc, 1) * sizeof(int));
+  tt->pred_score = smalloc(max(npred, 1) * sizeof(double));
+  tt->succ_score = smalloc(max(nsucc, 1) * sizeof(double));
+  tt->max_degree = 0;
+
+  for (i = 0, n = 0; i < hmm->nstates; i++) {
+    tt->pred_start[i] = n;
+    for (k = 0; k < lst_size(hmm->predecessors[i]); k++) {
+      int pred = lst_get_int(hmm->predecessors[i], k);
+      if (pred == BEGIN_STATE) continue;
+      tt->pred[n] = pred;
+      tt->pred_score[n++] = hmm_get_transition_score(hmm, pred, i);
+    }
+    tt->max_degree = max(tt->max_degree, n - tt->pred_start[i]);
+  }
+  tt->pred_start[hmm->nstates] = n;
+
+  for (i = 0, n = 0; i < hmm->nstates; i++) {
+    tt->succ_start[i] = n;
+    for (k = 0; k < lst_size(hmm->successors[i]); k++) {
+      int succ = lst_get_int(hmm->successors[i], k);
+      if (succ == END_STATE) continue;
+      tt->succ[n] = succ;
+      tt->succ_score[n++] = hmm_get_transition_score(hmm, i, succ);
+    }
+    tt->max_degree = max(tt->max_degree, n - tt->succ_start[i]);
+  }
+  tt->succ_start[hmm->nstates] = n;
+
+  tt->dense2 = (hmm->nstates == 2 && tt->pred_start[2] == 4 &&
+                tt->succ_start[2] == 4 && tt->pred_start[1] == 2);
+  if (tt->dense2 &&             /* check order assumed below */
+      !(tt->pred[0] == 0 && tt->pred[1] == 1 && tt->pred[2] == 0 &&
+        tt->pred[3] == 1 && tt->succ[0] == 0 && tt->succ[1] == 1 &&
+        tt->succ[2] == 0 && tt->succ[3] == 1))
+    tt->dense2 = FALSE;
+
+  hmm->trans_table = tt;
+  return tt;
 }
 
-/* This is the core dynamic programming routine used by hmm_viterbi
-   and hmm_forward.  It is not intended to be called directly. */
-void hmm_do_dp_forward(HMM *hmm, double **emission_scores, int seqlen, 
-                       hmm_mode mode, double **full_scores, int **backptr) {  
+static void hmm_free_transition_table(HMM *hmm) {
+  HMMTransitionTable *tt = hmm->trans_table;
+  if (tt == NULL) return;
+  sfree(tt->pred_start);
+  sfree(tt->succ_start);
+  sfree(tt->pred);
+  sfree(tt->succ);
+  sfree(tt->pred_score);
+  sfree(tt->succ_score);
+  sfree(tt);
+  hmm->trans_table = NULL;
+}
 
-  int i, j;
+/* log (base 2) of a sum of two values given as logs, computed exactly
+   as log_sum would */
+static PHAST_INLINE double hmm_log_sum2(double a, double b) {
+  double maxval = (a >= b ? a : b), other = (a >= b ? b : a);
+  double expsum = 1;
+  if (other - maxval > SUM_LOG_THRESHOLD)
+    expsum += exp2(other - maxval);
+  return maxval + log2(expsum);
+}
+
+/* Like log_sum, but for an array.  Values are summed in descending
+   order, as in log_sum, so results are identical.  Sorts vals as a
+   side effect.  Returns NEGINFTY if n == 0 */
+static double hmm_log_sum(double *vals, int n) {
+  int k, m;
+  double v, maxval, expsum;
+
+  if (n == 0) return NEGINFTY;
+  if (n == 2) return hmm_log_sum2(vals[0], vals[1]);
+
+  for (k = 1; k < n; k++) {     /* insertion sort (n usually small) */
+    v = vals[k];
+    for (m = k; m > 0 && vals[m-1] < v; m--)
+      vals[m] = vals[m-1];
+    vals[m] = v;
+  }
+
+  maxval = vals[0];
+  expsum = 1;
+  for (k = 1; k < n && vals[k] - maxval > SUM_LOG_THRESHOLD; k++)
+    expsum += exp2(vals[k] - maxval);
+  return maxval + log2(expsum);
+}
+
+/* allocate an nrows x ncols matrix of scores as a single block */
+static double **hmm_new_score_rows(int nrows, int ncols) {
+  double **rows = smalloc(nrows * sizeof(double*));
+  int i;
+  rows[0] = smalloc((size_t)nrows * ncols * sizeof(double));
+  for (i = 1; i < nrows; i++) rows[i] = rows[0] + (size_t)i * ncols;
+  return rows;
+}
 
-  if (!(seqlen > 0 && hmm != NULL && hmm->nstates > 0 && 
-	(mode == VITERBI || mode == FORWARD) && 
+static void hmm_free_score_rows(double **rows) {
+  sfree(rows[0]);
+  sfree(rows);
+}
+
+/* Posterior probabilities by the forward and backward algorithms
+   with scaled probabilities rather than logs.  Emissions are
+   converted to probabilities relative to the largest in each column
+   (2^(e - max)), and forward probabilities are normalized to sum to
+   one in each column; backward probabilities are divided by the same
+   normalizing constants, so that their products are posterior
+   probabilities up to a constant for each column.  Arrays are stored
+   column by column. */
+int hmm_posterior_probs_scaled(HMM *hmm, double **emission_scores,
+                               int seqlen, double **posterior_probs,
+                               double *logp) {
+  HMMTransitionTable *tt = hmm_transition_table(hmm);
+  int n = hmm->nstates, i, j, k, success = FALSE;
+  double *alpha = smalloc((size_t)n * seqlen * sizeof(double)),
+    *beta = smalloc((size_t)n * seqlen * sizeof(double)),
+    *norm = smalloc(seqlen * sizeof(double)),
+    *begin = smalloc(n * sizeof(double)),
+    *end = smalloc(n * sizeof(double)),
+    *emit_next = smalloc(n * sizeof(double)),
+    *tmp = smalloc(n * sizeof(double)),
+    *pred_prob = smalloc(max(tt->pred_start[n], 1) * sizeof(double)),
+    *succ_prob = smalloc(max(tt->succ_start[n], 1) * sizeof(double));
+  double logp_fw = 0, logp_bw = 0, maxe, sum;
+
+  for (i = 0; i < n; i++) {
+    begin[i] = exp2(hmm_get_transition_score(hmm, BEGIN_STATE, i));
+    end[i] = exp2(hmm_get_transition_score(hmm, i, END_STATE));
+  }
+  for (k = 0; k < tt->pred_start[n]; k++)
+    pred_prob[k] = exp2(tt->pred_score[k]);
+  for (k = 0; k < tt->succ_start[n]; k++)
+    succ_prob[k] = exp2(tt->succ_score[k]);
+
+  /* forward pass; relative emission probabilities are kept in beta
+     until they are needed by the backward pass */
+  for (j = 0; j < seqlen; j++) {
+    double *a = &alpha[(size_t)j * n], *e = &beta[(size_t)j * n];
+    checkInterruptN(j, 10000);
+    for (i = 0, maxe = NEGINFTY; i < n; i++)
+      if (emission_scores[i][j] > maxe) maxe = emission_scores[i][j];
+    for (i = 0; i < n; i++)
+      e[i] = exp2(emission_scores[i][j] - maxe);
+    if (j == 0)
+      for (i = 0; i < n; i++) a[i] = begin[i] * e[i];
+    else {
+      double *aprev = a - n;
+      for (i = 0; i < n; i++) {
+        for (k = tt->pred_start[i], sum = 0; k < tt->pred_start[i+1]; k++)
+          sum += aprev[tt->pred[k]] * pred_prob[k];
+        a[i] = sum * e[i];
+      }
+    }
+    for (i = 0, sum = 0; i < n; i++) sum += a[i];
+    if (!(sum > 0) || !isfinite(sum)) goto done;
+    for (i = 0; i < n; i++) a[i] /= sum;
+    norm[j] = sum;
+    logp_fw += log2(sum) + maxe;
+    if (j == 0) logp_bw += maxe;
+    else logp_bw += log2(sum) + maxe;
+  }
+  for (i = 0, sum = 0; i < n; i++)
+    sum += alpha[(size_t)(seqlen-1) * n + i] * end[i];
+  if (!(sum > 0)) goto done;
+  logp_fw += log2(sum);
+
+  /* backward pass */
+  for (i = 0; i < n; i++) {
+    emit_next[i] = beta[(size_t)(seqlen-1) * n + i];
+    beta[(size_t)(seqlen-1) * n + i] = end[i];
+  }
+  for (j = seqlen - 2; j >= 0; j--) {
+    double *b = &beta[(size_t)j * n], *bnext = b + n;
+    checkInterruptN(j, 10000);
+    for (k = 0; k < n; k++) tmp[k] = emit_next[k] * bnext[k] / norm[j+1];
+    for (i = 0; i < n; i++) emit_next[i] = b[i];
+    for (i = 0; i < n; i++) {
+      for (k = tt->succ_start[i], sum = 0; k < tt->succ_start[i+1]; k++)
+        sum += tmp[tt->succ[k]] * succ_prob[k];
+      b[i] = sum;
+    }
+  }
+  /* emit_next now holds relative emission probabilities for column 0 */
+  for (i = 0, sum = 0; i < n; i++) sum += begin[i] * emit_next[i] * beta[i];
+  logp_bw += log2(sum);
+
+  if (fabs(logp_fw - logp_bw) > 1.0)
+    fprintf(stderr, "WARNING: forward and backward algorithms returned different total log\nprobabilities (%f and %f, respectively).\n", logp_fw, logp_bw);
+
+  /* posterior probs, normalized separately for each column */
+  for (j = 0; j < seqlen; j++) {
+    double *a = &alpha[(size_t)j * n], *b = &beta[(size_t)j * n];
+    for (i = 0, sum = 0; i < n; i++) sum += a[i] * b[i];
+    if (!(sum > 0)) goto done;
+    for (i = 0; i < n; i++)
+      if (posterior_probs[i] != NULL)
+        posterior_probs[i][j] = a[i] * b[i] / sum;
+  }
+
+  *logp = logp_fw;
+  success = TRUE;
+
+ done:
+  sfree(alpha);
+  sfree(beta);
+  sfree(norm);
+  sfree(begin);
+  sfree(end);
+  sfree(emit_next);
+  sfree(tmp);
+  sfree(pred_prob);
+  sfree(succ_prob);
+  return success;
+}
+
+/* Compute column j of the Viterbi or forward scores from column j-1
+   (prev), as in hmm_max_or_sum, storing the scores in cur and (if bp
+   is not NULL) back pointers in bp.  The array cand is used for
+   scratch and must have at least tt->max_degree elements */
+static void hmm_dp_forward_column(HMM *hmm, HMMTransitionTable *tt,
+                                  double **emission_scores, int j,
+                                  hmm_mode mode, double *prev, double *cur,
+                                  int *bp, double *cand) {
+  int i, k, n;
+
+  if (j == 0) {
+    for (i = 0; i < hmm->nstates; i++) {
+      cur[i] = emission_scores[i][0] +
+        hmm_get_transition_score(hmm, BEGIN_STATE, i);
+      if (bp != NULL) bp[i] = -1;
+    }
+    return;
+  }
+
+  for (i = 0; i < hmm->nstates; i++) {
+    double retval = NEGINFTY;
+    if (mode == VITERBI) {
+      for (k = tt->pred_start[i]; k < tt->pred_start[i+1]; k++) {
+        double candidate = prev[tt->pred[k]] + tt->pred_score[k];
+        if (candidate > retval || k == tt->pred_start[i]) {
+          retval = candidate;
+          bp[i] = tt->pred[k];
+        }
+      }
+    }
+    else {
+      for (k = tt->pred_start[i], n = 0; k < tt->pred_start[i+1]; k++)
+        cand[n++] = prev[tt->pred[k]] + tt->pred_score[k];
+      retval = hmm_log_sum(cand, n);
+    }
+    cur[i] = emission_scores[i][j] + retval;
+  }
+}
+
+/* Compute column j of the backward scores from column j+1 (next),
+   storing them in cur.  The arrays tmp (nstates elements) and cand
+   (tt->max_degree elements) are used for scratch */
+static void hmm_dp_backward_column(HMM *hmm, HMMTransitionTable *tt,
+                                   double **emission_scores, int j,
+                                   int seqlen, double *next, double *cur,
+                                   double *tmp, double *cand) {
+  int i, k, n;
+
+  if (j == seqlen - 1) {
+    for (i = 0; i < hmm->nstates; i++)
+      cur[i] = hmm_get_transition_score(hmm, i, END_STATE);
+                                /*  will be 0 when no end state */
+    return;
+  }
+
+  for (i = 0; i < hmm->nstates; i++)
+    tmp[i] = emission_scores[i][j+1] + next[i];
+  for (i = 0; i < hmm->nstates; i++) {
+    for (k = tt->succ_start[i], n = 0; k < tt->succ_start[i+1]; k++)
+      cand[n++] = tmp[tt->succ[k]] + tt->succ_score[k];
+    cur[i] = hmm_log_sum(cand, n);
+  }
+}
+
+/* Default number of columns per block for checkpointed dynamic
+   programming, about sqrt(seqlen) */
+static int hmm_checkpoint_block_size(int seqlen, int block_size) {
+  if (block_size > 0) return block_size;
+  block_size = (int)ceil(sqrt((double)seqlen));
+  return max(block_size, 1);
+}
+
+/* Like hmm_viterbi, but keeps Viterbi scores only at the first column
+   of each block of block_size columns (checkpoints), recomputing
+   scores and back pointers one block at a time during the traceback.
+   Memory is O(nstates * (seqlen/block_size + block_size)) and the
+   path is identical to that of hmm_viterbi.  */
+void hmm_viterbi_checkpointed(HMM *hmm, double **emission_scores, int seqlen,
+                              int *path, int block_size) {
+  HMMTransitionTable *tt = hmm_transition_table(hmm);
+  int n = hmm->nstates, nblocks, i, j, b, bestidx;
+  double *ckpt, *prev, *cur, *tmp, *cand, *blk, besttran;
+  int *ckpt_bp, *bp, *blk_bp;
+
+  block_size = hmm_checkpoint_block_size(seqlen, block_size);
+  nblocks = (seqlen + block_size - 1) / block_size;
+  ckpt = smalloc((size_t)n * nblocks * sizeof(double));
+  ckpt_bp = smalloc((size_t)n * nblocks * sizeof(int));
+  prev = smalloc(n * sizeof(double));
+  cur = smalloc(n * sizeof(double));
+  bp = smalloc(n * sizeof(int));
+  cand = smalloc(max(tt->max_degree, 1) * sizeof(double));
+
+  /* forward pass, saving checkpoints */
+  for (j = 0; j < seqlen; j++) {
+    checkInterruptN(j, 10000);
+    hmm_dp_forward_column(hmm, tt, emission_scores, j, VITERBI, prev, cur,
+                          bp, cand);
+    if (j % block_size == 0) {
+      b = j / block_size;
+      for (i = 0; i < n; i++) {
+        ckpt[(size_t)b * n + i] = cur[i];
+        ckpt_bp[(size_t)b * n + i] = bp[i];
+      }
+    }
+    tmp = prev; prev = cur; cur = tmp;
+  }
+
+  /* find starting place, as in hmm_viterbi */
+  bestidx = 0;
+  besttran = hmm_get_transition_score(hmm, 0, END_STATE);
+  for (i = 1; i < n; i++) {
+    double thistran = hmm_get_transition_score(hmm, i, END_STATE);
+    if (prev[i] + thistran > prev[bestidx] + besttran)
+      bestidx = i;
+  }
+  path[seqlen-1] = bestidx;
+
+  /* recompute each block, then trace back through it */
+  blk = smalloc((size_t)n * block_size * sizeof(double));
+  blk_bp = smalloc((size_t)n * block_size * sizeof(int));
+  for (b = nblocks - 1; b >= 0; b--) {
+    int start = b * block_size, end = min(start + block_size, seqlen);
+    for (i = 0; i < n; i++) blk[i] = ckpt[(size_t)b * n + i];
+    for (j = start + 1; j < end; j++)
+      hmm_dp_forward_column(hmm, tt, emission_scores, j, VITERBI,
+                            &blk[(size_t)(j - start - 1) * n],
+                            &blk[(size_t)(j - start) * n],
+                            &blk_bp[(size_t)(j - start) * n], cand);
+    for (j = end - 1; j > start; j--)
+      path[j-1] = blk_bp[(size_t)(j - start) * n + path[j]];
+    if (b > 0)
+      path[start-1] = ckpt_bp[(size_t)b * n + path[start]];
+  }
+
+  sfree(ckpt);
+  sfree(ckpt_bp);
+  sfree(prev);
+  sfree(cur);
+  sfree(bp);
+  sfree(cand);
+  sfree(blk);
+  sfree(blk_bp);
+}
+
+/* Like the log-space version of hmm_posterior_probs, but keeps
+   forward scores only at the first column of each block of
+   block_size columns (checkpoints).  The backward pass proceeds one
+   block at a time, first recomputing the forward scores for the block
+   from its checkpoint.  Memory is O(nstates * (seqlen/block_size +
+   block_size)), at the cost of computing forward scores twice.
+   Posterior probabilities are identical to those of the log-space
+   version.  */
+double hmm_posterior_probs_checkpointed(HMM *hmm, double **emission_scores,
+                                        int seqlen, double **posterior_probs,
+                                        int block_size) {
+  HMMTransitionTable *tt = hmm_transition_table(hmm);
+  int n = hmm->nstates, nblocks, i, j, k, b;
+  double *ckpt, *prev, *cur, *next, *tmp, *cand, *vals, *blk;
+  double logp_fw, logp_bw;
+
+  block_size = hmm_checkpoint_block_size(seqlen, block_size);
+  nblocks = (seqlen + block_size - 1) / block_size;
+  ckpt = smalloc((size_t)n * nblocks * sizeof(double));
+  prev = smalloc(n * sizeof(double));
+  cur = smalloc(n * sizeof(double));
+  cand = smalloc(max(max(tt->max_degree, n), 1) * sizeof(double));
+  vals = smalloc(n * sizeof(double));
+
+  /* forward pass, saving checkpoints */
+  for (j = 0; j < seqlen; j++) {
+    checkInterruptN(j, 10000);
+    hmm_dp_forward_column(hmm, tt, emission_scores, j, FORWARD, prev, cur,
+                          NULL, cand);
+    if (j % block_size == 0)
+      for (i = 0; i < n; i++)
+        ckpt[(size_t)(j / block_size) * n + i] = cur[i];
+    tmp = prev; prev = cur; cur = tmp;
+  }
+
+  /* total log probability, as in hmm_forward */
+  for (k = 0, i = 0; k < lst_size(hmm->end_predecessors); k++) {
+    int pred = lst_get_int(hmm->end_predecessors, k);
+    if (pred == BEGIN_STATE) continue;
+    cand[i++] = prev[pred] + hmm_get_transition_score(hmm, pred, END_STATE);
+  }
+  logp_fw = hmm_log_sum(cand, i);
+
+  /* backward pass, one block at a time; prev holds the backward scores
+     for the column after the current one */
+  blk = smalloc((size_t)n * block_size * sizeof(double));
+  next = prev;
+  for (b = nblocks - 1; b >= 0; b--) {
+    int start = b * block_size, end = min(start + block_size, seqlen);
+    for (i = 0; i < n; i++) blk[i] = ckpt[(size_t)b * n + i];
+    for (j = start + 1; j < end; j++)
+      hmm_dp_forward_column(hmm, tt, emission_scores, j, FORWARD,
+                            &blk[(size_t)(j - start - 1) * n],
+                            &blk[(size_t)(j - start) * n], NULL, cand);
+
+    for (j = end - 1; j >= start; j--) {
+      double *fw = &blk[(size_t)(j - start) * n], this_logp;
+      checkInterruptN(j, 10000);
+      hmm_dp_backward_column(hmm, tt, emission_scores, j, seqlen, next, cur,
+                             vals, cand);
+
+      /* to avoid rounding errors, estimate total log prob separately
+         for each column, as in hmm_posterior_probs */
+      for (i = 0; i < n; i++) vals[i] = fw[i] + cur[i];
+      this_logp = hmm_log_sum(vals, n);
+      for (i = 0; i < n; i++)
+        if (posterior_probs[i] != NULL)
+          posterior_probs[i][j] = exp2(fw[i] + cur[i] - this_logp);
+
+      tmp = next; next = cur; cur = tmp;
+    }
+  }
+
+  /* total log probability, as in hmm_backward */
+  for (k = 0, i = 0; k < lst_size(hmm->begin_successors); k++) {
+    int succ = lst_get_int(hmm->begin_successors, k);
+    if (succ == END_STATE) continue;
+    cand[i++] = emission_scores[succ][0] + next[succ] +
+      hmm_get_transition_score(hmm, BEGIN_STATE, succ);
+  }
+  logp_bw = hmm_log_sum(cand, i);
+
+  if (fabs(logp_fw - logp_bw) > 1.0)
+    fprintf(stderr, "WARNING: forward and backward algorithms returned different total log\nprobabilities (%f and %f, respectively).\n", logp_fw, logp_bw);
+
+  sfree(ckpt);
+  sfree(cur);
+  sfree(next);
+  sfree(cand);
+  sfree(vals);
+  sfree(blk);
+  return logp_fw;
+}
+
+/* This is the core dynamic programming routine used by hmm_viterbi
+   and hmm_forward.  It is not intended to be called directly.  Each
+   cell is computed as in hmm_max_or_sum, but only allowed transitions
+   are visited (see hmm_transition_table), and scores from the
+   previous column are first gathered into a contiguous array */
+void hmm_do_dp_forward(HMM *hmm, double **emission_scores, int seqlen,
+                       hmm_mode mode, double **full_scores, int **backptr) {
+
+  int i, j, *bp;
+  HMMTransitionTable *tt;
+  double *prev, *cur, *cand;
+
+  if (!(seqlen > 0 && hmm != NULL && hmm->nstates > 0 &&
+	(mode == VITERBI || mode == FORWARD) &&
 	full_scores != NULL && (mode != VITERBI || backptr != NULL)))
     die("ERROR hmm_do_dp_forward: bad params\n");
 
+  tt = hmm_transition_table(hmm);
+
   /* initialization */
   for (i = 0; i < hmm->nstates; i++) {
     full_scores[i][0] = emission_scores[i][0] +
@@ -442,12 +944,44 @@ void hmm_do_dp_forward(HMM *hmm, double **emission_scores, int seqlen,
   }
 
   /* recursion */
-  for (j = 1; j < seqlen; j++) {
-    for (i = 0; i < hmm->nstates; i++) {
-      full_scores[i][j] = emission_scores[i][j] + 
-        hmm_max_or_sum(hmm, full_scores, emission_scores, backptr, 
-                       i, j, mode);
+  if (tt->dense2) {             /* two states, fully connected */
+    double t00 = tt->pred_score[0], t10 = tt->pred_score[1],
+      t01 = tt->pred_score[2], t11 = tt->pred_score[3];
+    double *f0 = full_scores[0], *f1 = full_scores[1],
+      *e0 = emission_scores[0], *e1 = emission_scores[1];
+    for (j = 1; j < seqlen; j++) {
+      double c00 = f0[j-1] + t00, c10 = f1[j-1] + t10,
+        c01 = f0[j-1] + t01, c11 = f1[j-1] + t11;
+      if (mode == VITERBI) {
+        if (c10 > c00) { f0[j] = e0[j] + c10; backptr[0][j] = 1; }
+        else { f0[j] = e0[j] + c00; backptr[0][j] = 0; }
+        if (c11 > c01) { f1[j] = e1[j] + c11; backptr[1][j] = 1; }
+        else { f1[j] = e1[j] + c01; backptr[1][j] = 0; }
+      }
+      else {
+        f0[j] = e0[j] + hmm_log_sum2(c00, c10);
+        f1[j] = e1[j] + hmm_log_sum2(c01, c11);
+      }
+    }
+  }
+  else {
+    prev = smalloc(hmm->nstates * sizeof(double));
+    cur = smalloc(hmm->nstates * sizeof(double));
+    bp = (mode == VITERBI ? smalloc(hmm->nstates * sizeof(int)) : NULL);
+    cand = smalloc(max(tt->max_degree, 1) * sizeof(double));
+    for (j = 1; j < seqlen; j++) {
+      for (i = 0; i < hmm->nstates; i++) prev[i] = full_scores[i][j-1];
+      hmm_dp_forward_column(hmm, tt, emission_scores, j, mode, prev, cur,
+                            bp, cand);
+      for (i = 0; i < hmm->nstates; i++) {
+        full_scores[i][j] = cur[i];
+        if (bp != NULL) backptr[i][j] = bp[i];
+      }
     }
+    sfree(prev);
+    sfree(cur);
+    if (bp != NULL) sfree(bp);
+    sfree(cand);
   }
 
 #ifdef DEBUG
@@ -456,30 +990,55 @@ void hmm_do_dp_forward(HMM *hmm, double **emission_scores, int seqlen,
 }
 
 /* This is the core dynamic programming routine used by hmm_backward.
-   It is not intended to be called directly. */
-void hmm_do_dp_backward(HMM *hmm, double **emission_scores,  int seqlen, 
-                        double **full_scores) {  
+   It is not intended to be called directly.  See hmm_do_dp_forward */
+void hmm_do_dp_backward(HMM *hmm, double **emission_scores,  int seqlen,
+                        double **full_scores) {
 
   int i, j;
+  HMMTransitionTable *tt;
+  double *next, *cur, *tmp, *cand;
 
-  if (!(seqlen > 0 && hmm != NULL && hmm->nstates > 0 && 
+  if (!(seqlen > 0 && hmm != NULL && hmm->nstates > 0 &&
 	full_scores != NULL))
     die("ERROR hmm_do_dp_backward: bad params\n");
 
+  tt = hmm_transition_table(hmm);
+
   /* initialization */
   for (i = 0; i < hmm->nstates; i++)
     full_scores[i][seqlen-1] = hmm_get_transition_score(hmm, i, END_STATE);
                                 /*  will be 0 when no end state */
 
   /* recursion */
-  for (j = seqlen - 2; j >= 0; j--) {
-    checkInterruptN(j, 1000);
-    for (i = 0; i < hmm->nstates; i++) {
-      full_scores[i][j] = 
-        hmm_max_or_sum(hmm, full_scores, emission_scores, NULL, 
-                       i, j, BACKWARD);
+  if (tt->dense2) {             /* two states, fully connected */
+    double t00 = tt->succ_score[0], t01 = tt->succ_score[1],
+      t10 = tt->succ_score[2], t11 = tt->succ_score[3];
+    double *b0 = full_scores[0], *b1 = full_scores[1],
+      *e0 = emission_scores[0], *e1 = emission_scores[1];
+    for (j = seqlen - 2; j >= 0; j--) {
+      double n0 = e0[j+1] + b0[j+1], n1 = e1[j+1] + b1[j+1];
+      checkInterruptN(j, 1000);
+      b0[j] = hmm_log_sum2(n0 + t00, n1 + t01);
+      b1[j] = hmm_log_sum2(n0 + t10, n1 + t11);
     }
   }
+  else {
+    next = smalloc(hmm->nstates * sizeof(double));
+    cur = smalloc(hmm->nstates * sizeof(double));
+    tmp = smalloc(hmm->nstates * sizeof(double));
+    cand = smalloc(max(tt->max_degree, 1) * sizeof(double));
+    for (j = seqlen - 2; j >= 0; j--) {
+      checkInterruptN(j, 1000);
+      for (i = 0; i < hmm->nstates; i++) next[i] = full_scores[i][j+1];
+      hmm_dp_backward_column(hmm, tt, emission_scores, j, seqlen, next, cur,
+                             tmp, cand);
+      for (i = 0; i < hmm->nstates; i++) full_scores[i][j] = cur[i];
+    }
+    sfree(next);
+    sfree(cur);
+    sfree(tmp);
+    sfree(cand);
+  }
 }
 
 /* Finds max or sum of score/transition combination over all previous
@@ -492,13 +1051,8 @@ double hmm_max_or_sum(HMM *hmm, double **full_scores, double **emission_scores,
                       int **backptr, int i, int j, hmm_mode mode) { 
   int k;
   double retval = NEGINFTY;
-  
-  static List *l = NULL;
-
-  if (l == NULL) {
-    l = lst_new_dbl(hmm->nstates);
-    set_static_var((void**)&l);
-  }
+  PhastWorkspace *ws = ws_current();
+  List *l = ws_dbl_list(ws, &ws->hmm_terms, hmm->nstates);
 
   if (mode == VITERBI) {
     int initialized = 0;
@@ -1002,6 +1556,7 @@ void hmm_reset(HMM *hmm) {
     vec_free(hmm->end_transition_scores);
     hmm->end_transition_scores = NULL;
   }
+  hmm_free_transition_table(hmm);
 }
 
 /* Given an HMM, some of whose states represent strand-specific
@@ -1249,5 +1804,8 @@ void hmm_set_transition_score_matrix(HMM *hmm) {
     else
       vec_set(hmm->begin_transition_scores, i, log2(prob));
   }
-}
 
+  /* adjacency lists, also derived from transition scores */
+  hmm_free_transition_table(hmm);
+  hmm_transition_table(hmm);
+}
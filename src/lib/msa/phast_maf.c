@@ -13,6 +13,7 @@
 #include <ctype.h>
 #include <phast_maf_block.h>
 #include <phast_misc.h>
+#include <phast_threads.h>
 
 
 /** Read An Alignment from a MAF file.  The alignment won't be
@@ -499,6 +500,328 @@ MSA *maf_read(FILE *F, FILE *REFSEQF, int tuple_size, char *alphabet,
 		reverse_groups, gap_strip_mode, keep_overlapping, NULL);
 }
 
+/* Hash function for column tuples of a fixed length (FNV-1a) */
+static PHAST_INLINE unsigned int maf_tuple_hash(const char *key, int len) {
+  unsigned int h = 2166136261u;
+  int i;
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char)key[i]) * 16777619u;
+  return h;
+}
+
+/* Find the slot for a column tuple in an open-addressing table of
+   tuple indices (nslots must be a power of two).  Returns the slot
+   holding the tuple, or the empty slot (value -1) where it belongs.
+   Keys are not stored separately; slots refer to ss->col_tuples */
+static int maf_tuple_slot(int *slots, int nslots, MSA_SS *ss,
+                          const char *key, int len) {
+  unsigned int h = maf_tuple_hash(key, len) & (nslots - 1);
+  while (slots[h] != -1 && memcmp(ss->col_tuples[slots[h]], key, len) != 0)
+    h = (h + 1) & (nslots - 1);
+  return h;
+}
+
+/* (Re)build the table of tuple indices with the specified number of
+   slots */
+static int *maf_tuple_slots_new(MSA_SS *ss, int len, int nslots) {
+  int *slots = smalloc(nslots * sizeof(int)), i;
+  for (i = 0; i < nslots; i++) slots[i] = -1;
+  for (i = 0; i < ss->ntuples; i++)
+    slots[maf_tuple_slot(slots, nslots, ss, ss->col_tuples[i], len)] = i;
+  return slots;
+}
+
+/* Read an alignment from a MAF file as a stream of blocks, building
+   the sufficient statistics (tuple size 1) directly from each block
+   as it is read.  Each block is discarded as soon as its columns have
+   been tallied, and distinct column tuples are stored only once (the
+   hash table holds tuple indices rather than copies of keys), so that
+   memory use is proportional to the number of distinct tuples plus,
+   if store_order == TRUE, one tuple index per alignment column.  The
+   result is the same as that of maf_read_cats_subset with
+   REFSEQF == NULL, gff == NULL, gap_strip_mode == NO_STRIP and
+   keep_overlapping == FALSE (and seq_keep == TRUE if seqnames is
+   non-NULL). */
+MSA *maf_read_ss_stream(FILE *F, char *alphabet, int store_order,
+                        List *seqnames) {
+  return maf_read_ss_stream_region(F, NULL, 0, 0, alphabet, store_order,
+                                   seqnames);
+}
+
+/* Like maf_read_ss_stream, but if idx is non-NULL, read only the
+   blocks overlapping the region [start, end) of the reference
+   sequence, seeking directly to each one */
+MSA *maf_read_ss_stream_region(FILE *F, MafIndex *idx, long start, long end,
+                               char *alphabet, int store_order,
+                               List *seqnames) {
+  Hashtable *name_hash = hsh_new(25);
+  MSA *msa;
+  MSA_SS *ss;
+  MafBlock *block;
+  MafSubBlock *sub, *ref;
+  List *block_starts = lst_new_int(1000), *block_ends = lst_new_int(1000),
+    *region = NULL;
+  MafBlockReader *reader = NULL;
+  char conv[256], *key, **rows, **iupac = get_iupac_map();
+  int *slots, nslots = 1 << 16;
+  int i, j, k, c, d, seqidx, refseqlen = -1, refseq_sorted = 1,
+    start_idx, length, end_idx, last_refseqpos = -1, first_idx = -1,
+    last_idx = -1, gap_sum = 0, offset = 0, ncols, tup_idx, slot,
+    ncols_total = 0, block_list_idx, prev_end, next_start, fill_idx = -1,
+    allgap_idx = -1, allgap, region_idx = 0;
+
+  msa = msa_new(NULL, NULL, -1, 0, alphabet);
+  if (seqnames != NULL) {
+    msa->names = smalloc(lst_size(seqnames) * sizeof(char*));
+    for (i = 0; i < lst_size(seqnames); i++) {
+      String *currname = (String*)lst_get_ptr(seqnames, i);
+      hsh_put_int(name_hash, currname->chars, i);
+      msa->names[i] = copy_charstr(currname->chars);
+    }
+    msa->nseqs = lst_size(seqnames);
+    maf_quick_peek(F, &msa->names, name_hash, NULL, &refseqlen, 0);
+  }
+  else
+    maf_quick_peek(F, &msa->names, name_hash, &msa->nseqs, &refseqlen, 1);
+  if (msa->nseqs == 0 || refseqlen == -1)
+    die("ERROR: got invalid maf file\n");
+
+  /* map each character in the MAF to its representation in the
+     alignment, as in maf_read_block; 0 marks an illegal character */
+  for (c = 0; c < 256; c++) {
+    d = msa_alph_has_lowercase(msa) ? c : toupper(c);
+    if (d == '.' && msa->inv_alphabet[(int)'.'] == -1) d = msa->missing[0];
+    if (d != GAP_CHAR && !msa->is_missing[d] && msa->inv_alphabet[d] == -1 &&
+        iupac[d] == NULL)
+      d = isalpha(d) ? 'N' : 0;
+    conv[c] = (char)d;
+  }
+
+  msa->ncats = -1;
+  msa->length = 0;
+  ss_new(msa, 1, nslots / 2, FALSE, store_order);
+  ss = msa->ss;
+  slots = maf_tuple_slots_new(ss, msa->nseqs, nslots);
+  key = smalloc((msa->nseqs + 1) * sizeof(char));
+  rows = smalloc(msa->nseqs * sizeof(char*));
+
+  if (idx != NULL) {
+    region = mafIndex_query(idx, start, end);
+    if (store_order && idx->nblocks > 0) {
+      /* out-of-order blocks are ignored when the whole file is read,
+         so drop them here too, or a block overlapping the start of the
+         region could displace one that a full read would keep */
+      int *in_order = mafIndex_in_order(idx);
+      List *kept = lst_new_int(lst_size(region));
+      long kept_start = -1, kept_end = -1;
+      for (i = 0; i < lst_size(region); i++)
+        if (in_order[lst_get_int(region, i)])
+          lst_push_int(kept, lst_get_int(region, i));
+      lst_free(region);
+      region = kept;
+      for (i = 0; i < idx->nblocks; i++) {
+        if (!in_order[i]) {
+          if (refseq_sorted) {
+            phast_warning("warning: maf_read: MAF file must be sorted with respect to reference" \
+                          " sequence if store_order=TRUE.  Ignoring out-of-order blocks\n");
+            refseq_sorted = 0;
+          }
+          continue;
+        }
+        if (idx->end[i] <= idx->start[i]) continue;   /* empty */
+        if (kept_start == -1) kept_start = idx->start[i];
+        if (idx->end[i] > kept_end) kept_end = idx->end[i];
+      }
+      sfree(in_order);
+
+      /* the alignment spans the part of the region that falls between
+         the start of the first block kept and the end of the last one
+         (as when the whole file is read), plus any blocks extending
+         beyond the region */
+      first_idx = max(start, kept_start);
+      last_idx = min(end, kept_end);
+      for (i = 0; i < lst_size(region); i++)
+        first_idx = min(first_idx, idx->start[lst_get_int(region, i)]);
+      if (first_idx < last_idx) msa->idx_offset = first_idx;
+      else first_idx = last_idx = -1;
+    }
+  }
+  else                          /* blocks may be parsed in parallel */
+    reader = mafBlockReader_new(F, thr_get_nthreads());
+
+  while ((block = region == NULL ? mafBlockReader_next(reader, NULL, NULL) :
+          region_idx < lst_size(region) ? 
+          mafIndex_read_block(idx, F, lst_get_int(region, region_idx++)) :
+          NULL) != NULL) {
+    checkInterrupt();
+
+    /* match rows of the block to sequences; the first sequence in the
+       block is the reference sequence */
+    for (i = 0; i < msa->nseqs; i++) rows[i] = NULL;
+    ref = NULL;
+    for (k = 0; k < lst_size(block->data); k++) {
+      sub = (MafSubBlock*)lst_get_ptr(block->data, k);
+      if (sub->lineType[0] != 's') continue;
+      if (ref == NULL) {
+        ref = sub;
+        if (ref->strand != '+')
+          die("ERROR: bad integers or strand in MAF (strand must be + for reference sequence) --\n\t\"%s\"\n", ref->src->chars);
+      }
+      seqidx = hsh_get_int(name_hash, sub->specName->chars);
+      if (seqidx == -1) {
+        if (seqnames != NULL) continue;
+        /* new species; extend existing tuples with missing data */
+        seqidx = msa->nseqs;
+        msa->names = srealloc(msa->names, (seqidx + 1) * sizeof(char*));
+        msa->names[seqidx] = copy_charstr(sub->specName->chars);
+        hsh_put_int(name_hash, sub->specName->chars, seqidx);
+        msa_add_seq_ss(msa, seqidx + 1);
+        msa->nseqs++;
+        key = srealloc(key, (msa->nseqs + 1) * sizeof(char));
+        rows = srealloc(rows, msa->nseqs * sizeof(char*));
+        rows[seqidx] = NULL;
+        sfree(slots);
+        slots = maf_tuple_slots_new(ss, msa->nseqs, nslots);
+      }
+      rows[seqidx] = sub->seq->chars;
+    }
+    if (ref == NULL) {
+      mafBlock_free(block);
+      continue;
+    }
+    start_idx = (int)ref->start;
+    length = ref->size;
+    end_idx = start_idx + length - 1;
+    ncols = block->seqlen;
+
+    /* skip out-of-order blocks if storing order, redundant ones
+       otherwise, and empty ones */
+    if (store_order && start_idx <= last_refseqpos) {
+      if (refseq_sorted) {
+        phast_warning("warning: maf_read: MAF file must be sorted with respect to reference" \
+                      " sequence if store_order=TRUE.  Ignoring out-of-order blocks\n");
+        refseq_sorted = 0;
+      }
+      mafBlock_free(block);
+      continue;
+    }
+    if (start_idx <= last_refseqpos) {
+      block_list_idx = lst_bsearch_int(block_starts, start_idx);
+      prev_end = block_list_idx >= 0 ? lst_get_int(block_ends, block_list_idx) : -1;
+      next_start = block_list_idx + 1 < lst_size(block_starts) ?
+        lst_get_int(block_starts, block_list_idx + 1) : end_idx + 1;
+      if (prev_end >= start_idx || next_start <= end_idx) {
+        mafBlock_free(block);
+        continue;
+      }
+    }
+    if (length < 1) {
+      mafBlock_free(block);
+      continue;
+    }
+    lst_push_int(block_starts, start_idx);
+    lst_push_int(block_ends, end_idx);
+    last_refseqpos = end_idx;
+
+    if (store_order) {
+      if (first_idx == -1) {
+        first_idx = start_idx;
+        msa->idx_offset = first_idx;
+      }
+      /* alignment columns preceding this block: reference positions
+         plus gaps in the reference sequence in earlier blocks */
+      offset = start_idx - first_idx + gap_sum;
+      msa->length = offset + ncols;
+      ss_realloc(msa, 1, ss->alloc_ntuples, FALSE, TRUE);
+      for (j = 0; j < ncols; j++)
+        if (ref->seq->chars[j] == GAP_CHAR) gap_sum++;
+    }
+    if (start_idx + length > last_idx)
+      last_idx = start_idx + length;
+
+    /* tally column tuples */
+    for (j = 0; j < ncols; j++) {
+      for (i = 0, allgap = TRUE; i < msa->nseqs; i++) {
+        if (rows[i] == NULL) key[i] = msa->missing[0];
+        else if ((key[i] = conv[(unsigned char)rows[i][j]]) == 0)
+          die("ERROR: unrecognized character in sequence in MAF block ('%c')\n",
+              rows[i][j]);
+        else if (key[i] != GAP_CHAR && key[i] != msa->missing[0])
+          allgap = FALSE;
+      }
+      /* as in ss_lookup_coltuple, all columns consisting only of gaps
+         and missing data are represented by a single tuple */
+      if (allgap && allgap_idx != -1) {
+        tup_idx = allgap_idx;
+        slot = -1;
+      }
+      else {
+        slot = maf_tuple_slot(slots, nslots, ss, key, msa->nseqs);
+        tup_idx = slots[slot];
+      }
+      if (tup_idx == -1) {
+        tup_idx = ss->ntuples++;
+        if (ss->ntuples > ss->alloc_ntuples)
+          ss_realloc(msa, 1, ss->ntuples, FALSE, store_order);
+        ss->col_tuples[tup_idx] = smalloc((msa->nseqs + 1) * sizeof(char));
+        memcpy(ss->col_tuples[tup_idx], key, msa->nseqs);
+        ss->col_tuples[tup_idx][msa->nseqs] = '\0';
+        slots[slot] = tup_idx;
+        if (allgap) allgap_idx = tup_idx;
+        if (2 * ss->ntuples > nslots) {
+          sfree(slots);
+          nslots *= 2;
+          slots = maf_tuple_slots_new(ss, msa->nseqs, nslots);
+        }
+      }
+      ss->counts[tup_idx]++;
+      if (store_order) ss->tuple_idx[offset + j] = tup_idx;
+    }
+    ncols_total += ncols;
+    mafBlock_free(block);
+  }
+
+  if (store_order) {
+    /* positions of the reference sequence not covered by any block
+       are represented as missing data */
+    msa->length = first_idx == -1 ? 0 : last_idx - first_idx + gap_sum;
+    ss_realloc(msa, 1, ss->alloc_ntuples, FALSE, TRUE);
+    for (j = 0; j < msa->length; j++) {
+      if (ss->tuple_idx[j] != -1) continue;
+      if (fill_idx == -1) {
+        key[0] = msa->missing[1];
+        for (i = 1; i < msa->nseqs; i++) key[i] = msa->missing[0];
+        slot = maf_tuple_slot(slots, nslots, ss, key, msa->nseqs);
+        if ((fill_idx = slots[slot]) == -1) {
+          fill_idx = ss->ntuples++;
+          if (ss->ntuples > ss->alloc_ntuples)
+            ss_realloc(msa, 1, ss->ntuples, FALSE, store_order);
+          ss->col_tuples[fill_idx] = smalloc((msa->nseqs + 1) * sizeof(char));
+          memcpy(ss->col_tuples[fill_idx], key, msa->nseqs);
+          ss->col_tuples[fill_idx][msa->nseqs] = '\0';
+        }
+      }
+      ss->tuple_idx[j] = fill_idx;
+      ss->counts[fill_idx]++;
+    }
+    ss->alloc_len = max(msa->length, 1);
+    ss->tuple_idx = srealloc(ss->tuple_idx, ss->alloc_len * sizeof(int));
+  }
+  else msa->length = ncols_total;
+  msa->alloc_len = msa->length;
+  ss_compact(ss);
+
+  sfree(slots);
+  sfree(key);
+  sfree(rows);
+  hsh_free(name_hash);
+  lst_free(block_starts);
+  lst_free(block_ends);
+  if (region != NULL) lst_free(region);
+  if (reader != NULL) mafBlockReader_free(reader);
+  return msa;
+}
+
 /* Read An Alignment from a MAF file which is not necessarily sorted wrt the
     reference sequence.  The alignment won't be
    constructed explicitly; instead, a sufficient-statistics
@@ -12,8 +12,15 @@
 #include <phast_msa.h>
 #include <phast_maf_block.h>
 #include <phast_hashtable.h>
+#include <phast_threads.h>
 #include <ctype.h>
 #include <assert.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef SKIP_PTHREADS
+#include <pthread.h>
+#endif
 
 MafBlock *mafBlock_new() {
   MafBlock *block = smalloc(sizeof(MafBlock));
@@ -256,23 +263,26 @@ void mafBlock_add_qLine(String *line, MafSubBlock *sub) {
 }
 
 
-//read next block in mfile and return MafBlock object or NULL if EOF.
-//specHash and numSpec are not used, but if specHash is not NULL,
-//it should be initialized, and any new species encountered will be added
-//to the hash, with numSpec increased accordingly.  If specHash is NULL,
-//numSpec will not be used or modified.
-MafBlock *mafBlock_read_next(FILE *mfile, Hashtable *specHash, int *numSpec) {
+//function that reads the next line of a MAF into a String, returning
+//EOF at end of input (see mafBlock_read_lines)
+typedef int (*maf_line_fun)(String *line, void *src);
+
+static int mafBlock_file_readline(String *line, void *src) {
+  return str_readline(line, (FILE*)src);
+}
+
+//parse the next block from a source of lines.  Used both for files
+//(mafBlock_read_next) and for chunks of text held in memory
+//(MafBlockReader)
+static MafBlock *mafBlock_read_lines(maf_line_fun readline, void *src,
+				     Hashtable *specHash, int *numSpec) {
   int i;
   char firstchar;
   String *currLine = str_new(1000);
   MafBlock *block=NULL;
   MafSubBlock *sub=NULL;
 
-  if (specHash != NULL && numSpec==NULL) 
-    die("ERROR: mafBlock_read_next: numSpec cannot be NULL "
-	"if specHash is not NULL\n");
-
-  while (EOF != str_readline(currLine, mfile)) {
+  while (EOF != readline(currLine, src)) {
     str_trim(currLine);
     if (currLine->length==0) {  //if blank line, it is either first or last line
       if (block == NULL) continue;
@@ -326,6 +336,19 @@ MafBlock *mafBlock_read_next(FILE *mfile, Hashtable *specHash, int *numSpec) {
   return block;
 }
 
+//read next block in mfile and return MafBlock object or NULL if EOF.
+//specHash and numSpec are not used, but if specHash is not NULL,
+//it should be initialized, and any new species encountered will be added
+//to the hash, with numSpec increased accordingly.  If specHash is NULL,
+//numSpec will not be used or modified.
+MafBlock *mafBlock_read_next(FILE *mfile, Hashtable *specHash, int *numSpec) {
+  if (specHash != NULL && numSpec==NULL) 
+    die("ERROR: mafBlock_read_next: numSpec cannot be NULL "
+	"if specHash is not NULL\n");
+  return mafBlock_read_lines(mafBlock_file_readline, (void*)mfile,
+			     specHash, numSpec);
+}
+
 //returns 1 if the block entirely consists of gaps.
 int mafBlock_all_gaps(MafBlock *block) {
   MafSubBlock *sub;
@@ -961,3 +984,573 @@ void mafBlock_mask_bases(MafBlock *block, int cutoff, FILE *outfile) {
 			  FILE *mfile) {
   
 			  }*/
+
+
+/* Index of the blocks of a MAF file by reference coordinates.
+   Entries are kept sorted by start, with maxend[i] the largest end
+   among entries 0..i, so that the entries overlapping a region can be
+   found by binary search even when blocks overlap */
+
+static MafIndex *mafIndex_new(int nblocks) {
+  MafIndex *idx = smalloc(sizeof(MafIndex));
+  idx->refseq = NULL;
+  idx->fsize = -1;
+  idx->nblocks = 0;
+  idx->alloc_nblocks = max(nblocks, 1);
+  idx->start = smalloc(idx->alloc_nblocks * sizeof(long));
+  idx->end = smalloc(idx->alloc_nblocks * sizeof(long));
+  idx->offset = smalloc(idx->alloc_nblocks * sizeof(long));
+  idx->maxend = NULL;
+  return idx;
+}
+
+static void mafIndex_add(MafIndex *idx, long start, long end, long offset) {
+  if (idx->nblocks == idx->alloc_nblocks) {
+    idx->alloc_nblocks *= 2;
+    idx->start = srealloc(idx->start, idx->alloc_nblocks * sizeof(long));
+    idx->end = srealloc(idx->end, idx->alloc_nblocks * sizeof(long));
+    idx->offset = srealloc(idx->offset, idx->alloc_nblocks * sizeof(long));
+  }
+  idx->start[idx->nblocks] = start;
+  idx->end[idx->nblocks] = end;
+  idx->offset[idx->nblocks++] = offset;
+}
+
+/* used for sorting entries by start, then by file offset */
+struct maf_index_entry {
+  long start, end, offset;
+};
+
+static int mafIndex_entry_compare(const void *ptr1, const void *ptr2) {
+  const struct maf_index_entry *e1 = ptr1, *e2 = ptr2;
+  if (e1->start != e2->start) return e1->start < e2->start ? -1 : 1;
+  if (e1->offset != e2->offset) return e1->offset < e2->offset ? -1 : 1;
+  return 0;
+}
+
+static int mafIndex_offset_compare(const void *ptr1, const void *ptr2) {
+  const struct maf_index_entry *e1 = ptr1, *e2 = ptr2;
+  if (e1->offset != e2->offset) return e1->offset < e2->offset ? -1 : 1;
+  return 0;
+}
+
+/* sort entries and compute maxend */
+static void mafIndex_finish(MafIndex *idx) {
+  struct maf_index_entry *e = smalloc(max(idx->nblocks, 1) * 
+                                      sizeof(struct maf_index_entry));
+  int i;
+  for (i = 0; i < idx->nblocks; i++) {
+    e[i].start = idx->start[i];
+    e[i].end = idx->end[i];
+    e[i].offset = idx->offset[i];
+  }
+  qsort(e, idx->nblocks, sizeof(struct maf_index_entry), 
+        mafIndex_entry_compare);
+  idx->maxend = srealloc(idx->maxend, idx->alloc_nblocks * sizeof(long));
+  for (i = 0; i < idx->nblocks; i++) {
+    idx->start[i] = e[i].start;
+    idx->end[i] = e[i].end;
+    idx->offset[i] = e[i].offset;
+    idx->maxend[i] = (i == 0 || e[i].end > idx->maxend[i-1]) ? 
+      e[i].end : idx->maxend[i-1];
+  }
+  sfree(e);
+}
+
+/* process the beginning of a line of a MAF file while building an index */
+static void mafIndex_scan_line(MafIndex *idx, char *line, long line_offset,
+                               long *block_offset, int *need_ref) {
+  char src[MAF_INDEX_LINE_PREFIX];
+  long start, size;
+  if (line[0] == 'a') {
+    *block_offset = line_offset;
+    *need_ref = TRUE;
+  }
+  else if (line[0] == 's' && *need_ref) {
+    if (sscanf(line, "s %s %ld %ld", src, &start, &size) != 3)
+      die("ERROR: bad line in MAF file --\n\t\"%s\"\n", line);
+    if (idx->refseq == NULL) {
+      idx->refseq = str_new_charstr(src);
+      str_shortest_root(idx->refseq, '.');
+    }
+    mafIndex_add(idx, start, start + size, *block_offset);
+    *need_ref = FALSE;
+  }
+}
+
+MafIndex *mafIndex_build(FILE *mfile) {
+  MafIndex *idx = mafIndex_new(10000);
+  char buf[65536], line[MAF_INDEX_LINE_PREFIX];
+  long offset, line_offset, block_offset = -1;
+  size_t nread, i;
+  int linelen = 0, need_ref = FALSE;
+
+  if ((offset = ftell(mfile)) < 0)
+    die("ERROR: mafIndex_build requires a seekable MAF file\n");
+  line_offset = offset;
+
+  /* scan the file in large chunks; only the beginning of each line is
+     retained, which is enough to recognize 'a' lines and to parse the
+     coordinates of the first 's' line of each block */
+  while ((nread = fread(buf, 1, sizeof(buf), mfile)) > 0) {
+    for (i = 0; i < nread; i++) {
+      if (buf[i] != '\n') {
+        if (linelen < MAF_INDEX_LINE_PREFIX - 1) line[linelen++] = buf[i];
+        continue;
+      }
+      line[linelen] = '\0';
+      mafIndex_scan_line(idx, line, line_offset, &block_offset, &need_ref);
+      linelen = 0;
+      line_offset = offset + (long)i + 1;
+    }
+    offset += (long)nread;
+  }
+  if (linelen > 0) {
+    line[linelen] = '\0';
+    mafIndex_scan_line(idx, line, line_offset, &block_offset, &need_ref);
+  }
+
+  if (idx->refseq == NULL) idx->refseq = str_new_charstr("");
+  mafIndex_finish(idx);
+  return idx;
+}
+
+void mafIndex_write(FILE *outfile, MafIndex *idx) {
+  int i;
+  fprintf(outfile, "##maf-index version=%d size=%ld refseq=%s\n",
+          MAF_INDEX_VERSION, idx->fsize, idx->refseq->chars);
+  for (i = 0; i < idx->nblocks; i++)
+    fprintf(outfile, "%ld\t%ld\t%ld\n", idx->start[i], idx->end[i],
+            idx->offset[i]);
+  fprintf(outfile, "##end nblocks=%d\n", idx->nblocks);
+}
+
+MafIndex *mafIndex_read(FILE *infile) {
+  MafIndex *idx;
+  String *line = str_new(STR_MED_LEN);
+  char refseq[STR_MED_LEN];
+  int version, nblocks = -1;
+  long fsize, start, end, offset;
+
+  refseq[0] = '\0';
+  if (str_readline(line, infile) == EOF ||
+      sscanf(line->chars, "##maf-index version=%d size=%ld refseq=%s",
+             &version, &fsize, refseq) < 2 ||
+      version != MAF_INDEX_VERSION) {
+    str_free(line);
+    return NULL;
+  }
+  idx = mafIndex_new(10000);
+  idx->fsize = fsize;
+  idx->refseq = str_new_charstr(refseq);
+  while (str_readline(line, infile) != EOF) {
+    if (nblocks >= 0 ||         /* nothing may follow the trailer */
+        (sscanf(line->chars, "##end nblocks=%d", &nblocks) != 1 &&
+         sscanf(line->chars, "%ld %ld %ld", &start, &end, &offset) != 3)) {
+      str_free(line);
+      mafIndex_free(idx);
+      return NULL;
+    }
+    if (nblocks < 0) mafIndex_add(idx, start, end, offset);
+  }
+  str_free(line);
+  /* a missing trailer or wrong count means the file was truncated */
+  if (nblocks != idx->nblocks) {
+    mafIndex_free(idx);
+    return NULL;
+  }
+  mafIndex_finish(idx);
+  return idx;
+}
+
+MafIndex *mafIndex_open(char *maf_fname, int save) {
+  MafIndex *idx = NULL;
+  char *idx_fname, *tmpfname;
+  struct stat maf_st, idx_st;
+  FILE *F;
+
+  if (strcmp(maf_fname, "-") == 0 || stat(maf_fname, &maf_st) != 0 ||
+      !S_ISREG(maf_st.st_mode))
+    return NULL;
+
+  idx_fname = smalloc((strlen(maf_fname) + strlen(MAF_INDEX_SUFFIX) + 1) * 
+                      sizeof(char));
+  sprintf(idx_fname, "%s%s", maf_fname, MAF_INDEX_SUFFIX);
+
+  /* use existing index if it is up to date */
+  if (stat(idx_fname, &idx_st) == 0 && idx_st.st_mtime >= maf_st.st_mtime &&
+      (F = fopen(idx_fname, "r")) != NULL) {
+    idx = mafIndex_read(F);
+    fclose(F);
+    if (idx != NULL && idx->fsize != (long)maf_st.st_size) {
+      mafIndex_free(idx);
+      idx = NULL;
+    }
+  }
+
+  if (idx == NULL) {
+    F = phast_fopen(maf_fname, "r");
+    idx = mafIndex_build(F);
+    phast_fclose(F);
+    idx->fsize = (long)maf_st.st_size;
+    if (save) {                 /* failure to save is not an error */
+      /* write to a temporary file and rename it, so that other
+         processes never see a partially written index */
+      tmpfname = smalloc((strlen(idx_fname) + 30) * sizeof(char));
+      sprintf(tmpfname, "%s.%d.tmp", idx_fname, (int)getpid());
+      if ((F = fopen(tmpfname, "w")) != NULL) {
+        mafIndex_write(F, idx);
+        if (ferror(F) || fclose(F) != 0 || rename(tmpfname, idx_fname) != 0)
+          remove(tmpfname);
+      }
+      sfree(tmpfname);
+    }
+  }
+  sfree(idx_fname);
+  return idx;
+}
+
+List *mafIndex_query(MafIndex *idx, long start, long end) {
+  List *rv = lst_new_int(10);
+  struct maf_index_entry *e;
+  int lo = 0, hi = idx->nblocks, mid, i, n;
+
+  /* first entry whose maxend exceeds start */
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (idx->maxend[mid] > start) hi = mid;
+    else lo = mid + 1;
+  }
+  for (i = lo, n = 0; i < idx->nblocks && idx->start[i] < end; i++)
+    if (idx->end[i] > start) n++;
+  if (n == 0) return rv;
+
+  /* return in file order (start is used to hold the entry index) */
+  e = smalloc(n * sizeof(struct maf_index_entry));
+  for (i = lo, n = 0; i < idx->nblocks && idx->start[i] < end; i++) {
+    if (idx->end[i] <= start) continue;
+    e[n].start = i;
+    e[n++].offset = idx->offset[i];
+  }
+  qsort(e, n, sizeof(struct maf_index_entry), mafIndex_offset_compare);
+  for (i = 0; i < n; i++) lst_push_int(rv, (int)e[i].start);
+  sfree(e);
+  return rv;
+}
+
+int *mafIndex_in_order(MafIndex *idx) {
+  struct maf_index_entry *e = smalloc(max(idx->nblocks, 1) * 
+                                      sizeof(struct maf_index_entry));
+  int *in_order = smalloc(max(idx->nblocks, 1) * sizeof(int)), i;
+  long last_end = -1;
+
+  /* visit entries in file order (start is used to hold the entry
+     index) */
+  for (i = 0; i < idx->nblocks; i++) {
+    e[i].start = i;
+    e[i].offset = idx->offset[i];
+  }
+  qsort(e, idx->nblocks, sizeof(struct maf_index_entry), 
+        mafIndex_offset_compare);
+  for (i = 0; i < idx->nblocks; i++) {
+    int j = (int)e[i].start;
+    in_order[j] = (idx->start[j] >= last_end);
+    /* empty blocks are skipped by readers, so they do not affect
+       later ones */
+    if (in_order[j] && idx->end[j] > idx->start[j])
+      last_end = idx->end[j];
+  }
+  sfree(e);
+  return in_order;
+}
+
+MafBlock *mafIndex_read_block(MafIndex *idx, FILE *mfile, int i) {
+  if (i < 0 || i >= idx->nblocks)
+    die("ERROR: mafIndex_read_block: bad block index %i\n", i);
+  if (fseek(mfile, idx->offset[i], SEEK_SET) != 0)
+    die("ERROR: mafIndex_read_block: cannot seek to offset %ld in MAF file\n",
+        idx->offset[i]);
+  return mafBlock_read_next(mfile, NULL, NULL);
+}
+
+void mafIndex_free(MafIndex *idx) {
+  if (idx->refseq != NULL) str_free(idx->refseq);
+  sfree(idx->start);
+  sfree(idx->end);
+  sfree(idx->offset);
+  if (idx->maxend != NULL) sfree(idx->maxend);
+  sfree(idx);
+}
+
+/* Parallel reading of MAF blocks.  The file is split into chunks of
+   about MAF_READER_CHUNK_SIZE bytes, each ending just before a line
+   that begins with 'a', so that every chunk holds whole blocks.
+   Chunks are kept in a list in file order; each worker takes the
+   first chunk not yet claimed and parses all of its blocks, and
+   mafBlockReader_next returns the blocks of the first chunk once it
+   has been parsed.  The reader thread stops reading when
+   2 * nthreads chunks are waiting to be consumed. */
+
+/* text of a chunk, read line by line by mafBlock_read_lines */
+struct maf_text {
+  char *buf;
+  long len, pos;
+};
+
+static int maf_text_readline(String *line, void *src) {
+  struct maf_text *text = (struct maf_text*)src;
+  char *nl;
+  long end;
+
+  if (text->pos >= text->len) return EOF;
+  nl = memchr(text->buf + text->pos, '\n', text->len - text->pos);
+  end = (nl == NULL ? text->len : nl - text->buf + 1);
+  str_clear(line);
+  str_nappend_charstr(line, text->buf + text->pos, (int)(end - text->pos));
+  text->pos = end;
+  return 0;
+}
+
+struct maf_chunk {
+  struct maf_text text;
+  List *blocks;                 /* parsed blocks; NULL until parsed */
+  int next_block;               /* next block to be returned */
+  struct maf_chunk *next;
+};
+
+struct maf_block_reader {
+  FILE *mfile;
+  int nthreads;
+#ifndef SKIP_PTHREADS
+  struct maf_chunk *head, *tail, /* chunks not yet consumed */
+    *unparsed;                  /* first chunk not yet claimed by a worker */
+  int nchunks, max_chunks, eof, stop;
+  char *carry;                  /* text following the last chunk read */
+  long carry_len, carry_alloc;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;       /* signalled on any change to the above */
+  pthread_t reader, *workers;
+#endif
+};
+
+#ifndef SKIP_PTHREADS
+
+/* read the next chunk of the file (called only by the reader thread).
+   Returns NULL at end of file */
+static struct maf_chunk *mafBlockReader_read_chunk(MafBlockReader *r) {
+  struct maf_chunk *chunk;
+  long alloc = max(MAF_READER_CHUNK_SIZE, 2 * r->carry_len), len, p,
+    split = -1;
+  size_t n;
+  int eof = FALSE;
+  char *buf = smalloc(alloc * sizeof(char));
+
+  memcpy(buf, r->carry, r->carry_len);
+  len = r->carry_len;
+  while (1) {
+    n = fread(buf + len, sizeof(char), alloc - len, r->mfile);
+    len += (long)n;
+    if (len < alloc) eof = TRUE;
+    /* split before the last line beginning with 'a' */
+    for (p = len - 1; p > 0; p--)
+      if (buf[p] == 'a' && buf[p-1] == '\n') break;
+    if (p > 0) split = p;
+    if (split > 0 || eof) break;
+    alloc *= 2;          /* block longer than buffer; read more */
+    buf = srealloc(buf, alloc * sizeof(char));
+  }
+
+  if (eof) split = len;  /* last chunk gets the rest of the file */
+  r->carry_len = len - split;
+  if (r->carry_len > r->carry_alloc) {
+    r->carry_alloc = r->carry_len;
+    r->carry = srealloc(r->carry, r->carry_alloc * sizeof(char));
+  }
+  memcpy(r->carry, buf + split, r->carry_len);
+
+  if (split == 0) {
+    sfree(buf);
+    return NULL;
+  }
+  chunk = smalloc(sizeof(struct maf_chunk));
+  chunk->text.buf = buf;
+  chunk->text.len = split;
+  chunk->text.pos = 0;
+  chunk->blocks = NULL;
+  chunk->next_block = 0;
+  chunk->next = NULL;
+  return chunk;
+}
+
+static void *mafBlockReader_reader_main(void *arg) {
+  MafBlockReader *r = (MafBlockReader*)arg;
+  struct maf_chunk *chunk;
+  int stop;
+
+  do {
+    pthread_mutex_lock(&r->lock);
+    while (r->nchunks >= r->max_chunks && !r->stop)
+      pthread_cond_wait(&r->changed, &r->lock);
+    stop = r->stop;
+    pthread_mutex_unlock(&r->lock);
+    if (stop) break;
+
+    chunk = mafBlockReader_read_chunk(r);
+
+    pthread_mutex_lock(&r->lock);
+    if (chunk == NULL) r->eof = TRUE;
+    else {
+      if (r->tail == NULL) r->head = chunk;
+      else r->tail->next = chunk;
+      r->tail = chunk;
+      if (r->unparsed == NULL) r->unparsed = chunk;
+      r->nchunks++;
+    }
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+  } while (chunk != NULL);
+  return NULL;
+}
+
+static void *mafBlockReader_worker_main(void *arg) {
+  MafBlockReader *r = (MafBlockReader*)arg;
+  struct maf_chunk *chunk;
+  MafBlock *block;
+  List *blocks;
+
+  while (1) {
+    pthread_mutex_lock(&r->lock);
+    while (r->unparsed == NULL && !r->eof && !r->stop)
+      pthread_cond_wait(&r->changed, &r->lock);
+    chunk = r->stop ? NULL : r->unparsed;
+    if (chunk != NULL) r->unparsed = chunk->next;
+    pthread_mutex_unlock(&r->lock);
+    if (chunk == NULL) break;
+
+    blocks = lst_new_ptr(1000);
+    while ((block = mafBlock_read_lines(maf_text_readline, &chunk->text,
+					NULL, NULL)) != NULL)
+      lst_push_ptr(blocks, block);
+    sfree(chunk->text.buf);
+    chunk->text.buf = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    chunk->blocks = blocks;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+  }
+  return NULL;
+}
+
+#endif
+
+MafBlockReader *mafBlockReader_new(FILE *mfile, int nthreads) {
+  MafBlockReader *r = smalloc(sizeof(MafBlockReader));
+  r->mfile = mfile;
+#ifdef SKIP_PTHREADS
+  r->nthreads = 1;
+#else
+  r->nthreads = nthreads < 1 ? 1 : nthreads;
+  if (r->nthreads > 1) {
+    int i;
+    r->head = r->tail = r->unparsed = NULL;
+    r->nchunks = 0;
+    r->max_chunks = 2 * r->nthreads;
+    r->eof = r->stop = FALSE;
+    r->carry = NULL;
+    r->carry_len = r->carry_alloc = 0;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->changed, NULL);
+    if (pthread_create(&r->reader, NULL, mafBlockReader_reader_main, r) != 0)
+      die("ERROR mafBlockReader_new: unable to create thread\n");
+    r->workers = smalloc(r->nthreads * sizeof(pthread_t));
+    for (i = 0; i < r->nthreads; i++)
+      if (pthread_create(&r->workers[i], NULL, mafBlockReader_worker_main,
+			 r) != 0)
+	die("ERROR mafBlockReader_new: unable to create thread\n");
+  }
+#endif
+  return r;
+}
+
+MafBlock *mafBlockReader_next(MafBlockReader *r, Hashtable *specHash,
+			      int *numSpec) {
+#ifndef SKIP_PTHREADS
+  MafBlock *block = NULL;
+  MafSubBlock *sub;
+  int i;
+#endif
+
+  if (r->nthreads <= 1) return mafBlock_read_next(r->mfile, specHash, numSpec);
+
+#ifndef SKIP_PTHREADS
+  if (specHash != NULL && numSpec==NULL) 
+    die("ERROR: mafBlockReader_next: numSpec cannot be NULL "
+	"if specHash is not NULL\n");
+
+  pthread_mutex_lock(&r->lock);
+  while (1) {
+    struct maf_chunk *chunk;
+    while (r->head == NULL ? !r->eof : r->head->blocks == NULL)
+      pthread_cond_wait(&r->changed, &r->lock);
+    if ((chunk = r->head) == NULL) break;
+    if (chunk->next_block < lst_size(chunk->blocks)) {
+      block = (MafBlock*)lst_get_ptr(chunk->blocks, chunk->next_block++);
+      break;
+    }
+    /* all blocks in first chunk returned; move on to the next */
+    r->head = chunk->next;
+    if (r->head == NULL) r->tail = NULL;
+    r->nchunks--;
+    pthread_cond_broadcast(&r->changed);
+    lst_free(chunk->blocks);
+    sfree(chunk);
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  /* new species are recorded in file order, as by mafBlock_read_next */
+  if (block != NULL && specHash != NULL) {
+    for (i = 0; i < lst_size(block->data); i++) {
+      sub = (MafSubBlock*)lst_get_ptr(block->data, i);
+      if (-1 == hsh_get_int(specHash, sub->specName->chars)) {
+	hsh_put_int(specHash, sub->specName->chars, *numSpec);
+	(*numSpec)++;
+      }
+    }
+  }
+  return block;
+#else
+  return NULL;
+#endif
+}
+
+void mafBlockReader_free(MafBlockReader *r) {
+#ifndef SKIP_PTHREADS
+  if (r->nthreads > 1) {
+    struct maf_chunk *chunk;
+    int i;
+    pthread_mutex_lock(&r->lock);
+    r->stop = TRUE;
+    pthread_cond_broadcast(&r->changed);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->reader, NULL);
+    for (i = 0; i < r->nthreads; i++)
+      pthread_join(r->workers[i], NULL);
+    while ((chunk = r->head) != NULL) {
+      r->head = chunk->next;
+      if (chunk->blocks != NULL) {
+	for (i = chunk->next_block; i < lst_size(chunk->blocks); i++)
+	  mafBlock_free((MafBlock*)lst_get_ptr(chunk->blocks, i));
+	lst_free(chunk->blocks);
+      }
+      if (chunk->text.buf != NULL) sfree(chunk->text.buf);
+      sfree(chunk);
+    }
+    if (r->carry != NULL) sfree(r->carry);
+    sfree(r->workers);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->changed);
+  }
+#endif
+  sfree(r);
+}
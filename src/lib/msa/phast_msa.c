@@ -96,14 +96,40 @@ MSA *msa_new(char **seqs, char **names, int nseqs, int length, char *alphabet) {
   return msa;
 }
 
+/* Build a table mapping each character of an alignment file to its
+   representation in msa.  Characters are upcased unless there are
+   lowercase characters in the alphabet, '.' is interpreted as missing
+   data unless it is in the alphabet (maybe no longer necessary), and
+   'N' is used in place of unrecognized alphabetical characters.  If
+   strict, any other unrecognized character maps to 0; otherwise it is
+   kept */
+static void msa_char_conv_table(MSA *msa, char *conv, int strict) {
+  int c, d, do_toupper = !msa_alph_has_lowercase(msa);
+  char **iupac = get_iupac_map();
+
+  for (c = 0; c < NCHARS; c++) {
+    d = do_toupper ? toupper(c) : c;
+    if (d == '.' && msa->inv_alphabet[(int)'.'] == -1) 
+      d = msa->missing[0];
+    else if (strict && d != GAP_CHAR && !msa->is_missing[d] &&
+             msa->inv_alphabet[d] == -1 && iupac[d] == NULL)
+      d = isalpha(d) ? 'N' : 0;
+    if (!strict && isalpha(d) && msa->inv_alphabet[d] == -1 && 
+        iupac[d] == NULL) 
+      d = 'N';
+    conv[c] = (char)d;
+  }
+}
+
 /* Creates a new alignment from the contents of the specified file,
    which is assumed to use the specified format.  If "alphabet" is
    NULL, default alphabet for DNA will be used.  This routine will
    abort if the sequence contains a character not in the alphabet. */
 MSA *msa_new_from_file_define_format(FILE *F, msa_format_type format, char *alphabet) {
-  int i, j, k=-1, nseqs=-1, len=-1, do_toupper;
+  int i, j, k=-1, nseqs=-1, len=-1;
   MSA *msa;
-  String *tmpstr;
+  LineBuffer *lb;
+  char conv[NCHARS], *line;
   
   if (format == UNKNOWN_FORMAT)
     die("unknown alignment format\n");
@@ -114,85 +140,88 @@ MSA *msa_new_from_file_define_format(FILE *F, msa_format_type format, char *alph
     return (msa_read_fasta(F, alphabet));
   else if (format == LAV)
     return la_to_msa(la_read_lav(F, 1), 0);
-  else if (format == SS) 
+  else if (format == SS || format == BSS) 
     return ss_read(F, alphabet);
 
   //format must be PHYLIP or MPM
   if (fscanf(F, "%d %d", &nseqs, &len) <= 0) 
     die("ERROR: PHYLIP or MPM file missing initial length declaration.\n");
   
-  tmpstr = str_new(STR_MED_LEN);
-
   /* we'll initialize the MSA first, so that we can use its
    * "inv_alphabet" */
   msa = msa_new(NULL, NULL, nseqs, len, alphabet);
   msa->names = (char**)smalloc(nseqs * sizeof(char*));
   msa->seqs = (char**)smalloc(nseqs * sizeof(char*));
+  msa_char_conv_table(msa, conv, TRUE);
 
-  /* upcase chars unless there are lowercase characters in the alphabet */
-  do_toupper = !msa_alph_has_lowercase(msa);    
-
-  for (i = 0; i < nseqs; i++) {
-    msa->names[i] = (char*)smalloc(STR_MED_LEN * sizeof(char));
+  for (i = 0; i < nseqs; i++) 
     msa->seqs[i] = (char*)smalloc((len + 1) * sizeof(char));
-  }
+
+  /* the rest of the file is parsed directly from a large read buffer
+     (the rest of the line with the length declaration is read
+     first) */
+  lb = lb_new(F);
+  line = lb_readline(lb, NULL);
 
   if (format == MPM) {
     for (i = 0; i < nseqs; i++) {
-      do { str_readline(tmpstr, F); str_trim(tmpstr); } 
-      while (tmpstr->length == 0);
-      strcpy(msa->names[i], tmpstr->chars);
+      for (;; line = NULL) {
+        if (line == NULL && (line = lb_readline(lb, NULL)) == NULL)
+          die("ERROR reading alignment, unable to read line from MSA");
+        k = (int)strlen(line);
+        while (k > 0 && isspace(line[k-1])) line[--k] = '\0';
+        if (k > 0) break;
+      }
+      msa->names[i] = copy_charstr(line);
+      line = NULL;
     }
   }
   for (i = 0; i < nseqs; i++) {
-    char line[MAX_LINE_LEN];
-
     if (format == PHYLIP) {
-      if (1 != fscanf(F, "%s", msa->names[i]))
-	die("ERROR: error reading phylip alignment\n");
+      /* name is the next whitespace-delimited word, and the sequence
+         begins with the rest of its line */
+      for (;;) {
+        if (line != NULL) {
+          while (isspace(*line)) line++;
+          if (*line != '\0') break;
+        }
+        if ((line = lb_readline(lb, NULL)) == NULL)
+          die("ERROR: error reading phylip alignment\n");
+      }
+      for (k = 0; line[k] != '\0' && !isspace(line[k]); k++);
+      msa->names[i] = (char*)smalloc((k + 1) * sizeof(char));
+      strncpy(msa->names[i], line, k);
+      msa->names[i][k] = '\0';
+      line += k;
                                 /* FIXME: this won't handle the weird
                                  * case in true PHYLIP format in which
                                  * the name is not separated from the
                                  * sequence by whitespace */ 
     }
-    else if (format == FASTA) {
-      if (fgets(line, MAX_LINE_LEN, F) == NULL) die("ERROR reading alignment, unable to read line from MSA");
-      for (j = 0; line[j] != 0 && (line[j] == '>' || isspace(line[j])); j++);
-      strcpy(msa->names[i], &line[j]);
-    }
+    else line = NULL;
 
     j = 0;
     while (j < len) {
       checkInterruptN(j, 1000);
-      if (fgets(line, MAX_LINE_LEN, F)==NULL) die("ERROR reading alignment, unable to read line from MSA");
+      if (line == NULL && (line = lb_readline(lb, NULL)) == NULL) 
+        die("ERROR reading alignment, unable to read line from MSA");
       for (k = 0; line[k] != '\0'; k++) {
         char base;
         if (isspace(line[k])) continue;
-        base = do_toupper ? (char)toupper(line[k]) : line[k];
-        if (base == '.' && msa->inv_alphabet[(int)'.'] == -1) 
-          base = msa->missing[0]; /* interpret '.' as missing data;
-                                     maybe no longer necessary */
-        else if (base != GAP_CHAR && !msa->is_missing[(int)base] &&
-                 msa->inv_alphabet[(int)base] == -1 && 
-                 get_iupac_map()[(int)base] == NULL) {
-          if (isalpha(base)) base = 'N';  
-                                /* use 'N' in place of unrecognized
-                                   alphabetical character */
-           else  
-             die("ERROR: bad character in multiple sequence alignment: '%c'.\n",  
-                 base);  
-        }
+        if ((base = conv[(unsigned char)line[k]]) == 0)
+          die("ERROR: bad character in multiple sequence alignment: '%c'.\n",  
+              msa_alph_has_lowercase(msa) ? line[k] : toupper(line[k]));
+        /* should reach end of line and j=len simultaneously;
+           otherwise sequence is not advertised length */
+        if (j == len) 
+          die("ERROR: bad sequence length in multiple alignment.\n"); 
         msa->seqs[i][j++] = base;
       }
+      line = NULL;
     }
-    /* should reach end of line and j=len simultaneously; otherwise
-     * sequence is not advertised length */
-    if (line[k] != '\0') 
-      die("ERROR: bad sequence length in multiple alignment.\n"); 
-
     msa->seqs[i][j] = '\0';
   }
-  str_free(tmpstr);
+  lb_free(lb);
 
   return msa;
 }
@@ -249,98 +278,97 @@ MSA *msa_create_copy(MSA *msa, int suff_stats_only) {
   return retval;
 }
 
-/* kept separate for now */
+/* If a line of a FASTA file is a description line (one containing
+   '>' followed by optional whitespace and a name), return a pointer
+   to the name and set *len to its length; otherwise return NULL */
+static char *msa_fasta_descrip_name(char *line, int *len) {
+  char *p = strchr(line, '>'), *q;
+  if (p == NULL) return NULL;
+  for (q = p + 1; isspace(*q); q++);
+  if (*q == '\0') return NULL;
+  for (*len = 0; q[*len] != '\0' && !isspace(q[*len]); (*len)++);
+  return q;
+}
+
+/* kept separate for now.  Lines are parsed directly from a large read
+   buffer (see LineBuffer), and each sequence is accumulated in a
+   single growing array */
 MSA *msa_read_fasta(FILE *F, char *alphabet) {
-  List *names = lst_new_ptr(10);
-  List *seqs = lst_new_ptr(10);
-  static Regex *descrip_re = NULL;
-  int maxlen, i, nseqs, j, do_toupper, line_no;
-  String *line = str_new(STR_MED_LEN);
-  List *l = lst_new_ptr(2);
-  String *new_str = NULL;
+  LineBuffer *lb = lb_new(F);
+  char **names = NULL, **seqs = NULL, conv[NCHARS], *line, *name;
+  int *seqlens = NULL, *allocs = NULL;
+  int maxlen, i, nseqs = 0, alloc_nseqs = 0, j, len, line_no;
   MSA *msa;
 
-  if (descrip_re == NULL) 
-    descrip_re = str_re_new("[[:space:]]*>[[:space:]]*([^[:space:]]+)");
-
   line_no=1;
-  while ((str_readline(line, F)) != EOF) {
-    if (str_re_match(line, descrip_re, l, 1) > 0) {
-      lst_push_ptr(names, lst_get_ptr(l, 1));
-      str_free((String*)lst_get_ptr(l, 0));
-
-      new_str = str_new(STR_MED_LEN);
-      lst_push_ptr(seqs, new_str);
+  while ((line = lb_readline(lb, &len)) != NULL) {
+    if ((name = msa_fasta_descrip_name(line, &j)) != NULL) {
+      if (nseqs == alloc_nseqs) {
+        alloc_nseqs = (alloc_nseqs == 0 ? 10 : 2 * alloc_nseqs);
+        names = srealloc(names, alloc_nseqs * sizeof(char*));
+        seqs = srealloc(seqs, alloc_nseqs * sizeof(char*));
+        seqlens = srealloc(seqlens, alloc_nseqs * sizeof(int));
+        allocs = srealloc(allocs, alloc_nseqs * sizeof(int));
+      }
+      names[nseqs] = (char*)smalloc((j + 1) * sizeof(char));
+      strncpy(names[nseqs], name, j);
+      names[nseqs][j] = '\0';
+      allocs[nseqs] = STR_MED_LEN;
+      seqs[nseqs] = (char*)smalloc(allocs[nseqs] * sizeof(char));
+      seqlens[nseqs++] = 0;
       continue;
     }
 
-    str_double_trim(line);
-    if (line->length == 0) continue;
+    /* trim whitespace at both ends */
+    while (len > 0 && isspace(line[len-1])) len--;
+    for (j = 0; j < len && isspace(line[j]); j++);
+    line += j;
+    len -= j;
+    if (len == 0) continue;
 
-    if (new_str == NULL) 
+    if (nseqs == 0) 
       die("ERROR in FASTA file: non-blank line preceding first description ('>') line.\n");
 
-    str_append(new_str, line);
+    i = nseqs - 1;
+    if (seqlens[i] + len + 1 > allocs[i]) {
+      allocs[i] = max(2 * allocs[i], seqlens[i] + len + 1);
+      seqs[i] = srealloc(seqs[i], allocs[i] * sizeof(char));
+    }
+    memcpy(&seqs[i][seqlens[i]], line, len);
+    seqlens[i] += len;
     checkInterruptN(line_no++, 1000);
   }
+  lb_free(lb);
 
-  if (lst_size(seqs) == 0)
+  if (nseqs == 0)
     die("ERROR: empty FASTA file.\n");
 
-  /* pad sequences with gaps if not same length */
   maxlen = 0;
-  for (i = 0; i < lst_size(seqs); i++)
-    if (((String*)lst_get_ptr(seqs, i))->length > maxlen)
-      maxlen = ((String*)lst_get_ptr(seqs, i))->length;
-
-  for (i = 0; i < lst_size(seqs); i++) {
-    String *s = (String*)lst_get_ptr(seqs, i);
-    for (j = s->length; j < maxlen; j++)
-      str_append_char(s, GAP_CHAR);
-  }
+  for (i = 0; i < nseqs; i++)
+    if (seqlens[i] > maxlen) maxlen = seqlens[i];
 
   /* now create MSA */
-  nseqs = lst_size(names);
-  if (nseqs != lst_size(seqs))
-    die("ERROR msa_read_fasta: nseqs (%i) != lst_size(seqs) (%i)\n",
-	nseqs, lst_size(seqs));
-
   msa = msa_new(NULL, NULL, nseqs, maxlen, alphabet);
-  msa->names = (char**)smalloc(nseqs * sizeof(char*));
-  msa->seqs = (char**)smalloc(nseqs * sizeof(char*));
-
-  /* upcase chars unless there are lowercase characters in the alphabet */
-  do_toupper = !msa_alph_has_lowercase(msa);    
+  msa->names = names;
+  msa->seqs = seqs;
+  msa_char_conv_table(msa, conv, FALSE);
 
   for (i = 0; i < nseqs; i++) {
-    String *n, *s;
-    n = (String*)lst_get_ptr(names, i);
-    msa->names[i] = (char*)smalloc((n->length + 1) * sizeof(char));
-    strcpy(msa->names[i], n->chars);
-    str_free(n);
+    if (allocs[i] < maxlen + 1)
+      seqs[i] = srealloc(seqs[i], (maxlen + 1) * sizeof(char));
 
-    s = (String*)lst_get_ptr(seqs, i);
-    msa->seqs[i] = (char*)smalloc((maxlen + 1) * sizeof(char));
+    /* pad sequences with gaps if not same length */
+    for (j = seqlens[i]; j < maxlen; j++)
+      seqs[i][j] = GAP_CHAR;
 
     /* scan chars and adjust if necessary */
-    for (j = 0; j < maxlen; j++) {
-      msa->seqs[i][j] = do_toupper ? (char)toupper(s->chars[j]) : s->chars[j];
-      if (msa->seqs[i][j] == '.' && msa->inv_alphabet[(int)'.'] == -1) 
-        msa->seqs[i][j] = msa->missing[0]; /* interpret '.' as missing
-                                              data; maybe no longer
-                                              necessary */
-      if (isalpha(msa->seqs[i][j]) && msa->inv_alphabet[(int)msa->seqs[i][j]] == -1 && get_iupac_map()[(int)msa->seqs[i][j]] == NULL) 
-        msa->seqs[i][j] = 'N';   /* assume 'N' if unrecognized letter */
-    }
-    msa->seqs[i][maxlen] = '\0';
-
-    str_free(s);
+    for (j = 0; j < maxlen; j++)
+      seqs[i][j] = conv[(unsigned char)seqs[i][j]];
+    seqs[i][maxlen] = '\0';
   }  
 
-  lst_free(names);
-  lst_free(seqs);
-  lst_free(l);
-  str_free(line);
+  sfree(seqlens);
+  sfree(allocs);
 
   return msa;
 }
@@ -356,6 +384,11 @@ void msa_print(FILE *F, MSA *msa, msa_format_type format, int pretty_print) {
     ss_write(msa, F, 1);
     return;
   }
+  if (format == BSS) {
+    if (msa->ss == NULL) ss_from_msas(msa, 1, 1, NULL, NULL, NULL, -1, 0);
+    ss_write_binary(msa, F, 1);
+    return;
+  }
 
   /* otherwise, require explicit representation of alignment */
   if (msa->seqs == NULL && msa->ss != NULL) ss_to_msa(msa);
@@ -1166,6 +1199,7 @@ void msa_add_seq_ss(MSA *msa, int new_nseqs) {
   char newchar;
   if (new_nseqs <= msa->nseqs) 
     die("ERROR: new numseq must be >= than old in ss_add_seq\n");
+  ss_unpack_tuples(msa);
   newlen = new_nseqs*msa->ss->tuple_size + 1;
   for (i=0; i<msa->ss->ntuples; i++) {
     checkInterruptN(i, 1000);
@@ -1690,7 +1724,7 @@ void msa_get_backgd_3x4(Vector *backgd, MSA *msa) {
     for (i=0; i < msa->ss->ntuples; i++) {
       for (spec=0; spec < msa->nseqs; spec++) {
 	for (j=0; j < 3; j++) {
-	  cod[j] = col_string_to_char(msa, msa->ss->col_tuples[i], spec, msa->ss->tuple_size, j-2);
+	  cod[j] = ss_get_char_tuple(msa, i, spec, j-2);
 	  if (msa->is_missing[(int)cod[j]] || cod[j]==GAP_CHAR) break;
 	}
 	if (j == 3 && 
@@ -2545,6 +2579,7 @@ msa_format_type msa_str_to_format(const char *str) {
   else if (!strcmp(str, "PHYLIP")) return PHYLIP;
   else if (!strcmp(str, "MAF")) return MAF;
   else if (!strcmp(str, "LAV")) return LAV;
+  else if (!strcmp(str, "BSS")) return BSS;
   return UNKNOWN_FORMAT;
 }
 
@@ -2555,6 +2590,7 @@ char *msa_format_to_str(msa_format_type format) {
   if (format == MPM) return "MPM";
   if (format == SS) return "SS";
   if (format == MAF) return "MAF";
+  if (format == BSS) return "BSS";
   return "UNKNOWN";
 }
 
@@ -2572,6 +2608,7 @@ msa_format_type msa_format_for_suffix(const char *fname) {
 	   str_equals_charstr(s, "phy")) retval = PHYLIP;
   else if (str_equals_charstr(s, "maf")) retval = MAF;
   else if (str_equals_charstr(s, "lav")) retval = LAV;
+  else if (str_equals_charstr(s, "bss")) retval = BSS;
   str_free(s);
   return retval;
 }
@@ -2593,8 +2630,9 @@ msa_format_type msa_format_for_content(FILE *F, int die_if_unknown) {
   lav_re = str_re_new("^#:lav.*");
   maf_re = str_re_new("^##maf");
 
-  //Check if file has a Sufficent Statistics header
-  if(str_re_match(line, ss_re, matches, 1) >= 0) {
+  //Check if file has a Sufficent Statistics header (text or binary)
+  if(str_re_match(line, ss_re, matches, 1) >= 0 ||
+     (line->length >= 4 && !strncmp(line->chars, SS_BINARY_MAGIC, 4))) {
     retval = SS;
   }
   //Check if file has a PHYLIP/MPM header
@@ -2659,6 +2697,8 @@ char *msa_suffix_for_format(msa_format_type t) {
     return "ss";
   case MAF:
     return "maf";
+  case BSS:
+    return "bss";
   default:
     return "msa";
   }
@@ -2827,6 +2867,7 @@ void msa_missing_to_gaps(MSA *msa, int refseq) {
     die("ERROR msa_missing_to_gaps: msa->seqs is NULL and msa->ss is NULL\n");
 
   if (msa->ss != NULL) {
+    ss_unpack_tuples(msa);
     for (i = 0; i < msa->ss->ntuples; i++) {
       checkInterruptN(i, 10000);
       for (j = 0; j < msa->nseqs; j++) {
@@ -2900,6 +2941,7 @@ void msa_toupper(MSA *msa) {
 
   /* now replace all lowercase chars in alignment */
   if (msa->ss != NULL) {
+    ss_unpack_tuples(msa);
     for (i = 0; i < msa->ss->ntuples; i++) {
       checkInterruptN(i, 10000);
       for (j = 0; j < msa->nseqs; j++) 
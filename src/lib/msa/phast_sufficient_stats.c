@@ -7,10 +7,16 @@
  * file LICENSE.txt for details.
  ***************************************************************************/
 
+#include <sys/stat.h>
+#include <limits.h>
+#if !defined(__MINGW32__)
+#include <sys/mman.h>
+#endif
 #include "phast_misc.h"
 #include "phast_sufficient_stats.h"
 #include "phast_maf.h"
 #include "phast_queues.h"
+#include "phast_threads.h"
 
 #define MAX_NTUPLE_ALLOC 100000
                                 /* maximum number of tuples to
@@ -103,6 +109,10 @@ void ss_from_msas(MSA *msa, int tuple_size, int store_order,
       die("ERROR: (ss_from_msas) numbers of categories must be equal in source and destination alignments.\n");
   }
 
+  /* column tuples are handled as strings below */
+  ss_unpack_tuples(msa);
+  if (source_msa != NULL) ss_unpack_tuples(source_msa);
+
   do_cats = (msa->ncats >= 0);
   key[msa->nseqs * tuple_size] = '\0';
   if (do_cats && cats_to_do != NULL) {
@@ -260,6 +270,7 @@ void ss_new(MSA *msa, int tuple_size, int max_ntuples, int do_cats,
   ss->ntuples = 0;
   ss->tuple_idx = NULL;
   ss->cat_counts = NULL;
+  ss->packed = NULL;
   ss->alloc_len = max(1000, msa->length);
   if (store_order) {
     ss->tuple_idx = (int*)smalloc(ss->alloc_len * sizeof(int));
@@ -290,6 +301,7 @@ void ss_realloc(MSA *msa, int tuple_size, int max_ntuples, int do_cats,
 
   int i, j, cat_counts_done = FALSE, old_alloc_len;
   MSA_SS *ss = msa->ss;
+  ss_unpack_tuples(msa);
   if (store_order && msa->length > ss->alloc_len) {
     old_alloc_len = ss->alloc_len;
     ss->alloc_len = max(ss->alloc_len * 2, msa->length);
@@ -405,45 +417,236 @@ void ss_free_pooled_msa(PooledMSA *pmsa) {
   sfree(pmsa);
 }
 
-/* Create an aggregate MSA from a list of MSA filenames, a list of
-   sequence names, and an alphabet.  The list 'seqnames' will be used
-   to define the order and contents of the sequences in the aggregate
-   MSA (missing sequences will be replaced with missing data).  All source
-   MSAs must share the same alphabet, and each must contain a subset
-   of the names in 'seqnames'.  This function differs from the one
-   above in that no direct representation is retained of the source
-   MSAs.  Also, no information about tuple order is retained.  If
-   cycle_size > 0, site categories will be labeled
-   1,2,...,<cycle_size>,...,1,2,...,<cycle_size>. */
-/* TODO: support collection of ordered sufficient stats -- possible
-   now using idx_offset arg of ss_from_msas.  See maf_read in maf.c
-   and warning message in msa_view.c. */
-MSA *ss_aggregate_from_files(List *fnames,
-                             List *seqnames, int tuple_size, List *cats_to_do, 
-                             int cycle_size) {
+/* Length of the prefix of a column tuple that identifies it in a
+   table of distinct tuples.  Trailing missing-data characters are
+   ignored, as are characters at tuple positions that consist entirely
+   of gaps and missing data, so that, e.g., columns of missing data
+   are not distinguished from one another.  The length is rounded up
+   to a multiple of the tuple size. */
+static int ss_coltuple_keylen(const char *coltuple_str, MSA *msa) {
+  int tuple_size = msa->ss->tuple_size, allgap[tuple_size], i, j;
+  for (i = 0; i < tuple_size; i++) {
+    for (j = 0; j < msa->nseqs; j++)
+      if (coltuple_str[j*tuple_size + i] != GAP_CHAR &&
+	  coltuple_str[j*tuple_size + i] != msa->missing[0]) break;
+    allgap[i] = (j == msa->nseqs);
+  }
+  for (i = tuple_size * msa->nseqs - 1; i >= 0; i--)
+    if (coltuple_str[i] != msa->missing[0] && allgap[i%tuple_size] == 0)
+      break;
+  i++;
+  while (i % tuple_size != 0) i++;
+  return i;
+}
 
-  MSA *retval;
-  Hashtable *tuple_hash = hsh_new(100000);
-  int nseqs = lst_size(seqnames);
+/* Running aggregate of the (unordered) sufficient statistics of a
+   series of alignments, as built by ss_aggregate_from_files.
+   Distinct column tuples are found with an open-addressing table of
+   tuple indices, which refers back to msa->ss->col_tuples rather than
+   storing copies of keys; keys are the prefixes given by
+   ss_coltuple_keylen, as in ss_lookup_coltuple. */
+typedef struct {
+  MSA *msa;                     /* aggregate alignment */
+  int *slots;                   /* tuple index for each slot, or -1 */
+  int nslots;                   /* size of table (a power of two) */
+  int *keylen;                  /* key length for each tuple */
+  int alloc_keylen;
+} SSAggregate;
+
+/* Hash function for column tuples; mixes eight characters at a time */
+static PHAST_INLINE unsigned int ss_tuple_hash(const char *key, int len) {
+  unsigned long long h = (unsigned long long)len * 0x9e3779b97f4a7c15ULL, w;
+  int i;
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, &key[i], 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  if (i < len) {
+    w = 0;
+    memcpy(&w, &key[i], len - i);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+  }
+  h ^= h >> 29;
+  return (unsigned int)h;
+}
+
+/* Find the slot for a key of the given length.  Returns the slot
+   holding the matching tuple, or the empty slot where it belongs */
+static int ss_agg_slot(SSAggregate *agg, const char *key, int len) {
+  char **col_tuples = agg->msa->ss->col_tuples;
+  int mask = agg->nslots - 1, h = ss_tuple_hash(key, len) & mask, idx;
+  while ((idx = agg->slots[h]) != -1 &&
+         (agg->keylen[idx] != len || memcmp(col_tuples[idx], key, len) != 0))
+    h = (h + 1) & mask;
+  return h;
+}
+
+/* (Re)build the table with the specified number of slots */
+static void ss_agg_rehash(SSAggregate *agg, int nslots) {
+  MSA_SS *ss = agg->msa->ss;
+  int i;
+  sfree(agg->slots);
+  agg->nslots = nslots;
+  agg->slots = smalloc(nslots * sizeof(int));
+  for (i = 0; i < nslots; i++) agg->slots[i] = -1;
+  for (i = 0; i < ss->ntuples; i++)
+    agg->slots[ss_agg_slot(agg, ss->col_tuples[i], agg->keylen[i])] = i;
+}
+
+static SSAggregate *ss_agg_new(List *seqnames, int ncats) {
+  SSAggregate *agg = smalloc(sizeof(SSAggregate));
+  int nseqs = lst_size(seqnames), i;
+  char **names = smalloc(nseqs * sizeof(char*));
+  for (i = 0; i < nseqs; i++)
+    names[i] = copy_charstr(((String*)lst_get_ptr(seqnames, i))->chars);
+  agg->msa = msa_new(NULL, names, nseqs, 0, NULL);
+  agg->msa->ncats = ncats;
+  agg->slots = NULL;
+  agg->nslots = 0;
+  agg->keylen = NULL;
+  agg->alloc_keylen = 0;
+  return agg;
+}
+
+/* Free an SSAggregate; returns the aggregate alignment, which is not
+   freed */
+static MSA *ss_agg_free(SSAggregate *agg) {
+  MSA *msa = agg->msa;
+  sfree(agg->slots);
+  sfree(agg->keylen);
+  sfree(agg);
+  return msa;
+}
+
+/* Return the index of a column tuple in the aggregate, adding it if
+   it has not been seen before */
+static int ss_agg_tuple(SSAggregate *agg, const char *coltuple_str) {
+  MSA *msa = agg->msa;
+  MSA_SS *ss = msa->ss;
+  int len = ss_coltuple_keylen(coltuple_str, msa),
+    tuplen = msa->nseqs * ss->tuple_size, h, idx;
+
+  h = ss_agg_slot(agg, coltuple_str, len);
+  if (agg->slots[h] != -1) return agg->slots[h];
+
+  idx = ss->ntuples++;
+  if (ss->ntuples > ss->alloc_ntuples)
+    ss_realloc(msa, ss->tuple_size, ss->ntuples, msa->ncats >= 0, FALSE);
+  if (ss->ntuples > agg->alloc_keylen) {
+    agg->alloc_keylen = ss->alloc_ntuples;
+    agg->keylen = srealloc(agg->keylen, agg->alloc_keylen * sizeof(int));
+  }
+  ss->col_tuples[idx] = smalloc((tuplen + 1) * sizeof(char));
+  memcpy(ss->col_tuples[idx], coltuple_str, tuplen);
+  ss->col_tuples[idx][tuplen] = '\0';
+  agg->keylen[idx] = len;
+  agg->slots[h] = idx;
+  if (2 * ss->ntuples > agg->nslots)
+    ss_agg_rehash(agg, 2 * agg->nslots);
+  return idx;
+}
+
+/* Add the column tuples of a source alignment to an aggregate.  Has
+   the same effect as ss_from_msas with store_order == FALSE, except
+   that the length of the aggregate is the total length of the source
+   alignments */
+static void ss_agg_add_msa(SSAggregate *agg, MSA *source_msa,
+                           List *cats_to_do, int tuple_size) {
+  MSA *msa = agg->msa;
+  int do_cats = (msa->ncats >= 0), *do_cat_number = NULL, i, j, idx;
+  char key[msa->nseqs * tuple_size + 1];
+  MSA_SS *main_ss, *source_ss = source_msa->ss;
+
+  if (msa->nseqs != source_msa->nseqs)
+    die("ERROR: (ss_from_msas) numbers of sequences must be equal in source and destination alignments.\n");
+
+  if (msa->ss == NULL) {
+    ss_new(msa, tuple_size, source_ss != NULL ?
+           max(source_ss->ntuples, 1) : min(max(source_msa->length, 1),
+                                            MAX_NTUPLE_ALLOC),
+           do_cats, FALSE);
+    ss_agg_rehash(agg, 1024);
+  }
+  main_ss = msa->ss;
+  msa->length += source_msa->length;
+
+  if (source_ss != NULL) {      /* just use existing suff stats */
+    for (i = 0; i < source_ss->ntuples; i++) {
+      checkInterruptN(i, 1000);
+      idx = ss_agg_tuple(agg, source_ss->col_tuples[i]);
+      main_ss->counts[idx] += source_ss->counts[i];
+      if (do_cats && source_ss->cat_counts != NULL)
+        for (j = 0; j <= source_msa->ncats; j++)
+          main_ss->cat_counts[j][idx] += source_ss->cat_counts[j][i];
+    }
+    return;
+  }
+
+  if (do_cats && cats_to_do != NULL) {
+    do_cat_number = smalloc((msa->ncats + 1) * sizeof(int));
+    for (i = 0; i <= msa->ncats; i++) do_cat_number[i] = 0;
+    for (i = 0; i < lst_size(cats_to_do); i++)
+      do_cat_number[lst_get_int(cats_to_do, i)] = 1;
+  }
+  key[msa->nseqs * tuple_size] = '\0';
+  for (i = 0; i < source_msa->length; i++) {
+    checkInterruptN(i, 1000);
+    if (do_cat_number != NULL && do_cat_number[source_msa->categories[i]] == 0)
+      continue;
+    col_to_string(key, source_msa, i, tuple_size);
+    idx = ss_agg_tuple(agg, key);
+    main_ss->counts[idx]++;
+    if (do_cats && source_msa->categories != NULL) {
+      if (!(source_msa->categories[i] >= 0 &&
+            source_msa->categories[i] <= msa->ncats))
+	die("ERROR ss_from_msas: smsa->categories[i]=%i should be in [0,%i]\n",
+	    source_msa->categories[i], msa->ncats);
+      main_ss->cat_counts[source_msa->categories[i]][idx]++;
+    }
+  }
+  if (do_cat_number != NULL) sfree(do_cat_number);
+}
+
+/* Add the tuples of one aggregate to another, in order */
+static void ss_agg_merge(SSAggregate *agg, MSA *part) {
+  MSA_SS *ss = part->ss;
+  int i, j, idx;
+
+  if (part->ncats != agg->msa->ncats)
+    die("ERROR: input alignments have different numbers of categories.\n");
+  if (ss == NULL) return;
+  if (agg->msa->ss == NULL) {
+    ss_new(agg->msa, ss->tuple_size, max(ss->ntuples, 1),
+           agg->msa->ncats >= 0, FALSE);
+    ss_agg_rehash(agg, 1024);
+  }
+  agg->msa->length += part->length;
+  for (i = 0; i < ss->ntuples; i++) {
+    checkInterruptN(i, 1000);
+    idx = ss_agg_tuple(agg, ss->col_tuples[i]);
+    agg->msa->ss->counts[idx] += ss->counts[i];
+    if (ss->cat_counts != NULL && agg->msa->ss->cat_counts != NULL)
+      for (j = 0; j <= part->ncats; j++)
+        agg->msa->ss->cat_counts[j][idx] += ss->cat_counts[j][i];
+  }
+}
+
+/* Add the alignments in files first through last-1 of a list to an
+   aggregate; reports each file on stderr unless quiet == TRUE */
+static void ss_agg_add_files(SSAggregate *agg, List *fnames, int first,
+                             int last, List *seqnames, int tuple_size,
+                             List *cats_to_do, int cycle_size, int quiet) {
   MSA *source_msa = NULL;
   int i, j;
   FILE *F;
   msa_format_type format;
-  char **names = (char**)smalloc(nseqs * sizeof(char*));
-
-  /* set up names for new MSA object */
-  for (i = 0; i < nseqs; i++) {
-    String *s = lst_get_ptr(seqnames, i);
-    names[i] = copy_charstr(s->chars);
-  }
 
-  retval = msa_new(NULL, names, nseqs, 0, NULL);
-  retval->ncats = cycle_size > 0 ? cycle_size : -1;
-
-  for (i = 0; i < lst_size(fnames); i++) {
+  for (i = first; i < last; i++) {
     String *fname = lst_get_ptr(fnames, i);
     checkInterrupt();
-    fprintf(stderr, "Reading alignment from %s ...\n", fname->chars);
+    if (!quiet)
+      fprintf(stderr, "Reading alignment from %s ...\n", fname->chars);
 
     F = phast_fopen(fname->chars, "r");
     format = msa_format_for_content(F, 1);
@@ -467,8 +670,8 @@ MSA *ss_aggregate_from_files(List *fnames,
         source_msa->categories[j] = (j % cycle_size) + 1;
     }
 
-    if (source_msa->ncats != retval->ncats) { /* only an issue with SS */
-      if (i == 0) retval->ncats = source_msa->ncats;
+    if (source_msa->ncats != agg->msa->ncats) { /* only an issue with SS */
+      if (i == first) agg->msa->ncats = source_msa->ncats;
       else die("ERROR: input alignments have different numbers of categories.\n");
     }
 
@@ -476,14 +679,93 @@ MSA *ss_aggregate_from_files(List *fnames,
     msa_reorder_rows(source_msa, seqnames);
 
     /* now add the source MSA to the aggregate */
-    ss_from_msas(retval, tuple_size, 0, cats_to_do, source_msa, 
-                 tuple_hash, -1, 0);
+    ss_agg_add_msa(agg, source_msa, cats_to_do, tuple_size);
 
     msa_free(source_msa);
   }
+}
 
-  hsh_free(tuple_hash);
-  return retval;
+/* data for parallel aggregation; each part covers a contiguous subset
+   of the files */
+typedef struct {
+  List *fnames, *seqnames, *cats_to_do;
+  int tuple_size, cycle_size, nparts;
+  SSAggregate **parts;
+} SSAggregateData;
+
+static void ss_aggregate_block(void *data, int start, int end, int thread) {
+  SSAggregateData *d = data;
+  int k, nfiles = lst_size(d->fnames);
+  for (k = start; k < end; k++)
+    ss_agg_add_files(d->parts[k], d->fnames, 
+                     (int)((long)k * nfiles / d->nparts),
+                     (int)((long)(k+1) * nfiles / d->nparts),
+                     d->seqnames, d->tuple_size, d->cats_to_do,
+                     d->cycle_size, TRUE);
+}
+
+/* Create an aggregate MSA from a list of MSA filenames, a list of
+   sequence names, and an alphabet.  The list 'seqnames' will be used
+   to define the order and contents of the sequences in the aggregate
+   MSA (missing sequences will be replaced with missing data).  All source
+   MSAs must share the same alphabet, and each must contain a subset
+   of the names in 'seqnames'.  This function differs from the one
+   above in that no direct representation is retained of the source
+   MSAs.  Also, no information about tuple order is retained.  If
+   cycle_size > 0, site categories will be labeled
+   1,2,...,<cycle_size>,...,1,2,...,<cycle_size>.  If more than one
+   thread is available (see thr_set_nthreads), the files are divided
+   into contiguous subsets that are read and aggregated in parallel,
+   and the partial aggregates are then merged in order, so that the
+   result does not depend on the number of threads.  Unless quiet ==
+   TRUE, each file is reported on stderr, in order, as it is read or
+   (when reading in parallel) merged. */
+/* TODO: support collection of ordered sufficient stats -- possible
+   now using idx_offset arg of ss_from_msas.  See maf_read in maf.c
+   and warning message in msa_view.c. */
+MSA *ss_aggregate_from_files(List *fnames,
+                             List *seqnames, int tuple_size, List *cats_to_do, 
+                             int cycle_size, int quiet) {
+  int ncats = cycle_size > 0 ? cycle_size : -1,
+    nfiles = lst_size(fnames), nparts = thr_nworkers(nfiles, 1), i, k;
+  SSAggregate *agg = ss_agg_new(seqnames, ncats);
+
+  if (nparts <= 1)
+    ss_agg_add_files(agg, fnames, 0, nfiles, seqnames, 
+                     tuple_size, cats_to_do, cycle_size, quiet);
+  else {
+    SSAggregateData d;
+    d.fnames = fnames;
+    d.seqnames = seqnames;
+    d.cats_to_do = cats_to_do;
+    d.tuple_size = tuple_size;
+    d.cycle_size = cycle_size;
+    d.nparts = nparts;
+    d.parts = smalloc(nparts * sizeof(SSAggregate*));
+    d.parts[0] = agg;
+    for (k = 1; k < nparts; k++) d.parts[k] = ss_agg_new(seqnames, ncats);
+
+    thr_foreach(nparts, 1, ss_aggregate_block, &d);
+
+    /* report the files here rather than from the threads, so that
+       they are listed in order */
+    for (k = 0; k < nparts; k++) {
+      if (!quiet)
+        for (i = (int)((long)k * nfiles / nparts); 
+             i < (int)((long)(k+1) * nfiles / nparts); i++)
+          fprintf(stderr, "Reading alignment from %s ...\n",
+                  ((String*)lst_get_ptr(fnames, i))->chars);
+      if (k > 0) {
+        MSA *part = ss_agg_free(d.parts[k]);
+        ss_agg_merge(agg, part);
+        msa_free(part);
+      }
+    }
+    sfree(d.parts);
+  }
+
+  if (agg->msa->ss != NULL) ss_compact(agg->msa->ss);
+  return ss_agg_free(agg);
 }
 
 
@@ -491,6 +773,7 @@ char *ss_get_one_seq(MSA *msa, int spec) {
   char *seq, c;
   int i, j, col;
   
+  ss_unpack_tuples(msa);
   seq = (char*)smalloc((msa->length+1)*sizeof(char));
   seq[msa->length] = '\0';
   if (msa->ss->tuple_idx == NULL) { /*unordered sufficient stats */
@@ -646,68 +929,125 @@ void ss_write(MSA *msa, FILE *F, int show_order) {
   }
 }
 
+/* characters allowed in the values of header fields of SS files */
+#define SS_DIGITS "0123456789"
+#define SS_SIGNED_DIGITS "-0123456789"
+#define SS_ALPH_CHARS \
+  "-.^ ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+
+/* Find the value of header field 'key' in a line of an SS file
+   ("key = value"; the key may appear anywhere in the line).  If chars
+   is non-NULL, the value is the longest run of characters in chars,
+   and must be nonempty; otherwise it is the rest of the line.  Returns
+   a pointer to the value and sets *len to its length, or returns NULL
+   if the line has no such field */
+static char *ss_header_value(char *line, const char *key, const char *chars,
+                             int *len) {
+  char *p, *q;
+  size_t keylen = strlen(key);
+
+  for (p = strstr(line, key); p != NULL; p = strstr(p + 1, key)) {
+    for (q = p + keylen; isspace(*q); q++);
+    if (*q != '=') continue;
+    for (q++; isspace(*q); q++);
+    *len = (int)(chars == NULL ? strlen(q) : strspn(q, chars));
+    if (chars == NULL || *len > 0) return q;
+  }
+  return NULL;
+}
+
+/* Like ss_header_value, for an integer-valued field.  Returns TRUE if
+   the field is present; *val is set only if the value can be
+   converted (as by str_as_int) */
+static int ss_header_int(char *line, const char *key, const char *chars,
+                         int *val) {
+  char tmp[STR_SHORT_LEN], *endptr;
+  int len, v;
+  char *value = ss_header_value(line, key, chars, &len);
+
+  if (value == NULL) return FALSE;
+  if (len >= STR_SHORT_LEN) len = STR_SHORT_LEN - 1;
+  memcpy(tmp, value, len);
+  tmp[len] = '\0';
+  v = (int)strtol(tmp, &endptr, 0);
+  if (endptr != tmp) *val = v;
+  return TRUE;
+}
+
+/* Split a line of an SS file into whitespace-delimited fields, as
+   str_split would (leading whitespace yields an empty first field).
+   The line is not modified; each field is described by a pointer to
+   its first character and its length.  Arrays are reallocated as
+   needed.  Returns the number of fields */
+static int ss_split_fields(char *line, int len, char ***fields,
+                           int **field_len, int *alloc) {
+  int i = 0, j, n = 0;
+
+  while (i < len) {
+    for (j = i; j < len && !isspace(line[j]); j++);
+    if (n == *alloc) {
+      *alloc = (*alloc == 0 ? 16 : 2 * *alloc);
+      *fields = srealloc(*fields, *alloc * sizeof(char*));
+      *field_len = srealloc(*field_len, *alloc * sizeof(int));
+    }
+    (*fields)[n] = &line[i];
+    (*field_len)[n++] = j - i;
+    for (i = j + 1; i < len && isspace(line[i]); i++);
+  }
+  return n;
+}
+
 /* make reading order optional?  alphabet argument overrides alphabet
-   in file (use NULL to use version in file) */
+   in file (use NULL to use version in file).  Lines are parsed
+   directly from a large read buffer (see LineBuffer), without
+   allocating memory for each line */
 MSA* ss_read(FILE *F, char *alphabet) {
-  Regex *nseqs_re, *length_re, *tuple_size_re, *ntuples_re, *tuple_re, 
-    *names_re, *alph_re, *ncats_re, *order_re, *offset_re;
-  String *line, *alph = NULL;
+  LineBuffer *lb;
+  String *alph = NULL;
   int nseqs, length, tuple_size, ntuples, i, ncats = -99, header_done = 0, 
-    idx_offset = 0, idx, offset, line_no=0;
+    idx_offset = 0, idx = -1, offset, line_no=0, len, nfields, k,
+    alloc_fields = 0, *field_len = NULL;
   MSA *msa = NULL;
-  List *matches;
-  char **names = NULL;
-
-  nseqs_re = str_re_new("NSEQS[[:space:]]*=[[:space:]]*([0-9]+)");
-  length_re = str_re_new("LENGTH[[:space:]]*=[[:space:]]*([0-9]+)");
-  tuple_size_re = str_re_new("TUPLE_SIZE[[:space:]]*=[[:space:]]*([0-9]+)");
-  ntuples_re = str_re_new("NTUPLES[[:space:]]*=[[:space:]]*([0-9]+)");
-  names_re = str_re_new("NAMES[[:space:]]*=[[:space:]]*(.*)");
-  alph_re = str_re_new("ALPHABET[[:space:]]*=[[:space:]]*([-.^A-Za-z ]+)");
-  ncats_re = str_re_new("NCATS[[:space:]]*=[[:space:]]*([-0-9]+)");
-  offset_re = str_re_new("IDX_OFFSET[[:space:]]*=[[:space:]]*([-0-9]+)");
-  tuple_re = str_re_new("^([0-9]+)[[:space:]]+([-.^A-Za-z ]+)[[:space:]]+([0-9.[:space:]]+)");
-  order_re = str_re_new("TUPLE_IDX_ORDER:");
+  char **names = NULL, **fields = NULL, *line, *value, *endptr;
 
-  line = str_new(STR_MED_LEN);
-  matches = lst_new_ptr(3);
+  /* binary files are recognized by their first byte */
+  i = getc(F);
+  if (i != EOF) ungetc(i, F);
+  if (i == (unsigned char)SS_BINARY_MAGIC[0])
+    return ss_read_binary(F, alphabet);
+
+  lb = lb_new(F);
   nseqs = length = tuple_size = ntuples = -1;
 
-  while (str_readline(line, F) != EOF) {
+  while ((line = lb_readline(lb, &len)) != NULL) {
     checkInterruptN(line_no, 1000);
     line_no++;
-    str_trim(line);
-    if (line->length == 0) continue;
-    if (line->chars[0]=='#') continue;
+    while (len > 0 && isspace(line[len-1])) line[--len] = '\0';
+    if (len == 0) continue;
+    if (line[0]=='#') continue;
 
     if (!header_done) {
-      if (str_re_match(line, nseqs_re, matches, 1) >= 0) {
-        str_as_int(lst_get_ptr(matches, 1), &nseqs);
-      }
-      else if (str_re_match(line, length_re, matches, 1) >= 0) {
-        str_as_int(lst_get_ptr(matches, 1), &length);
-      }
-      else if (str_re_match(line, tuple_size_re, matches, 1) >= 0) {
-        str_as_int(lst_get_ptr(matches, 1), &tuple_size);
-      }
-      else if (str_re_match(line, ntuples_re, matches, 1) >= 0) {
-        str_as_int(lst_get_ptr(matches, 1), &ntuples);
-      }
-      else if (str_re_match(line, alph_re, matches, 1) >= 0) {
-        alph = str_dup(lst_get_ptr(matches, 1));
+      if (ss_header_int(line, "NSEQS", SS_DIGITS, &nseqs));
+      else if (ss_header_int(line, "LENGTH", SS_DIGITS, &length));
+      else if (ss_header_int(line, "TUPLE_SIZE", SS_DIGITS, &tuple_size));
+      else if (ss_header_int(line, "NTUPLES", SS_DIGITS, &ntuples));
+      else if ((value = ss_header_value(line, "ALPHABET", SS_ALPH_CHARS, 
+                                        &k)) != NULL) {
+        alph = str_new(k);
+        str_nappend_charstr(alph, value, k);
         str_remove_all_whitespace(alph);
       }
-      else if (str_re_match(line, ncats_re, matches, 1) >= 0) {
-        str_as_int(lst_get_ptr(matches, 1), &ncats);
+      else if (ss_header_int(line, "NCATS", SS_SIGNED_DIGITS, &ncats)) {
         if (ncats < -1) ncats = -1;
       }
-      else if (str_re_match(line, offset_re, matches, 1) >= 0) {
-        str_as_int(lst_get_ptr(matches, 1), &idx_offset);
+      else if (ss_header_int(line, "IDX_OFFSET", SS_SIGNED_DIGITS, 
+                             &idx_offset)) {
         if (idx_offset < -1) idx_offset = -1;
       }
-      else if (str_re_match(line, names_re, matches, 1) >= 0) {
+      else if ((value = ss_header_value(line, "NAMES", NULL, &k)) != NULL) {
         List *names_list = lst_new_ptr(nseqs > 0 ? nseqs : 20);
-        str_split(lst_get_ptr(matches, 1), ", ", names_list);
+        String *namestr = str_new_charstr(value);
+        str_split(namestr, ", ", names_list);
         names = (char**)smalloc(lst_size(names_list) * sizeof(char*));
         for (i = 0; i < lst_size(names_list); i++) {
           String *s = (String*)lst_get_ptr(names_list, i);
@@ -715,9 +1055,10 @@ MSA* ss_read(FILE *F, char *alphabet) {
           str_free(s);
         }
         lst_free(names_list);
+        str_free(namestr);
       }      
       else 
-        die("ERROR: unrecognized line in sufficient statistics file.  Is your header information complete?\nOffending line: '%s'\n", line->chars);
+        die("ERROR: unrecognized line in sufficient statistics file.  Is your header information complete?\nOffending line: '%s'\n", line);
 
       if (nseqs > 0 && length >= 0 && tuple_size > 0 && ntuples > 0 && 
           alph != NULL && names != NULL && ncats != -99) {
@@ -729,8 +1070,6 @@ MSA* ss_read(FILE *F, char *alphabet) {
         msa->ss->ntuples = ntuples;
         /* in this case, we can preallocate the col_tuples, because we
            know exactly how many there will be */
-/* 	fprintf(stderr, "ntuples %d, nseqs %d, tuple_size %d, alloc_size %d\n", */
-/* 		ntuples, nseqs, tuple_size, (nseqs * tuple_size + 1)); */
         for (i = 0; i < ntuples; i++) {
           msa->ss->col_tuples[i] = (char*)smalloc((nseqs * tuple_size + 1) *
 						   sizeof(char));
@@ -742,76 +1081,283 @@ MSA* ss_read(FILE *F, char *alphabet) {
       }
     }
     
-    else if (str_split(line, NULL, matches) >= 3) {
-      String *tmpstr;
-
-      tmpstr = lst_get_ptr(matches, 0);
-      str_as_int(tmpstr, &idx);
+    else if ((nfields = ss_split_fields(line, len, &fields, &field_len, 
+                                        &alloc_fields)) >= 3) {
+      /* fields are not null-terminated, but are followed by
+         whitespace, which ends numbers; empty fields can't be
+         converted */
+      if (field_len[0] > 0) {
+        k = (int)strtol(fields[0], &endptr, 0);
+        if (endptr != fields[0]) idx = k;
+      }
       if (idx < 0 || idx >= ntuples) 
-        die("ERROR: tuple line has index out of bounds.\nOffending line is, \"%s\"\n", line->chars);
+        die("ERROR: tuple line has index out of bounds.\nOffending line is, \"%s\"\n", line);
+      if (nfields < msa->ss->tuple_size + ncats + 3)
+        die("ERROR: too few fields in tuple line.\nOffending line is, \"%s\"\n", line);
 
       for (offset = -1 * (msa->ss->tuple_size-1); offset <= 0; offset++) {
-        tmpstr = lst_get_ptr(matches, offset + msa->ss->tuple_size);
-        if (tmpstr->length != msa->nseqs) 
-          die("ERROR: length of column tuple does not match NSEQS.\nOffending line is, \"%s\"\n", line->chars);
-
-/* 	fprintf(stderr, "tuple %d from input msa: %s\n", idx, tmpstr->chars); */
+        k = offset + msa->ss->tuple_size;
+        if (field_len[k] != msa->nseqs) 
+          die("ERROR: length of column tuple does not match NSEQS.\nOffending line is, \"%s\"\n", line);
         for (i = 0; i < msa->nseqs; i++) {
           set_col_char_in_string(msa, msa->ss->col_tuples[idx], i,
                                  msa->ss->tuple_size, offset,
-                                 tmpstr->chars[i]);
+                                 fields[k][i]);
         }
-/* 	fprintf(stderr, "tuple from msa in memory: %s\n", msa->ss->col_tuples[idx]); */
       }
 
       for (i = -1; i <= ncats; i++) { 
                                 /* i == -1 -> global count; other
                                    values correspond to particular
                                    categories */
-        tmpstr = lst_get_ptr(matches, i+msa->ss->tuple_size+2);
-        str_as_dbl(tmpstr, i == -1 ? &msa->ss->counts[idx] : 
-                   &msa->ss->cat_counts[i][idx]);
+        double d;
+        k = i+msa->ss->tuple_size+2;
+        if (field_len[k] == 0) continue;
+        d = strtod(fields[k], &endptr);
+        if (endptr == fields[k]) continue;
+        if (i == -1) msa->ss->counts[idx] = d;
+        else msa->ss->cat_counts[i][idx] = d;
       }
     }
-    else if (str_re_match(line, order_re, NULL, 0) >= 0) {
+    else if (strstr(line, "TUPLE_IDX_ORDER:") != NULL) {
       msa->ss->tuple_idx = smalloc(msa->length * sizeof(int));
-      for (i = 0; str_readline(line, F) != EOF && i < msa->length; i++) {
-        str_trim(line);
-        if (line->length == 0) continue;
-        if (str_as_int(line, &msa->ss->tuple_idx[i]) != 0) 
+      for (i = 0; (line = lb_readline(lb, &len)) != NULL && i < msa->length; 
+           i++) {
+        while (len > 0 && isspace(line[len-1])) line[--len] = '\0';
+        if (len == 0) continue;
+        k = (int)strtol(line, &endptr, 0);
+        if (endptr == line || endptr != line + len) 
           die("ERROR: bad integer in TUPLE_IDX_ORDER list.\n");
+        msa->ss->tuple_idx[i] = k;
       }
       if (i < msa->length) 
         die("ERROR: too few numbers in TUPLE_IDX_ORDER list.\n");
     }
-
-    for (i = 0; i < lst_size(matches); i++)
-      str_free(lst_get_ptr(matches, i));
-    lst_clear(matches);
   }
 
   if (!header_done || msa == NULL)
     die("ERROR: Missing or incomplete header in SS file.\n");
 
-  lst_free(matches);
-  str_re_free(nseqs_re);
-  str_re_free(length_re);
-  str_re_free(tuple_size_re);
-  str_re_free(ntuples_re);
-  str_re_free(names_re);
-  str_re_free(alph_re);
-  str_re_free(ncats_re);
-  str_re_free(offset_re);
-  str_re_free(tuple_re);
-  str_re_free(order_re);
-  str_free(line);
-  
-/*   for (idx = 0; idx < ntuples; idx++) */
-/*     fprintf(stderr, "Tuple %d in msa: %s\n", idx, msa->ss->col_tuples[idx]); */
+  lb_free(lb);
+  if (fields != NULL) {
+    sfree(fields);
+    sfree(field_len);
+  }
   
   return msa;
 }
 
+/* Fixed-size header of a binary SS file.  It is followed by the
+   alphabet (alph_len chars), the sequence names (names_len chars,
+   each name null-terminated), padding to a multiple of 8 bytes, the
+   counts (ntuples doubles), the category counts if has_cat_counts
+   ((ncats+1) * ntuples doubles, category by category), the tuple
+   order if has_order (length ints), padding, and finally the column
+   tuples (ntuples * nseqs * tuple_size chars, without terminators) */
+typedef struct {
+  char magic[8];
+  int32_t version, byte_order, nseqs, tuple_size, ntuples, ncats,
+    idx_offset, has_cat_counts, has_order, alph_len, names_len;
+  uint32_t length;
+  int32_t reserved[2];
+} SSBinaryHeader;
+
+#define SS_BINARY_BYTE_ORDER 0x01020304
+#define SS_BINARY_PAD(n) ((8 - (n) % 8) % 8)
+
+void ss_write_binary(MSA *msa, FILE *F, int show_order) {
+  MSA_SS *ss = msa->ss;
+  SSBinaryHeader h;
+  char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  size_t tuplen = (size_t)msa->nseqs * ss->tuple_size, pad;
+  int i, j;
+
+  ss_unpack_tuples(msa);
+  memset(&h, 0, sizeof(SSBinaryHeader));
+  memcpy(h.magic, SS_BINARY_MAGIC, 8);
+  h.version = SS_BINARY_VERSION;
+  h.byte_order = SS_BINARY_BYTE_ORDER;
+  h.nseqs = msa->nseqs;
+  h.tuple_size = ss->tuple_size;
+  h.ntuples = ss->ntuples;
+  h.ncats = msa->ncats;
+  h.idx_offset = msa->idx_offset;
+  h.has_cat_counts = (msa->ncats > 0 && ss->cat_counts != NULL);
+  h.has_order = (show_order && ss->tuple_idx != NULL);
+  h.length = msa->length;
+  h.alph_len = strlen(msa->alphabet);
+  for (i = 0, h.names_len = 0; i < msa->nseqs; i++)
+    h.names_len += strlen(msa->names[i]) + 1;
+
+  if (fwrite(&h, sizeof(SSBinaryHeader), 1, F) != 1 ||
+      fwrite(msa->alphabet, 1, h.alph_len, F) != h.alph_len)
+    die("ERROR ss_write_binary: write failed\n");
+  for (i = 0; i < msa->nseqs; i++)
+    if (fwrite(msa->names[i], 1, strlen(msa->names[i]) + 1, F) !=
+        strlen(msa->names[i]) + 1)
+      die("ERROR ss_write_binary: write failed\n");
+  pad = SS_BINARY_PAD(h.alph_len + h.names_len);
+  if (fwrite(zeros, 1, pad, F) != pad)
+    die("ERROR ss_write_binary: write failed\n");
+
+  if (fwrite(ss->counts, sizeof(double), ss->ntuples, F) != ss->ntuples)
+    die("ERROR ss_write_binary: write failed\n");
+  if (h.has_cat_counts)
+    for (j = 0; j <= msa->ncats; j++)
+      if (fwrite(ss->cat_counts[j], sizeof(double), ss->ntuples, F) != 
+          ss->ntuples)
+        die("ERROR ss_write_binary: write failed\n");
+  if (h.has_order) {
+    if (fwrite(ss->tuple_idx, sizeof(int), msa->length, F) != msa->length)
+      die("ERROR ss_write_binary: write failed\n");
+    pad = SS_BINARY_PAD(msa->length * sizeof(int));
+    if (fwrite(zeros, 1, pad, F) != pad)
+      die("ERROR ss_write_binary: write failed\n");
+  }
+
+  for (i = 0; i < ss->ntuples; i++) {
+    checkInterruptN(i, 10000);
+    if (fwrite(ss->col_tuples[i], 1, tuplen, F) != tuplen)
+      die("ERROR ss_write_binary: write failed\n");
+  }
+}
+
+/* return pointer to the next nbytes of a binary SS file, advancing
+   *pos past them and any padding */
+static unsigned char *ss_binary_block(unsigned char *data, size_t size, 
+                                      size_t *pos, size_t nbytes, 
+                                      int pad) {
+  unsigned char *retval = data + *pos;
+  if (nbytes > size - *pos)
+    die("ERROR: binary sufficient statistics file is truncated.\n");
+  *pos += nbytes;
+  if (pad) *pos = min(*pos + SS_BINARY_PAD(*pos), size);
+  return retval;
+}
+
+MSA* ss_read_binary(FILE *F, char *alphabet) {
+  unsigned char *buf = NULL, *data, *block;
+  size_t size = 0, mapsize = 0, pos = 0, tuplen;
+  long offset = ftell(F);
+  SSBinaryHeader h;
+  MSA *msa;
+  MSA_SS *ss;
+  char **names, *alph;
+  int i, j;
+
+#if !defined(__MINGW32__)
+  struct stat st;
+  if (offset >= 0 && fstat(fileno(F), &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size > offset) {
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(F), 0);
+    if (buf == MAP_FAILED) buf = NULL;
+    else {
+      mapsize = st.st_size;
+      size = mapsize - offset;
+      data = buf + offset;
+    }
+  }
+#endif
+  if (buf == NULL) {            /* not mappable; read whole stream */
+    size_t alloc = 1 << 20, n;
+    buf = smalloc(alloc);
+    while ((n = fread(buf + size, 1, alloc - size, F)) > 0) {
+      size += n;
+      if (size == alloc) {
+        alloc *= 2;
+        buf = srealloc(buf, alloc);
+      }
+    }
+    data = buf;
+  }
+
+  if (size < sizeof(SSBinaryHeader))
+    die("ERROR: binary sufficient statistics file is truncated.\n");
+  memcpy(&h, data, sizeof(SSBinaryHeader));
+  pos = sizeof(SSBinaryHeader);
+  if (memcmp(h.magic, SS_BINARY_MAGIC, 8) != 0)
+    die("ERROR: bad magic number in binary sufficient statistics file.\n");
+  if (h.version != SS_BINARY_VERSION)
+    die("ERROR: unsupported binary sufficient statistics version (%d).\n",
+        h.version);
+  if (h.byte_order != SS_BINARY_BYTE_ORDER)
+    die("ERROR: binary sufficient statistics file was written on a machine with a different byte order.\n");
+  if (h.nseqs <= 0 || h.tuple_size <= 0 || h.ntuples < 0 || 
+      h.alph_len <= 0 || h.names_len < h.nseqs)
+    die("ERROR: bad header in binary sufficient statistics file.\n");
+  /* check sizes before anything is allocated based on them */
+  if (h.length > INT_MAX || (size_t)h.ntuples * sizeof(double) > size ||
+      (h.has_cat_counts && 
+       (h.ncats <= 0 || 
+        ((size_t)h.ncats + 1) * h.ntuples * sizeof(double) > size)) ||
+      (h.has_order && (size_t)h.length * sizeof(int) > size))
+    die("ERROR: bad header in binary sufficient statistics file.\n");
+
+  alph = smalloc(h.alph_len + 1);
+  memcpy(alph, ss_binary_block(data, size, &pos, h.alph_len, FALSE), 
+         h.alph_len);
+  alph[h.alph_len] = '\0';
+  block = ss_binary_block(data, size, &pos, h.names_len, TRUE);
+  if (block[h.names_len-1] != '\0')
+    die("ERROR: bad sequence names in binary sufficient statistics file.\n");
+  names = smalloc(h.nseqs * sizeof(char*));
+  for (i = 0; i < h.nseqs; i++) {
+    if (block >= data + pos)
+      die("ERROR: bad sequence names in binary sufficient statistics file.\n");
+    names[i] = copy_charstr((char*)block);
+    block += strlen(names[i]) + 1;
+  }
+
+  msa = msa_new(NULL, names, h.nseqs, h.length, 
+                alphabet != NULL ? alphabet : alph);
+                                /* allow alphabet from file to be
+                                   overridden */
+  sfree(alph);
+  if (h.ncats > 0) msa->ncats = h.ncats;
+  msa->idx_offset = h.idx_offset;
+  ss_new(msa, h.tuple_size, h.ntuples, h.has_cat_counts, 0);
+  ss = msa->ss;
+  ss->ntuples = h.ntuples;
+
+  memcpy(ss->counts, ss_binary_block(data, size, &pos, 
+                                     h.ntuples * sizeof(double), FALSE),
+         h.ntuples * sizeof(double));
+  if (h.has_cat_counts)
+    for (j = 0; j <= msa->ncats; j++)
+      memcpy(ss->cat_counts[j], 
+             ss_binary_block(data, size, &pos, h.ntuples * sizeof(double),
+                             FALSE),
+             h.ntuples * sizeof(double));
+  if (h.has_order) {
+    ss->tuple_idx = smalloc(msa->length * sizeof(int));
+    memcpy(ss->tuple_idx, ss_binary_block(data, size, &pos, 
+                                          msa->length * sizeof(int), TRUE),
+           msa->length * sizeof(int));
+    for (i = 0; i < msa->length; i++)
+      if (ss->tuple_idx[i] < 0 || ss->tuple_idx[i] >= h.ntuples)
+        die("ERROR: bad tuple order in binary sufficient statistics file.\n");
+  }
+
+  tuplen = (size_t)h.nseqs * h.tuple_size;
+  block = ss_binary_block(data, size, &pos, tuplen * h.ntuples, FALSE);
+  for (i = 0; i < h.ntuples; i++) {
+    checkInterruptN(i, 10000);
+    ss->col_tuples[i] = smalloc((tuplen + 1) * sizeof(char));
+    memcpy(ss->col_tuples[i], block + i * tuplen, tuplen);
+    ss->col_tuples[i][tuplen] = '\0';
+  }
+
+  if (mapsize > 0) {
+#if !defined(__MINGW32__)
+    munmap(buf, mapsize);
+#endif
+    fseek(F, 0, SEEK_END);
+  }
+  else sfree(buf);
+
+  return msa;
+}
+
 void ss_free_categories(MSA_SS *ss) {
   int j;
   if (ss->cat_counts != NULL) {
@@ -826,9 +1372,12 @@ void ss_free_categories(MSA_SS *ss) {
 /* free all memory associated with a sufficient stats object */
 void ss_free(MSA_SS *ss) {
   int j;
-  for (j = 0; j < ss->alloc_ntuples; j++)
-    sfree(ss->col_tuples[j]);
-  sfree(ss->col_tuples);
+  if (ss->col_tuples != NULL) {
+    for (j = 0; j < ss->alloc_ntuples; j++)
+      sfree(ss->col_tuples[j]);
+    sfree(ss->col_tuples);
+  }
+  if (ss->packed != NULL) ss_packed_free(ss->packed);
   ss_free_categories(ss);
   if (ss->counts != NULL) sfree(ss->counts);
   if (ss->tuple_idx != NULL) sfree(ss->tuple_idx);
@@ -864,8 +1413,9 @@ void ss_update_categories(MSA *msa) {
 /* Shrinks arrays to size ss->ntuples. */
 void ss_compact(MSA_SS *ss) {
   int j;
-  ss->col_tuples = (char**)srealloc(ss->col_tuples, 
-                                    ss->ntuples*sizeof(char*));
+  if (ss->col_tuples != NULL)
+    ss->col_tuples = (char**)srealloc(ss->col_tuples, 
+                                      ss->ntuples*sizeof(char*));
   ss->counts = (double*)srealloc(ss->counts, 
                                 ss->ntuples*sizeof(double));
   for (j = 0; ss->cat_counts != NULL && j <= ss->msa->ncats; j++)
@@ -874,6 +1424,134 @@ void ss_compact(MSA_SS *ss) {
   ss->alloc_ntuples = ss->ntuples;
 }
 
+/* Create an empty store of packed column tuples of the specified
+   length.  Codes are assigned to the characters in 'symbols' (if
+   non-NULL) in order, and to other characters as they are first
+   encountered */
+SSPackedTuples *ss_packed_new(int tuple_len, const char *symbols) {
+  SSPackedTuples *pt = smalloc(sizeof(SSPackedTuples));
+  int i;
+  pt->tuple_len = tuple_len;
+  pt->tuple_bytes = max((tuple_len + 1) / 2, 1);
+  pt->ntuples = 0;
+  pt->alloc_ntuples = 1000;
+  pt->data = smalloc((size_t)pt->alloc_ntuples * pt->tuple_bytes);
+  pt->ncodes = 0;
+  for (i = 0; i < SS_PACKED_NCODES; i++) pt->code_to_char[i] = '\0';
+  for (i = 0; i < 256; i++) pt->char_to_code[i] = -1;
+  for (i = 0; symbols != NULL && symbols[i] != '\0'; i++) {
+    if (pt->char_to_code[(unsigned char)symbols[i]] != -1) continue;
+    if (pt->ncodes == SS_PACKED_NCODES)
+      die("ERROR ss_packed_new: more than %i symbols\n", SS_PACKED_NCODES);
+    pt->code_to_char[pt->ncodes] = symbols[i];
+    pt->char_to_code[(unsigned char)symbols[i]] = (signed char)pt->ncodes++;
+  }
+  return pt;
+}
+
+void ss_packed_free(SSPackedTuples *pt) {
+  sfree(pt->data);
+  sfree(pt);
+}
+
+/* Pack a column tuple into 'dest'.  Returns FALSE if the tuple
+   contains a character for which no code is available (in which case
+   codes may still have been assigned to other new characters) */
+static int ss_packed_encode(SSPackedTuples *pt, const char *coltuple_str,
+                            unsigned char *dest) {
+  int i, code;
+  memset(dest, 0, pt->tuple_bytes);
+  for (i = 0; i < pt->tuple_len; i++) {
+    unsigned char c = (unsigned char)coltuple_str[i];
+    if ((code = pt->char_to_code[c]) == -1) {
+      if (pt->ncodes == SS_PACKED_NCODES) return FALSE;
+      pt->code_to_char[pt->ncodes] = (char)c;
+      code = pt->char_to_code[c] = (signed char)pt->ncodes++;
+    }
+    dest[i >> 1] |= (unsigned char)((i & 1) ? code << 4 : code);
+  }
+  return TRUE;
+}
+
+/* Append a column tuple (even if an equal one is already present).
+   Returns its index, or -1 if it can't be encoded */
+int ss_packed_push(SSPackedTuples *pt, const char *coltuple_str) {
+  unsigned char *dest;
+  if (pt->ntuples == pt->alloc_ntuples) {
+    pt->alloc_ntuples *= 2;
+    pt->data = srealloc(pt->data, (size_t)pt->alloc_ntuples * pt->tuple_bytes);
+  }
+  dest = &pt->data[(size_t)pt->ntuples * pt->tuple_bytes];
+  if (!ss_packed_encode(pt, coltuple_str, dest)) return -1;
+  return pt->ntuples++;
+}
+
+/* Write the string representation of a packed tuple to 'str', which
+   must have room for tuple_len + 1 characters */
+void ss_packed_unpack(SSPackedTuples *pt, int tupleidx, char *str) {
+  int i;
+  for (i = 0; i < pt->tuple_len; i++)
+    str[i] = ss_packed_get_char(pt, tupleidx, i);
+  str[pt->tuple_len] = '\0';
+}
+
+/* Replace the column tuples of an alignment's sufficient statistics
+   by a packed representation.  Returns FALSE (leaving the tuples
+   unchanged) if they contain more than SS_PACKED_NCODES distinct
+   characters */
+int ss_pack_tuples(MSA *msa) {
+  MSA_SS *ss = msa->ss;
+  SSPackedTuples *pt;
+  char symbols[SS_PACKED_NCODES + 1];
+  int i, n = 0;
+
+  if (ss == NULL)
+    die("ERROR ss_pack_tuples: msa->ss is NULL\n");
+  if (ss->packed != NULL) return TRUE;
+
+  /* alphabet, gap, and missing data characters get the first codes */
+  for (i = 0; msa->alphabet[i] != '\0' && n < SS_PACKED_NCODES; i++)
+    symbols[n++] = msa->alphabet[i];
+  if (n < SS_PACKED_NCODES) symbols[n++] = GAP_CHAR;
+  for (i = 0; msa->missing[i] != '\0' && n < SS_PACKED_NCODES; i++)
+    symbols[n++] = msa->missing[i];
+  symbols[n] = '\0';
+
+  pt = ss_packed_new(msa->nseqs * ss->tuple_size, symbols);
+  for (i = 0; i < ss->ntuples; i++) {
+    checkInterruptN(i, 10000);
+    if (ss_packed_push(pt, ss->col_tuples[i]) == -1) {
+      ss_packed_free(pt);
+      return FALSE;
+    }
+  }
+  pt->alloc_ntuples = max(pt->ntuples, 1);
+  pt->data = srealloc(pt->data, (size_t)pt->alloc_ntuples * pt->tuple_bytes);
+
+  for (i = 0; i < ss->alloc_ntuples; i++)
+    if (ss->col_tuples[i] != NULL) sfree(ss->col_tuples[i]);
+  sfree(ss->col_tuples);
+  ss->col_tuples = NULL;
+  ss->packed = pt;
+  return TRUE;
+}
+
+/* Restore the string representation of packed column tuples */
+void ss_unpack_tuples(MSA *msa) {
+  MSA_SS *ss;
+  int i;
+  if (msa->ss == NULL || msa->ss->packed == NULL) return;
+  ss = msa->ss;
+  ss->col_tuples = smalloc(max(ss->alloc_ntuples, 1) * sizeof(char*));
+  for (i = 0; i < ss->ntuples; i++) {
+    ss->col_tuples[i] = smalloc((ss->packed->tuple_len + 1) * sizeof(char));
+    ss_packed_unpack(ss->packed, i, ss->col_tuples[i]);
+  }
+  for (; i < ss->alloc_ntuples; i++) ss->col_tuples[i] = NULL;
+  ss_packed_free(ss->packed);
+  ss->packed = NULL;
+}
+
 /* given an MSA (with or without suff stats), create an alternative
    representation with sufficient statistics of a different tuple
    size.  The new alignment will share the seqs and names of the old
@@ -927,6 +1605,7 @@ MSA *ss_sub_alignment(MSA *msa, char **new_names, List *include_list,
 
   if (msa->ss == NULL)
     die("ERROR: sufficient stats required in ss_sub_alignment.\n");
+  ss_unpack_tuples(msa);
 
   if (!unordered_seqs && msa->ss->tuple_idx == NULL) 
     die("ERROR: ordered sufficient statistics required in ss_sub_alignment.\n");
@@ -1044,6 +1723,7 @@ void ss_reverse_compl(MSA *msa) {
   if (msa->ss == NULL || msa->ss->tuple_idx == NULL)
     die("ERROR ss_reverse_compl: Need ordered sufficient statistics\n");
   ss = msa->ss;
+  ss_unpack_tuples(msa);
 
   if (msa->categories == NULL && ss->cat_counts != NULL)
     fprintf(stderr, "WARNING: ss_reverse_compl cannot address category-specific counts without a\ncategories vector.  Ignoring category counts.  They will be wrong!\n");
@@ -1152,6 +1832,7 @@ void ss_reorder_rows(MSA *msa, int *new_to_old, int new_nseqs) {
   int ts = msa->ss->tuple_size;
   char tmp[msa->nseqs * ts];
   int col_offset, j, tup;
+  ss_unpack_tuples(msa);
   for (tup = 0; tup < msa->ss->ntuples; tup++) {
     checkInterruptN(tup, 10000);
     strncpy(tmp, msa->ss->col_tuples[tup], msa->nseqs * ts);
@@ -1176,6 +1857,7 @@ void ss_reorder_rows(MSA *msa, int *new_to_old, int new_nseqs) {
 void ss_remove_zero_counts(MSA *msa) {
   int i, cat, new_ntuples = 0;
   int *old_to_new = smalloc(msa->ss->ntuples * sizeof(int));
+  ss_unpack_tuples(msa);
 
   for (i = 0; i < msa->ss->ntuples; i++) {
     checkInterruptN(i, 10000);
@@ -1212,6 +1894,7 @@ void ss_unique(MSA *msa) {
   Hashtable *hash = hsh_new(msa->ss->ntuples);
   int i, idx, cat;
   int *old_to_new = smalloc(msa->ss->ntuples * sizeof(int));
+  ss_unpack_tuples(msa);
   key[msa->nseqs * msa->ss->tuple_size] = '\0';
 
   for (i = 0; i < msa->ss->ntuples; i++) {
@@ -1246,6 +1929,7 @@ void ss_unique(MSA *msa) {
 void ss_collapse_missing(MSA *msa, int do_gaps) {
   int i, j, len = msa->nseqs * msa->ss->tuple_size;
   int changed_missing = FALSE, changed_gaps = FALSE, exists_missing = FALSE;
+  ss_unpack_tuples(msa);
   for (i = 0; i < msa->ss->ntuples; i++) {
     checkInterruptN(i, 10000);
     for (j = 0; j < len; j++) {
@@ -1421,6 +2105,7 @@ void ss_reduce_tuple_size(MSA *msa, int new_tuple_size) {
   int i, j, k, newlen;
   if (new_tuple_size >= msa->ss->tuple_size)
     die("ERROR: new tuple size must be smaller than old in ss_reduce_tuple_size.\n");
+  ss_unpack_tuples(msa);
   newlen = msa->nseqs * new_tuple_size;
   for (i = 0; i < msa->ss->ntuples; i++)  {
     checkInterruptN(i, 10000);
@@ -1437,25 +2122,8 @@ void ss_reduce_tuple_size(MSA *msa, int new_tuple_size) {
 }
 
 int ss_lookup_coltuple(char *coltuple_str, Hashtable *tuple_hash, MSA *msa) {
-  int allgap[msa->ss->tuple_size], i, j, rv, tuple_size, len;
+  int i = ss_coltuple_keylen(coltuple_str, msa), rv;
   char tempchar;
-  tuple_size = msa->ss->tuple_size;
-  len = tuple_size * msa->nseqs;
-  for (i=0; i < tuple_size; i++) {
-    for (j=0; j<msa->nseqs; j++)
-      if (coltuple_str[j*tuple_size + i]!=GAP_CHAR &&
-	  coltuple_str[j*tuple_size + i]!=msa->missing[0]) break;
-    allgap[i] = (j == msa->nseqs);
-  }
-  for (i=len-1; i>=0; i--) {
-/*     fprintf(stderr, "i %d, coltuple_str %s, coltuple_str[i] %c, msa->missing[0] %c, allgap[i tuple_size] %d\n", */
-/* 	    i, coltuple_str, coltuple_str[i], msa->missing[0], */
-/* 	    allgap[i%tuple_size]); */
-    if (coltuple_str[i] != msa->missing[0] && allgap[i%tuple_size]==0)
-      break;
-  }
-  i++;
-  while (i%msa->ss->tuple_size != 0) i++;
   tempchar = coltuple_str[i];
   coltuple_str[i] = '\0';
   rv = hsh_get_int(tuple_hash, coltuple_str);
@@ -1465,24 +2133,8 @@ int ss_lookup_coltuple(char *coltuple_str, Hashtable *tuple_hash, MSA *msa) {
 
 void ss_add_coltuple(char *coltuple_str, void *val, Hashtable *tuple_hash, 
 		     MSA *msa) {
-  int allgap[msa->ss->tuple_size], i, j, tuple_size, len;
+  int i = ss_coltuple_keylen(coltuple_str, msa);
   char tempchar;
-  tuple_size = msa->ss->tuple_size;
-  len = tuple_size * msa->nseqs;
-
-  for (i=0; i < tuple_size; i++) {
-    for (j=0; j<msa->nseqs; j++)
-      if (coltuple_str[j*tuple_size + i]!=GAP_CHAR &&
-	  coltuple_str[j*tuple_size + i]!=msa->missing[0]) break;
-    allgap[i] = (j==msa->nseqs);
-  }
-
-  for (i=len-1; i>=0; i--)
-    if (coltuple_str[i] != msa->missing[0] && allgap[i%tuple_size]==0)
-      break;
-  i++;
-
-  while (i%msa->ss->tuple_size != 0) i++;
   /* Until 1-27-2009, tempchar was not being stored! This bug took three months
      to find and wreaked havoc with dmsample! --agd27 */
   tempchar = coltuple_str[i];
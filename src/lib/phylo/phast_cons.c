@@ -18,12 +18,14 @@
 #include <phast_dgamma.h>
 #include <phast_tree_likelihoods.h>
 #include <phast_maf.h>
+#include <phast_wig.h>
 #include "phast_cons.h"
 
 
 struct phastCons_struct *phastCons_struct_new(int rphast) {
   struct phastCons_struct *p = smalloc(sizeof(struct phastCons_struct));
   p->post_probs = TRUE;
+  p->post_probs_binary = FALSE;
   p->score = FALSE;
   p->gff = FALSE;
   p->FC = FALSE;
@@ -39,6 +41,8 @@ struct phastCons_struct *phastCons_struct_new(int rphast) {
   p->set_transitions = FALSE;
   p->nrates = -1;
   p->nrates2 = -1;
+  p->window_size = 0;
+  p->window_overlap = 0;
   p->refidx = 1;
   p->max_micro_indel = 20;
   p->lambda = 0.9;
@@ -82,12 +86,13 @@ struct phastCons_struct *phastCons_struct_new(int rphast) {
 
 
 int phastCons(struct phastCons_struct *p) {
-  int post_probs, score, quiet, gff, FC, estim_lambda,
+  int post_probs, post_probs_binary, score, quiet, gff, FC, estim_lambda,
     estim_transitions, two_state, indels,
     indels_only, estim_indels,
     estim_trees, ignore_missing, estim_rho, set_transitions,
     nummod, viterbi, compute_likelihood;
-  int nrates, nrates2, refidx, max_micro_indel, free_cm=0;
+  int nrates, nrates2, refidx, max_micro_indel, window_size, window_overlap,
+    free_cm=0;
   double lambda, mu, nu, alpha_0, beta_0, tau_0, alpha_1, beta_1, tau_1,
     gc, gamma, rho, omega;
   FILE *viterbi_f, *lnl_f, *log_f, *post_probs_f, *results_f;
@@ -112,6 +117,7 @@ int phastCons(struct phastCons_struct *p) {
 
   msa = p->msa;
   post_probs = p->post_probs;
+  post_probs_binary = p->post_probs_binary;
   score = p->score;
   gff = p->gff;
   FC = p->FC;
@@ -127,6 +133,8 @@ int phastCons(struct phastCons_struct *p) {
   set_transitions = p->set_transitions;
   nrates = p->nrates;
   nrates2 = p->nrates2;
+  window_size = p->window_size;
+  window_overlap = p->window_overlap;
   refidx = p->refidx;
   max_micro_indel = p->max_micro_indel;
   lambda = p->lambda;
@@ -355,6 +363,8 @@ int phastCons(struct phastCons_struct *p) {
   else indel_mode = NONPARAMETERIC;
 
   phmm = phmm_new(hmm, mod, cm, pivot_states, indel_mode);
+  phmm->window_size = window_size;
+  phmm->window_overlap = window_overlap;
 
   if (FC) {
     if (!quiet)
@@ -376,6 +386,10 @@ int phastCons(struct phastCons_struct *p) {
   }
   if (free_cm) cm_free(cm);
 
+  /* from here on, column tuples are only accessed character by
+     character, so they can be stored compactly */
+  if (msa->ss != NULL) ss_pack_tuples(msa);
+
   /* compute emissions */
   phmm_compute_emissions(phmm, msa, quiet);
 
@@ -532,6 +546,8 @@ int phastCons(struct phastCons_struct *p) {
   /* posterior probs */
   if (post_probs) {
     int *coord=NULL;
+    WigWriter *ww = post_probs_f == NULL ? NULL :
+      ww_new(post_probs_f, post_probs_binary);
 
     if (!quiet) fprintf(results_f, "Computing posterior probabilities...\n");
 
@@ -552,15 +568,15 @@ int phastCons(struct phastCons_struct *p) {
 	checkInterruptN(j, 1000);
 	if (refidx == 0 || msa_get_char(msa, refidx-1, j) != GAP_CHAR) {
 	  if (!msa_missing_col(msa, refidx, j)) {
-	    if (post_probs_f != NULL) {
+	    if (ww != NULL) {
 	      if (k > last + 1)
-		fprintf(post_probs_f, "fixedStep chrom=%s start=%d step=1\n", seqname,
-			k + msa->idx_offset + 1);
+		ww_fixed_step(ww, seqname, k + msa->idx_offset + 1);
 	      for (l=0; l < phmm->hmm->nstates; l++) {
-		if (l != 0) fprintf(post_probs_f, "\t");
-		fprintf(post_probs_f, "%.3f%c", postprobs[l][j],
-			l==phmm->hmm->nstates-1 ? '\n' : '\t');
+		if (l != 0) ww_text(ww, "\t");
+		ww_dbl(ww, postprobs[l][j], 3);
+		if (l != phmm->hmm->nstates-1) ww_text(ww, "\t");
 	      }
+	      ww_end_row(ww);
 	    }
 	    if (results != NULL) {
 	      coord[idx] = k + msa->idx_offset + 1;
@@ -610,11 +626,11 @@ int phastCons(struct phastCons_struct *p) {
 	checkInterruptN(j, 1000);
 	if (refidx == 0 || msa_get_char(msa, refidx-1, j) != GAP_CHAR) {
 	  if (!msa_missing_col(msa, refidx, j)) {
-	    if (post_probs_f != NULL) {
+	    if (ww != NULL) {
 	      if (k > last + 1)
-		fprintf(post_probs_f, "fixedStep chrom=%s start=%d step=1\n", seqname,
-			k + msa->idx_offset + 1);
-	      fprintf(post_probs_f, "%.3f\n", postprobs[j]);
+		ww_fixed_step(ww, seqname, k + msa->idx_offset + 1);
+	      ww_dbl(ww, postprobs[j], 3);
+	      ww_end_row(ww);
 	    }
 	    if (results != NULL) {
 	      coord[idx] = k + msa->idx_offset + 1;
@@ -636,6 +652,7 @@ int phastCons(struct phastCons_struct *p) {
       }
       sfree(postprobs);
     }
+    if (ww != NULL) ww_free(ww);
   }
 
   if (compute_likelihood) {
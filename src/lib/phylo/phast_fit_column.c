@@ -17,7 +17,14 @@
 #include <phast_fit_column.h>
 #include <phast_sufficient_stats.h>
 #include <phast_tree_likelihoods.h>
+#include <phast_likelihood_kernels.h>
+#include <phast_workspace.h>
+#include <phast_threads.h>
+#include <phast_tuple_cache.h>
+#include <phast_dgamma.h>
+#include <phast_stringsplus.h>
 #include <time.h>
+#include <unistd.h>
 
 #define DERIV_EPSILON 1e-6
 /* for numerical computation of derivatives */
@@ -25,20 +32,78 @@
 #define NSAMPLES_FIM 50
 /* number of samples to use in estimating FIM */
 
+#define FIM_CACHE_VERSION 1
+/* version of format of FIM cache files (see col_set_fim_cache) */
+
 #define SIGFIGS 4
 /* number of significant figures to which to estimate column scale
    parameters (currently affects 1d parameter estimation only) */
 
-/* Compute and return the log likelihood of a tree model with respect
-   to a single column tuple in an alignment.  This is a pared-down
-   version of tl_compute_log_likelihood for use in estimation of
-   base-by-base scale factors.  It assumes a 0th order model,
-   leaf-to-sequence mapping already available, prob matrices computed,
-   sufficient stats already available.  Note that this function uses
-   natural log rather than log2.  This function does allow for rate
-   variation. */
-double col_compute_likelihood(TreeModel *mod, MSA *msa, int tupleidx,
-                                  double **scratch) {
+/* Version of col_compute_likelihood for models with specialized
+   pruning kernels (see phast_likelihood_kernels.h).  Partial
+   likelihoods are kept in the current workspace, node by node, and
+   substitution matrices are packed as they are needed.  The
+   probability of each rate category is stored in rcat_prob, scaled by
+   2^-rcat_exp[rcat] (rcat_exp is always 0 unless
+   mod->rescale_partials is TRUE), and the terms of these
+   probabilities are also added to total_prob in order */
+static void col_compute_likelihood_packed(TreeModel *mod, MSA *msa,
+                                          int tupleidx, double *rcat_prob,
+                                          int *rcat_exp, double *total_prob) {
+  int i, nodeidx, rcat;
+  int nstates = mod->rate_matrix->size;
+  TreeNode *n;
+  List *traversal = tr_postorder(mod->tree);
+  PhastWorkspace *ws = ws_current();
+  double *pL = ws_vec(ws, &ws->col_partials,
+                      (mod->tree->nnodes+1) * nstates)->data;
+  double lP[nstates * nstates], rP[nstates * nstates];
+
+  for (rcat = 0; rcat < mod->nratecats; rcat++) {
+    rcat_exp[rcat] = 0;
+    for (nodeidx = 0; nodeidx < lst_size(traversal); nodeidx++) {
+      n = lst_get_ptr(traversal, nodeidx);
+      if (n->lchild == NULL) {
+        /* leaf: base case of recursion */
+        int state = mod->rate_matrix->
+          inv_states[(int)ss_get_char_tuple(msa, tupleidx,
+                                            mod->msa_seq_idx[n->id], 0)];
+        for (i = 0; i < nstates; i++) {
+          if (state < 0 || i == state)
+            pL[n->id * nstates + i] = 1;
+          else
+            pL[n->id * nstates + i] = 0;
+        }
+      }
+      else {
+        /* general recursive case */
+        lk_pack_matrix(lP, mod->P[n->lchild->id][rcat]->matrix);
+        lk_pack_matrix(rP, mod->P[n->rchild->id][rcat]->matrix);
+        lk_prune(nstates, &pL[n->id * nstates],
+                 &pL[n->lchild->id * nstates], lP,
+                 &pL[n->rchild->id * nstates], rP);
+        if (mod->rescale_partials)
+          rcat_exp[rcat] += tl_rescale(&pL[n->id * nstates], nstates);
+      }
+    }
+
+    /* termination (for each rate cat) */
+    rcat_prob[rcat] = 0;
+    for (i = 0; i < nstates; i++) {
+      double term = vec_get(mod->backgd_freqs, i) *
+        pL[mod->tree->id * nstates + i] * mod->freqK[rcat];
+      rcat_prob[rcat] += term;
+      *total_prob += term;
+    }
+  }
+}
+
+/* Compute the likelihood of a column tuple, scaled by 2^-scale_exp.
+   Without rescaling (see mod->rescale_partials), scale_exp is always
+   0.  See col_compute_likelihood for notes. */
+static double col_compute_scaled_likelihood(TreeModel *mod, MSA *msa,
+                                            int tupleidx, double **scratch,
+                                            int *scale_exp) {
 
   int i, j, k, nodeidx, rcat;
   int nstates = mod->rate_matrix->size;
@@ -46,6 +111,8 @@ double col_compute_likelihood(TreeModel *mod, MSA *msa, int tupleidx,
   double total_prob = 0;
   List *traversal = tr_postorder(mod->tree);
   double **pL = NULL;
+  double rcat_prob[mod->nratecats];
+  int rcat_exp[mod->nratecats];
 
   if (msa->ss->tuple_size != 1)
     die("ERROR col_compute_likelihood: need tuple size 1, got %i\n",
@@ -56,63 +123,111 @@ double col_compute_likelihood(TreeModel *mod, MSA *msa, int tupleidx,
   if (!mod->allow_gaps)
     die("ERROR col_compute_likelihood: need mod->allow_gaps to be TRUE\n");
 
-  /* allocate memory or use scratch if avail */
-  if (scratch != NULL)
-    pL = scratch;
+  if (lk_has_kernel(nstates))
+    col_compute_likelihood_packed(mod, msa, tupleidx, rcat_prob, rcat_exp,
+                                  &total_prob);
   else {
-    pL = smalloc(nstates * sizeof(double*));
-    for (j = 0; j < nstates; j++)
-      pL[j] = smalloc((mod->tree->nnodes+1) * sizeof(double));
-  }
+    /* allocate memory or use scratch if avail */
+    if (scratch != NULL)
+      pL = scratch;
+    else {
+      pL = smalloc(nstates * sizeof(double*));
+      for (j = 0; j < nstates; j++)
+        pL[j] = smalloc((mod->tree->nnodes+1) * sizeof(double));
+    }
 
-  for (rcat = 0; rcat < mod->nratecats; rcat++) {
-    for (nodeidx = 0; nodeidx < lst_size(traversal); nodeidx++) {
-      n = lst_get_ptr(traversal, nodeidx);
-      if (n->lchild == NULL) {
-        /* leaf: base case of recursion */
-        int state = mod->rate_matrix->
-          inv_states[(int)ss_get_char_tuple(msa, tupleidx,
-                                            mod->msa_seq_idx[n->id], 0)];
-        for (i = 0; i < nstates; i++) {
-          if (state < 0 || i == state)
-            pL[i][n->id] = 1;
-          else
-            pL[i][n->id] = 0;
+    for (rcat = 0; rcat < mod->nratecats; rcat++) {
+      rcat_exp[rcat] = 0;
+      for (nodeidx = 0; nodeidx < lst_size(traversal); nodeidx++) {
+        n = lst_get_ptr(traversal, nodeidx);
+        if (n->lchild == NULL) {
+          /* leaf: base case of recursion */
+          int state = mod->rate_matrix->
+            inv_states[(int)ss_get_char_tuple(msa, tupleidx,
+                                              mod->msa_seq_idx[n->id], 0)];
+          for (i = 0; i < nstates; i++) {
+            if (state < 0 || i == state)
+              pL[i][n->id] = 1;
+            else
+              pL[i][n->id] = 0;
+          }
         }
-      }
-      else {
-        /* general recursive case */
-        MarkovMatrix *lsubst_mat = mod->P[n->lchild->id][rcat];
-        MarkovMatrix *rsubst_mat = mod->P[n->rchild->id][rcat];
-        for (i = 0; i < nstates; i++) {
-          double totl = 0, totr = 0;
-          for (j = 0; j < nstates; j++)
-            totl += pL[j][n->lchild->id] *
-              mm_get(lsubst_mat, i, j);
+        else {
+          /* general recursive case */
+          MarkovMatrix *lsubst_mat = mod->P[n->lchild->id][rcat];
+          MarkovMatrix *rsubst_mat = mod->P[n->rchild->id][rcat];
+          double maxval = 0;
+          for (i = 0; i < nstates; i++) {
+            double totl = 0, totr = 0;
+            for (j = 0; j < nstates; j++)
+              totl += pL[j][n->lchild->id] *
+                mm_get(lsubst_mat, i, j);
 
-          for (k = 0; k < nstates; k++)
-            totr += pL[k][n->rchild->id] *
-              mm_get(rsubst_mat, i, k);
+            for (k = 0; k < nstates; k++)
+              totr += pL[k][n->rchild->id] *
+                mm_get(rsubst_mat, i, k);
 
-          pL[i][n->id] = totl * totr;
+            pL[i][n->id] = totl * totr;
+            if (pL[i][n->id] > maxval) maxval = pL[i][n->id];
+          }
+
+          /* rescale if necessary (see tl_rescale) */
+          if (mod->rescale_partials && maxval > 0 &&
+              maxval < TL_RESCALE_THRESHOLD) {
+            int e;
+            frexp(maxval, &e);
+            for (i = 0; i < nstates; i++)
+              pL[i][n->id] = ldexp(pL[i][n->id], -e);
+            rcat_exp[rcat] += e;
+          }
         }
       }
+
+      /* termination (for each rate cat) */
+      rcat_prob[rcat] = 0;
+      for (i = 0; i < nstates; i++) {
+        double term = vec_get(mod->backgd_freqs, i) *
+          pL[i][mod->tree->id] * mod->freqK[rcat];
+        rcat_prob[rcat] += term;
+        total_prob += term;
+      }
     }
 
-    /* termination (for each rate cat) */
-    for (i = 0; i < nstates; i++)
-      total_prob += vec_get(mod->backgd_freqs, i) *
-        pL[i][mod->tree->id] * mod->freqK[rcat];
+    if (scratch == NULL) {
+      for (j = 0; j < nstates; j++) sfree(pL[j]);
+      sfree(pL);
+    }
   }
 
-  if (scratch == NULL) {
-    for (j = 0; j < nstates; j++) sfree(pL[j]);
-    sfree(pL);
+  /* with rescaling, rate categories must be brought to a common
+     scale before their probabilities are summed */
+  *scale_exp = 0;
+  if (mod->rescale_partials) {
+    *scale_exp = tl_common_scale(rcat_prob, rcat_exp, mod->nratecats);
+    total_prob = 0;
+    for (rcat = 0; rcat < mod->nratecats; rcat++)
+      total_prob += rcat_prob[rcat];
   }
 
   return(total_prob);
 }
 
+/* Compute and return the log likelihood of a tree model with respect
+   to a single column tuple in an alignment.  This is a pared-down
+   version of tl_compute_log_likelihood for use in estimation of
+   base-by-base scale factors.  It assumes a 0th order model,
+   leaf-to-sequence mapping already available, prob matrices computed,
+   sufficient stats already available.  Note that this function uses
+   natural log rather than log2.  This function does allow for rate
+   variation. */
+double col_compute_likelihood(TreeModel *mod, MSA *msa, int tupleidx,
+                                  double **scratch) {
+  int scale_exp;
+  double prob = col_compute_scaled_likelihood(mod, msa, tupleidx, scratch,
+                                              &scale_exp);
+  return ldexp(prob, scale_exp);
+}
+
 
 
 /* See col_compute_likelihood above for notes.
@@ -120,7 +235,10 @@ double col_compute_likelihood(TreeModel *mod, MSA *msa, int tupleidx,
  */
 double col_compute_log_likelihood(TreeModel *mod, MSA *msa, int tupleidx,
                                   double **scratch) {
-  return log(col_compute_likelihood(mod, msa, tupleidx, scratch));
+  int scale_exp;
+  double prob = col_compute_scaled_likelihood(mod, msa, tupleidx, scratch,
+                                              &scale_exp);
+  return log(prob) + scale_exp * M_LN2;
 }
 
 
@@ -736,6 +854,283 @@ double col_deriv2_wrapper_1d(double x, void *data, double lb, double ub) {
   return d->deriv2;
 }
 
+/* number of tuples handed to a worker thread at a time */
+#define COL_THREAD_GRAIN 8
+
+int col_nworkers(MSA *msa) {
+  return thr_nworkers(msa->ss->ntuples, COL_THREAD_GRAIN);
+}
+
+ColWorker **col_new_workers(TreeModel *mod, MSA *msa, scale_type stype,
+                            mode_type mode, int nworkers) {
+  ColWorker **w = smalloc(nworkers * sizeof(ColWorker*));
+  int i;
+
+  /* copy models before fit data is set up for the original */
+  for (i = 0; i < nworkers; i++) {
+    w[i] = smalloc(sizeof(ColWorker));
+    w[i]->mod = (i == 0 ? mod : tm_create_copy(mod));
+    w[i]->modcpy = NULL;
+    w[i]->d2 = NULL;
+    if (stype == SUBTREE) {
+      w[i]->modcpy = tm_create_copy(mod);
+      w[i]->modcpy->subtree_root = NULL;
+    }
+  }
+
+  for (i = 0; i < nworkers; i++) {
+    if (stype == ALL)
+      w[i]->d = col_init_fit_data(w[i]->mod, msa, ALL, mode, FALSE);
+    else {
+      w[i]->d = col_init_fit_data(w[i]->modcpy, msa, ALL, NNEUT, FALSE);
+      w[i]->d2 = col_init_fit_data(w[i]->mod, msa, SUBTREE, mode, FALSE);
+    }
+  }
+  return w;
+}
+
+void col_free_workers(ColWorker **w, int nworkers) {
+  int i;
+  for (i = 0; i < nworkers; i++) {
+    col_free_fit_data(w[i]->d);
+    if (w[i]->d2 != NULL) col_free_fit_data(w[i]->d2);
+    if (w[i]->modcpy != NULL) {
+      w[i]->modcpy->estimate_branchlens = TM_BRANCHLENS_ALL;
+                                /* have to revert for tm_free to work
+                                   correctly */
+      tm_free(w[i]->modcpy);
+    }
+    if (i > 0) {
+      w[i]->mod->estimate_branchlens = TM_BRANCHLENS_ALL;
+      tm_free(w[i]->mod);
+    }
+    sfree(w[i]);
+  }
+  sfree(w);
+}
+
+/* data for col_tuple_block */
+typedef struct {
+  col_tuple_fun fun;
+  void *data;
+} ColTupleLoop;
+
+/* worker function for thr_foreach (see col_foreach_tuple) */
+static void col_tuple_block(void *data, int start, int end, int thread) {
+  ColTupleLoop *l = data;
+  int i;
+  for (i = start; i < end; i++)
+    l->fun(l->data, i, thread);
+}
+
+void col_foreach_tuple(MSA *msa, col_tuple_fun fun, void *data) {
+  ColTupleLoop l;
+  l.fun = fun;
+  l.data = data;
+  thr_foreach(msa->ss->ntuples, COL_THREAD_GRAIN, col_tuple_block, &l);
+}
+
+/* maximum number of per-tuple outputs of a test */
+#define COL_MAX_OUTPUTS 5
+
+/* directory of tuple results cache, or NULL (see col_set_cache_dir) */
+static char *col_cache_dir = NULL;
+
+static const char *col_mode_names[] = {"CON", "ACC", "NNEUT", "CONACC"};
+
+void col_set_cache_dir(const char *dir) {
+  if (col_cache_dir != NULL) sfree(col_cache_dir);
+  col_cache_dir = (dir == NULL ? NULL : copy_charstr(dir));
+}
+
+/* prefix of FIM cache files, or NULL (see col_set_fim_cache) */
+static char *col_fim_prefix = NULL;
+
+/* resolution of FIM grids (see col_set_fim_grid) */
+static double col_gridsize1 = GRIDSIZE1, col_gridsize2 = GRIDSIZE2,
+  col_gridmaxlog = GRIDMAXLOG;
+
+void col_set_fim_cache(const char *prefix) {
+  if (col_fim_prefix != NULL) sfree(col_fim_prefix);
+  col_fim_prefix = (prefix == NULL ? NULL : copy_charstr(prefix));
+}
+
+void col_set_fim_grid(double gridsize1, double gridsize2, double maxlog) {
+  if (gridsize1 <= 0 || gridsize1 > 1 || gridsize2 <= 0 || maxlog < 0)
+    die("ERROR col_set_fim_grid: bad grid resolution (%g, %g, %g)\n",
+        gridsize1, gridsize2, maxlog);
+  col_gridsize1 = gridsize1;
+  col_gridsize2 = gridsize2;
+  col_gridmaxlog = maxlog;
+}
+
+/* data shared by workers in col_lrts, col_lrts_sub, col_score_tests,
+   col_score_tests_sub and col_gerp.  Output arrays that are not used
+   by a given test are NULL */
+typedef struct {
+  ColWorker **w;
+  MSA *msa;
+  mode_type mode;
+  FILE *logf;
+  List *inside, *outside;       /* leaves inside and outside subtree */
+  double fim;                   /* FIM (col_score_tests) */
+  FimGrid *grid;                /* FIM grid (col_score_tests_sub) */
+  int **has_data;               /* per-worker scratch (col_gerp) */
+  double *pvals, *scales, *null_scales, *sub_scales, *llrs, *derivs,
+    *sub_derivs, *teststats, *nneut, *nobs, *nrejected, *nspec;
+
+  /* tuple results cache (see col_cache_begin) */
+  TupleCache *cache;
+  char *keys;                   /* key of tuple i at keys[i*(keylen+1)] */
+  int keylen;
+  int *cached;                  /* TRUE for tuples found in cache */
+  double **outs[COL_MAX_OUTPUTS]; /* outputs stored in cache */
+  int nouts;
+  int scratch[COL_MAX_OUTPUTS]; /* TRUE if outs[j] is scratch memory */
+} ColTestData;
+
+/* Consult the tuple results cache, if one is in use (see
+   col_set_cache_dir), before any tuples are scored.  The outputs of
+   the test are given as the addresses of fields of td, in a fixed
+   order; those that are NULL are given scratch arrays so that
+   complete records can be stored.  Outputs of tuples found in the
+   cache are filled in, and the tuples are marked in td->cached so
+   that the per-tuple functions skip them.  Must be called after the
+   workers are created, so that mod->msa_seq_idx is available.
+   Returns the number of tuples that remain to be scored */
+static int col_cache_begin(ColTestData *td, TreeModel *mod, const char *test,
+                           double **outs[], int nouts) {
+  MSA *msa = td->msa;
+  char *name;
+  double vals[COL_MAX_OUTPUTS];
+  int i, j, nleft = msa->ss->ntuples;
+
+  td->cache = NULL;
+  if (col_cache_dir == NULL) return nleft;
+
+  name = smalloc((strlen(test) + 20) * sizeof(char));
+  sprintf(name, "%s.%s", test, col_mode_names[td->mode]);
+  td->cache = tc_open(col_cache_dir, mod, name, nouts);
+  sfree(name);
+
+  td->nouts = nouts;
+  for (j = 0; j < nouts; j++) {
+    td->outs[j] = outs[j];
+    td->scratch[j] = (*outs[j] == NULL);
+    if (td->scratch[j])
+      *outs[j] = smalloc(msa->ss->ntuples * sizeof(double));
+  }
+
+  td->keylen = tc_key_len(mod);
+  td->keys = smalloc(msa->ss->ntuples * (td->keylen + 1) * sizeof(char));
+  td->cached = smalloc(msa->ss->ntuples * sizeof(int));
+  for (i = 0; i < msa->ss->ntuples; i++) {
+    char *key = &td->keys[i * (td->keylen + 1)];
+    tc_tuple_key(mod, msa, i, key);
+    td->cached[i] = tc_lookup(td->cache, key, vals);
+    if (td->cached[i]) {
+      for (j = 0; j < nouts; j++)
+        (*outs[j])[i] = vals[j];
+      nleft--;
+    }
+  }
+  return nleft;
+}
+
+/* Add newly scored tuples to the cache and save it, then release the
+   state set up by col_cache_begin */
+static void col_cache_end(ColTestData *td) {
+  double vals[COL_MAX_OUTPUTS];
+  int i, j;
+
+  if (td->cache == NULL) return;
+
+  for (i = 0; i < td->msa->ss->ntuples; i++) {
+    if (td->cached[i]) continue;
+    for (j = 0; j < td->nouts; j++)
+      vals[j] = (*td->outs[j])[i];
+    tc_add(td->cache, &td->keys[i * (td->keylen + 1)], vals);
+  }
+  tc_save(td->cache);
+
+  for (j = 0; j < td->nouts; j++) {
+    if (td->scratch[j]) {
+      sfree(*td->outs[j]);
+      *td->outs[j] = NULL;
+    }
+  }
+  sfree(td->keys);
+  sfree(td->cached);
+  tc_free(td->cache);
+  td->cache = NULL;
+}
+
+/* LRT for a single tuple (see col_lrts) */
+static void col_lrts_tuple(void *data, int i, int thread) {
+  ColTestData *td = data;
+  ColFitData *d = td->w[thread]->d;
+  TreeModel *mod = d->mod;
+  MSA *msa = td->msa;
+  mode_type mode = td->mode;
+  double null_lnl, alt_lnl, delta_lnl, this_scale = 1;
+
+  checkInterruptN(i, 100);
+  if (td->cache != NULL && td->cached[i]) return;
+
+  /* first check for actual substitution data in column; if none,
+     don't waste time computing likelihoods */
+  if (!col_has_data(mod, msa, i)) {
+    delta_lnl = 0;
+    this_scale = 1;
+  }
+
+  else {                      /* compute null and alt lnl */
+    mod->scale = 1;
+    tm_set_subst_matrices(mod);
+
+    /* compute log likelihoods under null and alt hypotheses */
+    null_lnl = col_compute_log_likelihood(mod, msa, i, d->fels_scratch[0]);
+
+    vec_set(d->params, 0, d->init_scale);
+    d->tupleidx = i;
+
+    opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
+                  &alt_lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
+                  td->logf, NULL, NULL);
+    /* turns out to be faster (roughly 15% in limited experiments)
+       to use numerical rather than exact derivatives */
+
+    alt_lnl *= -1;
+    this_scale = d->params->data[0];
+
+    delta_lnl = alt_lnl - null_lnl;
+    if (delta_lnl <= -0.01)
+      die("ERROR col_lrts: delta_lnl = %e < -0.01\n", delta_lnl);
+    if (delta_lnl < 0) delta_lnl = 0;
+  } /* end estimation of delta_lnl */
+
+  /* compute p-vals via chi-sq */
+  if (td->pvals != NULL) {
+    if (mode == NNEUT || mode == CONACC)
+      td->pvals[i] = chisq_cdf(2*delta_lnl, 1, FALSE);
+    else
+      td->pvals[i] = half_chisq_cdf(2*delta_lnl, 1, FALSE);
+      /* assumes 50:50 mix of chisq and point mass at zero, due to
+         bounding of param */
+
+    if (td->pvals[i] < 1e-20)
+      td->pvals[i] = 1e-20;
+    /* approx limit of eval of tail prob; pvals of 0 cause problems */
+
+    if (mode == CONACC && this_scale > 1)
+      td->pvals[i] *= -1; /* mark as acceleration */
+  }
+
+  /* store scales and log likelihood ratios if necessary */
+  if (td->scales != NULL) td->scales[i] = this_scale;
+  if (td->llrs != NULL) td->llrs[i] = delta_lnl;
+}
+
 /* Perform a likelihood ratio test for each column tuple in an
    alignment, comparing the given null model with an alternative model
    that has a free scaling parameter for all branches.  Assumes a 0th
@@ -748,72 +1143,109 @@ double col_deriv2_wrapper_1d(double x, void *data, double lb, double ub) {
    (for 1 <= scale), NNEUT (0 <= scale), or CONACC (0 <= scale) */
 void col_lrts(TreeModel *mod, MSA *msa, mode_type mode, double *tuple_pvals,
               double *tuple_scales, double *tuple_llrs, FILE *logf) {
-  int i;
-  ColFitData *d;
-  double null_lnl, alt_lnl, delta_lnl, this_scale = 1;
-
-  /* init ColFitData */
-  d = col_init_fit_data(mod, msa, ALL, mode, FALSE);
+  ColTestData td = {0};
+  int nworkers = col_nworkers(msa);
+
+  /* init ColFitData (one per worker) */
+  td.w = col_new_workers(mod, msa, ALL, mode, nworkers);
+  td.msa = msa;
+  td.mode = mode;
+  td.logf = logf;
+  td.pvals = tuple_pvals;
+  td.scales = tuple_scales;
+  td.llrs = tuple_llrs;
+
+  {
+    double **outs[] = {&td.pvals, &td.scales, &td.llrs};
+    col_cache_begin(&td, mod, "lrt", outs, 3);
+  }
 
   /* iterate through column tuples */
-  for (i = 0; i < msa->ss->ntuples; i++) {
-    checkInterruptN(i, 100);
+  col_foreach_tuple(msa, col_lrts_tuple, &td);
 
-    /* first check for actual substitution data in column; if none,
-       don't waste time computing likelihoods */
-    if (!col_has_data(mod, msa, i)) {
-      delta_lnl = 0;
-      this_scale = 1;
-    }
-
-    else {                      /* compute null and alt lnl */
-      mod->scale = 1;
-      tm_set_subst_matrices(mod);
-
-      /* compute log likelihoods under null and alt hypotheses */
-      null_lnl = col_compute_log_likelihood(mod, msa, i, d->fels_scratch[0]);
-
-      vec_set(d->params, 0, d->init_scale);
-      d->tupleidx = i;
-
-      opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
-                    &alt_lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
-                    logf, NULL, NULL);
-      /* turns out to be faster (roughly 15% in limited experiments)
-         to use numerical rather than exact derivatives */
-
-      alt_lnl *= -1;
-      this_scale = d->params->data[0];
+  col_cache_end(&td);
+  col_free_workers(td.w, nworkers);
+}
 
-      delta_lnl = alt_lnl - null_lnl;
-      if (delta_lnl <= -0.01)
-	die("ERROR col_lrts: delta_lnl = %e < -0.01\n", delta_lnl);
-      if (delta_lnl < 0) delta_lnl = 0;
-    } /* end estimation of delta_lnl */
+/* LRT for a single tuple, subtree version (see col_lrts_sub) */
+static void col_lrts_sub_tuple(void *data, int i, int thread) {
+  ColTestData *td = data;
+  ColFitData *d = td->w[thread]->d, *d2 = td->w[thread]->d2;
+  MSA *msa = td->msa;
+  mode_type mode = td->mode;
+  double null_lnl, alt_lnl, delta_lnl;
 
-    /* compute p-vals via chi-sq */
-    if (tuple_pvals != NULL) {
-      if (mode == NNEUT || mode == CONACC)
-        tuple_pvals[i] = chisq_cdf(2*delta_lnl, 1, FALSE);
-      else
-        tuple_pvals[i] = half_chisq_cdf(2*delta_lnl, 1, FALSE);
-        /* assumes 50:50 mix of chisq and point mass at zero, due to
-           bounding of param */
+  checkInterruptN(i, 100);
+  if (td->cache != NULL && td->cached[i]) return;
 
-      if (tuple_pvals[i] < 1e-20)
-        tuple_pvals[i] = 1e-20;
-      /* approx limit of eval of tail prob; pvals of 0 cause problems */
+  /* first check for informative substitution data in column; if none,
+     don't waste time computing likeihoods */
+  if (!col_has_data_sub(d2->mod, msa, i, td->inside, td->outside)) {
+    delta_lnl = 0;
+    d->params->data[0] = d2->params->data[0] = d2->params->data[1] = 1;
+  }
 
-      if (mode == CONACC && this_scale > 1)
-          tuple_pvals[i] *= -1; /* mark as acceleration */
-    }
+  else {
+    /* compute log likelihoods under null and alt hypotheses */
+    d->tupleidx = i;
+    vec_set(d->params, 0, d->init_scale);
+    opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
+                  &null_lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
+                  td->logf, NULL, NULL);
+
+    //      opt_bfgs(col_likelihood_wrapper, d->params, d, &null_lnl, d->lb,
+    //	       d->ub, logf, NULL, OPT_HIGH_PREC, NULL, NULL);
+
+    /* turns out to be faster (roughly 15% in limited experiments)
+       to use numerical rather than exact derivatives */
+    null_lnl *= -1;
+
+    d2->tupleidx = i;
+    vec_set(d2->params, 0, max(0.05, d->params->data[0]));
+    /* init to previous estimate to save time, but don't init to
+       value at boundary */
+    vec_set(d2->params, 1, d2->init_scale_sub);
+
+    if (opt_bfgs(col_likelihood_wrapper, d2->params, d2, &alt_lnl, d2->lb,
+                 d2->ub, td->logf, NULL, OPT_HIGH_PREC, NULL, NULL) != 0)
+      ;                         /* do nothing; nonzero exit typically
+                                   occurs when max iterations is
+                                   reached; a warning is printed to
+                                   the log */
+    alt_lnl *= -1;
+
+    delta_lnl = alt_lnl - null_lnl;
+    if (delta_lnl <= -0.1)
+      die("ERROR col_lrts_sub: delta_lnl = %e <= -0.1\n", delta_lnl);
+    if (delta_lnl < 0) delta_lnl = 0;
+  }
 
-    /* store scales and log likelihood ratios if necessary */
-    if (tuple_scales != NULL) tuple_scales[i] = this_scale;
-    if (tuple_llrs != NULL) tuple_llrs[i] = delta_lnl;
+  /* compute p-vals via chi-sq */
+  if (td->pvals != NULL) {
+    if (mode == NNEUT || mode == CONACC)
+      td->pvals[i] = chisq_cdf(2*delta_lnl, 1, FALSE);
+    else
+      td->pvals[i] = half_chisq_cdf(2*delta_lnl, 1, FALSE);
+      /* assumes 50:50 mix of chisq and point mass at zero, due to
+         bounding of param */
+
+    if (td->pvals[i] < 1e-20)
+      td->pvals[i] = 1e-20;
+    /* approx limit of eval of tail prob; pvals of 0 cause problems */
+
+    if (mode == CONACC && d2->params->data[1] > 1)
+      td->pvals[i] *= -1;    /* mark as acceleration */
   }
 
-  col_free_fit_data(d);
+  /* store scales and log likelihood ratios if necessary */
+  if (td->null_scales != NULL)
+    td->null_scales[i] = d->params->data[0];
+  if (td->scales != NULL)
+    td->scales[i] = d2->params->data[0];
+  if (td->sub_scales != NULL)
+    td->sub_scales[i] = d2->params->data[1];
+  if (td->llrs != NULL)
+    td->llrs[i] = delta_lnl;
 }
 
 /* Subtree version of LRT */
@@ -821,177 +1253,221 @@ void col_lrts_sub(TreeModel *mod, MSA *msa, mode_type mode,
                   double *tuple_pvals, double *tuple_null_scales,
                   double *tuple_scales, double *tuple_sub_scales,
                   double *tuple_llrs, FILE *logf) {
-  int i;
-  ColFitData *d, *d2;
-  double null_lnl, alt_lnl, delta_lnl;
-  TreeModel *modcpy;
-  List *inside=NULL, *outside=NULL;
-
-  modcpy = tm_create_copy(mod);   /* need separate copy of tree model
-                                     with different internal scaling
-                                     data for supertree/subtree case */
-  modcpy->subtree_root = NULL;
-
-  /* init ColFitData -- one for null model, one for alt */
-  d = col_init_fit_data(modcpy, msa, ALL, NNEUT, FALSE);
-  d2 = col_init_fit_data(mod, msa, SUBTREE, mode, FALSE);
-                                /* mod has the subtree info, modcpy
-                                   does not */
+  ColTestData td = {0};
+  int nworkers = col_nworkers(msa);
+
+  /* init ColFitData -- for each worker, one for null model (using a
+     copy of the tree model without the subtree) and one for alt */
+  td.w = col_new_workers(mod, msa, SUBTREE, mode, nworkers);
+  td.msa = msa;
+  td.mode = mode;
+  td.logf = logf;
+  td.pvals = tuple_pvals;
+  td.null_scales = tuple_null_scales;
+  td.scales = tuple_scales;
+  td.sub_scales = tuple_sub_scales;
+  td.llrs = tuple_llrs;
+
+  {
+    double **outs[] = {&td.pvals, &td.null_scales, &td.scales,
+                       &td.sub_scales, &td.llrs};
+    col_cache_begin(&td, mod, "lrt_sub", outs, 5);
+  }
 
   /* prepare lists of leaves inside and outside root, for use in
      checking for informative substitutions */
   if (mod->subtree_root != NULL) {
-    inside = lst_new_ptr(mod->tree->nnodes);
-    outside = lst_new_ptr(mod->tree->nnodes);
-    tr_partition_leaves(mod->tree, mod->subtree_root, inside, outside);
+    td.inside = lst_new_ptr(mod->tree->nnodes);
+    td.outside = lst_new_ptr(mod->tree->nnodes);
+    tr_partition_leaves(mod->tree, mod->subtree_root, td.inside, td.outside);
   }
 
   /* iterate through column tuples */
-  for (i = 0; i < msa->ss->ntuples; i++) {
-    checkInterruptN(i, 100);
+  col_foreach_tuple(msa, col_lrts_sub_tuple, &td);
 
-    /* first check for informative substitution data in column; if none,
-       don't waste time computing likeihoods */
-    if (!col_has_data_sub(mod, msa, i, inside, outside)) {
-      delta_lnl = 0;
-      d->params->data[0] = d2->params->data[0] = d2->params->data[1] = 1;
-    }
+  col_cache_end(&td);
+  col_free_workers(td.w, nworkers);
+  if (td.inside != NULL) lst_free(td.inside);
+  if (td.outside != NULL) lst_free(td.outside);
+}
 
-    else {
-      /* compute log likelihoods under null and alt hypotheses */
-      d->tupleidx = i;
-      vec_set(d->params, 0, d->init_scale);
-      opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
-                    &null_lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
-                    logf, NULL, NULL);
-
-      //      opt_bfgs(col_likelihood_wrapper, d->params, d, &null_lnl, d->lb,
-      //	       d->ub, logf, NULL, OPT_HIGH_PREC, NULL, NULL);
-
-      /* turns out to be faster (roughly 15% in limited experiments)
-         to use numerical rather than exact derivatives */
-      null_lnl *= -1;
-
-      d2->tupleidx = i;
-      vec_set(d2->params, 0, max(0.05, d->params->data[0]));
-      /* init to previous estimate to save time, but don't init to
-         value at boundary */
-      vec_set(d2->params, 1, d2->init_scale_sub);
-
-      if (opt_bfgs(col_likelihood_wrapper, d2->params, d2, &alt_lnl, d2->lb,
-                   d2->ub, logf, NULL, OPT_HIGH_PREC, NULL, NULL) != 0)
-        ;                         /* do nothing; nonzero exit typically
-                                     occurs when max iterations is
-                                     reached; a warning is printed to
-                                     the log */
-      alt_lnl *= -1;
-
-      delta_lnl = alt_lnl - null_lnl;
-      if (delta_lnl <= -0.1)
-	die("ERROR col_lrts_sub: delta_lnl = %e <= -0.1\n", delta_lnl);
-      if (delta_lnl < 0) delta_lnl = 0;
-    }
+/* Fill in the rate categories of a discrete gamma model, as
+   tm_generate_msa does when the FIM is estimated.  Score tests call
+   this before copying the model for worker threads, so that every
+   copy, and a run that reads the FIM from a cache, uses the same
+   rates as the model that simulated the FIM alignment */
+static void col_init_rate_cats(TreeModel *mod) {
+  if (mod->nratecats > 1 && !mod->empirical_rates)
+    DiscreteGamma(mod->freqK, mod->rK, mod->alpha, mod->alpha,
+                  mod->nratecats, 0);
+}
 
-    /* compute p-vals via chi-sq */
-    if (tuple_pvals != NULL) {
-      if (mode == NNEUT || mode == CONACC)
-        tuple_pvals[i] = chisq_cdf(2*delta_lnl, 1, FALSE);
-      else
-        tuple_pvals[i] = half_chisq_cdf(2*delta_lnl, 1, FALSE);
-        /* assumes 50:50 mix of chisq and point mass at zero, due to
-           bounding of param */
+/* score test for a single tuple (see col_score_tests) */
+static void col_score_tests_tuple(void *data, int i, int thread) {
+  ColTestData *td = data;
+  ColFitData *d = td->w[thread]->d;
+  mode_type mode = td->mode;
+  double first_deriv, teststat;
+
+  checkInterruptN(i, 1000);
+  if (td->cache != NULL && td->cached[i]) return;
+
+  /* first check for actual substitution data in column; if none,
+     don't waste time computing score */
+  if (!col_has_data(d->mod, td->msa, i)) {
+    first_deriv = 0;
+    teststat = 0;
+  }
 
-      if (tuple_pvals[i] < 1e-20)
-        tuple_pvals[i] = 1e-20;
-      /* approx limit of eval of tail prob; pvals of 0 cause problems */
+  else {
+    d->tupleidx = i;
 
-      if (mode == CONACC && d2->params->data[1] > 1)
-        tuple_pvals[i] *= -1;    /* mark as acceleration */
-    }
+    col_scale_derivs(d, &first_deriv, NULL, d->fels_scratch);
 
-    /* store scales and log likelihood ratios if necessary */
-    if (tuple_null_scales != NULL)
-      tuple_null_scales[i] = d->params->data[0];
-    if (tuple_scales != NULL)
-      tuple_scales[i] = d2->params->data[0];
-    if (tuple_sub_scales != NULL)
-      tuple_sub_scales[i] = d2->params->data[1];
-    if (tuple_llrs != NULL)
-      tuple_llrs[i] = delta_lnl;
+    teststat = first_deriv*first_deriv / td->fim;
+
+    if ((mode == ACC && first_deriv < 0) ||
+        (mode == CON && first_deriv > 0))
+      teststat = 0;             /* derivative points toward boundary;
+                                   truncate at 0 */
   }
 
-  col_free_fit_data(d);
-  col_free_fit_data(d2);
-  modcpy->estimate_branchlens = TM_BRANCHLENS_ALL;
-                                /* have to revert for tm_free to work
-                                   correctly */
-  tm_free(modcpy);
-  if (inside != NULL) lst_free(inside);
-  if (outside != NULL) lst_free(outside);
+  if (td->pvals != NULL) {
+    if (mode == NNEUT || mode == CONACC)
+      td->pvals[i] = chisq_cdf(teststat, 1, FALSE);
+    else
+      td->pvals[i] = half_chisq_cdf(teststat, 1, FALSE);
+      /* assumes 50:50 mix of chisq and point mass at zero */
+
+    if (td->pvals[i] < 1e-20)
+      td->pvals[i] = 1e-20;
+    /* approx limit of eval of tail prob; pvals of 0 cause problems */
+
+    if (mode == CONACC && first_deriv > 0)
+      td->pvals[i] *= -1; /* mark as acceleration */
+  }
+
+  /* store scales and log likelihood ratios if necessary */
+  if (td->derivs != NULL) td->derivs[i] = first_deriv;
+  if (td->teststats != NULL) td->teststats[i] = teststat;
 }
 
 /* Score test */
 void col_score_tests(TreeModel *mod, MSA *msa, mode_type mode,
                      double *tuple_pvals, double *tuple_derivs,
                      double *tuple_teststats) {
-  int i;
-  ColFitData *d;
-  double first_deriv, teststat, fim;
-
-  /* init ColFitData */
-  d = col_init_fit_data(mod, msa, ALL, NNEUT, FALSE);
+  ColTestData td = {0};
+  int nleft, nworkers = col_nworkers(msa);
+
+  col_init_rate_cats(mod);
+
+  /* init ColFitData (one per worker) */
+  td.w = col_new_workers(mod, msa, ALL, NNEUT, nworkers);
+  td.msa = msa;
+  td.mode = mode;
+  td.pvals = tuple_pvals;
+  td.derivs = tuple_derivs;
+  td.teststats = tuple_teststats;
+
+  {
+    double **outs[] = {&td.pvals, &td.derivs, &td.teststats};
+    nleft = col_cache_begin(&td, mod, "score", outs, 3);
+  }
 
-  /* precompute FIM */
-  fim = col_estimate_fim(mod);
+  /* precompute FIM (not needed if all tuples were cached) */
+  if (nleft > 0) {
+    td.fim = col_estimate_fim(mod);
 
-  if (fim < 0)
-    die("ERROR: negative fisher information in col_score_tests\n");
+    if (td.fim < 0)
+      die("ERROR: negative fisher information in col_score_tests\n");
 
-  /* iterate through column tuples */
-  for (i = 0; i < msa->ss->ntuples; i++) {
-    checkInterruptN(i, 1000);
+    /* iterate through column tuples */
+    col_foreach_tuple(msa, col_score_tests_tuple, &td);
+  }
 
-    /* first check for actual substitution data in column; if none,
-       don't waste time computing score */
-    if (!col_has_data(mod, msa, i)) {
-      first_deriv = 0;
-      teststat = 0;
-    }
+  col_cache_end(&td);
+  col_free_workers(td.w, nworkers);
+}
 
-    else {
-      d->tupleidx = i;
+/* score test for a single tuple, subtree version (see
+   col_score_tests_sub) */
+static void col_score_tests_sub_tuple(void *data, int i, int thread) {
+  ColTestData *td = data;
+  ColFitData *d = td->w[thread]->d, *d2 = td->w[thread]->d2;
+  mode_type mode = td->mode;
+  double lnl, teststat;
+  Vector *grad;
+  Matrix *fim;
 
-      col_scale_derivs(d, &first_deriv, NULL, d->fels_scratch);
+  checkInterruptN(i, 100);
+  if (td->cache != NULL && td->cached[i]) return;
+  grad = vec_new(2);
 
-      teststat = first_deriv*first_deriv / fim;
+  /* first check for informative substitution data in column; if none,
+     don't waste time computing score */
+  if (!col_has_data_sub(d2->mod, td->msa, i, td->inside, td->outside)) {
+    teststat = 0;
+    vec_zero(grad);
+    d->params->data[0] = 1.0;
+  }
 
-      if ((mode == ACC && first_deriv < 0) ||
-          (mode == CON && first_deriv > 0))
-        teststat = 0;             /* derivative points toward boundary;
-                                     truncate at 0 */
+  else {
+    d->tupleidx = i;
+    vec_set(d->params, 0, d->init_scale);
+
+    opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
+                  &lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
+                  td->logf, NULL, NULL);
+    /* turns out to be faster (roughly 15% in limited experiments)
+       to use numerical rather than exact derivatives */
+
+    d2->tupleidx = i;
+    d2->mod->scale = d->params->data[0];
+    d2->mod->scale_sub = 1;
+    tm_set_subst_matrices(d2->mod);
+    col_scale_derivs_subtree(d2, grad, NULL, d2->fels_scratch);
+
+    fim = col_get_fim_sub(td->grid, d2->mod->scale);
+
+    teststat = grad->data[1]*grad->data[1] /
+      (fim->data[1][1] - fim->data[0][1]*fim->data[1][0]/fim->data[0][0]);
+
+    if (teststat < 0) {
+      fprintf(stderr, "WARNING: teststat < 0 (%f\t%f\t%f\t%f\t%f\t%f)\n",
+              teststat, fim->data[0][0], fim->data[0][1],
+              fim->data[1][0], fim->data[1][1],
+              fim->data[0][1]*fim->data[1][0]/fim->data[0][0]);
+      teststat = 0;
     }
+    mat_free(fim);
 
-    if (tuple_pvals != NULL) {
-      if (mode == NNEUT || mode == CONACC)
-        tuple_pvals[i] = chisq_cdf(teststat, 1, FALSE);
-      else
-        tuple_pvals[i] = half_chisq_cdf(teststat, 1, FALSE);
-        /* assumes 50:50 mix of chisq and point mass at zero */
+    if ((mode == ACC && grad->data[1] < 0) ||
+        (mode == CON && grad->data[1] > 0))
+      teststat = 0;             /* derivative points toward boundary;
+                                   truncate at 0 */
+  }
 
-      if (tuple_pvals[i] < 1e-20)
-        tuple_pvals[i] = 1e-20;
-      /* approx limit of eval of tail prob; pvals of 0 cause problems */
+  if (td->pvals != NULL) {
+    if (mode == NNEUT || mode == CONACC)
+      td->pvals[i] = chisq_cdf(teststat, 1, FALSE);
+    else
+      td->pvals[i] = half_chisq_cdf(teststat, 1, FALSE);
+    /* assumes 50:50 mix of chisq and point mass at zero */
 
-      if (mode == CONACC && first_deriv > 0)
-        tuple_pvals[i] *= -1; /* mark as acceleration */
-    }
+    if (td->pvals[i] < 1e-20)
+      td->pvals[i] = 1e-20;
+    /* approx limit of eval of tail prob; pvals of 0 cause problems */
 
-    /* store scales and log likelihood ratios if necessary */
-    if (tuple_derivs != NULL) tuple_derivs[i] = first_deriv;
-    if (tuple_teststats != NULL) tuple_teststats[i] = teststat;
+    if (mode == CONACC && grad->data[1] > 0)
+      td->pvals[i] *= -1; /* mark as acceleration */
   }
 
-  col_free_fit_data(d);
+  /* store scales and log likelihood ratios if necessary */
+  if (td->null_scales != NULL) td->null_scales[i] = d->params->data[0];
+  if (td->derivs != NULL) td->derivs[i] = grad->data[0];
+  if (td->sub_derivs != NULL) td->sub_derivs[i] = grad->data[1];
+  if (td->teststats != NULL) td->teststats[i] = teststat;
+  vec_free(grad);
 }
 
 /* Subtree version of score test */
@@ -999,115 +1475,60 @@ void col_score_tests_sub(TreeModel *mod, MSA *msa, mode_type mode,
                          double *tuple_pvals, double *tuple_null_scales,
                          double *tuple_derivs, double *tuple_sub_derivs,
                          double *tuple_teststats, FILE *logf) {
-  int i;
-  ColFitData *d, *d2;
-  Vector *grad = vec_new(2);
-  Matrix *fim;
-  double lnl, teststat;
-  FimGrid *grid;
-  List *inside=NULL, *outside=NULL;
-  TreeModel *modcpy = tm_create_copy(mod); /* need separate copy of tree model
-                                              with different internal scaling
-                                              data for supertree/subtree case */
-  modcpy->subtree_root = NULL;
-
-  /* init ColFitData -- one for null model, one for alt */
-  d = col_init_fit_data(modcpy, msa, ALL, NNEUT, FALSE);
-  d2 = col_init_fit_data(mod, msa, SUBTREE, NNEUT, FALSE);
-                                /* mod has the subtree info, modcpy
-                                   does not */
-
-  /* precompute Fisher information matrices for a grid of scale values */
-  grid = col_fim_grid_sub(mod);
-
-  /* prepare lists of leaves inside and outside root, for use in
-     checking for informative substitutions */
-  if (mod->subtree_root != NULL) {
-    inside = lst_new_ptr(mod->tree->nnodes);
-    outside = lst_new_ptr(mod->tree->nnodes);
-    tr_partition_leaves(mod->tree, mod->subtree_root, inside, outside);
+  ColTestData td = {0};
+  int nleft, nworkers = col_nworkers(msa);
+
+  col_init_rate_cats(mod);
+
+  /* init ColFitData -- for each worker, one for null model (using a
+     copy of the tree model without the subtree) and one for alt */
+  td.w = col_new_workers(mod, msa, SUBTREE, NNEUT, nworkers);
+  td.msa = msa;
+  td.mode = mode;
+  td.logf = logf;
+  td.pvals = tuple_pvals;
+  td.null_scales = tuple_null_scales;
+  td.derivs = tuple_derivs;
+  td.sub_derivs = tuple_sub_derivs;
+  td.teststats = tuple_teststats;
+
+  {
+    double **outs[] = {&td.pvals, &td.null_scales, &td.derivs,
+                       &td.sub_derivs, &td.teststats};
+    char test[STR_MED_LEN];
+    /* results depend on the grid resolution, if not the default */
+    if (col_gridsize1 == GRIDSIZE1 && col_gridsize2 == GRIDSIZE2 &&
+        col_gridmaxlog == GRIDMAXLOG)
+      sprintf(test, "score_sub");
+    else
+      sprintf(test, "score_sub.grid%g,%g,%g", col_gridsize1, col_gridsize2,
+              col_gridmaxlog);
+    nleft = col_cache_begin(&td, mod, test, outs, 5);
   }
 
-  /* iterate through column tuples */
-  for (i = 0; i < msa->ss->ntuples; i++) {
-    checkInterruptN(i, 100);
-
-    /* first check for informative substitution data in column; if none,
-       don't waste time computing score */
-    if (!col_has_data_sub(mod, msa, i, inside, outside)) {
-      teststat = 0;
-      vec_zero(grad);
-      d->params->data[0] = 1.0;
+  /* precompute Fisher information matrices for a grid of scale
+     values (not needed if all tuples were cached) */
+  if (nleft > 0) {
+    td.grid = col_fim_grid_sub(mod);
+
+    /* prepare lists of leaves inside and outside root, for use in
+       checking for informative substitutions */
+    if (mod->subtree_root != NULL) {
+      td.inside = lst_new_ptr(mod->tree->nnodes);
+      td.outside = lst_new_ptr(mod->tree->nnodes);
+      tr_partition_leaves(mod->tree, mod->subtree_root, td.inside,
+                          td.outside);
     }
 
-    else {
-      d->tupleidx = i;
-      vec_set(d->params, 0, d->init_scale);
-
-      opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
-                    &lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
-                    logf, NULL, NULL);
-      /* turns out to be faster (roughly 15% in limited experiments)
-         to use numerical rather than exact derivatives */
-
-      d2->tupleidx = i;
-      d2->mod->scale = d->params->data[0];
-      d2->mod->scale_sub = 1;
-      tm_set_subst_matrices(d2->mod);
-      col_scale_derivs_subtree(d2, grad, NULL, d2->fels_scratch);
-
-      fim = col_get_fim_sub(grid, d2->mod->scale);
-
-      teststat = grad->data[1]*grad->data[1] /
-        (fim->data[1][1] - fim->data[0][1]*fim->data[1][0]/fim->data[0][0]);
-
-      if (teststat < 0) {
-        fprintf(stderr, "WARNING: teststat < 0 (%f\t%f\t%f\t%f\t%f\t%f)\n",
-                teststat, fim->data[0][0], fim->data[0][1],
-                fim->data[1][0], fim->data[1][1],
-                fim->data[0][1]*fim->data[1][0]/fim->data[0][0]);
-        teststat = 0;
-      }
-      mat_free(fim);
-
-      if ((mode == ACC && grad->data[1] < 0) ||
-          (mode == CON && grad->data[1] > 0))
-        teststat = 0;             /* derivative points toward boundary;
-                                     truncate at 0 */
-    }
-
-    if (tuple_pvals != NULL) {
-      if (mode == NNEUT || mode == CONACC)
-        tuple_pvals[i] = chisq_cdf(teststat, 1, FALSE);
-      else
-        tuple_pvals[i] = half_chisq_cdf(teststat, 1, FALSE);
-      /* assumes 50:50 mix of chisq and point mass at zero */
-
-      if (tuple_pvals[i] < 1e-20)
-        tuple_pvals[i] = 1e-20;
-      /* approx limit of eval of tail prob; pvals of 0 cause problems */
-
-      if (mode == CONACC && grad->data[1] > 0)
-        tuple_pvals[i] *= -1; /* mark as acceleration */
-    }
-
-    /* store scales and log likelihood ratios if necessary */
-    if (tuple_null_scales != NULL) tuple_null_scales[i] = d->params->data[0];
-    if (tuple_derivs != NULL) tuple_derivs[i] = grad->data[0];
-    if (tuple_sub_derivs != NULL) tuple_sub_derivs[i] = grad->data[1];
-    if (tuple_teststats != NULL) tuple_teststats[i] = teststat;
+    /* iterate through column tuples */
+    col_foreach_tuple(msa, col_score_tests_sub_tuple, &td);
   }
 
-  col_free_fit_data(d);
-  col_free_fit_data(d2);
-  vec_free(grad);
-  modcpy->estimate_branchlens = TM_BRANCHLENS_ALL;
-                                /* have to revert for tm_free to work
-                                   correctly */
-  tm_free(modcpy);
-  if (inside != NULL) lst_free(inside);
-  if (outside != NULL) lst_free(outside);
-  col_free_fim_grid(grid);
+  col_cache_end(&td);
+  col_free_workers(td.w, nworkers);
+  if (td.inside != NULL) lst_free(td.inside);
+  if (td.outside != NULL) lst_free(td.outside);
+  if (td.grid != NULL) col_free_fim_grid(td.grid);
 }
 
 /* Create object with metadata and scratch memory for fitting scale
@@ -1270,6 +1691,47 @@ void col_free_fit_data(ColFitData *d) {
   sfree(d);
 }
 
+/* GERP-like computation for a single tuple (see col_gerp) */
+static void col_gerp_tuple(void *data, int i, int thread) {
+  ColTestData *td = data;
+  ColFitData *d = td->w[thread]->d;
+  TreeModel *mod = d->mod;
+  int *has_data = td->has_data[thread];
+  int j, nspec = 0;
+  double nneut, scale, lnl;
+
+  checkInterruptN(i, 1000);
+  if (td->cache != NULL && td->cached[i]) return;
+  col_find_missing_branches(mod, td->msa, i, has_data, &nspec);
+
+  if (nspec < 3)
+    nneut = scale = 0;
+  else {
+    vec_set(d->params, 0, d->init_scale);
+    d->tupleidx = i;
+
+    opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
+                  &lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
+                  td->logf, NULL, NULL);
+    /* turns out to be faster (roughly 15% in limited experiments)
+       to use numerical rather than exact derivatives */
+
+    scale = d->params->data[0];
+    for (j = 1, nneut = 0; j < mod->tree->nnodes; j++)  /* node 0 is root */
+      if (has_data[j])
+        nneut += ((TreeNode*)lst_get_ptr(mod->tree->nodes, j))->dparent;
+  }
+
+  if (td->nspec != NULL) td->nspec[i] = (double)nspec;
+  if (td->nneut != NULL) td->nneut[i] = nneut;
+  if (td->nobs != NULL) td->nobs[i] = scale * nneut;
+  if (td->nrejected != NULL) {
+    td->nrejected[i] = nneut * (1 - scale);
+    if (td->mode == ACC) td->nrejected[i] *= -1;
+    else if (td->mode == NNEUT) td->nrejected[i] = fabs(td->nrejected[i]);
+  }
+}
+
 /* Perform a GERP-like computation for each tuple.  Computes expected
    number of subst. under neutrality (tuple_nneut), expected number
    after rescaling by ML (tuple_nobs), expected number of rejected
@@ -1280,48 +1742,36 @@ void col_free_fit_data(ColFitData *d) {
 void col_gerp(TreeModel *mod, MSA *msa, mode_type mode, double *tuple_nneut,
               double *tuple_nobs, double *tuple_nrejected,
               double *tuple_nspec, FILE *logf) {
-  int i, j, nspec = 0;
-  double nneut, scale, lnl;
-  int *has_data = smalloc(mod->tree->nnodes * sizeof(int));
-  ColFitData *d;
-
-  /* init ColFitData */
-  d = col_init_fit_data(mod, msa, ALL, NNEUT, FALSE);
+  ColTestData td = {0};
+  int i, nworkers = col_nworkers(msa);
+
+  /* init ColFitData and scratch (one per worker) */
+  td.w = col_new_workers(mod, msa, ALL, NNEUT, nworkers);
+  td.has_data = smalloc(nworkers * sizeof(int*));
+  for (i = 0; i < nworkers; i++)
+    td.has_data[i] = smalloc(mod->tree->nnodes * sizeof(int));
+  td.msa = msa;
+  td.mode = mode;
+  td.logf = logf;
+  td.nneut = tuple_nneut;
+  td.nobs = tuple_nobs;
+  td.nrejected = tuple_nrejected;
+  td.nspec = tuple_nspec;
+
+  {
+    double **outs[] = {&td.nneut, &td.nobs, &td.nrejected, &td.nspec};
+    col_cache_begin(&td, mod, "gerp", outs, 4);
+  }
 
   /* iterate through column tuples */
-  for (i = 0; i < msa->ss->ntuples;i++) {
-    checkInterruptN(i, 1000);
-    col_find_missing_branches(mod, msa, i, has_data, &nspec);
+  col_foreach_tuple(msa, col_gerp_tuple, &td);
 
-    if (nspec < 3)
-      nneut = scale = 0;
-    else {
-      vec_set(d->params, 0, d->init_scale);
-      d->tupleidx = i;
-
-      opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d,
-                    &lnl, SIGFIGS, d->lb->data[0], d->ub->data[0],
-                    logf, NULL, NULL);
-      /* turns out to be faster (roughly 15% in limited experiments)
-         to use numerical rather than exact derivatives */
-
-      scale = d->params->data[0];
-      for (j = 1, nneut = 0; j < mod->tree->nnodes; j++)  /* node 0 is root */
-        if (has_data[j])
-          nneut += ((TreeNode*)lst_get_ptr(mod->tree->nodes, j))->dparent;
-    }
+  col_cache_end(&td);
 
-    if (tuple_nspec != NULL) tuple_nspec[i] = (double)nspec;
-    if (tuple_nneut != NULL) tuple_nneut[i] = nneut;
-    if (tuple_nobs != NULL) tuple_nobs[i] = scale * nneut;
-    if (tuple_nrejected != NULL) {
-      tuple_nrejected[i] = nneut * (1 - scale);
-      if (mode == ACC) tuple_nrejected[i] *= -1;
-      else if (mode == NNEUT) tuple_nrejected[i] = fabs(tuple_nrejected[i]);
-    }
-  }
-  col_free_fit_data(d);
-  sfree(has_data);
+  for (i = 0; i < nworkers; i++)
+    sfree(td.has_data[i]);
+  sfree(td.has_data);
+  col_free_workers(td.w, nworkers);
 }
 
 /* Identify branches wrt which a given column tuple is uninformative,
@@ -1442,6 +1892,8 @@ void col_scale_derivs_subtree_num(ColFitData *d, Vector *gradient,
 Matrix *col_estimate_fim_sub(TreeModel *mod) {
   Vector *grad = vec_new(2);
   Matrix *hessian = mat_new(2, 2), *fim = mat_new(2, 2);
+  int *seq_idx = mod->msa_seq_idx; /* tm_generate_msa replaces the
+                                      index; restore it for the caller */
   MSA *msa = tm_generate_msa(NSAMPLES_FIM, NULL, &mod, NULL);
   ColFitData *d = col_init_fit_data(mod, msa, SUBTREE, NNEUT, TRUE);
   int i;
@@ -1460,29 +1912,127 @@ Matrix *col_estimate_fim_sub(TreeModel *mod) {
 
   msa_free(msa);
   col_free_fit_data(d);
+  sfree(mod->msa_seq_idx);
+  mod->msa_seq_idx = seq_idx;
   vec_free(grad);
   mat_free(hessian);
   return (fim);
 }
 
+/* (used below) return the name of the FIM cache file with the given
+   extension for a tree model with fingerprint fp */
+static char *col_fim_cache_fname(const char *fp, const char *ext) {
+  char *fname = smalloc((strlen(col_fim_prefix) + strlen(ext) +
+                         TM_FINGERPRINT_LEN + 3) * sizeof(char));
+  sprintf(fname, "%s.%s.%s", col_fim_prefix, fp, ext);
+  return fname;
+}
+
+/* (used below) open a FIM cache file for reading, and check its
+   header.  Returns NULL if the file does not exist or has a
+   different header (e.g., it was written by an older version), in
+   which case it will be replaced */
+static FILE *col_fim_cache_open(const char *fname, const char *header) {
+  FILE *F = phast_fopen_no_exit(fname, "r");
+  String *line;
+  if (F == NULL) return NULL;
+  line = str_new(STR_MED_LEN);
+  if (str_readline(line, F) == EOF ||
+      (str_trim(line), !str_equals_charstr(line, header))) {
+    str_free(line);
+    phast_fclose(F);
+    return NULL;
+  }
+  str_free(line);
+  return F;
+}
+
+/* (used below) write a FIM cache file containing either a grid (if g
+   is not NULL) or a single value.  The file is written under a
+   temporary name and then renamed, so readers always see a complete
+   file.  Failure is not fatal, since the estimate can always be
+   recomputed */
+static void col_fim_cache_save(const char *fname, const char *header,
+                               FimGrid *g, double fim) {
+  char *tmpfname = smalloc((strlen(fname) + 30) * sizeof(char));
+  FILE *F;
+
+  sprintf(tmpfname, "%s.%d.tmp", fname, (int)getpid());
+  F = phast_fopen_no_exit(tmpfname, "w");
+  if (F == NULL) {
+    phast_warning("WARNING: could not write FIM cache %s\n", tmpfname);
+    sfree(tmpfname);
+    return;
+  }
+  fprintf(F, "%s\n", header);
+  if (g != NULL)
+    col_write_fim_grid(F, g);
+  else
+    fprintf(F, "%.17g\n", fim);
+  if (ferror(F) || fclose(F) != 0 || rename(tmpfname, fname) != 0) {
+    phast_warning("WARNING: could not write FIM cache %s\n", fname);
+    remove(tmpfname);
+  }
+  sfree(tmpfname);
+}
+
 /* Precompute estimates of FIM for a grid of possible scale params
    (subtree case) */
 FimGrid *col_fim_grid_sub(TreeModel *mod) {
   int i;
-  FimGrid *g = smalloc(sizeof(FimGrid));
+  FimGrid *g = NULL;
+  char fp[TM_FINGERPRINT_LEN + 1], ext[STR_MED_LEN], *fname = NULL,
+    *header = NULL;
+  FILE *F;
+
+  if (col_fim_prefix != NULL) {
+    tm_fingerprint(mod, fp);
+    /* grids of different resolutions are kept in separate files */
+    if (col_gridsize1 == GRIDSIZE1 && col_gridsize2 == GRIDSIZE2 &&
+        col_gridmaxlog == GRIDMAXLOG)
+      sprintf(ext, "fimgrid");
+    else
+      sprintf(ext, "grid%g,%g,%g.fimgrid", col_gridsize1, col_gridsize2,
+              col_gridmaxlog);
+    fname = col_fim_cache_fname(fp, ext);
+    header = smalloc(STR_MED_LEN * sizeof(char));
+    sprintf(header, "##fim-cache %d %s grid %.17g %.17g %.17g %d",
+            FIM_CACHE_VERSION, fp, col_gridsize1, col_gridsize2,
+            col_gridmaxlog, NSAMPLES_FIM);
+    if ((F = col_fim_cache_open(fname, header)) != NULL) {
+      g = col_read_fim_grid(F);
+      phast_fclose(F);
+      if (g == NULL)
+        phast_warning("WARNING: ignoring malformed FIM cache %s\n", fname);
+    }
+  }
 
-  g->ngrid1 = (int)(1.0/GRIDSIZE1);
-  g->ngrid2 = (int)((1.0 * GRIDMAXLOG / GRIDSIZE2) + 1);
+  if (g != NULL) {
+    /* leave mod as it would be after computing the grid */
+    col_init_rate_cats(mod);
+    mod->scale_sub = 1;
+    mod->scale = g->scales[g->ngrid - 1];
+    tm_set_subst_matrices(mod);
+    sfree(fname);
+    sfree(header);
+    return g;
+  }
+
+  g = smalloc(sizeof(FimGrid));
+  g->gridsize1 = col_gridsize1;
+  g->gridsize2 = col_gridsize2;
+  g->ngrid1 = (int)(1.0/g->gridsize1);
+  g->ngrid2 = (int)((1.0 * col_gridmaxlog / g->gridsize2) + 1);
   g->ngrid = g->ngrid1 + g->ngrid2;
   g->scales = smalloc(g->ngrid * sizeof(double));
 
   mod->scale_sub = 1;
 
   for (i = 0; i < g->ngrid1; i++)
-    g->scales[i] = i * GRIDSIZE1;
+    g->scales[i] = i * g->gridsize1;
 
   for (i = 0; i < g->ngrid2; i++)
-    g->scales[g->ngrid1 + i] = exp(i * GRIDSIZE2);
+    g->scales[g->ngrid1 + i] = exp(i * g->gridsize2);
 
   g->fim = smalloc(g->ngrid * sizeof(void*));
   for (i = 0; i < g->ngrid; i++) {
@@ -1491,6 +2041,12 @@ FimGrid *col_fim_grid_sub(TreeModel *mod) {
     g->fim[i] = col_estimate_fim_sub(mod);
   }
 
+  if (fname != NULL) {
+    col_fim_cache_save(fname, header, g, 0);
+    sfree(fname);
+    sfree(header);
+  }
+
   return g;
 }
 
@@ -1501,6 +2057,56 @@ void col_free_fim_grid(FimGrid *g) {
     mat_free(g->fim[i]);
   sfree(g->fim);
   sfree(g->scales);
+  sfree(g);
+}
+
+/* write FimGrid object to a file */
+void col_write_fim_grid(FILE *F, FimGrid *g) {
+  int i, j, k;
+  fprintf(F, "NGRID1: %d\n", g->ngrid1);
+  fprintf(F, "NGRID2: %d\n", g->ngrid2);
+  fprintf(F, "GRIDSIZE1: %.17g\n", g->gridsize1);
+  fprintf(F, "GRIDSIZE2: %.17g\n", g->gridsize2);
+  fprintf(F, "DIM: %d\n", g->fim[0]->nrows);
+  for (i = 0; i < g->ngrid; i++) {
+    fprintf(F, "%.17g", g->scales[i]);
+    for (j = 0; j < g->fim[i]->nrows; j++)
+      for (k = 0; k < g->fim[i]->ncols; k++)
+        fprintf(F, " %.17g", g->fim[i]->data[j][k]);
+    fprintf(F, "\n");
+  }
+}
+
+/* read FimGrid object written by col_write_fim_grid; returns NULL if
+   the file is malformed */
+FimGrid *col_read_fim_grid(FILE *F) {
+  FimGrid *g;
+  int i, j, k, dim, ok = TRUE;
+
+  g = smalloc(sizeof(FimGrid));
+  if (fscanf(F, " NGRID1: %d NGRID2: %d GRIDSIZE1: %lf GRIDSIZE2: %lf DIM: %d",
+             &g->ngrid1, &g->ngrid2, &g->gridsize1, &g->gridsize2,
+             &dim) != 5 ||
+      g->ngrid1 < 0 || g->ngrid2 < 1 || g->gridsize1 <= 0 ||
+      g->gridsize2 <= 0 || dim < 1) {
+    sfree(g);
+    return NULL;
+  }
+  g->ngrid = g->ngrid1 + g->ngrid2;
+  g->scales = smalloc(g->ngrid * sizeof(double));
+  g->fim = smalloc(g->ngrid * sizeof(void*));
+  for (i = 0; i < g->ngrid; i++) {
+    g->fim[i] = mat_new(dim, dim);
+    ok = ok && (fscanf(F, "%lf", &g->scales[i]) == 1);
+    for (j = 0; j < dim; j++)
+      for (k = 0; k < dim; k++)
+        ok = ok && (fscanf(F, "%lf", &g->fim[i]->data[j][k]) == 1);
+  }
+  if (!ok) {
+    col_free_fim_grid(g);
+    return NULL;
+  }
+  return g;
 }
 
 /* Estimate scale Fisher Information Matrix for the non-subtree case.
@@ -1508,9 +2114,38 @@ void col_free_fim_grid(FimGrid *g) {
    required.  Estimation is done by sampling, as above */
 double col_estimate_fim(TreeModel *mod) {
   double deriv1, deriv2, retval = 0;
-  MSA *msa = tm_generate_msa(NSAMPLES_FIM, NULL, &mod, NULL);
-  ColFitData *d = col_init_fit_data(mod, msa, ALL, NNEUT, FALSE);
+  int *seq_idx;
+  MSA *msa;
+  ColFitData *d;
   int i;
+  char fp[TM_FINGERPRINT_LEN + 1], *fname = NULL, *header = NULL;
+  FILE *F;
+
+  if (col_fim_prefix != NULL) {
+    /* the estimate depends on the current scale factors, which are
+       not part of the fingerprint */
+    tm_fingerprint(mod, fp);
+    fname = col_fim_cache_fname(fp, "fim");
+    header = smalloc(STR_MED_LEN * sizeof(char));
+    sprintf(header, "##fim-cache %d %s scalar %.17g %.17g %d",
+            FIM_CACHE_VERSION, fp, mod->scale, mod->scale_sub, NSAMPLES_FIM);
+    if ((F = col_fim_cache_open(fname, header)) != NULL) {
+      int found = (fscanf(F, "%lf", &retval) == 1);
+      phast_fclose(F);
+      if (found) {
+        col_init_rate_cats(mod); /* as if the FIM had been estimated */
+        sfree(fname);
+        sfree(header);
+        return retval;
+      }
+      phast_warning("WARNING: ignoring malformed FIM cache %s\n", fname);
+      retval = 0;
+    }
+  }
+
+  seq_idx = mod->msa_seq_idx;   /* see col_estimate_fim_sub */
+  msa = tm_generate_msa(NSAMPLES_FIM, NULL, &mod, NULL);
+  d = col_init_fit_data(mod, msa, ALL, NNEUT, FALSE);
 
   ss_from_msas(msa, 1, TRUE, NULL, NULL, NULL, -1, 0);
 
@@ -1524,6 +2159,14 @@ double col_estimate_fim(TreeModel *mod) {
 
   msa_free(msa);
   col_free_fit_data(d);
+  sfree(mod->msa_seq_idx);
+  mod->msa_seq_idx = seq_idx;
+
+  if (fname != NULL) {
+    col_fim_cache_save(fname, header, NULL, retval);
+    sfree(fname);
+    sfree(header);
+  }
   return (retval);
 }
 
@@ -1538,9 +2181,13 @@ Matrix *col_get_fim_sub(FimGrid *g, double scale) {
     die("ERROR col_get_fix_sub: scale should be >= 0 but is %e\n", scale);
 
   if (scale < 1)
-    idx = (int)floor(scale / GRIDSIZE1);
+    idx = min((int)floor(scale / g->gridsize1), g->ngrid1 - 1);
   else
-    idx = g->ngrid1 + (int)floor(log(scale) / GRIDSIZE2);
+    idx = g->ngrid1 + (int)floor(log(scale) / g->gridsize2);
+
+  /* correct for round-off near grid points */
+  while (idx > 0 && idx < g->ngrid && g->scales[idx] > scale) idx--;
+  while (idx < g->ngrid - 1 && g->scales[idx+1] <= scale) idx++;
 
   if (idx >= g->ngrid - 1)
     retval = mat_create_copy(g->fim[g->ngrid - 1]);
@@ -0,0 +1,128 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/* Inner-loop kernels for Felsenstein's pruning algorithm.  See
+   phast_likelihood_kernels.h */
+
+#include <phast_likelihood_kernels.h>
+
+/* Matrices are packed column by column (dest[j*n+i] = P[i][j]), so
+   that the entries multiplied by the same child partial are adjacent
+   and the sums for several states i can be accumulated side by side
+   in vector registers.  Note that no fused multiply-add is used, so
+   that rounding is the same as in the scalar code. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define LK_X86
+#include <immintrin.h>
+#endif
+
+void lk_pack_matrix(double *dest, Matrix *P) {
+  int i, j, n = P->nrows;
+  for (j = 0; j < n; j++)
+    for (i = 0; i < n; i++)
+      dest[j*n + i] = P->data[i][j];
+}
+
+/* portable version, for any number of states */
+static void lk_prune_generic(int n, double *partial,
+                             const double *lpartial, const double *lP,
+                             const double *rpartial, const double *rP) {
+  int i, j;
+  for (i = 0; i < n; i++) {
+    double totl = 0, totr = 0;
+    for (j = 0; j < n; j++)
+      totl += lpartial[j] * lP[j*n + i];
+    for (j = 0; j < n; j++)
+      totr += rpartial[j] * rP[j*n + i];
+    partial[i] = totl * totr;
+  }
+}
+
+#ifdef LK_X86
+
+/* SSE2: two states per register.  Always available on x86-64.  n
+   must be a multiple of 2 and no larger than 16; called with a
+   constant n so that loops are fully unrolled */
+static inline void lk_prune_sse2(int n, double *partial,
+                                 const double *lpartial, const double *lP,
+                                 const double *rpartial, const double *rP) {
+  __m128d totl[8], totr[8];
+  int i, j;
+  for (i = 0; i < n/2; i++)
+    totl[i] = totr[i] = _mm_setzero_pd();
+  for (j = 0; j < n; j++) {
+    __m128d l = _mm_set1_pd(lpartial[j]), r = _mm_set1_pd(rpartial[j]);
+    for (i = 0; i < n/2; i++) {
+      totl[i] = _mm_add_pd(totl[i], _mm_mul_pd(l, _mm_loadu_pd(&lP[j*n + 2*i])));
+      totr[i] = _mm_add_pd(totr[i], _mm_mul_pd(r, _mm_loadu_pd(&rP[j*n + 2*i])));
+    }
+  }
+  for (i = 0; i < n/2; i++)
+    _mm_storeu_pd(&partial[2*i], _mm_mul_pd(totl[i], totr[i]));
+}
+
+/* AVX2: four states per register.  n must be a multiple of 4 and no
+   larger than 16 */
+__attribute__((target("avx2")))
+static inline void lk_prune_avx2(int n, double *partial,
+                                 const double *lpartial, const double *lP,
+                                 const double *rpartial, const double *rP) {
+  __m256d totl[4], totr[4];
+  int i, j;
+  for (i = 0; i < n/4; i++)
+    totl[i] = totr[i] = _mm256_setzero_pd();
+  for (j = 0; j < n; j++) {
+    __m256d l = _mm256_set1_pd(lpartial[j]), r = _mm256_set1_pd(rpartial[j]);
+    for (i = 0; i < n/4; i++) {
+      totl[i] = _mm256_add_pd(totl[i], _mm256_mul_pd(l, _mm256_loadu_pd(&lP[j*n + 4*i])));
+      totr[i] = _mm256_add_pd(totr[i], _mm256_mul_pd(r, _mm256_loadu_pd(&rP[j*n + 4*i])));
+    }
+  }
+  for (i = 0; i < n/4; i++)
+    _mm256_storeu_pd(&partial[4*i], _mm256_mul_pd(totl[i], totr[i]));
+}
+
+__attribute__((target("avx2")))
+static void lk_prune4_avx2(double *partial,
+                           const double *lpartial, const double *lP,
+                           const double *rpartial, const double *rP) {
+  lk_prune_avx2(4, partial, lpartial, lP, rpartial, rP);
+}
+
+__attribute__((target("avx2")))
+static void lk_prune16_avx2(double *partial,
+                            const double *lpartial, const double *lP,
+                            const double *rpartial, const double *rP) {
+  lk_prune_avx2(16, partial, lpartial, lP, rpartial, rP);
+}
+
+#endif
+
+void lk_prune(int nstates, double *partial,
+              const double *lpartial, const double *lP,
+              const double *rpartial, const double *rP) {
+#ifdef LK_X86
+  if (nstates == 4) {
+    if (__builtin_cpu_supports("avx2"))
+      lk_prune4_avx2(partial, lpartial, lP, rpartial, rP);
+    else
+      lk_prune_sse2(4, partial, lpartial, lP, rpartial, rP);
+    return;
+  }
+  if (nstates == 16) {
+    if (__builtin_cpu_supports("avx2"))
+      lk_prune16_avx2(partial, lpartial, lP, rpartial, rP);
+    else
+      lk_prune_sse2(16, partial, lpartial, lP, rpartial, rP);
+    return;
+  }
+#endif
+  lk_prune_generic(nstates, partial, lpartial, lP, rpartial, rP);
+}
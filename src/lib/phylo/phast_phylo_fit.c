@@ -54,6 +54,7 @@ struct phyloFit_struct* phyloFit_struct_new(int rphast) {
   pf->quiet = FALSE; //probably want to switch to TRUE for rphast after debugging
   pf->nratecats = -1;
   pf->use_em = FALSE;
+  pf->analytic_grad = FALSE;
   pf->window_size = -1;
   pf->window_shift = -1;
   pf->use_conditionals = FALSE;
@@ -1003,6 +1004,7 @@ int run_phyloFit(struct phyloFit_struct *pf) {
       } else mod->bound_arg = NULL;
 
       mod->use_conditionals = pf->use_conditionals;
+      mod->analytic_grad = pf->analytic_grad;
 
       if (pf->estimate_scale_only ||
 	  pf->estimate_backgd ||
@@ -37,6 +37,7 @@ struct phyloP_struct *phyloP_struct_new(int rphast) {
   p->quantiles_only = FALSE;
   
   p->output_wig = FALSE;
+  p->output_binary = FALSE;
   p->output_gff = FALSE;
 
   p->fit_model = FALSE;
@@ -134,7 +135,7 @@ void phyloP(struct phyloP_struct *p) {
   /* variables for options that are passed through p */
   int nsites, fit_model, base_by_base, refidx;
   int prior_only, post_only, quantiles_only,
-    output_wig, output_gff;
+    output_wig, output_gff, output_binary;
   double ci, epsilon;
   char *subtree_name, *chrom;
   List *branch_name;
@@ -187,6 +188,7 @@ void phyloP(struct phyloP_struct *p) {
   post_only = p->post_only;
   quantiles_only = p->quantiles_only;
   output_wig = p->output_wig;
+  output_binary = p->output_binary;
   output_gff = p->output_gff;
 
   if (msa == NULL && !prior_only)
@@ -351,12 +353,12 @@ void phyloP(struct phyloP_struct *p) {
                           pvals, post_means, post_vars, logf);
 
         if (outfile != NULL && output_wig)
-          print_wig(outfile, msa, pvals, chrom, refidx, TRUE, NULL);
+          print_wig(outfile, output_binary, msa, pvals, chrom, refidx, TRUE, NULL);
 	if ((outfile != NULL && !output_wig) || results!=NULL) {
 	  char str[1000];
 	  sprintf(str, "#neutral mean = %.3f var = %.3f\n#post_mean post_var pval", 
                   prior_mean, prior_var);
-          print_base_by_base(output_wig ? NULL : outfile, 
+          print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			     str, chrom, msa, NULL, 
 			     refidx, results, FALSE, TRUE, 3,
 			     "post.mean", post_means, 
@@ -419,12 +421,12 @@ void phyloP(struct phyloP_struct *p) {
                                   logf);
 
         if (output_wig) 
-          print_wig(outfile, msa, pvals, chrom, refidx, TRUE, results);
+          print_wig(outfile, output_binary, msa, pvals, chrom, refidx, TRUE, results);
 	if (results != NULL || !output_wig) {
           char str[1000];
           sprintf(str, "#neutral mean_sub = %.3f var_sub = %.3f mean_sup = %.3f  var_sup = %.3f\n#post_mean_sub post_var_sub post_mean_sup post_var_sup pval", 
                   prior_mean_sub, prior_var_sub, prior_mean_sup, prior_var_sup);
-          print_base_by_base(output_wig ? NULL : outfile, 
+          print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			     str, chrom, msa, NULL, 
 			     refidx, results, FALSE, TRUE, 5, 
 			     "post.mean.sub", post_means_sub, 
@@ -492,9 +494,9 @@ void phyloP(struct phyloP_struct *p) {
       if (subtree_name == NULL && branch_name == NULL) { /* no subtree case */
         col_lrts(mod, msa, mode, pvals, scales, llrs, logf);
         if (output_wig) 
-          print_wig(outfile, msa, pvals, chrom, refidx, TRUE, NULL);
+          print_wig(outfile, output_binary, msa, pvals, chrom, refidx, TRUE, NULL);
 	if (results != NULL || !output_wig)
-          print_base_by_base(output_wig ? NULL : outfile, 
+          print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			     "#scale lnlratio pval", 
 			     chrom, msa, NULL, refidx, results, FALSE, TRUE, 3, 
                              "scale", scales, "lnlratio", llrs, "pval", pvals);
@@ -508,9 +510,9 @@ void phyloP(struct phyloP_struct *p) {
                      llrs, logf);
 
         if (output_wig) 
-          print_wig(outfile, msa, pvals, chrom, refidx, TRUE, NULL);
+          print_wig(outfile, output_binary, msa, pvals, chrom, refidx, TRUE, NULL);
 	if (results != NULL || !output_wig)
-          print_base_by_base(output_wig ? NULL : outfile, 
+          print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			     "#null_scale alt_scale alt_subscale lnlratio pval", 
                              chrom, msa, NULL, refidx, results, FALSE, TRUE, 5, 
 			     "null.scale", null_scales, "alt.scale", scales,
@@ -573,9 +575,9 @@ void phyloP(struct phyloP_struct *p) {
         col_score_tests(mod, msa, mode, pvals, derivs, 
                         teststats);
         if (output_wig) 
-          print_wig(outfile, msa, pvals, chrom, refidx, TRUE, NULL);
+          print_wig(outfile, output_binary, msa, pvals, chrom, refidx, TRUE, NULL);
 	if (results != NULL || !output_wig)
-          print_base_by_base(output_wig ? NULL : outfile, 
+          print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			     "#deriv teststat pval", 
 			     chrom, msa, NULL, refidx, results, FALSE, TRUE, 3, 
                              "deriv", derivs, "teststat", teststats, 
@@ -591,9 +593,9 @@ void phyloP(struct phyloP_struct *p) {
                             sub_derivs, teststats, logf);
 
         if (output_wig) 
-          print_wig(outfile, msa, pvals, chrom, refidx, TRUE, NULL);
+          print_wig(outfile, output_binary, msa, pvals, chrom, refidx, TRUE, NULL);
 	if (results != NULL || !output_wig)
-          print_base_by_base(output_wig ? NULL : outfile, 
+          print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			     "#scale deriv subderiv teststat pval", 
 			     chrom, msa, NULL, refidx, results, FALSE, TRUE, 5, 
 			     "scale", null_scales, "deriv", derivs, 
@@ -656,9 +658,9 @@ void phyloP(struct phyloP_struct *p) {
       }
       col_gerp(mod, msa, mode, nneut, nobs, nrejected, nspec, logf);
       if (output_wig) 
-        print_wig(outfile, msa, nrejected, chrom, refidx, FALSE, NULL);
+        print_wig(outfile, output_binary, msa, nrejected, chrom, refidx, FALSE, NULL);
       if (results != NULL || !output_wig) {
-        print_base_by_base(output_wig ? NULL : outfile, 
+        print_base_by_base(output_wig ? NULL : outfile, output_binary,
 			   "#nneut nobs nrej nspec", chrom, 
 			   msa, formatstr, refidx, results, FALSE, FALSE, 4, 
 			   "nneut", nneut, "nobs", nobs, "nrej", nrejected, 
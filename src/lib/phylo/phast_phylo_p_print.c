@@ -21,6 +21,7 @@
 #include <phast_prob_matrix.h>
 #include <phast_phylo_p_print.h>
 #include <phast_list_of_lists.h>
+#include <phast_wig.h>
 
 void print_quantiles(FILE *outfile, Vector *distrib, ListOfLists *result) {
   int *quantiles = pv_quantiles(distrib);
@@ -583,16 +584,18 @@ void print_feats_sph_subtree(FILE *outfile, p_value_joint_stats *stats,
 }
 
 
-void print_wig(FILE *outfile, MSA *msa, double *vals, char *chrom,
-	       int refidx, int log_trans, ListOfLists *result) {
+void print_wig(FILE *outfile, int binary, MSA *msa, double *vals,
+	       char *chrom, int refidx, int log_trans, ListOfLists *result) {
   int last, j, k;
   double val;
   List *posList=NULL, *scoreList=NULL;
+  WigWriter *w = NULL;
 
   if (result != NULL) {
     posList = lst_new_int(msa->length);
     scoreList = lst_new_dbl(msa->length);
   }
+  if (outfile != NULL) w = ww_new(outfile, binary);
 
   last = -INFTY;
   if (!(refidx >= 0 && refidx <= msa->nseqs))
@@ -601,9 +604,8 @@ void print_wig(FILE *outfile, MSA *msa, double *vals, char *chrom,
     checkInterruptN(j, 1000);
     if (refidx == 0 || msa_get_char(msa, refidx-1, j) != GAP_CHAR) {
       if (refidx == 0 || !msa_missing_col(msa, refidx, j)) {
-        if (k > last + 1 && outfile != NULL)
-          fprintf(outfile, "fixedStep chrom=%s start=%d step=1\n", chrom,
-		  k + msa->idx_offset + 1);
+        if (k > last + 1 && w != NULL)
+          ww_fixed_step(w, chrom, k + msa->idx_offset + 1);
         val = vals[msa->ss->tuple_idx[j]];
         if (log_trans) {
           int sign = 1;
@@ -613,7 +615,10 @@ void print_wig(FILE *outfile, MSA *msa, double *vals, char *chrom,
           }
           val = fabs(-log10(val)) * sign; /* fabs prevents -0 for val == 1 */
         }
-        if (outfile != NULL) fprintf(outfile, "%.3f\n", val);
+        if (w != NULL) {
+          ww_dbl(w, val, 3);
+          ww_end_row(w);
+        }
 	if (result != NULL) {
 	  lst_push_int(posList, k + msa->idx_offset + 1);
 	  lst_push_dbl(scoreList, val);
@@ -623,6 +628,7 @@ void print_wig(FILE *outfile, MSA *msa, double *vals, char *chrom,
       k++;
     }
   }
+  if (w != NULL) ww_free(w);
   if (result != NULL) {
     ListOfLists *group = lol_new(2);
     lol_push(group, posList, "coord", INT_LIST);
@@ -648,8 +654,9 @@ double *log10_pval(double *pval, int len) {
 
 
 /* Print arbitrary columns of tuple-specific data in wig-like format */
-void print_base_by_base(FILE *outfile, char *header, char *chrom, MSA *msa,
-                        char **formatstr, int refidx, ListOfLists *result,
+void print_base_by_base(FILE *outfile, int binary, char *header, char *chrom,
+                        MSA *msa, char **formatstr, int refidx,
+                        ListOfLists *result,
 			int log_trans_outfile, int log_trans_results,
 			int ncols, ...) {
   int last, j, k, tup, col;
@@ -657,6 +664,7 @@ void print_base_by_base(FILE *outfile, char *header, char *chrom, MSA *msa,
   double *data[ncols+1];
   List **resultList=NULL;
   char **colname;
+  WigWriter *w = NULL;
   int get_log = (log_trans_outfile && outfile != NULL) ||
     (log_trans_results && result != NULL);
 
@@ -673,10 +681,10 @@ void print_base_by_base(FILE *outfile, char *header, char *chrom, MSA *msa,
   }
 
   last = -INFTY;
-  if (header != NULL && outfile != NULL) {
-    fprintf(outfile, "%s", header);
-    if (log_trans_outfile) fprintf(outfile, " score\n");
-    else fprintf(outfile, "\n");
+  if (outfile != NULL) w = ww_new(outfile, binary);
+  if (header != NULL && w != NULL) {
+    ww_text(w, header);
+    ww_text(w, log_trans_outfile ? " score\n" : "\n");
   }
 
   va_start(ap, ncols);
@@ -697,17 +705,20 @@ void print_base_by_base(FILE *outfile, char *header, char *chrom, MSA *msa,
     checkInterruptN(j, 1000);
     if (refidx == 0 || msa_get_char(msa, refidx-1, j) != GAP_CHAR) {
       if (refidx == 0 || !msa_missing_col(msa, refidx, j)) {
-        if (k > last + 1 && outfile != NULL)
-          fprintf(outfile, "fixedStep chrom=%s start=%d step=1\n", chrom,
-                 k + msa->idx_offset + 1);
+        if (k > last + 1 && w != NULL)
+          ww_fixed_step(w, chrom, k + msa->idx_offset + 1);
         tup = msa->ss->tuple_idx[j];
-	if (outfile != NULL) {
+	if (w != NULL) {
 	  for (col = 0; col < ncols; col++) {
-	    fprintf(outfile, (formatstr == NULL ? "%.5f" : formatstr[col]), data[col][tup]);
-	    if (col <  ncols-1) fputc('\t', outfile);
+	    if (formatstr == NULL) ww_dbl(w, data[col][tup], 5);
+	    else ww_dbl_fmt(w, formatstr[col], data[col][tup]);
+	    if (col <  ncols-1) ww_text(w, "\t");
+	  }
+	  if (log_trans_outfile) {
+	    ww_text(w, "\t");
+	    ww_dbl(w, data[col][tup], 5);
 	  }
-	  if (log_trans_outfile) fprintf(outfile, "\t%.5f", data[col][tup]);
-	  fputc('\n', outfile);
+	  ww_end_row(w);
 	}
 	if (result != NULL) {
 	  lst_push_int(resultList[0], k + msa->idx_offset + 1);
@@ -722,6 +733,7 @@ void print_base_by_base(FILE *outfile, char *header, char *chrom, MSA *msa,
     }
   }
   va_end(ap);
+  if (w != NULL) ww_free(w);
 
   if (result != NULL) {
     ListOfLists *group = lol_new(ncols+1+log_trans_results);
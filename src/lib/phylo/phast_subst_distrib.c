@@ -21,6 +21,7 @@
 #include <phast_prob_vector.h>
 #include <phast_prob_matrix.h>
 #include <phast_fit_column.h>
+#include <phast_workspace.h>
 
 /* (used below) compute and return a set of matrices giving p(b, n |
    j), the probability of n substitutions and a final base b given j
@@ -76,6 +77,102 @@ int get_njumps_max(double lambda, double t_max, double epsilon) {
   return max(10, j);
 }
 
+/* (used below) allocate the per-node bookkeeping of a jump process
+   that is set by sub_set_subst_bounds */
+static void sub_alloc_subst_bounds(JumpProcess *jp) {
+  int nnodes = jp->mod->tree->nnodes, size = jp->R->nrows;
+  jp->subst_max = smalloc(nnodes * sizeof(int));
+  jp->subst_max_full = smalloc(nnodes * sizeof(int));
+  jp->partials_offset = smalloc((nnodes + 1) * sizeof(int));
+  jp->branch_marg = smalloc(nnodes * size * size * sizeof(double));
+}
+
+/* (used below) set the maximum numbers of substitutions to consider
+   beneath each node, the layout of the buffer used by
+   sub_posterior_distrib_site and sub_joint_distrib_site, and the
+   marginal branch distributions.  Must be called whenever the branch
+   distributions change.  The full bound for a node follows from the
+   supports of the branch distributions beneath it.  It is capped by
+   the number of jumps that can occur in the whole tree with
+   probability greater than jp->epsilon, given its total (scaled, if
+   scaled == TRUE) branch length.  The same cap applies at every node,
+   so that the partials computed for counts up to the cap are exactly
+   those of the uncapped computation; only the mass above the cap is
+   lost (see sub_truncation_suspect) */
+static void sub_set_subst_bounds(JumpProcess *jp, int scaled) {
+  TreeModel *mod = jp->mod;
+  int nnodes = mod->tree->nnodes, size = jp->R->nrows;
+  List *traversal = tr_postorder(mod->tree);
+  double *t = smalloc(nnodes * sizeof(double)),
+    *len = smalloc(nnodes * sizeof(double));
+  int i, id, l, r, a, b, k, ncols_l, ncols_r, offset, cap;
+
+  for (i = 0; i < nnodes; i++) {
+    TreeNode *n = lst_get_ptr(mod->tree->nodes, i);
+    t[n->id] = n->dparent;
+    if (scaled) {
+      t[n->id] *= mod->scale;
+      if (mod->in_subtree != NULL && mod->in_subtree[n->id])
+        t[n->id] *= mod->scale_sub;
+    }
+  }
+
+  /* p(b | a) for each branch */
+  for (id = 0; id < nnodes; id++) {
+    double *marg = jp->branch_marg + id * size * size;
+    Matrix **d = jp->branch_distrib[id];
+    for (a = 0; a < size; a++) {
+      for (b = 0; b < size; b++) {
+        marg[a*size + b] = 0;
+        for (k = 0; d != NULL && k < d[a]->ncols; k++)
+          marg[a*size + b] += d[a]->data[b][k];
+      }
+    }
+  }
+
+  jp->partials_width = 1;
+  for (i = 0; i < lst_size(traversal); i++) {
+    TreeNode *n = lst_get_ptr(traversal, i);
+    id = n->id;
+    if (n->lchild == NULL) {
+      jp->subst_max_full[id] = 0;
+      len[id] = 0;
+      continue;
+    }
+    l = n->lchild->id;
+    r = n->rchild->id;
+    ncols_l = jp->branch_distrib[l][0]->ncols;
+    ncols_r = jp->branch_distrib[r][0]->ncols;
+    jp->subst_max_full[id] = max(jp->subst_max_full[l] + ncols_l - 1,
+                                 jp->subst_max_full[r] + ncols_r - 1);
+    len[id] = len[l] + t[l] + len[r] + t[r];
+    jp->partials_width = max(jp->partials_width,
+                             max(jp->subst_max_full[l] + ncols_l,
+                                 jp->subst_max_full[r] + ncols_r));
+  }
+
+  cap = get_njumps_max(jp->lambda, len[mod->tree->id], jp->epsilon) - 1;
+  jp->subst_capped = FALSE;
+  for (id = 0; id < nnodes; id++) {
+    jp->subst_max[id] = min(jp->subst_max_full[id], cap);
+    if (jp->subst_max[id] < jp->subst_max_full[id])
+      jp->subst_capped = TRUE;
+  }
+
+  /* partials for node are size x (subst_max_full + 1), followed by two
+     size x partials_width scratch arrays and nnodes x size untruncated
+     partials */
+  for (id = 0, offset = 0; id < nnodes; id++) {
+    jp->partials_offset[id] = offset;
+    offset += size * (jp->subst_max_full[id] + 1);
+  }
+  jp->partials_offset[nnodes] = offset;
+  jp->partials_size = offset + 2 * size * jp->partials_width + nnodes * size;
+
+  sfree(t);
+  sfree(len);
+}
+
 /* define jump process based on substitution model */
 JumpProcess *sub_define_jump_process(TreeModel *mod, 
                                      double epsilon, 
@@ -138,6 +235,9 @@ JumpProcess *sub_define_jump_process(TreeModel *mod,
         sub_distrib_branch_conditional(jp, n->dparent);
   }
 
+  sub_alloc_subst_bounds(jp);
+  sub_set_subst_bounds(jp, FALSE);
+
   return jp;
 }
 
@@ -158,6 +258,10 @@ void sub_free_jump_process(JumpProcess *jp) {
         mat_free(jp->branch_distrib[i][j]);
   }
   sfree(jp->branch_distrib);
+  sfree(jp->subst_max);
+  sfree(jp->subst_max_full);
+  sfree(jp->partials_offset);
+  sfree(jp->branch_marg);
   mat_free(jp->R);
   mat_free(jp->M);
   sfree(jp);
@@ -185,6 +289,7 @@ void sub_recompute_conditionals(JumpProcess *jp) {
         sub_distrib_branch_conditional(jp, t);
     }
   }
+  sub_set_subst_bounds(jp, TRUE);
 }
 
 /* compute and return a probability vector giving p(n | t), the probability
@@ -260,111 +365,177 @@ Vector *sub_prior_distrib_site(JumpProcess *jp) {
   return sub_distrib_branch(jp, tr_total_len(jp->mod->tree));
 }
 
-/* compute and return a probability vector giving the posterior
-   distribution over the number of substitutions per site given a tree
-   model and alignment column */
-Vector *sub_posterior_distrib_site(JumpProcess *jp, MSA *msa, int tuple_idx) {
-  int lidx, n, i, j, k, a, b, c;
-  Matrix **L = smalloc(jp->mod->tree->nnodes * sizeof(void*));
-  List *traversal = tr_postorder(jp->mod->tree);
-  int size = jp->mod->rate_matrix->size;
-  Vector *retval;
-  int *maxsubst = smalloc(jp->mod->tree->nnodes * sizeof(int));
+/* (used below) return the calling thread's buffer for partial
+   likelihoods, large enough for the given jump process */
+static double *sub_partials_buffer(JumpProcess *jp) {
+  PhastWorkspace *ws = ws_current();
+  if (ws->sub_partials == NULL || ws->sub_partials->size < jp->partials_size)
+    ws_vec(ws, &ws->sub_partials, jp->partials_size);
+  return ws->sub_partials->data;
+}
 
-  if (jp->mod->order != 0)
-    die("ERROR sub_posterior_distrib_site: jp->mod->order=%i, should be 0\n",
-	jp->mod->order);
-  if (msa->ss == NULL)
-    die("ERROR sub_posterior_distrib_size: msa->ss is NULL\n");
+/* (used below) combine the partials Lc of a child node, which has at
+   most mc substitutions beneath it, with the distributions d for the
+   branch above it.  On return, conv[a*nj + j] is the joint
+   probability of j substitutions on and beneath the branch and the
+   data beneath the child, given label a at the top of the branch, for
+   0 <= j < nj */
+static void sub_conv_branch(double *Lc, int mc, Matrix **d, int size,
+                            double *conv, int nj) {
+  int a, b, i, j, min_i, max_i;
+  for (j = 0; j < nj; j++) {
+    /* i goes from 0 to j, but we can trim off extreme vals */
+    min_i = max(0, j - d[0]->ncols + 1);
+    max_i = min(j, mc);
+    for (a = 0; a < size; a++) {
+      double sum = 0;
+      for (b = 0; b < size; b++)
+        for (i = min_i; i <= max_i; i++)
+          sum += Lc[b*(mc+1) + i] * d[a]->data[b][j-i];
+      conv[a*nj + j] = sum;
+    }
+  }
+}
 
-  if (jp->mod->msa_seq_idx == NULL)
-    tm_build_seq_idx(jp->mod, msa);
+/* (used below) compute partial likelihoods for all nodes of the tree
+   for a given alignment column (or, if msa is NULL, a column of
+   missing data), considering at most bound[id] substitutions beneath
+   each node.  The partials for node id are stored at L =
+   buf + jp->partials_offset[id], with L[a*(bound[id]+1) + n] the joint
+   probability of n substitutions and the data beneath the node, given
+   that it has label a.  If skip_root == TRUE, the partials for the
+   root are not computed.  Returns the probability of the column
+   without truncation, for comparison */
+static double sub_site_partials(JumpProcess *jp, MSA *msa, int tuple_idx,
+                                int *bound, double *buf, int skip_root) {
+  List *traversal = tr_postorder(jp->mod->tree);
+  int size = jp->mod->rate_matrix->size, nnodes = jp->mod->tree->nnodes;
+  double *convl = buf + jp->partials_offset[nnodes],
+    *convr = convl + size * jp->partials_width,
+    *F = convr + size * jp->partials_width;
+  double prob = 0;
+  int lidx, a, b, j, n, w, l, r;
 
   for (lidx = 0; lidx < lst_size(traversal); lidx++) {
     TreeNode *node = lst_get_ptr(traversal, lidx);
-
-    L[node->id] = mat_new(size, 500);
-    mat_zero(L[node->id]);
-    /* L[node->id]->[a][n] is the joint probability of n substitutions
-       and the data beneath node, given that node has label a */
+    double *L = buf + jp->partials_offset[node->id];
+    w = bound[node->id] + 1;
 
     if (node->lchild == NULL) {    /* leaf -- base case */
-      char c;
-
-      if (jp->mod->msa_seq_idx[node->id] < 0)
-        die("ERROR: no match for leaf '%s' in alignment.\n", node->name);
-
-      c = ss_get_char_tuple(msa, tuple_idx, 
-                                 jp->mod->msa_seq_idx[node->id], 0);
-      if (msa->is_missing[(int)c] || c == GAP_CHAR)
+      char c = 0;
+      for (a = 0; a < size; a++) L[a] = 0;
+      if (msa != NULL) {
+        if (jp->mod->msa_seq_idx[node->id] < 0)
+          die("ERROR: no match for leaf '%s' in alignment.\n", node->name);
+        c = ss_get_char_tuple(msa, tuple_idx,
+                              jp->mod->msa_seq_idx[node->id], 0);
+      }
+      if (msa == NULL || msa->is_missing[(int)c] || c == GAP_CHAR)
         for (a = 0; a < size; a++)
-          L[node->id]->data[a][0] = 1;
+          L[a] = 1;
       else {
         if (msa->inv_alphabet[(int)c] < 0)
           die("ERROR: bad character in alignment ('%c')\n", c);
-        L[node->id]->data[msa->inv_alphabet[(int)c]][0] = 1;
+        L[msa->inv_alphabet[(int)c]] = 1;
       }
+      for (a = 0; a < size; a++)
+        F[node->id*size + a] = L[a];
+      continue;
+    }
 
-      maxsubst[node->id] = 0;	/* max no. subst. beneath node */
+    /* internal node -- recursive case */
+    l = node->lchild->id;
+    r = node->rchild->id;
+
+    /* untruncated partials, by Felsenstein's pruning algorithm */
+    for (a = 0; a < size; a++) {
+      double *marg_l = jp->branch_marg + (l*size + a) * size,
+        *marg_r = jp->branch_marg + (r*size + a) * size,
+        left = 0, right = 0;
+      for (b = 0; b < size; b++) {
+        left += marg_l[b] * F[l*size + b];
+        right += marg_r[b] * F[r*size + b];
+      }
+      F[node->id*size + a] = left * right;
     }
-    
-    else {            /* internal node -- recursive case */
-
-      Matrix **d_left = jp->branch_distrib[node->lchild->id];
-      Matrix **d_right = jp->branch_distrib[node->rchild->id];
-
-      maxsubst[node->id] = max(maxsubst[node->lchild->id] + d_left[0]->ncols - 1, 
-                               maxsubst[node->rchild->id] + d_right[0]->ncols - 1);
-
-      for (n = 0; n <= maxsubst[node->id]; n++) {
-	checkInterruptN(n, 10);
-        for (j = 0; j <= n; j++) {
-          int min_i, max_i, min_k, max_k;
-          min_i = max(0, j - d_left[0]->ncols + 1);
-          max_i = min(j, maxsubst[node->lchild->id]);
-          min_k = max(0, n - j - d_right[0]->ncols + 1);
-          max_k = min(n - j, maxsubst[node->rchild->id]);
-
-          for (a = 0; a < size; a++) {
-            double left = 0, right = 0;
-	    
-            for (b = 0; b < size; b++) 
-              /* i goes from 0 to j, but we can trim off extreme vals */
-              for (i = min_i; i <= max_i; i++) 
-                left += L[node->lchild->id]->data[b][i] * 
-                  d_left[a]->data[b][j-i];
-
-            for (c = 0; c < size; c++) 
-              /* k goes from 0 to n-j, but we can trim off extreme vals */
-              for (k = min_k; k <= max_k; k++) 
-                right += L[node->rchild->id]->data[c][k] * 
-                  d_right[a]->data[c][n-j-k];
-      
-            L[node->id]->data[a][n] += (left * right);
-          }
+
+    if (node != jp->mod->tree || !skip_root) {
+      checkInterrupt();
+      sub_conv_branch(buf + jp->partials_offset[l], bound[l],
+                      jp->branch_distrib[l], size, convl, w);
+      sub_conv_branch(buf + jp->partials_offset[r], bound[r],
+                      jp->branch_distrib[r], size, convr, w);
+      for (a = 0; a < size; a++) {
+        for (n = 0; n < w; n++) {
+          double sum = 0;
+          for (j = 0; j <= n; j++)
+            sum += convl[a*w + j] * convr[a*w + n - j];
+          L[a*w + n] = sum;
         }
       }
     }
   }
 
-  retval = vec_new(maxsubst[jp->mod->tree->id] + 1);
-  vec_zero(retval);
-  for (n = 0; n <= maxsubst[jp->mod->tree->id]; n++)
-    for (a = 0; a < size; a++)
-      retval->data[n] += L[jp->mod->tree->id]->data[a][n] * 
-        jp->mod->backgd_freqs->data[a];
+  for (a = 0; a < size; a++)
+    prob += F[jp->mod->tree->id*size + a] * jp->mod->backgd_freqs->data[a];
+  return prob;
+}
+
+/* (used below) decide whether too much of the probability of a
+   column (full_prob) was lost in computing its partials with the
+   given bounds (which gave prob), so that the computation should be
+   repeated without caps.  The fraction lost may not exceed
+   jp->epsilon, the precision requested for the distributions */
+static int sub_truncation_suspect(JumpProcess *jp, int *bound, double prob,
+                                  double full_prob) {
+  return (bound != jp->subst_max_full && jp->subst_capped &&
+          full_prob - prob > jp->epsilon * full_prob);
+}
+
+/* compute and return a probability vector giving the posterior
+   distribution over the number of substitutions per site given a tree
+   model and alignment column */
+Vector *sub_posterior_distrib_site(JumpProcess *jp, MSA *msa, int tuple_idx) {
+  int n, a, root = jp->mod->tree->id, *bound = jp->subst_max;
+  int size = jp->mod->rate_matrix->size;
+  double *buf, *L, prob, full_prob;
+  Vector *retval;
+
+  if (jp->mod->order != 0)
+    die("ERROR sub_posterior_distrib_site: jp->mod->order=%i, should be 0\n",
+	jp->mod->order);
+  if (msa->ss == NULL)
+    die("ERROR sub_posterior_distrib_size: msa->ss is NULL\n");
+
+  if (jp->mod->msa_seq_idx == NULL)
+    tm_build_seq_idx(jp->mod, msa);
+
+  buf = sub_partials_buffer(jp);
+  while (TRUE) {
+    full_prob = sub_site_partials(jp, msa, tuple_idx, bound, buf, FALSE);
+    L = buf + jp->partials_offset[root];
+
+    retval = vec_new(bound[root] + 1);
+    vec_zero(retval);
+    prob = 0;
+    for (n = 0; n <= bound[root]; n++) {
+      for (a = 0; a < size; a++)
+        retval->data[n] += L[a*(bound[root]+1) + n] * 
+          jp->mod->backgd_freqs->data[a];
+      prob += retval->data[n];
+    }
+
+    if (!sub_truncation_suspect(jp, bound, prob, full_prob)) break;
+    vec_free(retval);
+    bound = jp->subst_max_full;
+  }
 
   normalize_probs(retval->data, retval->size);
 
   /* trim off very small values */
-  for (n = maxsubst[jp->mod->tree->id]; n >= 0 && retval->data[n] < jp->epsilon; n--);
+  for (n = bound[root]; n >= 0 && retval->data[n] < jp->epsilon; n--);
   retval->size = n+1;
 
-  for (lidx = 0; lidx < jp->mod->tree->nnodes; lidx++)
-    mat_free(L[lidx]);
-  sfree(L);
-  sfree(maxsubst);
-
   pv_normalize(retval);
   return retval;
 }
@@ -404,23 +575,143 @@ Vector *sub_posterior_distrib_alignment(JumpProcess *jp, MSA *msa) {
   return retval;
 }
 
+/* create a copy of a jump process for use with a private copy of its
+   tree model, so that scale factors can be changed independently (see
+   sub_pval_per_site).  Matrices that do not depend on branch lengths
+   are shared with the original */
+static JumpProcess *sub_copy_jump_process(JumpProcess *jp, TreeModel *mod) {
+  JumpProcess *retval = smalloc(sizeof(JumpProcess));
+  int i, j, size = jp->R->nrows;
+  *retval = *jp;
+  retval->mod = mod;
+  retval->branch_distrib = smalloc(mod->tree->nnodes * sizeof(void*));
+  for (i = 0; i < mod->tree->nnodes; i++) {
+    if (jp->branch_distrib[i] == NULL) {
+      retval->branch_distrib[i] = NULL;
+      continue;
+    }
+    retval->branch_distrib[i] = smalloc(size * sizeof(void*));
+    for (j = 0; j < size; j++)
+      retval->branch_distrib[i][j] = mat_create_copy(jp->branch_distrib[i][j]);
+  }
+  sub_alloc_subst_bounds(retval);
+  for (i = 0; i < mod->tree->nnodes; i++) {
+    retval->subst_max[i] = jp->subst_max[i];
+    retval->subst_max_full[i] = jp->subst_max_full[i];
+    retval->partials_offset[i] = jp->partials_offset[i];
+  }
+  retval->partials_offset[i] = jp->partials_offset[i];
+  for (i = 0; i < mod->tree->nnodes * size * size; i++)
+    retval->branch_marg[i] = jp->branch_marg[i];
+  return retval;
+}
+
+/* free a jump process created by sub_copy_jump_process */
+static void sub_free_jump_process_copy(JumpProcess *jp) {
+  int i, j;
+  for (i = 0; i < jp->mod->tree->nnodes; i++) {
+    if (jp->branch_distrib[i] == NULL) continue;
+    for (j = 0; j < jp->R->nrows; j++)
+      mat_free(jp->branch_distrib[i][j]);
+    sfree(jp->branch_distrib[i]);
+  }
+  sfree(jp->branch_distrib);
+  sfree(jp->subst_max);
+  sfree(jp->subst_max_full);
+  sfree(jp->partials_offset);
+  sfree(jp->branch_marg);
+  sfree(jp);
+}
+
+/* data shared by workers in sub_pval_per_site and
+   sub_pval_per_site_subtree */
+typedef struct {
+  JumpProcess **jp;             /* jump process for each worker */
+  ColWorker **w;                /* workers for fitting scale factors
+                                   (NULL if not fitting) */
+  int nworkers;
+  MSA *msa;
+  mode_type mode;
+  FILE *logf;
+  Matrix *prior;                /* joint prior (subtree case) */
+  double *pvals, *post_mean, *post_var, *msub, *vsub, *msup, *vsup;
+} SubSiteData;
+
+/* set up one jump process per worker.  If fit_model is TRUE, each
+   worker also gets ColFitData of the given type, and every worker but
+   the first a private copy of the tree model and jump process;
+   otherwise jp is shared, and is not modified */
+static void sub_init_site_data(SubSiteData *sd, JumpProcess *jp, MSA *msa,
+                               int fit_model, scale_type stype) {
+  int i;
+  sd->nworkers = col_nworkers(msa);
+  sd->msa = msa;
+  sd->w = NULL;
+  if (fit_model)
+    sd->w = col_new_workers(jp->mod, msa, stype, NNEUT, sd->nworkers);
+  else {
+    /* set up lazily computed state before sharing */
+    if (jp->mod->msa_seq_idx == NULL)
+      tm_build_seq_idx(jp->mod, msa);
+    tr_postorder(jp->mod->tree);
+  }
+  sd->jp = smalloc(sd->nworkers * sizeof(void*));
+  sd->jp[0] = jp;
+  for (i = 1; i < sd->nworkers; i++) 
+    sd->jp[i] = fit_model ? 
+      sub_copy_jump_process(jp, sd->w[i]->mod) : jp;
+}
+
+static void sub_free_site_data(SubSiteData *sd) {
+  int i;
+  if (sd->w != NULL) {
+    for (i = 1; i < sd->nworkers; i++)
+      sub_free_jump_process_copy(sd->jp[i]);
+    col_free_workers(sd->w, sd->nworkers);
+  }
+  sfree(sd->jp);
+}
+
+/* posterior mean and variance for a single tuple (see
+   sub_pval_per_site) */
+static void sub_pval_per_site_tuple(void *data, int tup, int thread) {
+  SubSiteData *sd = data;
+  JumpProcess *jp = sd->jp[thread];
+  Vector *post;
+  double var, lnl;
+
+  if (sd->w != NULL) {          /* estimate scale factor for col */
+    ColFitData *d = sd->w[thread]->d;
+    vec_set(d->params, 0, d->init_scale);
+    d->tupleidx = tup;
+    opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d, 
+                  &lnl, SIGFIGS, d->lb->data[0], d->ub->data[0], 
+                  sd->logf, NULL, NULL);   
+    jp->mod->scale = d->params->data[0];
+    sub_recompute_conditionals(jp);
+  }
+  post = sub_posterior_distrib_site(jp, sd->msa, tup); 
+  pv_stats(post, &sd->post_mean[tup], &var);
+  if (sd->post_var != NULL) sd->post_var[tup] = var;
+  vec_free(post);
+}
+
 /* compute individual site p-values, one per tuple.  If post_mean, and
    post_var are non-NULL, also return tuple-by-tuple mean and variance
    of posterior.  If prior_mean and prior_var are non-NULL, return
    mean and variance of the prior, which will be the same for all
    sites.  Returned array, post_mean, and post_var should have
    dimension msa->ss->ntuples; prior_mean and prior_var should be
-   pointers to individual doubles */
+   pointers to individual doubles.  Tuples are processed in parallel
+   (see col_foreach_tuple) */
 void sub_pval_per_site(JumpProcess *jp, MSA *msa, mode_type mode,
                        int fit_model, double *prior_mean, double *prior_var, 
                        double *pvals, double *post_mean, double *post_var,
                        FILE *logf) { 
   int tup;
-  double var, lnl;
   Vector *prior = sub_prior_distrib_site(jp);
-  Vector *post;
   double *x0; /* array of posterior means; used for p-value computation */
-  ColFitData *d=NULL;
+  SubSiteData sd;
 
   if (post_mean != NULL)
     x0 = post_mean;             /* just reuse post_mean in this case */
@@ -430,24 +721,13 @@ void sub_pval_per_site(JumpProcess *jp, MSA *msa, mode_type mode,
   if (prior_mean != NULL && prior_var != NULL) 
     pv_stats(prior, prior_mean, prior_var);
 
-  if (fit_model) 
-    d = col_init_fit_data(jp->mod, msa, ALL, NNEUT, FALSE);
+  sub_init_site_data(&sd, jp, msa, fit_model, ALL);
+  sd.logf = logf;
+  sd.post_mean = x0;
+  sd.post_var = post_var;
   
-  for (tup = 0; tup < msa->ss->ntuples; tup++) {
-    if (fit_model) {            /* estimate scale factor for col */
-      vec_set(d->params, 0, d->init_scale);
-      d->tupleidx = tup;
-      opt_newton_1d(col_likelihood_wrapper_1d, &d->params->data[0], d, 
-                    &lnl, SIGFIGS, d->lb->data[0], d->ub->data[0], 
-                    logf, NULL, NULL);   
-      jp->mod->scale = d->params->data[0];
-      sub_recompute_conditionals(jp);
-    }
-    post = sub_posterior_distrib_site(jp, msa, tup); 
-    pv_stats(post, &x0[tup], &var);
-    if (post_var != NULL) post_var[tup] = var;
-    vec_free(post);
-  }  
+  col_foreach_tuple(msa, sub_pval_per_site_tuple, &sd);
+
   if (pvals != NULL) {
     if (mode == NNEUT) {
       pv_p_values(prior, x0, msa->ss->ntuples, pvals, TWOTAIL);
@@ -481,13 +761,91 @@ void sub_pval_per_site(JumpProcess *jp, MSA *msa, mode_type mode,
 
   if (post_mean == NULL) sfree(x0);
   vec_free(prior);
+  sub_free_site_data(&sd);
   if (fit_model) {
-    col_free_fit_data(d);
     jp->mod->scale = 1;
     sub_recompute_conditionals(jp); /* in case needed again */
   }
 }
 
+/* posterior means, variances and p-value for a single tuple (see
+   sub_pval_per_site_subtree) */
+static void sub_pval_per_site_subtree_tuple(void *data, int tup, 
+                                            int thread) {
+  SubSiteData *sd = data;
+  JumpProcess *jp = sd->jp[thread];
+  Matrix *prior = sd->prior, *post;
+  Vector *marg_sub, *marg_sup;
+  double *msub = sd->msub, *vsub = sd->vsub, *msup = sd->msup, 
+    *vsup = sd->vsup, *pvals = sd->pvals;
+  mode_type mode = sd->mode;
+  double lnl;
+
+  checkInterruptN(tup, 1000);
+  if (sd->w != NULL) {          /* estimate scale factors (supertree
+                                   and subtree) for col */
+    ColFitData *d = sd->w[thread]->d2;
+    vec_set(d->params, 0, d->init_scale);
+    vec_set(d->params, 1, d->init_scale_sub);
+    d->tupleidx = tup;
+    if (opt_bfgs(col_likelihood_wrapper, d->params, d, &lnl, d->lb, 
+                 d->ub, sd->logf, NULL, OPT_HIGH_PREC, NULL, NULL) != 0)
+      ;                         /* do nothing; warning will be
+                                   produced if problem */
+    jp->mod->scale = d->params->data[0];
+    jp->mod->scale_sub = d->params->data[1];
+    sub_recompute_conditionals(jp);
+  }
+
+  post = sub_joint_distrib_site(jp, sd->msa, tup); 
+  marg_sub = pm_marg_x(post);
+  pv_stats(marg_sub, &msub[tup], &vsub[tup]);
+  marg_sup = pm_marg_y(post);
+  pv_stats(marg_sup, &msup[tup], &vsup[tup]);
+  vec_free(marg_sub);
+  vec_free(marg_sup);
+  mat_free(post);
+
+  if (pvals != NULL) {
+    Vector *cond;
+    if (msub[tup] + msup[tup] > prior->nrows + prior->ncols - 2) 
+      cond = pm_marg_x(prior);
+    /* off scale of finite representation of joint distrib.  This
+       can happen because either msub or msup is unusually large.
+       We simply fall back on the marginal in this case.  This
+       usually produces a reasonable result, although it could be
+       misleading in the rare case in which msub and msup are both
+       very large */
+    else 
+      cond = pm_x_given_tot(prior, (int)(msub[tup] + msup[tup]));
+
+    if (mode == NNEUT) {
+      if (ceil(msub[tup]) >= cond->size)
+        pvals[tup] = 2*jp->epsilon; /* off scale of the finite
+                                       representation of conditional */
+      else 
+        pvals[tup] = pv_p_value(cond, msub[tup], TWOTAIL);
+    }
+    else {
+      double pcons = INFTY, pacc = INFTY;
+      if (mode == ACC || mode == CONACC) {
+        if (ceil(msub[tup]) >= cond->size)
+          pacc = jp->epsilon; /* off scale of the finite
+                                 representation of conditional */
+        else 
+          pacc = pv_p_value(cond, msub[tup], UPPER);
+      }
+      if (mode == CON || mode == CONACC)
+        pcons = pv_p_value(cond, msub[tup], LOWER);
+
+      pvals[tup] = min(pcons, pacc);
+      if (mode == CONACC && pacc < pcons)
+        pvals[tup] *= -1;
+    }
+    vec_free(cond);
+  }
+}
+
 /* compute individual site p-values, one per tuple.  Similar to above
    function but for use in supertree/subtree mode.  */
 void sub_pval_per_site_subtree(JumpProcess *jp, MSA *msa, mode_type mode, 
@@ -498,27 +856,24 @@ void sub_pval_per_site_subtree(JumpProcess *jp, MSA *msa, mode_type mode,
                                double *post_mean_sub, double *post_var_sub, 
                                double *post_mean_sup, double *post_var_sup, 
                                FILE *logf) { 
-  int tup, alloc = FALSE;
-  double lnl;
+  int alloc = FALSE;
   Matrix *prior = sub_joint_distrib_site(jp, NULL, -1);
-  Matrix *post=NULL;
   Vector *marg_sub, *marg_sup;
-  double *msub, *vsub, *msup, *vsup;
-  ColFitData *d=NULL;
+  SubSiteData sd;
 
   if (post_mean_sub != NULL && post_var_sub != NULL &&
       post_mean_sup != NULL && post_var_sup != NULL) {
-    msub = post_mean_sub;
-    vsub = post_var_sub;
-    msup = post_mean_sup;
-    vsup = post_var_sup;
+    sd.msub = post_mean_sub;
+    sd.vsub = post_var_sub;
+    sd.msup = post_mean_sup;
+    sd.vsup = post_var_sup;
   }
   else {
     alloc = TRUE;
-    msub = smalloc(msa->ss->ntuples * sizeof(double));
-    vsub = smalloc(msa->ss->ntuples * sizeof(double));
-    msup = smalloc(msa->ss->ntuples * sizeof(double));
-    vsup = smalloc(msa->ss->ntuples * sizeof(double));
+    sd.msub = smalloc(msa->ss->ntuples * sizeof(double));
+    sd.vsub = smalloc(msa->ss->ntuples * sizeof(double));
+    sd.msup = smalloc(msa->ss->ntuples * sizeof(double));
+    sd.vsup = smalloc(msa->ss->ntuples * sizeof(double));
   }
 
   if (prior_mean_sub != NULL && prior_var_sub != NULL &&
@@ -531,84 +886,24 @@ void sub_pval_per_site_subtree(JumpProcess *jp, MSA *msa, mode_type mode,
     vec_free(marg_sup);
   }
 
-  if (fit_model) 
-    d = col_init_fit_data(jp->mod, msa, SUBTREE, NNEUT, FALSE);
-
-  for (tup = 0; tup < msa->ss->ntuples; tup++) {
-    checkInterruptN(tup, 1000);
-    if (fit_model) {            /* estimate scale factors (supertree
-                                   and subtree) for col */
-      vec_set(d->params, 0, d->init_scale);
-      vec_set(d->params, 1, d->init_scale_sub);
-      d->tupleidx = tup;
-      if (opt_bfgs(col_likelihood_wrapper, d->params, d, &lnl, d->lb, 
-                   d->ub, logf, NULL, OPT_HIGH_PREC, NULL, NULL) != 0)
-        ;                       /* do nothing; warning will be
-                                   produced if problem */
-      jp->mod->scale = d->params->data[0];
-      jp->mod->scale_sub = d->params->data[1];
-      sub_recompute_conditionals(jp);
-    }
-
-    post = sub_joint_distrib_site(jp, msa, tup); 
-    marg_sub = pm_marg_x(post);
-    pv_stats(marg_sub, &msub[tup], &vsub[tup]);
-    marg_sup = pm_marg_y(post);
-    pv_stats(marg_sup, &msup[tup], &vsup[tup]);
-    vec_free(marg_sub);
-    vec_free(marg_sup);
-
-    if (pvals != NULL) {
-      Vector *cond;
-      if (msub[tup] + msup[tup] > prior->nrows + prior->ncols - 2) 
-        cond = pm_marg_x(prior);
-      /* off scale of finite representation of joint distrib.  This
-         can happen because either msub or msup is unusually large.
-         We simply fall back on the marginal in this case.  This
-         usually produces a reasonable result, although it could be
-         misleading in the rare case in which msub and msup are both
-         very large */
-      else 
-        cond = pm_x_given_tot(prior, (int)(msub[tup] + msup[tup]));
-
-      if (mode == NNEUT) {
-        if (ceil(msub[tup]) >= cond->size)
-          pvals[tup] = 2*jp->epsilon; /* off scale of the finite
-                                         representation of conditional */
-        else 
-          pvals[tup] = pv_p_value(cond, msub[tup], TWOTAIL);
-      }
-      else {
-        double pcons = INFTY, pacc = INFTY;
-        if (mode == ACC || mode == CONACC) {
-          if (ceil(msub[tup]) >= cond->size)
-            pacc = jp->epsilon; /* off scale of the finite
-                                   representation of conditional */
-          else 
-            pacc = pv_p_value(cond, msub[tup], UPPER);
-        }
-        if (mode == CON || mode == CONACC)
-          pcons = pv_p_value(cond, msub[tup], LOWER);
+  sub_init_site_data(&sd, jp, msa, fit_model, SUBTREE);
+  sd.mode = mode;
+  sd.logf = logf;
+  sd.prior = prior;
+  sd.pvals = pvals;
 
-        pvals[tup] = min(pcons, pacc);
-        if (mode == CONACC && pacc < pcons)
-          pvals[tup] *= -1;
-      }
-      vec_free(cond);
-    }
-  }  
+  col_foreach_tuple(msa, sub_pval_per_site_subtree_tuple, &sd);
 
   if (alloc) {
-    sfree(msub);
-    sfree(vsub);
-    sfree(msup);
-    sfree(vsup);
+    sfree(sd.msub);
+    sfree(sd.vsub);
+    sfree(sd.msup);
+    sfree(sd.vsup);
   }
   mat_free(prior);
-  mat_free(post);
+  sub_free_site_data(&sd);
 
   if (fit_model) {
-    col_free_fit_data(d);
     jp->mod->scale = jp->mod->scale_sub = 1;
     sub_recompute_conditionals(jp); /* in case needed again */
   }
@@ -644,14 +939,11 @@ void sub_posterior_stats_alignment(JumpProcess *jp, MSA *msa,
    probability of n1 substitutions in the left subtree and n2
    substitutions in the right subtree  */
 Matrix *sub_joint_distrib_site(JumpProcess *jp, MSA *msa, int tuple_idx) {
-  int lidx, n, i, j, k, a, b, c, n1, n2, n1_max = 0, n2_max = 0, done;
-  Matrix **L = smalloc(jp->mod->tree->nnodes * sizeof(void*));
-  List *traversal = tr_postorder(jp->mod->tree);
-  int size = jp->mod->rate_matrix->size;
+  int n1, n2, a, n1_max, n2_max, done, *bound = jp->subst_max;
+  int size = jp->mod->rate_matrix->size, nnodes = jp->mod->tree->nnodes;
+  int l = jp->mod->tree->lchild->id, r = jp->mod->tree->rchild->id;
   Matrix *retval;
-  Matrix **d_left, **d_right;
-  double sum;
-  int *maxsubst = smalloc(jp->mod->tree->nnodes * sizeof(int));
+  double sum, full_prob, *buf, *Ll, *Lr;
 
   if (jp->mod->order != 0)
     die("ERROR sub_joint_distrib_site: jp->mod->Order should be 0, is %i\n",
@@ -660,95 +952,34 @@ Matrix *sub_joint_distrib_site(JumpProcess *jp, MSA *msa, int tuple_idx) {
   if (msa != NULL && jp->mod->msa_seq_idx == NULL)
     tm_build_seq_idx(jp->mod, msa);
 
-  for (lidx = 0; lidx < lst_size(traversal); lidx++) {
-    TreeNode *node = lst_get_ptr(traversal, lidx);
-    checkInterrupt();
-
-    L[node->id] = mat_new(size, 500);
-    mat_zero(L[node->id]);
-    /* L[node->id]->[a][n] is the joint probability of n substitutions
-       and the data beneath node, given that node has label a */
-
-    if (node->lchild == NULL) {    /* leaf -- base case */
-      char c;
-      if (msa != NULL) {
-        if (jp->mod->msa_seq_idx[node->id] < 0)
-          die("ERROR: no match for leaf '%s' in alignment.\n", node->name);
-        c = ss_get_char_tuple(msa, tuple_idx, jp->mod->msa_seq_idx[node->id], 0);
-      }
-      if (msa == NULL || msa->is_missing[(int)c] || c == GAP_CHAR)
+  buf = sub_partials_buffer(jp);
+  while (TRUE) {
+    /* the distribution at the root is obtained directly from the
+       partials for its children; the left branch leads to the
+       subtree and the right one (of length zero) to the supertree */
+    full_prob = sub_site_partials(jp, msa, tuple_idx, bound, buf, TRUE);
+    n1_max = bound[l] + jp->branch_distrib[l][0]->ncols;
+    n2_max = bound[r] + 1;
+    Ll = buf + jp->partials_offset[nnodes];
+    sub_conv_branch(buf + jp->partials_offset[l], bound[l],
+                    jp->branch_distrib[l], size, Ll, n1_max);
+    Lr = buf + jp->partials_offset[r];
+
+    retval = mat_new(n1_max, n2_max);
+    mat_zero(retval);
+    sum = 0;
+    for (n1 = 0; n1 < n1_max; n1++) {
+      for (n2 = 0; n2 < n2_max; n2++) {
         for (a = 0; a < size; a++)
-          L[node->id]->data[a][0] = 1;
-      else {
-        if (msa->inv_alphabet[(int)c] < 0)
-	  die("ERROR sub_joint_distrib_site: msa->inv_alphabet[%c]=%i\n",
-	      c, msa->inv_alphabet[(int)c]);
-        L[node->id]->data[msa->inv_alphabet[(int)c]][0] = 1;
-      }
-
-      maxsubst[node->id] = 0;	/* max no. subst. beneath node */
-    }
-    
-    else {            /* internal node -- recursive case */
-
-      d_left = jp->branch_distrib[node->lchild->id];
-      d_right = jp->branch_distrib[node->rchild->id];
-
-      maxsubst[node->id] = max(maxsubst[node->lchild->id] + d_left[0]->ncols - 1, 
-                               maxsubst[node->rchild->id] + d_right[0]->ncols - 1);
-      
-      if (node == jp->mod->tree) {
-        /* save these for below */
-        n1_max = maxsubst[jp->mod->tree->lchild->id] + d_left[0]->ncols;
-        n2_max = maxsubst[jp->mod->tree->rchild->id] + d_right[0]->ncols;
-      }
-
-      for (n = 0; n <= maxsubst[node->id]; n++) {
-        for (j = 0; j <= n; j++) {	
-          int min_i, max_i, min_k, max_k;
-          min_i = max(0, j - d_left[0]->ncols + 1);
-          max_i = min(j, maxsubst[node->lchild->id]);
-          min_k = max(0, n - j - d_right[0]->ncols + 1);
-          max_k = min(n - j, maxsubst[node->rchild->id]);
-
-          for (a = 0; a < size; a++) {
-            double left = 0, right = 0;
-
-            for (b = 0; b < size; b++) 
-              for (i = min_i; i <= max_i; i++) 
-                left += L[node->lchild->id]->data[b][i] * 
-                  d_left[a]->data[b][j-i];
-
-            for (c = 0; c < size; c++) 
-              for (k = min_k; k <= max_k; k++) 
-                right += L[node->rchild->id]->data[c][k] * 
-                  d_right[a]->data[c][n-j-k];
-      
-            L[node->id]->data[a][n] += (left * right);
-          }
-        }
+          retval->data[n1][n2] += Ll[a*n1_max + n1] * 
+            jp->mod->backgd_freqs->data[a] * Lr[a*n2_max + n2];
+        sum += retval->data[n1][n2];
       }
     }
-  }
 
-  retval = mat_new(n1_max, n2_max);
-  mat_zero(retval);
-  d_left = jp->branch_distrib[jp->mod->tree->lchild->id];
-  sum = 0;
-  for (n1 = 0; n1 < n1_max; n1++) {
-    for (n2 = 0; n2 < n2_max; n2++) {
-      for (a = 0; a < size; a++) {
-        double left = 0;
-        int min_i = max(0, n1 - d_left[a]->ncols + 1);
-        for (b = 0; b < size; b++) 
-          for (i = min_i; i <= n1; i++) 
-            left += L[jp->mod->tree->lchild->id]->data[b][i] * 
-              d_left[a]->data[b][n1-i];
-        retval->data[n1][n2] += left * jp->mod->backgd_freqs->data[a] * 
-          L[jp->mod->tree->rchild->id]->data[a][n2];
-      }
-      sum += retval->data[n1][n2];
-    }
+    if (!sub_truncation_suspect(jp, bound, sum, full_prob)) break;
+    mat_free(retval);
+    bound = jp->subst_max_full;
   }
   mat_scale(retval, 1/sum);     /* normalize */
 
@@ -769,12 +1000,6 @@ Matrix *sub_joint_distrib_site(JumpProcess *jp, MSA *msa, int tuple_idx) {
       }
   mat_resize(retval, n1_max, n2_max);
 
-  for (lidx = 0; lidx < jp->mod->tree->nnodes; lidx++)
-    mat_free(L[lidx]);
-  sfree(L);
-
-  sfree(maxsubst);
-
   pm_normalize(retval);
   return retval;
 }
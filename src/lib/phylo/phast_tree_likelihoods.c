@@ -15,6 +15,8 @@
 #include <phast_subst_mods.h>
 #include <phast_dgamma.h>
 #include <phast_sufficient_stats.h>
+#include <phast_threads.h>
+#include <phast_likelihood_kernels.h>
 
 /* Computation of likelihoods for columns of a given multiple
    alignment, according to a given tree model.  */
@@ -31,73 +33,610 @@ int tuple_index_missing_data(char *tuple, int *inv_alph, int *is_missing,
 
 
 
+/* Scratch space for the Felsenstein pruning computation on a single
+   column tuple.  Each worker thread has its own copy.  Partial
+   likelihoods are indexed by node id, then state, so that the values
+   for all states at a node are contiguous. */
+typedef struct {
+  double **inside_joint, **inside_marginal, **outside_joint,
+    **outside_marginal;
+  double ****subst_probs;       /* indexed by rate cat, from, to, node */
+  double *rcat_prob;
+  double *tmp;
+  /* used only if mod->rescale_partials is TRUE */
+  int *rcat_exp;                /* scale exponent for each rate cat */
+  double *marg_prob;            /* marginal prob for each rate cat */
+  int *marg_exp;                /* scale exponent of marg_prob */
+  double *node_total;           /* total prob based on each node */
+} TLScratch;
+
+/* Data shared by all workers in a call to tl_compute_log_likelihood.
+   Workers write only to the entries belonging to their own tuples;
+   quantities summed over tuples are accumulated afterward, in tuple
+   order, so that results do not depend on the number of threads */
+typedef struct {
+  TreeModel *mod;
+  MSA *msa;
+  int cat;
+  TreePosteriors *post;
+  FlatTraversal *ft;
+  double *packed_P;             /* substitution matrices packed for
+                                   lk_prune, indexed by node id and
+                                   rate cat (NULL if no specialized
+                                   kernel for this number of states) */
+  TLScratch **scratch;          /* one per worker */
+  double *tuple_scores;         /* log2 prob of each tuple, unweighted */
+  int block_start;              /* first tuple in current block */
+  double *rcat_post_probs;      /* posterior prob of each rate cat, for
+                                   each tuple in current block */
+  double *nsubst_terms;         /* contribution of each tuple in current
+                                   block to post->expected_nsubst_tot
+                                   (if needed) */
+  int nsubst_stride;            /* number of nsubst_terms per tuple */
+} TLData;
+
+/* maximum number of doubles to buffer for the per-tuple contributions
+   to expected_nsubst_tot; determines the number of tuples per block,
+   unless that would leave threads without work (see
+   tl_compute_log_likelihood) */
+#define TL_NSUBST_BUFSIZE (1<<20)
+
+/* number of tuples handed to a worker thread at a time */
+#define TL_THREAD_GRAIN 16
+
+/* row of mod->tip_lookup used for missing data */
+#define TL_TIP_MISSING 256
+
+/* row of mod->tip_lookup for a given character (or TL_TIP_MISSING) */
+#define TL_TIP_ROW(mod, alph_size, row) (&(mod)->tip_lookup[(row) * (alph_size)])
+
+/* Build table of leaf partial likelihoods (1 or 0 for each character
+   in the alphabet) for every possible alignment character, plus a row
+   of all 1s (TL_TIP_MISSING) for missing data.  These depend only on
+   the character, so leaves can be initialized by copying rows of this
+   table. */
+static double *tl_build_tip_lookup(TreeModel *mod, int alph_size) {
+  double *tips = smalloc((TL_TIP_MISSING + 1) * alph_size * sizeof(double));
+  int c, i;
+  for (c = 0; c <= TL_TIP_MISSING; c++) {
+    double *row = &tips[c * alph_size];
+    int observed_state = (c < TL_TIP_MISSING ?
+                          mod->rate_matrix->inv_states[c] : -1);
+    int *iupac_prob = (c < TL_TIP_MISSING && observed_state < 0 ?
+                       mod->iupac_inv_map[c] : NULL);
+    for (i = 0; i < alph_size; i++) {
+      if (iupac_prob != NULL)
+        row[i] = iupac_prob[i];
+      else
+        row[i] = (observed_state < 0 || i == observed_state);
+    }
+  }
+  return tips;
+}
+
+static double **tl_new_partials(int nnodes, int nstates) {
+  int i;
+  double **p = (double**)smalloc(nnodes * sizeof(double*));
+  p[0] = (double*)smalloc(nnodes * nstates * sizeof(double));
+  for (i = 1; i < nnodes; i++)
+    p[i] = p[0] + i * nstates;
+  return p;
+}
+
+static void tl_free_partials(double **p) {
+  sfree(p[0]);
+  sfree(p);
+}
+
+static TLScratch *tl_new_scratch(TreeModel *mod, int do_post) {
+  int j, k, rcat;
+  int nstates = mod->rate_matrix->size;
+  TLScratch *s = smalloc(sizeof(TLScratch));
+
+  s->inside_joint = tl_new_partials(mod->tree->nnodes+1, nstates);
+  s->outside_joint = tl_new_partials(mod->tree->nnodes+1, nstates);
+  s->inside_marginal = s->outside_marginal = NULL;
+  /* only needed if post != NULL? */
+  if (mod->order > 0)
+    s->inside_marginal = tl_new_partials(mod->tree->nnodes+1, nstates);
+  if (mod->order > 0 && do_post)
+    s->outside_marginal = tl_new_partials(mod->tree->nnodes+1, nstates);
+  s->subst_probs = NULL;
+  if (do_post) {
+    s->subst_probs = (double****)smalloc(mod->nratecats * sizeof(double***));
+    for (rcat = 0; rcat < mod->nratecats; rcat++) {
+      s->subst_probs[rcat] = (double***)smalloc(nstates * sizeof(double**));
+      for (j = 0; j < nstates; j++) {
+        s->subst_probs[rcat][j] = (double**)smalloc(nstates * sizeof(double*));
+        for (k = 0; k < nstates; k++)
+          s->subst_probs[rcat][j][k] = (double*)smalloc(mod->tree->nnodes * sizeof(double));
+      }
+    }
+  }
+  s->rcat_prob = (double*)smalloc(mod->nratecats * sizeof(double));
+  s->tmp = (double*)smalloc(nstates * sizeof(double));
+  s->rcat_exp = s->marg_exp = NULL;
+  s->marg_prob = s->node_total = NULL;
+  if (mod->rescale_partials) {
+    s->rcat_exp = (int*)smalloc(mod->nratecats * sizeof(int));
+    s->marg_exp = (int*)smalloc(mod->nratecats * sizeof(int));
+    s->marg_prob = (double*)smalloc(mod->nratecats * sizeof(double));
+    s->node_total = (double*)smalloc(mod->tree->nnodes * sizeof(double));
+  }
+  return s;
+}
+
+static void tl_free_scratch(TreeModel *mod, TLScratch *s) {
+  int j, k, rcat;
+  int nstates = mod->rate_matrix->size;
+  tl_free_partials(s->inside_joint);
+  tl_free_partials(s->outside_joint);
+  if (s->inside_marginal != NULL) tl_free_partials(s->inside_marginal);
+  if (s->outside_marginal != NULL) tl_free_partials(s->outside_marginal);
+  if (s->subst_probs != NULL) {
+    for (rcat = 0; rcat < mod->nratecats; rcat++) {
+      for (j = 0; j < nstates; j++) {
+        for (k = 0; k < nstates; k++)
+          sfree(s->subst_probs[rcat][j][k]);
+        sfree(s->subst_probs[rcat][j]);
+      }
+      sfree (s->subst_probs[rcat]);
+    }
+    sfree(s->subst_probs);
+  }
+  sfree(s->rcat_prob);
+  sfree(s->tmp);
+  if (s->rcat_exp != NULL) {
+    sfree(s->rcat_exp);
+    sfree(s->marg_exp);
+    sfree(s->marg_prob);
+    sfree(s->node_total);
+  }
+  sfree(s);
+}
+
+/* Compute the (log2) probability of a single column tuple, and any
+   per-tuple posterior quantities.  Contributions to quantities summed
+   over tuples are stored in the block buffers of 'd' */
+static void tl_compute_tuple(TLData *d, TLScratch *s, int tupleidx) {
+  TreeModel *mod = d->mod;
+  MSA *msa = d->msa;
+  TreePosteriors *post = d->post;
+  FlatTraversal *ft = d->ft;
+  int cat = d->cat;
+  int i, j, k, pass, col_offset, nodeidx, rcat, id;
+  int nstates = mod->rate_matrix->size;
+  int alph_size = (int)strlen(mod->rate_matrix->states);
+  int npasses = (mod->order > 0 && mod->use_conditionals == 1 ? 2 : 1);
+  int skip_fels = FALSE;
+  double total_prob, marg_tot;
+  double **inside_joint = s->inside_joint, **inside_marginal = s->inside_marginal,
+    **outside_joint = s->outside_joint, **outside_marginal = s->outside_marginal,
+    ****subst_probs = s->subst_probs;
+  double *rcat_prob = s->rcat_prob, *tmp = s->tmp;
+  double *root_inside;
+  int rescale = mod->rescale_partials, scale_exp, total_exp = 0;
+
+  checkInterruptN(tupleidx, 1000);
+
+  total_prob = 0;
+  marg_tot = NULL_LOG_LIKELIHOOD;
+
+  /* check for gaps and whether column is informative, if necessary */
+  if (!mod->allow_gaps)
+    for (j = 0; !skip_fels && j < msa->nseqs; j++)
+      if (ss_get_char_tuple(msa, tupleidx, j, 0) == GAP_CHAR)
+        skip_fels = TRUE;
+  if (!skip_fels && mod->inform_reqd) {
+    int ninform = 0;
+    for (j = 0; j < msa->nseqs; j++) {
+      if (msa->is_informative != NULL && !msa->is_informative[j])
+        continue;
+      else if (!msa->is_missing[(int)ss_get_char_tuple(msa, tupleidx, j, 0)])
+        ninform++;
+    }
+    if (ninform < 2) skip_fels = TRUE;
+  }
+
+  if (!skip_fels) {
+    for (pass = 0; pass < npasses; pass++) {
+      double **pL = (pass == 0 ? inside_joint : inside_marginal);
+      double **pLbar = (pass == 0 ? outside_joint : outside_marginal);
+
+      if (pass > 0)
+        marg_tot = 0;         /* will need to compute */
+
+      /* leaves: base case of recursion.  These do not depend on the
+         rate category, so they are set up once per pass */
+      for (nodeidx = 0; nodeidx < ft->nleaves; nodeidx++) {
+        int thisseq;
+        double *leaf;
+
+        id = ft->leaves[nodeidx];
+        leaf = pL[id];
+        thisseq = mod->msa_seq_idx[id];
+        if (thisseq < 0)
+          die("ERROR tl_compute_log_likelihood: expected a leaf node\n");
+
+        if (mod->order == 0) {  /* handle 0th order model as special
+                                   case, for efficiency.  In this case
+                                   the partial match *is* the total
+                                   match */
+          double *tip = TL_TIP_ROW(mod, alph_size,
+                                   (unsigned char)ss_get_char_tuple(msa, tupleidx,
+                                                                    thisseq, 0));
+          for (i = 0; i < nstates; i++)
+            leaf[i] = tip[i];
+        }
+        else {
+          /* first figure out whether there is a match for each
+             character in each position; we'll call this the record
+             of "partial_matches".  On a second pass, for the current
+             base, we use the "missing information" principle */
+          double *partial_match[mod->order+1];
+          for (col_offset = -1*mod->order; col_offset <= 0; col_offset++) {
+            if (pass == 0 || col_offset < 0)
+              partial_match[mod->order+col_offset] =
+                TL_TIP_ROW(mod, alph_size,
+                           (unsigned char)ss_get_char_tuple(msa, tupleidx, thisseq,
+                                                            col_offset));
+            else
+              partial_match[mod->order+col_offset] =
+                TL_TIP_ROW(mod, alph_size, TL_TIP_MISSING);
+          }
+
+          /* now find the intersection of the partial matches */
+          for (i = 0; i < nstates; i++) {
+            int total_match = 1;
+            /* figure out the "projection" of state i in the dimension
+               of each position, and see whether there is a
+               corresponding partial match. */
+            /* NOTE: mod->order is approx equal to log nstates
+               (prob no more than 2) */
+            for (col_offset = -1*mod->order; col_offset <= 0 && total_match;
+                 col_offset++) {
+              int projection = (i / int_pow(alph_size, -1 * col_offset)) %
+                alph_size;
+
+              if (!partial_match[mod->order+col_offset][projection])
+                total_match = 0; /* must have partial matches in all
+                                    dimensions for a total match */
+            }
+            leaf[i] = total_match;
+          }
+        }
+      }
+
+      for (rcat = 0; rcat < mod->nratecats; rcat++) {
+        scale_exp = 0;
+        /* general recursive case */
+        for (nodeidx = 0; nodeidx < ft->ninternal; nodeidx++) {
+          int lid, rid;
+          double *lpartial, *rpartial, *partial, **lsubst, **rsubst;
+
+          id = ft->internal[nodeidx];
+          lid = ft->lchild[id];
+          rid = ft->rchild[id];
+          lpartial = pL[lid];
+          rpartial = pL[rid];
+          partial = pL[id];
+          if (d->packed_P != NULL) { /* specialized kernel */
+            int psize = nstates * nstates;
+            lk_prune(nstates, partial,
+                     lpartial, &d->packed_P[(lid * mod->nratecats + rcat) * psize],
+                     rpartial, &d->packed_P[(rid * mod->nratecats + rcat) * psize]);
+          }
+          else {
+            lsubst = mod->P[lid][rcat]->matrix->data;
+            rsubst = mod->P[rid][rcat]->matrix->data;
+            for (i = 0; i < nstates; i++) {
+              double totl = 0, totr = 0;
+              for (j = 0; j < nstates; j++)
+                totl += lpartial[j] * lsubst[i][j];
+
+              for (k = 0; k < nstates; k++)
+                totr += rpartial[k] * rsubst[i][k];
+
+              partial[i] = totl * totr;
+            }
+          }
+          if (rescale)
+            scale_exp += tl_rescale(partial, nstates);
+        }
+
+        if (post != NULL && pass == 0) {
+          MarkovMatrix *subst_mat;
+          double this_total, denom;
+
+          /* do outside calculation */
+          for (nodeidx = 0; nodeidx < ft->nnodes; nodeidx++) {
+            int par;
+            id = ft->preorder[nodeidx];
+            par = ft->parent[id];
+            if (par < 0) { /* base case */
+              for (i = 0; i < nstates; i++)
+                pLbar[id][i] = vec_get(mod->backgd_freqs, i);
+            }
+            else {            /* recursive case */
+              int sib = ft->sibling[id];
+              MarkovMatrix *par_subst_mat = mod->P[id][rcat];
+              MarkovMatrix *sib_subst_mat = mod->P[sib][rcat];
+
+              /* breaking this computation into two parts as follows
+                 reduces its complexity by a factor of nstates */
+
+              for (j = 0; j < nstates; j++) { /* parent state */
+                tmp[j] = 0;
+                for (k = 0; k < nstates; k++) { /* sibling state */
+                  tmp[j] += pLbar[par][j] *
+                    pL[sib][k] * mm_get(sib_subst_mat, j, k);
+                }
+              }
+
+              for (i = 0; i < nstates; i++) { /* child state */
+                pLbar[id][i] = 0;
+                for (j = 0; j < nstates; j++) { /* parent state */
+                  pLbar[id][i] +=
+                    tmp[j] * mm_get(par_subst_mat, j, i);
+                }
+              }
+              if (rescale)
+                tl_rescale(pLbar[id], nstates);
+            }
+
+
+            /* compute total probability based on current node, to
+               avoid numerical errors */
+            this_total = 0;
+            for (i = 0; i < nstates; i++)
+              this_total += pL[id][i] * pLbar[id][i];
+
+            /* with rescaling, totals at different nodes are on
+               different scales, so the total at the parent must be
+               used below */
+            if (rescale)
+              s->node_total[id] = this_total;
+
+            if (post->expected_nsubst != NULL && par >= 0)
+              post->expected_nsubst[rcat][id][tupleidx] = 1;
+
+            subst_mat = mod->P[id][rcat];
+            for (i = 0; i < nstates; i++) {
+              /* compute posterior prob of base (tuple) i at node n */
+              if (post->base_probs != NULL) {
+                post->base_probs[rcat][i][id][tupleidx] =
+                  safediv(pL[id][i] * pLbar[id][i], this_total);
+              }
+
+              if (par < 0) continue;
+
+              /* (intermediate computation used for subst probs) */
+              denom = 0;
+              for (k = 0; k < nstates; k++)
+                denom += pL[id][k] * mm_get(subst_mat, i, k);
+
+              for (j = 0; j < nstates; j++) {
+                /* compute posterior prob of a subst of base j at
+                   node n for base i at node n->parent */
+                subst_probs[rcat][i][j][id] =
+                  safediv(pL[par][i] * pLbar[par][i],
+                          rescale ? s->node_total[par] : this_total) *
+                  pL[id][j] * mm_get(subst_mat, i, j);
+                subst_probs[rcat][i][j][id] =
+                  safediv(subst_probs[rcat][i][j][id], denom);
+
+                if (post->subst_probs != NULL)
+                  post->subst_probs[rcat][i][j][id][tupleidx] =
+                    subst_probs[rcat][i][j][id];
+
+                if (post->expected_nsubst != NULL && j == i)
+                  post->expected_nsubst[rcat][id][tupleidx] -=
+                    subst_probs[rcat][i][j][id];
+
+              }
+            }
+          }
+        }
+
+        if (pass == 0) {
+          root_inside = inside_joint[mod->tree->id];
+          rcat_prob[rcat] = 0;
+          for (i = 0; i < nstates; i++) {
+            rcat_prob[rcat] += vec_get(mod->backgd_freqs, i) *
+              root_inside[i] * mod->freqK[rcat];
+          }
+          total_prob += rcat_prob[rcat];
+          if (rescale) s->rcat_exp[rcat] = scale_exp;
+        }
+        else if (!rescale) {
+          root_inside = inside_marginal[mod->tree->id];
+          for (i = 0; i < nstates; i++)
+            marg_tot += vec_get(mod->backgd_freqs, i) *
+              root_inside[i] * mod->freqK[rcat];
+        }
+        else {
+          root_inside = inside_marginal[mod->tree->id];
+          s->marg_prob[rcat] = 0;
+          for (i = 0; i < nstates; i++)
+            s->marg_prob[rcat] += vec_get(mod->backgd_freqs, i) *
+              root_inside[i] * mod->freqK[rcat];
+          s->marg_exp[rcat] = scale_exp;
+        }
+      } /* for rcat */
+
+      /* with rescaling, rate categories must be brought to a common
+         scale before their probabilities are summed */
+      if (rescale && pass == 0) {
+        total_exp = tl_common_scale(rcat_prob, s->rcat_exp, mod->nratecats);
+        total_prob = 0;
+        for (rcat = 0; rcat < mod->nratecats; rcat++)
+          total_prob += rcat_prob[rcat];
+      }
+      else if (rescale) {
+        total_exp -= tl_common_scale(s->marg_prob, s->marg_exp,
+                                     mod->nratecats);
+        marg_tot = 0;
+        for (rcat = 0; rcat < mod->nratecats; rcat++)
+          marg_tot += s->marg_prob[rcat];
+      }
+    } /* for pass */
+  } /* if skip_fels */
+
+  /* compute posterior prob of each rate cat and related quantities */
+  if (post != NULL) {
+    double count = (cat >= 0 ? msa->ss->cat_counts[cat][tupleidx] :
+                 msa->ss->counts[tupleidx]);
+    int bufidx = tupleidx - d->block_start;
+    if (skip_fels) die("ERROR: tl_compute_log_likelihood: skip_fels should be 0 but is %i\n", skip_fels);
+    for (rcat = 0; rcat < mod->nratecats; rcat++) {
+      double rcat_post_prob = safediv(rcat_prob[rcat], total_prob);
+      if (post->rcat_probs != NULL)
+        post->rcat_probs[rcat][tupleidx] = rcat_post_prob;
+      d->rcat_post_probs[bufidx * mod->nratecats + rcat] = rcat_post_prob;
+      if (post->expected_nsubst_tot != NULL) {
+        double *terms = &d->nsubst_terms[bufidx * d->nsubst_stride +
+                                         rcat * nstates * nstates *
+                                         mod->tree->nnodes];
+        for (id = 0; id < ft->nnodes; id++) {
+          if (ft->parent[id] < 0) continue;
+          for (i = 0; i < nstates; i++)
+            for (j = 0; j < nstates; j++)
+              terms[(i * nstates + j) * mod->tree->nnodes + id] =
+                subst_probs[rcat][i][j][id] * count * rcat_post_prob;
+        }
+      }
+      if (post->expected_nsubst_col != NULL) {
+        for (id = 0; id < ft->nnodes; id++) {
+          if (ft->parent[id] < 0) continue;
+          for (i = 0; i < nstates; i++)
+            for (j = 0; j < nstates; j++)
+              post->expected_nsubst_col[rcat][id][tupleidx][i][j] =
+                subst_probs[rcat][i][j][id] * rcat_post_prob;
+        }
+      }
+    }
+  }
+
+  if (mod->order > 0 && mod->use_conditionals == 1 && !skip_fels)
+    total_prob /= marg_tot;
+
+  /*    if (total_prob > 1.0) {
+        if (total_prob - 1.0 < 1.0e-6) total_prob = 1.0;
+        else die("got total_prob=%.10g\n", total_prob);
+        }*/
+  d->tuple_scores[tupleidx] = log2(total_prob) + total_exp;
+  /* NOTE: tuple_scores contains the
+     (log) probabilities *unweighted* by tuple counts */
+}
+
+/* worker function for thr_foreach: compute tuples
+   block_start+start, ..., block_start+end-1 */
+static void tl_compute_tuples(void *data, int start, int end, int thread) {
+  TLData *d = data;
+  int idx, tupleidx;
+  for (idx = start; idx < end; idx++) {
+    tupleidx = d->block_start + idx;
+    if ((d->cat >= 0 && d->msa->ss->cat_counts[d->cat][tupleidx] == 0) ||
+        (d->cat < 0 && d->msa->ss->counts[tupleidx] == 0))
+      continue;
+    tl_compute_tuple(d, d->scratch[thread], tupleidx);
+  }
+}
+
+/* current block size, needed by tl_sum_nsubst_terms */
+typedef struct {
+  TLData *d;
+  int block_size;
+} TLSumData;
+
+/* worker function for thr_foreach: add the contributions of the
+   tuples in the current block to expected_nsubst_tot, for nodes
+   start, ..., end-1.  Tuples are always added in order. */
+static void tl_sum_nsubst_terms(void *data, int start, int end, int thread) {
+  TLSumData *sd = data;
+  TLData *d = sd->d;
+  TreeModel *mod = d->mod;
+  int nstates = mod->rate_matrix->size, nnodes = mod->tree->nnodes;
+  int node, rcat, i, j, idx, tupleidx;
+
+  for (node = start; node < end; node++) {
+    if (node == mod->tree->id) continue;
+    for (rcat = 0; rcat < mod->nratecats; rcat++)
+      for (i = 0; i < nstates; i++)
+        for (j = 0; j < nstates; j++) {
+          int offset = ((rcat * nstates + i) * nstates + j) * nnodes + node;
+          double *tot = &d->post->expected_nsubst_tot[rcat][i][j][node];
+          for (idx = 0; idx < sd->block_size; idx++) {
+            tupleidx = d->block_start + idx;
+            if ((d->cat >= 0 && d->msa->ss->cat_counts[d->cat][tupleidx] == 0) ||
+                (d->cat < 0 && d->msa->ss->counts[tupleidx] == 0))
+              continue;
+            *tot += d->nsubst_terms[idx * d->nsubst_stride + offset];
+          }
+        }
+  }
+}
+
+/* Rescale partial likelihoods to avoid underflow.  See
+   phast_tree_likelihoods.h */
+int tl_rescale(double *partial, int nstates) {
+  double maxval = 0;
+  int i, e;
+  for (i = 0; i < nstates; i++)
+    if (partial[i] > maxval) maxval = partial[i];
+  if (maxval == 0 || maxval >= TL_RESCALE_THRESHOLD)
+    return 0;
+  frexp(maxval, &e);
+  for (i = 0; i < nstates; i++)
+    partial[i] = ldexp(partial[i], -e);
+  return e;
+}
+
+/* Put quantities with separate scale exponents on a common scale.
+   See phast_tree_likelihoods.h */
+int tl_common_scale(double *prob, int *exp, int n) {
+  int i, maxexp = 0, found = FALSE;
+  for (i = 0; i < n; i++)
+    if (prob[i] > 0 && (!found || exp[i] > maxexp)) {
+      maxexp = exp[i];
+      found = TRUE;
+    }
+  for (i = 0; i < n; i++)
+    prob[i] = ldexp(prob[i], exp[i] - maxexp);
+  return maxexp;
+}
+
 /* Compute the likelihood of a tree model with respect to an
    alignment.  Optionally retain column-by-column likelihoods,
    optionally compute posterior probabilities.  If 'post' is NULL, no
    posterior probabilities (or related quantities) will be computed.
    If 'post' is non-NULL each of its attributes must either be NULL or
-   previously allocated to the required size. */
+   previously allocated to the required size.  Column tuples are
+   divided among thr_get_nthreads() threads; results are identical
+   for any number of threads. */
 double tl_compute_log_likelihood(TreeModel *mod, MSA *msa,
                                  double *col_scores, double *tuple_scores,
 				 int cat, TreePosteriors *post) {
 
-  int i, j;
+  int i, j, k, rcat, tupleidx, defined, block_size, grain, nworkers, idx;
   double retval = 0;
   int nstates = mod->rate_matrix->size;
   int alph_size = (int)strlen(mod->rate_matrix->states);
-  int npasses = (mod->order > 0 && mod->use_conditionals == 1 ? 2 : 1);
-  int pass, col_offset, k, nodeidx, rcat, /* colidx, */ tupleidx, defined;
-  TreeNode *n;
-  double total_prob, marg_tot;
-  List *traversal;
-  double **inside_joint = NULL, **inside_marginal = NULL,
-    **outside_joint = NULL, **outside_marginal = NULL,
-    ****subst_probs = NULL;
-  double *curr_tuple_scores=NULL;
-  double rcat_prob[mod->nratecats];
-  double tmp[nstates];
+  TLData d;
+  TLSumData sd;
+  ThrPool *pool;
 
   checkInterrupt();
 
-  /* allocate memory */
-  inside_joint = (double**)smalloc(nstates * sizeof(double*));
-  for (j = 0; j < nstates; j++)
-    inside_joint[j] = (double*)smalloc((mod->tree->nnodes+1) *
-                                       sizeof(double));
-  outside_joint = (double**)smalloc(nstates * sizeof(double*));
-  for (j = 0; j < nstates; j++)
-    outside_joint[j] = (double*)smalloc((mod->tree->nnodes+1) *
-                                        sizeof(double));
-  /* only needed if post != NULL? */
-  if (mod->order > 0) {
-    inside_marginal = (double**)smalloc(nstates * sizeof(double*));
-    for (j = 0; j < nstates; j++)
-      inside_marginal[j] = (double*)smalloc((mod->tree->nnodes+1) *
-                                            sizeof(double));
-  }
-  if (mod->order > 0 && post != NULL) {
-    outside_marginal = (double**)smalloc(nstates * sizeof(double*));
-    for (j = 0; j < nstates; j++)
-      outside_marginal[j] = (double*)smalloc((mod->tree->nnodes+1) *
-                                             sizeof(double));
-  }
-  if (post != NULL) {
-    subst_probs = (double****)smalloc(mod->nratecats * sizeof(double***));
-    for (rcat = 0; rcat < mod->nratecats; rcat++) {
-      subst_probs[rcat] = (double***)smalloc(nstates * sizeof(double**));
-      for (j = 0; j < nstates; j++) {
-        subst_probs[rcat][j] = (double**)smalloc(nstates * sizeof(double*));
-        for (k = 0; k < nstates; k++)
-          subst_probs[rcat][j][k] = (double*)smalloc(mod->tree->nnodes * sizeof(double));
-      }
-    }
-  }
-
   /* create IUPAC mapping if needed */
   if (mod->iupac_inv_map == NULL)
     mod->iupac_inv_map = build_iupac_inv_map(mod->rate_matrix->inv_states,
                                              alph_size);
 
+  /* create table of leaf partial likelihoods if needed */
+  if (mod->tip_lookup == NULL)
+    mod->tip_lookup = tl_build_tip_lookup(mod, alph_size);
+
 
   if (cat > msa->ncats)
     die("ERROR tl_compute_log_likelihood: cat (%i) > msa->ncats (%i)\n", cat, msa->ncats);
@@ -133,13 +672,36 @@ double tl_compute_log_likelihood(TreeModel *mod, MSA *msa,
   if (!defined) {
     tm_set_subst_matrices(mod);
   }
-  if (col_scores != NULL && tuple_scores == NULL)
-    curr_tuple_scores = (double*)smalloc(msa->ss->ntuples * sizeof(double));
-  else if (tuple_scores != NULL)
-    curr_tuple_scores = tuple_scores;
-  if (curr_tuple_scores != NULL)
-    for (tupleidx = 0; tupleidx < msa->ss->ntuples; tupleidx++)
-      curr_tuple_scores[tupleidx] = 0;
+
+  /* everything below is read-only or per-tuple, so that tuples can be
+     processed in parallel; the flat representation of the tree is
+     rebuilt before any threads start, in case the tree has changed */
+  d.mod = mod;
+  d.msa = msa;
+  d.cat = cat;
+  d.post = post;
+  tm_build_flat_traversal(mod);
+  d.ft = mod->flat_trav;
+
+  d.packed_P = NULL;
+  if (lk_has_kernel(nstates)) {
+    d.packed_P = (double*)smalloc(mod->tree->nnodes * mod->nratecats *
+                                  nstates * nstates * sizeof(double));
+    for (i = 0; i < mod->tree->nnodes; i++) {
+      if (d.ft->parent[i] < 0) continue;
+      for (rcat = 0; rcat < mod->nratecats; rcat++)
+        lk_pack_matrix(&d.packed_P[(i * mod->nratecats + rcat) *
+                                   nstates * nstates],
+                       mod->P[i][rcat]->matrix);
+    }
+  }
+
+  if (tuple_scores != NULL)
+    d.tuple_scores = tuple_scores;
+  else
+    d.tuple_scores = (double*)smalloc(msa->ss->ntuples * sizeof(double));
+  for (tupleidx = 0; tupleidx < msa->ss->ntuples; tupleidx++)
+    d.tuple_scores[tupleidx] = 0;
 
   if (post != NULL && post->expected_nsubst_tot != NULL) {
     for (rcat = 0; rcat < mod->nratecats; rcat++)
@@ -152,328 +714,84 @@ double tl_compute_log_likelihood(TreeModel *mod, MSA *msa,
     for (rcat = 0; rcat < mod->nratecats; rcat++)
       post->rcat_expected_nsites[rcat] = 0;
 
-  for (tupleidx = 0; tupleidx < msa->ss->ntuples; tupleidx++) {
-    int skip_fels = FALSE;
-
-    if ((cat >= 0 && msa->ss->cat_counts[cat][tupleidx] == 0) ||
-        (cat < 0 && msa->ss->counts[tupleidx] == 0))
-      continue;
-    checkInterruptN(tupleidx, 1000);
-
-    total_prob = 0;
-    marg_tot = NULL_LOG_LIKELIHOOD;
-
-    /* check for gaps and whether column is informative, if necessary */
-    if (!mod->allow_gaps)
-      for (j = 0; !skip_fels && j < msa->nseqs; j++)
-        if (ss_get_char_tuple(msa, tupleidx, j, 0) == GAP_CHAR)
-          skip_fels = TRUE;
-    if (!skip_fels && mod->inform_reqd) {
-      int ninform = 0;
-      for (j = 0; j < msa->nseqs; j++) {
-        if (msa->is_informative != NULL && !msa->is_informative[j])
-          continue;
-        else if (!msa->is_missing[(int)ss_get_char_tuple(msa, tupleidx, j, 0)])
-          ninform++;
-      }
-      if (ninform < 2) skip_fels = TRUE;
-    }
-
-    if (!skip_fels) {
-      for (pass = 0; pass < npasses; pass++) {
-        double **pL = (pass == 0 ? inside_joint : inside_marginal);
-        double **pLbar = (pass == 0 ? outside_joint : outside_marginal);
-        /*         TreePosteriors *postpass = (pass == 0 ? post : postmarg); */
-
-        if (pass > 0)
-          marg_tot = 0;         /* will need to compute */
-
-        for (rcat = 0; rcat < mod->nratecats; rcat++) {
-          traversal = tr_postorder(mod->tree);
-          for (nodeidx = 0; nodeidx < lst_size(traversal); nodeidx++) {
-            int partial_match[mod->order+1][alph_size];
-            n = lst_get_ptr(traversal, nodeidx);
-            if (n->lchild == NULL) {
-              /* leaf: base case of recursion */
-              int thisseq;
-
-              thisseq = mod->msa_seq_idx[n->id];
-	      if (thisseq < 0)
-		die("ERROR tl_compute_log_likelihood: expected a leaf node\n");
-
-              /* first figure out whether there is a match for each
-                 character in each position; we'll call this the record of
-                 "partial_matches". */
-              for (col_offset = -1*mod->order; col_offset <= 0; col_offset++) {
-                int observed_state = -1;
-                int *iupac_prob = NULL;
-
-                if (pass == 0 || col_offset < 0) {
-                  char thischar = ss_get_char_tuple(msa, tupleidx,
-						    thisseq, col_offset);
-                  observed_state = mod->rate_matrix->inv_states[(int)thischar];
-                  if (observed_state < 0)
-                    iupac_prob = mod->iupac_inv_map[(int)thischar];
-                }
-
-                /* otherwise, we're on a second pass and looking the
-                   current base, so we want to use the "missing
-                   information" principle */
-
-                if (iupac_prob != NULL) {
-                  for (i = 0; i < alph_size; i++)
-                    partial_match[mod->order+col_offset][i] = iupac_prob[i];
-                }
-                else {
-                  for (i = 0; i < alph_size; i++) {
-                    if (observed_state < 0 || i == observed_state)
-                      partial_match[mod->order+col_offset][i] = 1;
-                    else
-                      partial_match[mod->order+col_offset][i] = 0;
-                  }
-                }
-              }
-
-              /* now find the intersection of the partial matches */
-              for (i = 0; i < nstates; i++) {
-                if (mod->order == 0)  /* handle 0th order model as special
-                                         case, for efficiency.  In this case
-                                         the partial match *is* the total
-                                         match */
-                  pL[i][n->id] = partial_match[0][i];
-                else {
-                  int total_match = 1;
-                  /* figure out the "projection" of state i in the dimension
-                     of each position, and see whether there is a
-                     corresponding partial match. */
-                  /* NOTE: mod->order is approx equal to log nstates
-                     (prob no more than 2) */
-                  for (col_offset = -1*mod->order; col_offset <= 0 && total_match;
-                       col_offset++) {
-                    int projection = (i / int_pow(alph_size, -1 * col_offset)) %
-                      alph_size;
-
-                    if (!partial_match[mod->order+col_offset][projection])
-                      total_match = 0; /* must have partial matches in all
-                                          dimensions for a total match */
-                  }
-                  pL[i][n->id] = total_match;
-                }
-              }
-            }
-            else {
-              /* general recursive case */
-              MarkovMatrix *lsubst_mat = mod->P[n->lchild->id][rcat];
-              MarkovMatrix *rsubst_mat = mod->P[n->rchild->id][rcat];
-              for (i = 0; i < nstates; i++) {
-                double totl = 0, totr = 0;
-                for (j = 0; j < nstates; j++)
-                  totl += pL[j][n->lchild->id] *
-                    mm_get(lsubst_mat, i, j);
-
-                for (k = 0; k < nstates; k++)
-                  totr += pL[k][n->rchild->id] *
-                    mm_get(rsubst_mat, i, k);
-
-                pL[i][n->id] = totl * totr;
-              }
-            }
-          }
-
-          if (post != NULL && pass == 0) {
-            MarkovMatrix *subst_mat;
-            double this_total, denom;
-
-            /* do outside calculation */
-            traversal = tr_preorder(mod->tree);
-            for (nodeidx = 0; nodeidx < lst_size(traversal); nodeidx++) {
-              n = lst_get_ptr(traversal, nodeidx);
-              if (n->parent == NULL) { /* base case */
-                for (i = 0; i < nstates; i++)
-                  pLbar[i][n->id] = vec_get(mod->backgd_freqs, i);
-              }
-              else {            /* recursive case */
-                TreeNode *sibling = (n == n->parent->lchild ?
-                                     n->parent->rchild : n->parent->lchild);
-                MarkovMatrix *par_subst_mat = mod->P[n->id][rcat];
-                MarkovMatrix *sib_subst_mat = mod->P[sibling->id][rcat];
-
-                /* breaking this computation into two parts as follows
-                   reduces its complexity by a factor of nstates */
-
-                for (j = 0; j < nstates; j++) { /* parent state */
-                  tmp[j] = 0;
-                  for (k = 0; k < nstates; k++) { /* sibling state */
-                    tmp[j] += pLbar[j][n->parent->id] *
-                      pL[k][sibling->id] * mm_get(sib_subst_mat, j, k);
-                  }
-                }
-
-                for (i = 0; i < nstates; i++) { /* child state */
-                  pLbar[i][n->id] = 0;
-                  for (j = 0; j < nstates; j++) { /* parent state */
-                    pLbar[i][n->id] +=
-                      tmp[j] * mm_get(par_subst_mat, j, i);
-                  }
-                }
-              }
-
-
-              /* compute total probability based on current node, to
-                 avoid numerical errors */
-              this_total = 0;
-              for (i = 0; i < nstates; i++)
-                this_total += pL[i][n->id] * pLbar[i][n->id];
-
-              if (post->expected_nsubst != NULL && n->parent != NULL)
-                post->expected_nsubst[rcat][n->id][tupleidx] = 1;
-
-              subst_mat = mod->P[n->id][rcat];
-              for (i = 0; i < nstates; i++) {
-                /* compute posterior prob of base (tuple) i at node n */
-                if (post->base_probs != NULL) {
-                  post->base_probs[rcat][i][n->id][tupleidx] =
-                    safediv(pL[i][n->id] * pLbar[i][n->id], this_total);
-                }
-
-                if (n->parent == NULL) continue;
-
-                /* (intermediate computation used for subst probs) */
-                denom = 0;
-                for (k = 0; k < nstates; k++)
-                  denom += pL[k][n->id] * mm_get(subst_mat, i, k);
-
-                for (j = 0; j < nstates; j++) {
-                  /* compute posterior prob of a subst of base j at
-                     node n for base i at node n->parent */
-                  subst_probs[rcat][i][j][n->id] =
-                    safediv(pL[i][n->parent->id] * pLbar[i][n->parent->id],
-                            this_total) *
-                    pL[j][n->id] * mm_get(subst_mat, i, j);
-                  subst_probs[rcat][i][j][n->id] =
-                    safediv(subst_probs[rcat][i][j][n->id], denom);
-
-                  if (post->subst_probs != NULL)
-                    post->subst_probs[rcat][i][j][n->id][tupleidx] =
-                      subst_probs[rcat][i][j][n->id];
-
-                  if (post->expected_nsubst != NULL && j == i)
-                    post->expected_nsubst[rcat][n->id][tupleidx] -=
-                      subst_probs[rcat][i][j][n->id];
-
-                }
-              }
-            }
-          }
-
-          if (pass == 0) {
-            rcat_prob[rcat] = 0;
-            for (i = 0; i < nstates; i++) {
-              rcat_prob[rcat] += vec_get(mod->backgd_freqs, i) *
-                inside_joint[i][mod->tree->id] * mod->freqK[rcat];
-            }
-            total_prob += rcat_prob[rcat];
-          }
-          else {
-            for (i = 0; i < nstates; i++)
-              marg_tot += vec_get(mod->backgd_freqs, i) *
-                inside_marginal[i][mod->tree->id] * mod->freqK[rcat];
-          }
-        } /* for rcat */
-      } /* for pass */
-    } /* if skip_fels */
-
-      /* compute posterior prob of each rate cat and related quantities */
-    if (post != NULL) {
-      if (skip_fels) die("ERROR: tl_compute_log_likelihood: skip_fels should be 0 but is %i\n", skip_fels);
-      for (rcat = 0; rcat < mod->nratecats; rcat++) {
-        double rcat_post_prob = safediv(rcat_prob[rcat], total_prob);
-        if (post->rcat_probs != NULL)
-          post->rcat_probs[rcat][tupleidx] = rcat_post_prob;
-        if (post->rcat_expected_nsites != NULL)
-          post->rcat_expected_nsites[rcat] += rcat_post_prob *
-            (cat >= 0 ? msa->ss->cat_counts[cat][tupleidx] :
-             msa->ss->counts[tupleidx]);
-        if (post->expected_nsubst_tot != NULL) {
-          for (nodeidx = 0; nodeidx < mod->tree->nnodes; nodeidx++) {
-            n = lst_get_ptr(mod->tree->nodes, nodeidx);
-            if (n->parent == NULL) continue;
-            for (i = 0; i < nstates; i++)
-              for (j = 0; j < nstates; j++)
-                post->expected_nsubst_tot[rcat][i][j][n->id] +=
-                  subst_probs[rcat][i][j][n->id] *
-                  (cat >= 0 ? msa->ss->cat_counts[cat][tupleidx] :
-                   msa->ss->counts[tupleidx]) *
-                  rcat_post_prob;
-          }
-        }
-	if (post->expected_nsubst_col != NULL) {
-	  for (nodeidx = 0; nodeidx < mod->tree->nnodes; nodeidx++) {
-            n = lst_get_ptr(mod->tree->nodes, nodeidx);
-            if (n->parent == NULL) continue;
-            for (i = 0; i < nstates; i++)
-              for (j = 0; j < nstates; j++)
-                post->expected_nsubst_col[rcat][n->id][tupleidx][i][j] =
-                  subst_probs[rcat][i][j][n->id] * rcat_post_prob;
-          }
-        }
-      }
+  /* tuples are processed in blocks, to bound the memory needed for
+     the per-tuple contributions to expected_nsubst_tot.  Every block
+     has at least two tuples per thread, so that large models (for
+     which the buffer holds few tuples) still run in parallel.  The
+     contributions are added in tuple order whatever the block size */
+  block_size = msa->ss->ntuples;
+  grain = TL_THREAD_GRAIN;
+  d.nsubst_stride = 0;
+  d.nsubst_terms = NULL;
+  d.rcat_post_probs = NULL;
+  if (post != NULL && post->expected_nsubst_tot != NULL) {
+    d.nsubst_stride = mod->nratecats * nstates * nstates * mod->tree->nnodes;
+    block_size = max(2 * thr_get_nthreads(),
+                     TL_NSUBST_BUFSIZE / d.nsubst_stride);
+    if (block_size > msa->ss->ntuples) block_size = msa->ss->ntuples;
+    grain = max(1, min(TL_THREAD_GRAIN, block_size / (2 * thr_get_nthreads())));
+    d.nsubst_terms = (double*)smalloc(block_size * d.nsubst_stride *
+                                      sizeof(double));
+  }
+  if (post != NULL)
+    d.rcat_post_probs = (double*)smalloc(max(block_size, 1) * mod->nratecats *
+                                         sizeof(double));
+
+  /* the same workers are used for every block */
+  pool = thr_pool_new(thr_nworkers(block_size, grain));
+  nworkers = thr_pool_nworkers(pool);
+  d.scratch = (TLScratch**)smalloc(nworkers * sizeof(TLScratch*));
+  for (i = 0; i < nworkers; i++)
+    d.scratch[i] = tl_new_scratch(mod, post != NULL);
+  sd.d = &d;
+
+  for (d.block_start = 0; d.block_start < msa->ss->ntuples;
+       d.block_start += block_size) {
+    sd.block_size = min(block_size, msa->ss->ntuples - d.block_start);
+
+    thr_pool_foreach(pool, sd.block_size, grain, tl_compute_tuples, &d);
+
+    /* now accumulate sums over tuples, in order */
+    for (idx = 0; idx < sd.block_size; idx++) {
+      double total_prob;
+      double count;
+      tupleidx = d.block_start + idx;
+      count = (cat >= 0 ? msa->ss->cat_counts[cat][tupleidx] :
+               msa->ss->counts[tupleidx]);
+      if (count == 0) continue;
+
+      if (post != NULL && post->rcat_expected_nsites != NULL)
+        for (rcat = 0; rcat < mod->nratecats; rcat++)
+          post->rcat_expected_nsites[rcat] +=
+            d.rcat_post_probs[idx * mod->nratecats + rcat] * count;
+
+      total_prob = d.tuple_scores[tupleidx];
+      total_prob *= count;      /* log space */
+      retval += total_prob;     /* log space */
     }
+    if (d.nsubst_terms != NULL)
+      thr_pool_foreach(pool, mod->tree->nnodes, 1, tl_sum_nsubst_terms, &sd);
+  }
+  thr_pool_free(pool);
 
-    if (mod->order > 0 && mod->use_conditionals == 1 && !skip_fels)
-      total_prob /= marg_tot;
-
-    /*    if (total_prob > 1.0) {
-      if (total_prob - 1.0 < 1.0e-6) total_prob = 1.0;
-      else die("got total_prob=%.10g\n", total_prob);
-      }*/
-    total_prob = log2(total_prob);
-
-    if (curr_tuple_scores != NULL &&
-        (cat < 0 || msa->ss->cat_counts[cat][tupleidx] > 0))
-      curr_tuple_scores[tupleidx] = total_prob;
-    /* NOTE: curr_tuple_scores contains the
-       (log) probabilities *unweighted* by tuple counts */
-
-    total_prob *= (cat >= 0 ? msa->ss->cat_counts[cat][tupleidx] :
-                   msa->ss->counts[tupleidx]); /* log space */
-
-    retval += total_prob;     /* log space */
-
-  } /* for tupleidx */
+  for (i = 0; i < nworkers; i++)
+    tl_free_scratch(mod, d.scratch[i]);
+  sfree(d.scratch);
+  if (d.nsubst_terms != NULL) sfree(d.nsubst_terms);
+  if (d.rcat_post_probs != NULL) sfree(d.rcat_post_probs);
+  if (d.packed_P != NULL) sfree(d.packed_P);
 
-  for (j = 0; j < nstates; j++) {
-    sfree(inside_joint[j]);
-    sfree(outside_joint[j]);
-    if (mod->order > 0) sfree(inside_marginal[j]);
-    if (mod->order > 0 && post != NULL) sfree(outside_marginal[j]);
-  }
-  sfree(inside_joint);
-  sfree(outside_joint);
-  if (mod->order > 0) sfree(inside_marginal);
-  if (mod->order > 0 && post != NULL) sfree(outside_marginal);
   if (col_scores != NULL) {
     if (cat >= 0)
       for (i = 0; i < msa->length; i++)
         col_scores[i] = msa->categories[i] == cat ?
-          curr_tuple_scores[msa->ss->tuple_idx[i]] :
+          d.tuple_scores[msa->ss->tuple_idx[i]] :
           NEGINFTY;
     else
       for (i = 0; i < msa->length; i++)
-        col_scores[i] = curr_tuple_scores[msa->ss->tuple_idx[i]];
-    if (tuple_scores == NULL) sfree(curr_tuple_scores);
-  }
-  if (post != NULL) {
-    for (rcat = 0; rcat < mod->nratecats; rcat++) {
-      for (j = 0; j < nstates; j++) {
-        for (k = 0; k < nstates; k++)
-          sfree(subst_probs[rcat][j][k]);
-        sfree(subst_probs[rcat][j]);
-      }
-      sfree (subst_probs[rcat]);
-    }
-    sfree(subst_probs);
+        col_scores[i] = d.tuple_scores[msa->ss->tuple_idx[i]];
   }
+  if (tuple_scores == NULL) sfree(d.tuple_scores);
   return(retval);
 }
 
@@ -49,6 +49,11 @@
 
 #define BGC_SEL_LIMIT 200.0
 
+#define DERIV_EPSILON 1e-6      /* for numerical derivatives with
+                                   respect to parameters other than
+                                   branch lengths, in
+                                   tm_compute_grad_branchlens */
+
 /* internal functions */
 double tm_likelihood_wrapper(Vector *params, void *data);
 double tm_multi_likelihood_wrapper(Vector *params, void *data);
@@ -140,6 +145,8 @@ TreeModel *tm_new(TreeNode *tree, MarkovMatrix *rate_matrix,
   tm->allow_but_penalize_gaps = 0;
   tm->allow_gaps = 1;
   tm->inform_reqd = FALSE;
+  tm->rescale_partials = FALSE;
+  tm->analytic_grad = FALSE;
   tm->estimate_backgd = 0;
   tm->estimate_branchlens = TM_BRANCHLENS_ALL;
   tm->scale = 1;
@@ -164,6 +171,9 @@ TreeModel *tm_new(TreeNode *tree, MarkovMatrix *rate_matrix,
   tm->bound_arg = NULL;
   tm->scale_during_opt = 0;
   tm->iupac_inv_map = NULL;
+  tm->tip_lookup = NULL;
+  tm->flat_trav = NULL;
+  tm->P_cache = NULL;
   return tm;
 }
 
@@ -303,6 +313,11 @@ void tm_free(TreeModel *tm) {
     str_free(tm->noopt_arg);
   if (tm->iupac_inv_map != NULL)
     free_iupac_inv_map(tm->iupac_inv_map);
+  if (tm->tip_lookup != NULL)
+    sfree(tm->tip_lookup);
+  if (tm->flat_trav != NULL)
+    tm_free_flat_traversal(tm->flat_trav);
+  tm_invalidate_subst_matrices(tm);
   sfree(tm);
 }
 
@@ -636,7 +651,7 @@ void tm_print(FILE *F, TreeModel *tm) {
 }
 
 /* Note: does not copy msa_seq_idx, tree_posteriors, P, rate_matrix_param_row,
-   or iupac_inv_map
+   iupac_inv_map, tip_lookup, flat_trav, or P_cache
  */
 TreeModel *tm_create_copy(TreeModel *src) {
   TreeModel *retval;
@@ -656,6 +671,8 @@ TreeModel *tm_create_copy(TreeModel *src) {
   retval->allow_gaps = src->allow_gaps;
   retval->allow_but_penalize_gaps = src->allow_but_penalize_gaps;
   retval->inform_reqd = src->inform_reqd;
+  retval->rescale_partials = src->rescale_partials;
+  retval->analytic_grad = src->analytic_grad;
   retval->estimate_backgd = src->estimate_backgd;
   retval->estimate_branchlens = src->estimate_branchlens;
   retval->estimate_ratemat = src->estimate_ratemat;
@@ -683,13 +700,13 @@ TreeModel *tm_create_copy(TreeModel *src) {
       retval->ignore_branch[i] = src->ignore_branch[i];
   }
   
-  if (src->empirical_rates) {
-    for (i = 0; i < src->nratecats; i++) {
-      retval->rK[i] = src->rK[i];
-      retval->freqK[i] = src->freqK[i];
-    }
-    retval->empirical_rates = 1;
+  /* rate categories of a discrete gamma model may already have been
+     filled in (see DiscreteGamma); copy them in either case */
+  for (i = 0; i < src->nratecats; i++) {
+    retval->rK[i] = src->rK[i];
+    retval->freqK[i] = src->freqK[i];
   }
+  if (src->empirical_rates) retval->empirical_rates = 1;
 
   retval->scale_idx = src->scale_idx;
   retval->bl_idx = src->bl_idx;
@@ -989,13 +1006,71 @@ AltSubstMod* tm_add_alt_mod(TreeModel *mod, String *altmod_str) {
 }
 
 
+static void tm_free_subst_cache(SubstMatCache *c) {
+  sfree(c->P);
+  sfree(c->t);
+  sfree(c->ignored);
+  mat_free(c->Q);
+  vec_free(c->backgd_freqs);
+  sfree(c);
+}
+
+void tm_invalidate_subst_matrices(TreeModel *tm) {
+  if (tm->P_cache != NULL) {
+    tm_free_subst_cache(tm->P_cache);
+    tm->P_cache = NULL;
+  }
+}
+
+/* make sure tm->P_cache exists and is consistent with the current
+   dimensions of the model, and invalidate all of its entries if any
+   input shared by all branches has changed since it was last used */
+static void tm_update_subst_cache(TreeModel *tm) {
+  SubstMatCache *c = tm->P_cache;
+  int i, same_backgd, n = tm->tree->nnodes * tm->nratecats;
+
+  if (c != NULL && (c->nnodes != tm->tree->nnodes ||
+                    c->nratecats != tm->nratecats ||
+                    c->Q->nrows != tm->rate_matrix->size ||
+                    c->backgd_freqs->size != tm->backgd_freqs->size))
+    tm_invalidate_subst_matrices(tm);
+
+  if (tm->P_cache == NULL) {
+    c = tm->P_cache = smalloc(sizeof(SubstMatCache));
+    c->nnodes = tm->tree->nnodes;
+    c->nratecats = tm->nratecats;
+    c->P = smalloc(n * sizeof(MarkovMatrix*));
+    c->t = smalloc(n * sizeof(double));
+    c->ignored = smalloc(n * sizeof(int));
+    c->Q = mat_new(tm->rate_matrix->size, tm->rate_matrix->size);
+    c->backgd_freqs = vec_new(tm->backgd_freqs->size);
+    for (i = 0; i < n; i++) c->P[i] = NULL;
+  }
+  else {
+    for (i = 0, same_backgd = TRUE; same_backgd && i < c->backgd_freqs->size; i++)
+      same_backgd = (c->backgd_freqs->data[i] == tm->backgd_freqs->data[i]);
+    if (same_backgd && c->rate_matrix == tm->rate_matrix && 
+        c->subst_mod == tm->subst_mod && c->selection == tm->selection &&
+        mat_equal(c->Q, tm->rate_matrix->matrix))
+      return;                   /* nothing shared has changed */
+    for (i = 0; i < n; i++) c->P[i] = NULL;
+  }
+
+  c->rate_matrix = tm->rate_matrix;
+  c->subst_mod = tm->subst_mod;
+  c->selection = tm->selection;
+  mat_copy(c->Q, tm->rate_matrix->matrix);
+  vec_copy(c->backgd_freqs, tm->backgd_freqs);
+}
+
 void tm_set_subst_matrices(TreeModel *tm) {
-  int i, j;
+  int i, j, ignored, use_cache, idx;
   double scaling_const, curr_scaling_const=1.0, 
-    tmp, branch_scale, selection, bgc=0.0;
+    tmp, branch_scale, selection, bgc=0.0, t;
   Vector *backgd_freqs = tm->backgd_freqs;
   subst_mod_type subst_mod = tm->subst_mod;
   MarkovMatrix *rate_matrix = tm->rate_matrix;
+  SubstMatCache *cache = NULL;
   TreeNode *n;
 
   scaling_const = -1;
@@ -1020,6 +1095,16 @@ void tm_set_subst_matrices(TreeModel *tm) {
   }
   selection = tm->selection;
 
+  /* matrices are recomputed only if their inputs have changed.
+     Branch-specific substitution models are not tracked, so in that
+     case all matrices are recomputed every time */
+  use_cache = (tm->alt_subst_mods == NULL);
+  if (use_cache) {
+    tm_update_subst_cache(tm);
+    cache = tm->P_cache;
+  }
+  else tm_invalidate_subst_matrices(tm);
+
   for (i = 0; i < tm->tree->nnodes; i++) {
     checkInterrupt();
     branch_scale = tm->scale;
@@ -1059,24 +1144,36 @@ void tm_set_subst_matrices(TreeModel *tm) {
 	} else curr_scaling_const = scaling_const;
       }
       
+      t = n->dparent * branch_scale * tm->rK[j];
+      ignored = (tm->ignore_branch != NULL && tm->ignore_branch[i]);
+
       if (tm->P[i][j] == NULL)
         tm->P[i][j] = mm_new(rate_matrix->size, rate_matrix->states, DISCRETE);
+      else if (use_cache) {
+        idx = i * tm->nratecats + j;
+        if (cache->P[idx] == tm->P[i][j] && cache->t[idx] == t &&
+            cache->ignored[idx] == ignored)
+          continue;             /* up to date */
+      }
       
-      if (tm->ignore_branch != NULL && tm->ignore_branch[i])  
+      if (ignored)  
 	/* treat as if infinitely long */
         tm_set_probs_independent(tm, tm->P[i][j]);
       
       /* for simple models, full matrix exponentiation is not necessary */
       else if (subst_mod == JC69 && selection==0.0 && bgc == 0.0)
-        tm_set_probs_JC69(tm, tm->P[i][j], 
-                          n->dparent * branch_scale * tm->rK[j]);
+        tm_set_probs_JC69(tm, tm->P[i][j], t);
       else if (subst_mod == F81 && selection == 0.0 && bgc == 0.0)
-        tm_set_probs_F81(backgd_freqs, tm->P[i][j], curr_scaling_const, 
-                         n->dparent * branch_scale * tm->rK[j]);
+        tm_set_probs_F81(backgd_freqs, tm->P[i][j], curr_scaling_const, t);
       
-      else {                     /* full matrix exponentiation */
-        mm_exp(tm->P[i][j], rate_matrix, 
-               n->dparent * branch_scale * tm->rK[j]);
+      else                      /* full matrix exponentiation */
+        mm_exp(tm->P[i][j], rate_matrix, t);
+
+      if (use_cache) {
+        idx = i * tm->nratecats + j;
+        cache->P[idx] = tm->P[i][j];
+        cache->t[idx] = t;
+        cache->ignored[idx] = ignored;
       }
     }
   }
@@ -1944,6 +2041,7 @@ int tm_fit(TreeModel *mod, MSA *msa, Vector *params, int cat,
   double ll;
   Vector *lower_bounds, *upper_bounds, *opt_params;
   int i, retval = 0, npar, numeval;
+  void (*grad_func)(Vector*, Vector*, void*, Vector*, Vector*) = NULL;
 
   if (msa->ss == NULL) {
     if (msa->seqs == NULL)
@@ -2005,11 +2103,26 @@ int tm_fit(TreeModel *mod, MSA *msa, Vector *params, int cat,
     }
   }
   
+  if (mod->analytic_grad) {
+    if (tm_can_compute_grad_branchlens(mod)) {
+      grad_func = tm_compute_grad_branchlens;
+      mod->tree_posteriors = tl_new_tree_posteriors(mod, msa, 0, 0, 0, 1,
+                                                    0, 0, 0);
+    }
+    else if (!quiet)
+      fprintf(stderr, "WARNING: analytic gradients not supported for this model; using numerical gradients.\n");
+  }
+
   if (!quiet) fprintf(stderr, "numpar = %i\n", opt_params->size);
   retval = opt_bfgs(tm_likelihood_wrapper, opt_params, (void*)mod, &ll, 
-                    lower_bounds, upper_bounds, logf, NULL, precision, 
+                    lower_bounds, upper_bounds, logf, grad_func, precision, 
 		    NULL, &numeval);
 
+  if (grad_func != NULL) {
+    tl_free_tree_posteriors(mod, msa, mod->tree_posteriors);
+    mod->tree_posteriors = NULL;
+  }
+
   mod->lnL = ll * -1 * log(2);  /* make negative again and convert to
                                    natural log scale */
   if (!quiet) fprintf(stderr, "Done.  log(likelihood) = %f numeval=%i\n", mod->lnL, numeval);
@@ -2611,6 +2724,115 @@ double tm_likelihood_wrapper(Vector *params, void *data) {
 }
 
 
+int tm_can_compute_grad_branchlens(TreeModel *mod) {
+  return (mod->tree != NULL &&
+          mod->estimate_branchlens == TM_BRANCHLENS_ALL &&
+          mod->alt_subst_mods == NULL && mod->selection_idx < 0 &&
+          mod->subst_mod != JC69 && mod->subst_mod != F81 &&
+          !(mod->order > 0 && mod->use_conditionals));
+}
+
+void tm_compute_grad_branchlens(Vector *grad, Vector *params, void *data,
+                                Vector *lb, Vector *ub) {
+  TreeModel *mod = (TreeModel*)data;
+  int nstates = mod->rate_matrix->size;
+  int i, j, k, rcat, idx, grad_idx, nodeidx;
+  double fval, deriv, dtdx, origparm, val1, val2, delta;
+  double ****ens;
+  int perturbed = FALSE;
+  int *is_branchlen = smalloc(params->size * sizeof(int));
+  Matrix *QP = mat_new(nstates, nstates);
+  List *traversal;
+  TreeNode *n;
+
+  /* inside/outside pass at current parameter values; obtains function
+     value and expected substitution counts */
+  tm_unpack_params(mod, params, -1);
+  fval = -1 * tl_compute_log_likelihood(mod, mod->msa, NULL, NULL, 
+                                        mod->category, mod->tree_posteriors);
+  ens = mod->tree_posteriors->expected_nsubst_tot;
+
+  vec_zero(grad);
+  for (i = 0; i < params->size; i++) is_branchlen[i] = FALSE;
+
+  /* branch-length parameters follow a preorder traversal of the tree
+     (see tm_unpack_params).  dlnL/dt for a branch is the sum over
+     substitution types of the expected count times (dP/dt) / P, where
+     dP/dt = rK * scale * Q P */
+  traversal = tr_preorder(mod->tree);
+  idx = 0;
+  for (nodeidx = 0; nodeidx < lst_size(traversal); nodeidx++) {
+    n = lst_get_ptr(traversal, nodeidx);
+    if (n->parent == NULL) continue;
+    grad_idx = mod->param_map[mod->bl_idx + idx++];
+    if (grad_idx < 0) continue;
+    is_branchlen[grad_idx] = TRUE;
+    if (mod->ignore_branch != NULL && mod->ignore_branch[n->id]) 
+      continue;                 /* likelihood does not depend on t */
+
+    /* branches from root share a single parameter if reversible */
+    dtdx = ((n == mod->tree->lchild || n == mod->tree->rchild) &&
+            tm_is_reversible(mod)) ? 0.5 : 1;
+
+    deriv = 0;
+    for (rcat = 0; rcat < mod->nratecats; rcat++) {
+      MarkovMatrix *P = mod->P[n->id][rcat];
+      mat_mult(QP, mod->rate_matrix->matrix, P->matrix);
+      for (i = 0; i < nstates; i++) {
+        for (j = 0; j < nstates; j++) {
+          double p = mm_get(P, i, j), dp = mat_get(QP, i, j), count;
+          count = ens[rcat][i][j][n->id];
+          if (count == 0) continue;
+          /* see compute_grad_em_approx for treatment of p == 0 */
+          if (p == 0) {
+            if (dp == 0) continue;
+            deriv += (dp < 0 ? NEGINFTY : INFTY);
+          }
+          else deriv += count * dp / p * mod->rK[rcat] * mod->scale;
+        }
+      }
+    }
+    /* convert to bits and negate, as in tm_likelihood_wrapper */
+    vec_set(grad, grad_idx, vec_get(grad, grad_idx) - 
+            deriv * dtdx / log(2));
+  }
+
+  /* all other parameters by finite differences (central, unless
+     close to a boundary) */
+  for (k = 0; k < params->size; k++) {
+    if (is_branchlen[k]) continue;
+    perturbed = TRUE;
+    origparm = vec_get(params, k);
+    delta = 2 * DERIV_EPSILON;
+    if (lb != NULL && origparm - vec_get(lb, k) < DERIV_EPSILON) {
+      delta = DERIV_EPSILON;
+      val1 = fval;
+    }
+    else {
+      vec_set(params, k, origparm - DERIV_EPSILON);
+      val1 = tm_likelihood_wrapper(params, mod);
+    }
+    if (ub != NULL && vec_get(ub, k) - origparm < DERIV_EPSILON) {
+      delta = DERIV_EPSILON;
+      val2 = fval;
+    }
+    else {
+      vec_set(params, k, origparm + DERIV_EPSILON);
+      val2 = tm_likelihood_wrapper(params, mod);
+    }
+    vec_set(grad, k, (val2 - val1) / delta);
+    vec_set(params, k, origparm);
+  }
+
+  /* leave model consistent with params */
+  if (perturbed)
+    tm_unpack_params(mod, params, -1);
+
+  sfree(is_branchlen);
+  mat_free(QP);
+}
+
+
 /*double tm_multi_likelihood_wrapper(Vector *params, void *data) {
   List *modlist = (List*)data;
   double ll=0, **scores;
@@ -3627,6 +3849,153 @@ void tm_build_seq_idx(TreeModel *mod, MSA *msa) {
   }
 }
 
+/* build flat representation of tree, for likelihood computations */
+void tm_build_flat_traversal(TreeModel *mod) {
+  FlatTraversal *ft = mod->flat_trav;
+  int nnodes = mod->tree->nnodes;
+  List *postorder = tr_postorder(mod->tree), *preorder = tr_preorder(mod->tree);
+  TreeNode *n;
+  int i;
+
+  if (ft != NULL && ft->nnodes != nnodes) {
+    tm_free_flat_traversal(ft);
+    ft = NULL;
+  }
+  if (ft == NULL) {
+    ft = smalloc(sizeof(FlatTraversal));
+    ft->nnodes = nnodes;
+    ft->leaves = smalloc(7 * nnodes * sizeof(int));
+    ft->internal = ft->leaves + nnodes;
+    ft->preorder = ft->internal + nnodes;
+    ft->lchild = ft->preorder + nnodes;
+    ft->rchild = ft->lchild + nnodes;
+    ft->parent = ft->rchild + nnodes;
+    ft->sibling = ft->parent + nnodes;
+    mod->flat_trav = ft;
+  }
+
+  ft->nleaves = ft->ninternal = 0;
+  for (i = 0; i < nnodes; i++) {
+    n = lst_get_ptr(postorder, i);
+    if (n->lchild == NULL) {
+      ft->leaves[ft->nleaves++] = n->id;
+      ft->lchild[n->id] = ft->rchild[n->id] = -1;
+    }
+    else {
+      ft->internal[ft->ninternal++] = n->id;
+      ft->lchild[n->id] = n->lchild->id;
+      ft->rchild[n->id] = n->rchild->id;
+    }
+  }
+  for (i = 0; i < nnodes; i++) {
+    n = lst_get_ptr(preorder, i);
+    ft->preorder[i] = n->id;
+    if (n->parent == NULL)
+      ft->parent[n->id] = ft->sibling[n->id] = -1;
+    else {
+      ft->parent[n->id] = n->parent->id;
+      ft->sibling[n->id] = (n == n->parent->lchild ? n->parent->rchild->id :
+                            n->parent->lchild->id);
+    }
+  }
+}
+
+void tm_free_flat_traversal(FlatTraversal *ft) {
+  sfree(ft->leaves);
+  sfree(ft);
+}
+
+/* 64-bit FNV-1a hash, for tm_fingerprint */
+static uint64_t tm_hash_bytes(uint64_t h, const void *data, size_t len) {
+  const unsigned char *c = data;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= c[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static uint64_t tm_hash_int(uint64_t h, int x) {
+  return tm_hash_bytes(h, &x, sizeof(int));
+}
+
+static uint64_t tm_hash_dbl(uint64_t h, double x) {
+  return tm_hash_bytes(h, &x, sizeof(double));
+}
+
+/* (includes the terminating null) */
+static uint64_t tm_hash_str(uint64_t h, const char *s) {
+  do {
+    h ^= (unsigned char)*s;
+    h *= 0x100000001b3ULL;
+  } while (*s++ != '\0');
+  return h;
+}
+
+static uint64_t tm_hash_vec(uint64_t h, Vector *v) {
+  int i;
+  if (v == NULL) return tm_hash_int(h, -1);
+  h = tm_hash_int(h, v->size);
+  for (i = 0; i < v->size; i++)
+    h = tm_hash_dbl(h, v->data[i]);
+  return h;
+}
+
+static uint64_t tm_hash_mm(uint64_t h, MarkovMatrix *M) {
+  int i, j;
+  if (M == NULL) return tm_hash_int(h, -1);
+  h = tm_hash_int(h, M->size);
+  for (i = 0; i < M->size; i++)
+    for (j = 0; j < M->size; j++)
+      h = tm_hash_dbl(h, mm_get(M, i, j));
+  return h;
+}
+
+void tm_fingerprint(TreeModel *mod, char *fp) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  int i;
+
+  h = tm_hash_str(h, mod->rate_matrix->states);
+  h = tm_hash_int(h, mod->order);
+  h = tm_hash_int(h, mod->subst_mod);
+  h = tm_hash_int(h, mod->nratecats);
+  for (i = 0; i < mod->nratecats; i++) {
+    h = tm_hash_dbl(h, mod->rK[i]);
+    h = tm_hash_dbl(h, mod->freqK[i]);
+  }
+  h = tm_hash_int(h, mod->selection_idx);
+  if (mod->selection_idx >= 0)
+    h = tm_hash_dbl(h, mod->selection);
+  h = tm_hash_vec(h, mod->backgd_freqs);
+  h = tm_hash_mm(h, mod->rate_matrix);
+
+  /* topology, names, and branch lengths, by node id */
+  for (i = 0; i < mod->tree->nnodes; i++) {
+    TreeNode *n = lst_get_ptr(mod->tree->nodes, i);
+    h = tm_hash_str(h, n->name);
+    h = tm_hash_int(h, n->parent == NULL ? -1 : n->parent->id);
+    h = tm_hash_dbl(h, n->dparent);
+    h = tm_hash_int(h, mod->in_subtree == NULL ? -1 : mod->in_subtree[i]);
+  }
+  h = tm_hash_int(h, mod->subtree_root == NULL ? -1 : mod->subtree_root->id);
+
+  if (mod->alt_subst_mods != NULL) {
+    for (i = 0; i < lst_size(mod->alt_subst_mods); i++) {
+      AltSubstMod *am = lst_get_ptr(mod->alt_subst_mods, i);
+      if (am->defString != NULL)
+        h = tm_hash_str(h, am->defString->chars);
+      h = tm_hash_int(h, am->subst_mod);
+      h = tm_hash_dbl(h, am->selection);
+      h = tm_hash_dbl(h, am->bgc);
+      h = tm_hash_vec(h, am->backgd_freqs);
+      h = tm_hash_mm(h, am->rate_matrix);
+    }
+  }
+
+  sprintf(fp, "%016llx", (unsigned long long)h);
+}
+
 /** Prune away leaves in tree that don't correspond to sequences in a
     given alignment.  Warning: root of tree (value of mod->tree) may
     change. */
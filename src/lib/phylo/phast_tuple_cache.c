@@ -0,0 +1,184 @@
+/***************************************************************************
+ * PHAST: PHylogenetic Analysis with Space/Time models
+ * Copyright (c) 2002-2005 University of California, 2006-2010 Cornell
+ * University.  All rights reserved.
+ *
+ * This source code is distributed under a BSD-style license.  See the
+ * file LICENSE.txt for details.
+ ***************************************************************************/
+
+/* Persistent cache of per-column-tuple results.  See phast_tuple_cache.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <phast_tuple_cache.h>
+#include <phast_sufficient_stats.h>
+#include <phast_stringsplus.h>
+#include <phast_misc.h>
+
+#define TC_FORMAT_VERSION 1
+
+/* append a record without checking for an existing key */
+static void tc_append(TupleCache *tc, const char *key, double *vals) {
+  int i;
+  if (tc->nrecords == tc->capacity) {
+    tc->capacity *= 2;
+    tc->vals = srealloc(tc->vals, tc->capacity * tc->nvals * sizeof(double));
+    /* hashtables have a fixed number of buckets, so rebuild the index
+       to keep lookups fast as the cache grows */
+    hsh_free(tc->index);
+    tc->index = hsh_new(tc->capacity);
+    for (i = 0; i < tc->nrecords; i++)
+      hsh_put_int(tc->index, lst_get_ptr(tc->keys, i), i);
+  }
+  for (i = 0; i < tc->nvals; i++)
+    tc->vals[tc->nrecords * tc->nvals + i] = vals[i];
+  lst_push_ptr(tc->keys, copy_charstr(key));
+  hsh_put_int(tc->index, key, tc->nrecords);
+  tc->nrecords++;
+}
+
+/* add any records in the cache file that are not already in memory.
+   A file with an unexpected header (e.g., from a different format
+   version) is ignored, and will be replaced when the cache is saved */
+static void tc_load(TupleCache *tc) {
+  FILE *F = phast_fopen_no_exit(tc->fname, "r");
+  String *line;
+  double *vals;
+  char *key, *p, *end;
+  int i, ok;
+
+  if (F == NULL) return;
+
+  line = str_new(STR_LONG_LEN);
+  if (str_readline(line, F) == EOF ||
+      (str_trim(line), !str_equals_charstr(line, tc->header))) {
+    phast_warning("WARNING: ignoring tuple cache %s (unexpected header)\n",
+                  tc->fname);
+    str_free(line);
+    phast_fclose(F);
+    return;
+  }
+
+  vals = smalloc(tc->nvals * sizeof(double));
+  while (str_readline(line, F) != EOF) {
+    str_trim(line);
+    if (line->length == 0) continue;
+    key = line->chars;
+    for (p = key; *p != '\0' && *p != ' ' && *p != '\t'; p++);
+    if (*p == '\0') continue;
+    *p++ = '\0';
+    for (i = 0, ok = TRUE; ok && i < tc->nvals; i++) {
+      vals[i] = strtod(p, &end);
+      if (end == p) ok = FALSE;
+      p = end;
+    }
+    if (ok && hsh_get_int(tc->index, key) < 0)
+      tc_append(tc, key, vals);
+  }
+
+  sfree(vals);
+  str_free(line);
+  phast_fclose(F);
+}
+
+TupleCache *tc_open(const char *dir, TreeModel *mod, const char *test,
+                    int nvals) {
+  TupleCache *tc = smalloc(sizeof(TupleCache));
+  char fp[TM_FINGERPRINT_LEN + 1];
+
+  tm_fingerprint(mod, fp);
+  tc->fname = smalloc((strlen(dir) + strlen(test) + TM_FINGERPRINT_LEN + 20) *
+                      sizeof(char));
+  sprintf(tc->fname, "%s/%s.%s.tcache", dir, fp, test);
+  tc->header = smalloc((strlen(test) + TM_FINGERPRINT_LEN + 50) *
+                       sizeof(char));
+  sprintf(tc->header, "##tuple-cache %d %s %s %d", TC_FORMAT_VERSION,
+          fp, test, nvals);
+  tc->nvals = nvals;
+  tc->capacity = 10000;
+  tc->index = hsh_new(tc->capacity);
+  tc->keys = lst_new_ptr(tc->capacity);
+  tc->vals = smalloc(tc->capacity * nvals * sizeof(double));
+  tc->nrecords = tc->nadded = 0;
+
+  tc_load(tc);
+  return tc;
+}
+
+void tc_free(TupleCache *tc) {
+  int i;
+  for (i = 0; i < lst_size(tc->keys); i++)
+    sfree(lst_get_ptr(tc->keys, i));
+  lst_free(tc->keys);
+  hsh_free(tc->index);
+  sfree(tc->vals);
+  sfree(tc->fname);
+  sfree(tc->header);
+  sfree(tc);
+}
+
+int tc_key_len(TreeModel *mod) {
+  return (mod->tree->nnodes + 1) / 2;
+}
+
+void tc_tuple_key(TreeModel *mod, MSA *msa, int tupleidx, char *key) {
+  int i, k = 0;
+  for (i = 0; i < mod->tree->nnodes; i++) {
+    TreeNode *n = lst_get_ptr(mod->tree->nodes, i);
+    if (n->lchild != NULL) continue;
+    key[k++] = (mod->msa_seq_idx[i] < 0 ? '*' :
+                ss_get_char_tuple(msa, tupleidx, mod->msa_seq_idx[i], 0));
+  }
+  key[k] = '\0';
+}
+
+int tc_lookup(TupleCache *tc, const char *key, double *vals) {
+  int i, rec = hsh_get_int(tc->index, key);
+  if (rec < 0) return FALSE;
+  for (i = 0; i < tc->nvals; i++)
+    vals[i] = tc->vals[rec * tc->nvals + i];
+  return TRUE;
+}
+
+void tc_add(TupleCache *tc, const char *key, double *vals) {
+  if (hsh_get_int(tc->index, key) >= 0) return;
+  tc_append(tc, key, vals);
+  tc->nadded++;
+}
+
+void tc_save(TupleCache *tc) {
+  char *tmpfname;
+  FILE *F;
+  int r, i;
+
+  if (tc->nadded == 0) return;
+
+  /* pick up anything saved by other processes in the meantime */
+  tc_load(tc);
+
+  tmpfname = smalloc((strlen(tc->fname) + 30) * sizeof(char));
+  sprintf(tmpfname, "%s.%d.tmp", tc->fname, (int)getpid());
+  F = phast_fopen_no_exit(tmpfname, "w");
+  if (F == NULL) {
+    phast_warning("WARNING: could not write tuple cache %s\n", tmpfname);
+    sfree(tmpfname);
+    return;
+  }
+  fprintf(F, "%s\n", tc->header);
+  for (r = 0; r < tc->nrecords; r++) {
+    fprintf(F, "%s", (char*)lst_get_ptr(tc->keys, r));
+    for (i = 0; i < tc->nvals; i++)
+      fprintf(F, " %.17g", tc->vals[r * tc->nvals + i]);
+    fprintf(F, "\n");
+  }
+  if (ferror(F) || fclose(F) != 0 || rename(tmpfname, tc->fname) != 0) {
+    phast_warning("WARNING: could not write tuple cache %s\n", tc->fname);
+    remove(tmpfname);
+  }
+  else
+    tc->nadded = 0;
+  sfree(tmpfname);
+}
@@ -15,6 +15,7 @@
 #include <phast_tree_likelihoods.h>
 #include <phast_subst_mods.h>
 #include <phast_em.h>
+#include <phast_threads.h>
 
 /* initial values for alpha, beta, tau; possibly should be passed in instead */
 #define ALPHA_INIT 0.05
@@ -103,6 +104,7 @@ PhyloHmm *phmm_new(HMM *hmm,    /* HMM.  If indel_mode ==
   phmm->gpm = NULL;
   phmm->T = phmm->t = NULL;
   phmm->em_data = NULL;
+  phmm->window_size = phmm->window_overlap = 0;
   phmm->alpha = NULL;
   phmm->beta = NULL;
   phmm->tau = NULL;
@@ -635,6 +637,77 @@ void phmm_compute_emissions(PhyloHmm *phmm,
   }
 }
 
+/* data shared by windows in phmm_decode_windows */
+typedef struct {
+  PhyloHmm *phmm;
+  int *path;
+  double **post_probs;
+} PhmmWindowData;
+
+/* decode windows with indices in [start, end) (see phmm_decode_windows) */
+static void phmm_decode_windows_block(void *data, int start, int end,
+                                      int thread) {
+  PhmmWindowData *d = data;
+  PhyloHmm *phmm = d->phmm;
+  int nstates = phmm->hmm->nstates, w, i;
+  double *em[nstates], *pp[nstates];
+
+  for (w = start; w < end; w++) {
+    int core_beg = w * phmm->window_size,
+      core_end = min(core_beg + phmm->window_size, phmm->alloc_len),
+      beg = max(core_beg - phmm->window_overlap, 0),
+      len = min(core_end + phmm->window_overlap, phmm->alloc_len) - beg;
+
+    for (i = 0; i < nstates; i++) em[i] = &phmm->emissions[i][beg];
+
+    if (d->path != NULL) {
+      int *path = smalloc(len * sizeof(int));
+      hmm_viterbi(phmm->hmm, em, len, path);
+      memcpy(&d->path[core_beg], &path[core_beg - beg],
+             (core_end - core_beg) * sizeof(int));
+      sfree(path);
+    }
+
+    if (d->post_probs != NULL) {
+      for (i = 0; i < nstates; i++)
+        pp[i] = d->post_probs[i] == NULL ? NULL :
+          smalloc(len * sizeof(double));
+      hmm_posterior_probs(phmm->hmm, em, len, pp);
+      for (i = 0; i < nstates; i++) {
+        if (pp[i] == NULL) continue;
+        memcpy(&d->post_probs[i][core_beg], &pp[i][core_beg - beg],
+               (core_end - core_beg) * sizeof(double));
+        sfree(pp[i]);
+      }
+    }
+  }
+}
+
+/* Compute the Viterbi path (if path is non-NULL) and/or posterior
+   probabilities (if post_probs is non-NULL) separately for each
+   window of phmm->window_size sites.  Each window is extended by
+   phmm->window_overlap sites on either side, to reduce edge effects,
+   but only the results for its central part are kept.  Windows are
+   processed in parallel.  They share the emissions, which are
+   computed for the whole sequence, so only the dynamic-programming
+   matrices are bounded by the window size */
+static void phmm_decode_windows(PhyloHmm *phmm, int *path,
+                                double **post_probs) {
+  PhmmWindowData d;
+  int nwindows = (phmm->alloc_len + phmm->window_size - 1) /
+    phmm->window_size;
+  d.phmm = phmm;
+  d.path = path;
+  d.post_probs = post_probs;
+  hmm_transition_table(phmm->hmm); /* set up before sharing */
+  thr_foreach(nwindows, 1, phmm_decode_windows_block, &d);
+}
+
+/* whether results should be computed in windows */
+static int phmm_use_windows(PhyloHmm *phmm) {
+  return phmm->window_size > 0 && phmm->window_size < phmm->alloc_len;
+}
+
 /** Run the Viterbi algorithm and return a set of predictions.
     Emissions must have already been computed (see
     phmm_compute_emissions) */
@@ -660,7 +733,10 @@ GFF_Set* phmm_predict_viterbi(PhyloHmm *phmm,
   if (phmm->emissions == NULL)
     die("ERROR: emissions required for phmm_viterbi_features.\n");
           
-  hmm_viterbi(phmm->hmm, phmm->emissions, phmm->alloc_len, path);
+  if (phmm_use_windows(phmm))
+    phmm_decode_windows(phmm, path, NULL);
+  else
+    hmm_viterbi(phmm->hmm, phmm->emissions, phmm->alloc_len, path);
 
   retval = cm_labeling_as_gff(phmm->cm, path, phmm->alloc_len, 
                               phmm->state_to_cat, 
@@ -757,11 +833,17 @@ double phmm_lnl(PhyloHmm *phmm) {
 
 /** Computes posterior probabilities for a PhyloHmm.  Emissions must
     have already been computed (see phmm_compute_emissions).  Returns 
-    log likelihood.  */
+    log likelihood, or INFTY if computed in windows (see
+    phmm_decode_windows).  */
 double phmm_postprobs(PhyloHmm *phmm, double **post_probs) {
   if (phmm->emissions == NULL)
     die("ERROR: emissions required for phmm_posterior_probs.\n");
 
+  if (phmm_use_windows(phmm)) {
+    phmm_decode_windows(phmm, NULL, post_probs);
+    return INFTY;               /* likelihood not available */
+  }
+
   return hmm_posterior_probs(phmm->hmm, phmm->emissions, phmm->alloc_len, 
                              post_probs) * log(2);
                                 /* convert to natural log */          
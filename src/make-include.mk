@@ -60,6 +60,13 @@ PHAST_VERSION=\"$(shell cat ${PHAST}/version)\"
 CFLAGS += -I${INC} -DPHAST_VERSION=${PHAST_VERSION} -DPHAST_HOME=\"${PHAST_HOME}\" -I${PHAST}/src/lib/pcre -fno-strict-aliasing
 LIBPATH = -L${LIB} 
 
+# multithreading uses POSIX threads, and compressed file support uses
+# zlib, neither of which is available in the mingw cross-compiler;
+# Windows builds run single-threaded and without compression
+ifeq ($(TARGETOS), Windows)
+  CFLAGS += -DSKIP_PTHREADS -DSKIP_ZLIB
+endif
+
 # uncomment these lines for profiling (add -g for line-by-line
 # profiling and -a for monitoring of basic blocks)
 #CFLAGS += -pg
@@ -133,14 +140,14 @@ endif
 # vecLib
 ifdef VECLIB
 CFLAGS += -DVECLIB
-LIBS = -lphast -framework Accelerate -lc -lm
+LIBS = -lphast -framework Accelerate -lc -lm -lpthread -lz
 
 # CLAPACK
 else
 ifdef CLAPACKPATH
 ifneq ($(TARGETOS), Windows)
   CFLAGS += -I${CLAPACKPATH}/INCLUDE -I${F2CPATH}
-  LIBS = -lphast -llapack -ltmg -lblaswr -lc -lf2c -lm
+  LIBS = -lphast -llapack -ltmg -lblaswr -lc -lf2c -lm -lpthread -lz
 else
   CFLAGS += -I${CLAPACKPATH}/INCLUDE -I${F2CPATH} -DPCRE_STATIC
   LIBS = -lphast -lm  ${CLAPACKPATH}/liblapack.a ${CLAPACKPATH}/libf2c.a ${CLAPACKPATH}/libblas.a
@@ -155,7 +162,7 @@ LIBPATH += -L${F2CPATH}
 else
 ifneq ($(TARGETOS), Windows)
   CFLAGS += -DSKIP_LAPACK
-  LIBS = -lphast -lc -lm
+  LIBS = -lphast -lc -lm -lpthread -lz
 else
   CFLAGS += -DSKIP_LAPACK -DPCRE_STATIC
   LIBS = -lphast -lm  
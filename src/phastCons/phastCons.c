@@ -18,6 +18,7 @@
 #include <phast_dgamma.h>
 #include <phast_tree_likelihoods.h>
 #include <phast_maf.h>
+#include <phast_threads.h>
 #include "phast_cons.h"
 #include "phastCons.help"
 
@@ -30,6 +31,7 @@ int main(int argc, char *argv[]) {
     {"viterbi", 1, 0, 'V'},
     {"most-conserved", 1, 0, 'V'}, /* same as --viterbi */
     {"no-post-probs", 0, 0, 'n'},
+    {"binary-post-probs", 0, 0, 'W'},
     {"msa-format", 1, 0, 'i'},
     {"FC", 0, 0, 'X'},
     {"lambda", 1, 0, 'l'},
@@ -62,6 +64,10 @@ int main(int argc, char *argv[]) {
     {"coding-potential", 0, 0, 'p'},
     {"indels-only", 0, 0, 'J'},
     {"alias", 1, 0, 'A'},
+    {"windows", 1, 0, 'w'},
+    {"threads", 1, 0, 'j'},
+    {"rescale", 0, 0, 'Z'},
+    {"checkpoint-cells", 1, 0, 'K'},
     {"quiet", 0, 0, 'q'},
     {"help", 0, 0, 'h'},
     {0, 0, 0, 0}
@@ -71,7 +77,7 @@ int main(int argc, char *argv[]) {
   FILE *infile;
   char *msa_fname;
   char c;
-  int opt_idx, i, coding_potential=FALSE;
+  int opt_idx, i, coding_potential=FALSE, rescale=FALSE;
   List *tmpl = NULL;
   String *tmpstr;
   char *mods_fname = NULL;
@@ -79,7 +85,7 @@ int main(int argc, char *argv[]) {
   msa_format_type msa_format = UNKNOWN_FORMAT;
 
   while ((c = (char)getopt_long(argc, argv, 
-			  "S:H:V:ni:k:l:C:G:zt:E:R:T:O:r:xL:sN:P:g:U:c:e:IY:D:JM:F:pA:Xqh", 
+			  "S:H:V:nWi:k:l:C:G:zt:E:R:T:O:r:xL:sN:P:g:U:c:e:IY:D:JM:F:pA:w:j:XZK:qh", 
                           long_opts, &opt_idx)) != -1) {
     switch (c) {
     case 'S':
@@ -99,6 +105,9 @@ int main(int argc, char *argv[]) {
     case 'n':
       p->post_probs = FALSE;
       break;
+    case 'W':
+      p->post_probs_binary = TRUE;
+      break;
     case 'i':
       msa_format = msa_str_to_format(optarg);
       if (msa_format == UNKNOWN_FORMAT) 
@@ -243,6 +252,27 @@ int main(int argc, char *argv[]) {
     case 'A':
       p->alias_hash = make_name_hash(optarg);
       break;
+    case 'w':
+      {
+        List *l = get_arg_list(optarg);
+        if (lst_size(l) != 2 ||
+            str_as_int(lst_get_ptr(l, 0), &p->window_size) != 0 ||
+            str_as_int(lst_get_ptr(l, 1), &p->window_overlap) != 0 ||
+            p->window_size <= 0 || p->window_overlap < 0)
+          die("ERROR: bad argument to --windows.\n");
+        lst_free_strings(l);
+        lst_free(l);
+      }
+      break;
+    case 'j':
+      thr_set_nthreads(get_arg_int_bounds(optarg, 1, INFTY));
+      break;
+    case 'Z':
+      rescale = TRUE;
+      break;
+    case 'K':
+      hmm_set_checkpoint_cells(get_arg_int_bounds(optarg, 0, INFTY));
+      break;
     case 'q':
       p->results_f = NULL;
       break;
@@ -327,6 +357,7 @@ int main(int argc, char *argv[]) {
       fprintf(p->results_f, "Reading tree model from %s...\n", fname->chars);
     p->mod[i] = tm_new_from_file(phast_fopen(fname->chars, "r"), 1);
     p->mod[i]->use_conditionals = 1;     
+    p->mod[i]->rescale_partials = rescale;
   }
 
   /* read alignment */
@@ -339,8 +370,7 @@ int main(int argc, char *argv[]) {
     fprintf(p->results_f, "Reading alignment from %s...\n", msa_fname);
   if (msa_format == MAF) {
     List *keepSeqs = tr_leaf_names(p->mod[0]->tree);
-    p->msa = maf_read_cats_subset(infile, NULL, 1, NULL, NULL, 
-				  NULL, -1, TRUE, NULL, NO_STRIP, FALSE, NULL, keepSeqs, 1);
+    p->msa = maf_read_ss_stream(infile, NULL, TRUE, keepSeqs);
     lst_free_strings(keepSeqs);
     lst_free(keepSeqs);
   }
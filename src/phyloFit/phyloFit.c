@@ -27,6 +27,7 @@
 #include <phast_sufficient_stats.h>
 #include <phast_maf.h>
 #include <phast_phylo_fit.h>
+#include <phast_threads.h>
 #include "phyloFit.help"
 
 
@@ -36,7 +37,7 @@ int main(int argc, char *argv[]) {
   char c;
   int opt_idx, seed=-1;
   String *optstr;
-  List *tmplist = NULL; 
+  List *tmplist = NULL, *msa_fname_list; 
   struct phyloFit_struct *pf;
   FILE *infile;
   int store_order=0;
@@ -53,6 +54,7 @@ int main(int argc, char *argv[]) {
     {"log", 1, 0, 'l'},
     {"out-root", 1, 0, 'o'},
     {"EM", 0, 0, 'E'},
+    {"analytic-grad", 0, 0, 0},
     {"error", 1, 0, 'e'},
     {"precision", 1, 0, 'p'},
     {"do-cats", 1, 0, 'C'},
@@ -92,14 +94,15 @@ int main(int argc, char *argv[]) {
     {"selection", 1, 0, 0},
     {"bound", 1, 0, 'u'},
     {"seed", 1, 0, 'D'},
+    {"threads", 1, 0, 'j'},
     {0, 0, 0, 0}
   };
 
-  // NOTE: remaining shortcuts left: HjQx
+  // NOTE: remaining shortcuts left: HQx
 
   pf = phyloFit_struct_new(0);
 
-  while ((c = (char)getopt_long(argc, argv, "m:t:s:g:c:C:i:o:k:a:l:w:v:M:p:A:I:K:S:b:d:O:u:Y:e:D:GVENRqLPXZUBFfnrzhWyJ", long_opts, &opt_idx)) != -1) {
+  while ((c = (char)getopt_long(argc, argv, "m:t:s:g:c:C:i:o:k:a:l:w:v:M:p:A:I:K:S:b:d:O:u:Y:e:D:j:GVENRqLPXZUBFfnrzhWyJ", long_opts, &opt_idx)) != -1) {
     switch(c) {
     case 'm':
       msa_fname = optarg;
@@ -294,6 +297,9 @@ int main(int argc, char *argv[]) {
 	pf->selection = get_arg_dbl(optarg);
 	pf->use_selection = TRUE;
       }
+      else if (strcmp(long_opts[opt_idx].name, "analytic-grad") == 0) {
+	pf->analytic_grad = TRUE;
+      }
       else {
 	die("ERROR: unknown option.  Type 'phyloFit -h' for usage.\n");
       }
@@ -307,6 +313,9 @@ int main(int argc, char *argv[]) {
     case 'D':
       seed = get_arg_int_bounds(optarg, 1, INFTY);
       break;
+    case 'j':
+      thr_set_nthreads(get_arg_int_bounds(optarg, 1, INFTY));
+      break;
     case 'h':
       printf("%s", HELP);
       exit(0);
@@ -324,34 +333,63 @@ int main(int argc, char *argv[]) {
     pf->msa_fname = msa_fname;
   }
 
-  infile = phast_fopen(msa_fname, "r");
+  /* several alignment files: aggregate their sufficient statistics,
+     using the leaves of the tree as sequence names */
+  msa_fname_list = get_arg_list(msa_fname);
+  if (lst_size(msa_fname_list) > 1 || msa_fname[0] == '*') {
+    TreeNode *tree = pf->tree;
+    List *seqnames;
+    int subst_mod = pf->subst_mod;
+    if (pf->input_mod != NULL) {
+      if (tree == NULL) tree = pf->input_mod->tree;
+      if (subst_mod == UNDEF_MOD) subst_mod = pf->input_mod->subst_mod;
+    }
+    if (tree == NULL)
+      die("ERROR: --tree or --init-model required with multiple alignment files.\n");
+    if (pf->gff != NULL || pf->nonoverlapping || store_order)
+      die("ERROR: cannot use --features, --non-overlapping, --windows, or\n--windows-explicit with multiple alignment files.\n");
+    seqnames = tr_leaf_names(tree);
+    pf->msa = ss_aggregate_from_files(msa_fname_list, seqnames,
+                                      tm_order(subst_mod) + 1, NULL, -1,
+                                      pf->quiet);
+    if (pf->gaps_as_bases)
+      msa_reset_alphabet(pf->msa, alph);
+    pf->label_categories = FALSE;
+    lst_free_strings(seqnames);
+    lst_free(seqnames);
+  }
+  else {
+    infile = phast_fopen(msa_fname, "r");
 
-  if (input_format == UNKNOWN_FORMAT)
-    input_format = msa_format_for_content(infile, 1);
+    if (input_format == UNKNOWN_FORMAT)
+      input_format = msa_format_for_content(infile, 1);
 
-  if (pf->nonoverlapping && (pf->use_conditionals || pf->gff != NULL || 
-			     pf->cats_to_do_str || input_format == SS))
-    die("ERROR: cannot use --non-overlapping with --markov, --features,\n--msa-format SS, or --do-cats.\n");
+    if (pf->nonoverlapping && (pf->use_conditionals || pf->gff != NULL || 
+                               pf->cats_to_do_str || input_format == SS))
+      die("ERROR: cannot use --non-overlapping with --markov, --features,\n--msa-format SS, or --do-cats.\n");
 
 
-  /* read alignment */
-  if (!pf->quiet) fprintf(stderr, "Reading alignment from %s ...\n", msa_fname);
-  if (input_format == MAF) {
-    pf->msa = maf_read(infile, NULL, 
-		       tm_order(pf->subst_mod) + 1, 
-		       NULL, pf->gff, pf->cm, 
-		       pf->nonoverlapping ? tm_order(pf->subst_mod) + 1 : -1, 
-		       store_order, pf->reverse_group_tag, NO_STRIP, FALSE);
-    if (pf->gaps_as_bases) 
-      msa_reset_alphabet(pf->msa, alph);
-  }
-  else 
-    pf->msa = msa_new_from_file_define_format(infile, 
-				input_format, alph);
+    /* read alignment */
+    if (!pf->quiet) fprintf(stderr, "Reading alignment from %s ...\n", msa_fname);
+    if (input_format == MAF) {
+      pf->msa = maf_read(infile, NULL, 
+                         tm_order(pf->subst_mod) + 1, 
+                         NULL, pf->gff, pf->cm, 
+                         pf->nonoverlapping ? tm_order(pf->subst_mod) + 1 : -1, 
+                         store_order, pf->reverse_group_tag, NO_STRIP, FALSE);
+      if (pf->gaps_as_bases) 
+        msa_reset_alphabet(pf->msa, alph);
+    }
+    else 
+      pf->msa = msa_new_from_file_define_format(infile, 
+                                  input_format, alph);
 
-  /* set up for categories */
-  /* first label sites, if necessary */
-  pf->label_categories = (input_format != MAF);
+    /* set up for categories */
+    /* first label sites, if necessary */
+    pf->label_categories = (input_format != MAF);
+  }
+  lst_free_strings(msa_fname_list);
+  lst_free(msa_fname_list);
 
   run_phyloFit(pf);
 
@@ -10,6 +10,10 @@
 #include "phast_phylo_p.h"
 #include "phyloP.help"
 #include <phast_misc.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <phast_threads.h>
 
 
 int main(int argc, char *argv[]) {
@@ -19,9 +23,10 @@ int main(int argc, char *argv[]) {
   msa_format_type msa_format = UNKNOWN_FORMAT;
 
   /* other variables */
-  int opt_idx, seed = -1;
-  List *cats_to_do_str=NULL;
+  int opt_idx, seed = -1, rescale = FALSE, fim_cache = FALSE, i;
+  List *cats_to_do_str=NULL, *grid_res;
   struct timeval now;
+  struct stat st;
 
   struct option long_opts[] = {
     {"method", 1, 0, 'm'},
@@ -38,6 +43,7 @@ int main(int argc, char *argv[]) {
     {"quantiles", 0, 0, 'q'},
     {"wig-scores", 0, 0, 'w'},
     {"base-by-base", 0, 0, 'b'},
+    {"binary-scores", 0, 0, 'W'},
     {"refidx", 1, 0, 'r'},
     {"chrom", 1, 0, 'N'},
     {"log", 1, 0, 'l'},
@@ -46,6 +52,11 @@ int main(int argc, char *argv[]) {
     {"catmap", 1, 0, 'M'},
     {"no-prune", 0, 0, 'P'},
     {"seed", 1, 0, 'd'},
+    {"threads", 1, 0, 'j'},
+    {"cache", 1, 0, 'K'},
+    {"fim-cache", 0, 0, 'X'},
+    {"fim-grid", 1, 0, 'G'},
+    {"rescale", 0, 0, 'Z'},
     {"help", 0, 0, 'h'},
     {0, 0, 0, 0}
   };
@@ -56,7 +67,7 @@ int main(int argc, char *argv[]) {
   srandom((unsigned int)now.tv_usec);
 #endif
 
-  while ((c = (char)getopt_long(argc, argv, "m:o:i:n:pc:s:f:Fe:l:r:B:d:qwgbPN:h", 
+  while ((c = (char)getopt_long(argc, argv, "m:o:i:n:pc:s:f:Fe:l:r:B:d:j:K:XG:ZqwgbWPN:h", 
                           long_opts, &opt_idx)) != -1) {
     switch (c) {
     case 'm':
@@ -124,6 +135,9 @@ int main(int argc, char *argv[]) {
     case 'b':
       p->base_by_base = TRUE;
       break;
+    case 'W':
+      p->output_binary = TRUE;
+      break;
     case 'N':
       p->chrom = optarg;
       break;
@@ -148,6 +162,34 @@ int main(int argc, char *argv[]) {
     case 'P':
       p->no_prune = TRUE;
       break;
+    case 'j':
+      thr_set_nthreads(get_arg_int_bounds(optarg, 1, INFTY));
+      break;
+    case 'K':
+      if (stat(optarg, &st) != 0)
+        die("ERROR: cache directory '%s' does not exist\n", optarg);
+      if (!S_ISDIR(st.st_mode))
+        die("ERROR: '%s' is not a directory\n", optarg);
+      if (access(optarg, W_OK | X_OK) != 0)
+        die("ERROR: cache directory '%s' is not writable\n", optarg);
+      col_set_cache_dir(optarg);
+      break;
+    case 'X':
+      fim_cache = TRUE;
+      break;
+    case 'G':
+      grid_res = get_arg_list_dbl(optarg);
+      if (lst_size(grid_res) != 3 || lst_get_dbl(grid_res, 0) <= 0 ||
+          lst_get_dbl(grid_res, 0) > 1 || lst_get_dbl(grid_res, 1) <= 0 ||
+          lst_get_dbl(grid_res, 2) < 0)
+        die("ERROR: bad argument to --fim-grid (-G).\n");
+      col_set_fim_grid(lst_get_dbl(grid_res, 0), lst_get_dbl(grid_res, 1),
+                       lst_get_dbl(grid_res, 2));
+      lst_free(grid_res);
+      break;
+    case 'Z':
+      rescale = TRUE;
+      break;
     case 'h':
       printf("%s", HELP);
       exit(0);
@@ -158,12 +200,17 @@ int main(int argc, char *argv[]) {
 
   set_seed(seed);
 
+  if (p->output_binary && !p->base_by_base)
+    die("ERROR: --binary-scores requires --wig-scores or --base-by-base.\n");
+
   if ((p->prior_only && optind > argc - 1) || 
       (!p->prior_only && optind != argc - 2))
     die("ERROR: bad arguments.  Try 'phyloP -h'.\n");
   p->mod_fname = argv[optind];
+  if (fim_cache) col_set_fim_cache(p->mod_fname);
 
   p->mod = tm_new_from_file(phast_fopen(p->mod_fname, "r"), 1);
+  p->mod->rescale_partials = rescale;
 
   if (cats_to_do_str != NULL) {
     if (p->cm == NULL) die("ERROR: --cats-to-do requires --catmap option\n");
@@ -175,7 +222,27 @@ int main(int argc, char *argv[]) {
     msa_f = phast_fopen(p->msa_fname, "r");
     if (msa_format == UNKNOWN_FORMAT)
       msa_format = msa_format_for_content(msa_f, 1);
-    if (msa_format == MAF) 
+    if (msa_format == MAF && p->cats_to_do == NULL &&
+        (p->feats != NULL || p->base_by_base)) {
+                                /* ordered tuples without categories */
+      MafIndex *idx = NULL;
+      long start = LONG_MAX, end = 0;
+      /* with --features, read only the blocks spanned by the features;
+         an index built here is not saved next to the user's input */
+      if (p->feats != NULL && !p->base_by_base && 
+          lst_size(p->feats->features) > 0) {
+        for (i = 0; i < lst_size(p->feats->features); i++) {
+          GFF_Feature *f = lst_get_ptr(p->feats->features, i);
+          if (f->start - 1 < start) start = f->start - 1;
+          if (f->end > end) end = f->end;
+        }
+        idx = mafIndex_open(p->msa_fname, FALSE);
+      }
+      p->msa = maf_read_ss_stream_region(msa_f, idx, start, end, NULL, 
+                                         TRUE, NULL);
+      if (idx != NULL) mafIndex_free(idx);
+    }
+    else if (msa_format == MAF) 
       p->msa = maf_read_cats(msa_f, NULL, 1, NULL, 
 			     p->cats_to_do==NULL ? NULL : p->feats, p->cm, -1, 
 			     (p->feats == NULL && p->base_by_base==0) ? FALSE : TRUE, /* --features requires order */
@@ -14,10 +14,12 @@
 #include <phast_msa.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <limits.h>
 #include <phast_sufficient_stats.h>
 #include <phast_local_alignment.h>
 #include <phast_maf.h>
 #include <phast_maf_block.h>
+#include <phast_threads.h>
 
 void print_usage() {
     printf("\n\
@@ -62,6 +64,12 @@ OPTIONS:\n\
     --end, -e <end_col>\n\
         End index of sub-alignment.  Default is length of alignment.\n\
         Coordinates defined as in --start option, above.\n\
+\n\
+        When --start or --end is given in reference-sequence\n\
+        coordinates, only the blocks overlapping the requested range\n\
+        are read, using an index of the MAF file.  The index is saved\n\
+        as <infile>.idx (if possible) the first time it is needed and\n\
+        reused as long as it is newer than the MAF file.\n\
 \n\
     --seqs, -l <seq_list>\n\
         Comma-separated list of sequences to include (default)\n\
@@ -156,6 +164,10 @@ OPTIONS:\n\
         Remove lines in MAF starting with i.\n\
     --strip-e-lines, -E\n\
         Remove lines in MAF starting with e.\n\
+    --threads, -j <nthreads>\n\
+        Use <nthreads> threads to parse MAF blocks (default 1), in\n\
+        addition to a thread that reads the input file.  Output does\n\
+        not depend on the number of threads.\n\
     --help, -h\n\
         Print this help message.\n\n");
 }
@@ -262,6 +274,17 @@ void close_outfiles(List *outfileList, Hashtable *outfileHash) {
 }
 
 
+/* Read the next block of the MAF, either sequentially (using reader)
+   or, if region is non-NULL, the next of the indexed blocks listed in
+   region (see mafIndex_query) */
+MafBlock *read_next_block(FILE *mfile, MafBlockReader *reader,
+			  MafIndex *idx, List *region, int *region_idx) {
+  if (region == NULL) return mafBlockReader_next(reader, NULL, NULL);
+  if (*region_idx >= lst_size(region)) return NULL;
+  return mafIndex_read_block(idx, mfile, lst_get_int(region, (*region_idx)++));
+}
+
+
 int main(int argc, char* argv[]) {
   char *maf_fname = NULL, *out_root_fname = "maf_parse", *masked_fn = NULL;
   String *refseq = NULL, *currRefseq;
@@ -283,6 +306,10 @@ int main(int argc, char* argv[]) {
   MSA *msa = NULL;//, **catMsa;
   char *mask_features_spec_arg=NULL;
   List *mask_features_spec=NULL;
+  MafIndex *mafIdx = NULL;
+  List *region = NULL;
+  int regionIdx = 0;
+  MafBlockReader *reader = NULL;
 
 
   struct option long_opts[] = {
@@ -305,12 +332,13 @@ int main(int argc, char* argv[]) {
     {"strip-i-lines", 0, 0, 'I'},
     {"strip-e-lines", 0, 0, 'E'},
     {"mask-features", 1, 0, 'M'},
+    {"threads", 1, 0, 'j'},
     {"help", 0, 0, 'h'},
     {0, 0, 0, 0}
   };
 
 
-  while ((c = (char)getopt_long(argc, argv, "s:e:l:O:r:S:d:g:c:P:b:o:m:M:pLnxEIh", long_opts, &opt_idx)) != -1) {
+  while ((c = (char)getopt_long(argc, argv, "s:e:l:O:r:S:d:g:c:P:b:o:m:M:j:pLnxEIh", long_opts, &opt_idx)) != -1) {
     switch(c) {
     case 's':
       startcol = get_arg_int(optarg);
@@ -382,6 +410,9 @@ int main(int argc, char* argv[]) {
     case 'p':
       pretty_print = TRUE;
       break;
+    case 'j':
+      thr_set_nthreads(get_arg_int_bounds(optarg, 1, INFTY));
+      break;
     case 'h':
       print_usage();
       exit(0);
@@ -448,8 +479,20 @@ int main(int argc, char* argv[]) {
   /* Check to see if --do-cats names a feature which is length 1.
      If so, set output_format to SS ? or FASTA ? */
 
+  /* when extracting a range of the reference sequence, use an index
+     to read only the blocks that overlap it (blocks that do not
+     overlap would be discarded by mafBlock_trim below) */
+  if (useRefseq && (startcol != 1 || endcol != -1)) {
+    mafIdx = mafIndex_open(maf_fname, TRUE);
+    if (mafIdx != NULL)
+      region = mafIndex_query(mafIdx, startcol - 1,
+			      endcol == -1 ? LONG_MAX : (long)endcol + 1);
+  }
+
   mfile = phast_fopen(maf_fname, "r");
-  block = mafBlock_read_next(mfile, NULL, NULL);
+  if (region == NULL)
+    reader = mafBlockReader_new(mfile, thr_get_nthreads());
+  block = read_next_block(mfile, reader, mafIdx, region, &regionIdx);
 
   if (splitInterval == -1 && gff==NULL) {
     //TODO: do we want to copy header from original MAF in this case?
@@ -566,7 +609,7 @@ int main(int argc, char* argv[]) {
 
   get_next_block:
     mafBlock_free(block);
-    block = mafBlock_read_next(mfile, NULL, NULL);
+    block = read_next_block(mfile, reader, mafIdx, region, &regionIdx);
   }
 
   if (masked_file != NULL) fclose(masked_file);
@@ -580,6 +623,11 @@ int main(int argc, char* argv[]) {
     msa_free(msa);
   }
   if (gff != NULL) gff_free_set(gff);
+  if (mafIdx != NULL) {
+    lst_free(region);
+    mafIndex_free(mafIdx);
+  }
+  if (reader != NULL) mafBlockReader_free(reader);
   phast_fclose(mfile);
   return 0;
 }
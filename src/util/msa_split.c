@@ -162,8 +162,9 @@ OPTIONS:\n\
         (For use with --in-format MAF) Name of file containing\n\
         reference sequence, in FASTA format.\n\
 \n\
-    --out-format, -o FASTA|PHYLIP|MPM|SS\n\
-        Output alignment file format.  Default is FASTA.\n\
+    --out-format, -o FASTA|PHYLIP|MPM|SS|BSS\n\
+        Output alignment file format.  Default is FASTA.  BSS is a\n\
+        binary version of SS, which is much faster to read.\n\
 \n\
     --out-root, -r <name>\n\
         Filename root for output files (default \"msa_split\").\n\
@@ -238,12 +239,15 @@ void write_sub_msa(MSA *submsa, char *fname, msa_format_type output_format,
   FILE *F = phast_fopen(fname, "w+");
 
   /* create sufficient stats, if necessary */
-  if (output_format == SS) {
+  if (output_format == SS || output_format == BSS) {
     if (submsa->ss == NULL)
       ss_from_msas(submsa, tuple_size, ordered_stats, NULL, NULL, NULL, -1, 0);
     else if (submsa->ss->tuple_size != tuple_size) 
       die("ERROR: tuple size in SS file does not match desired tuple size for output.\nConversion not supported.\n");
-    ss_write(submsa, F, ordered_stats);
+    if (output_format == BSS)
+      ss_write_binary(submsa, F, ordered_stats);
+    else
+      ss_write(submsa, F, ordered_stats);
   }
   else 
     msa_print(F, submsa, output_format, 0);
@@ -595,6 +599,7 @@ int main(int argc, char* argv[]) {
   FILE *infile = phast_fopen(msa_fname, "r");
   if (input_format == UNKNOWN_FORMAT)
     input_format = msa_format_for_content(infile, 1);
+  if (input_format == BSS) input_format = SS;
   if (input_format == MAF) {
     if (gff != NULL) fprintf(stderr, "WARNING: use of --features with a MAF file currently forces a projection onto the reference sequence.\n");
 
@@ -861,7 +866,8 @@ int main(int argc, char* argv[]) {
 	else {  /* write gff file for subset */
 	  /* map coords back to original frame(s) of ref */
 	  msa_map_gff_coords(sub_msa, sub_gff, 0, 1, 
-			     output_format == SS ? sub_msa->idx_offset : 0);
+			     output_format == SS || output_format == BSS ? 
+                             sub_msa->idx_offset : 0);
 			     /* if output SS, add offset */
 
 	  sprintf(subfname, "%s.%d-%d.gff", out_fname_root, orig_start, orig_end);
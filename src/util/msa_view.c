@@ -17,6 +17,7 @@
 #include <phast_sufficient_stats.h>
 #include <phast_local_alignment.h>
 #include <phast_maf.h>
+#include <phast_threads.h>
 
 /* minimum number of codons required for -L */
 #define MIN_NCODONS 10
@@ -153,6 +154,12 @@ OPTIONS:\n\
         replaced by rows of missing data).  The standard <msa_fname>\n\
         argument should be replaced with a list of (whitespace-\n\
         separated) file names.\n\
+\n\
+    --threads, -j <nthreads>\n\
+        (For use with --aggregate, --out-format SS and --unordered-ss)\n\
+        Read and aggregate files using up to <nthreads> threads\n\
+        (default 1).  Files are divided among threads in contiguous\n\
+        subsets; the output does not depend on the number of threads.\n\
 \n\
     --split-all, -X <filename root>\n\
         Split output alignment into separate fasta files by species.\n\
@@ -172,10 +179,14 @@ OPTIONS:\n\
         sufficient statistics for phylogenetic inference (distinct columns\n\
         or tuple of columns and their counts).  Use --out-format SS with\n\
         --in-format MAF for best efficiency (explicit alignment is\n\
-        never created).  Also, use --unordered-ss if possible.\n\
+        never created).  Also, use --unordered-ss if possible.  SS\n\
+        input may be in text or binary form (see BSS below).\n\
 \n\
-    --out-format, -o PHYLIP|FASTA|MPM|SS\n\
-        (Default FASTA)  Output file format.\n\
+    --out-format, -o PHYLIP|FASTA|MPM|SS|BSS\n\
+        (Default FASTA)  Output file format.  BSS is a binary version\n\
+        of SS, which is much faster to read.  It can be used wherever\n\
+        an SS file is accepted, but can only be read on machines\n\
+        with the same byte order.\n\
 \n\
     --alphabet, -a <alphabet_string>\n\
         Use the specified alphabet (default \"ACGT\").  In addition,\n\
@@ -410,7 +421,7 @@ int main(int argc, char* argv[]) {
     rand_perm = FALSE, reverse_compl = FALSE, stats_only = FALSE, win_size = -1, 
     cycle_size = -1, maf_keep_overlapping = FALSE, collapse_missing = FALSE,
     fourD = FALSE, mark_missing_maxsize = -1, missing_as_indels = FALSE,
-    unmask = FALSE, split_all = FALSE;
+    unmask = FALSE, split_all = FALSE, binary_ss = FALSE;
   char c, *out_root=NULL, out_fname[STR_MED_LEN];
   List *cats_to_do = NULL, *aggregate_list = NULL, *msa_fname_list = NULL, 
     *order_list = NULL, *fill_N_list = NULL;
@@ -444,6 +455,7 @@ int main(int argc, char* argv[]) {
     {"codons", 0, 0, 'D'},
     {"4d", 0, 0, '4'},
     {"aggregate", 1, 0, 'A'},
+    {"threads", 1, 0, 'j'},
     {"refseq", 1, 0, 'M'},
     {"order", 1, 0, 'O'},
     {"summary-only", 0, 0, 'S'},
@@ -461,7 +473,7 @@ int main(int argc, char* argv[]) {
     {0, 0, 0, 0}
   };
 
-  while ((c = (char)getopt_long(argc, argv, "i:o:s:e:l:G:r:T:a:g:c:C:L:I:A:M:O:w:N:Y:X:fuDVxPzRSk4mh", long_opts, &opt_idx)) != -1) {
+  while ((c = (char)getopt_long(argc, argv, "i:o:s:e:l:G:r:T:a:g:c:C:L:I:A:j:M:O:w:N:Y:X:fuDVxPzRSk4mh", long_opts, &opt_idx)) != -1) {
     switch(c) {
     case 'i':
       input_format = msa_str_to_format(optarg);
@@ -512,6 +524,9 @@ int main(int argc, char* argv[]) {
     case 'A':
       aggregate_list = get_arg_list(optarg);
       break;
+    case 'j':
+      thr_set_nthreads(get_arg_int_bounds(optarg, 1, INFTY));
+      break;
     case 'g':
       gff = gff_read_set(phast_fopen(optarg, "r"));
       break;
@@ -613,6 +628,13 @@ int main(int argc, char* argv[]) {
   if (gff != NULL && cm == NULL) 
     cm = cm_new_from_features(gff);
 
+  /* binary SS is handled like SS until the alignment is printed */
+  if (output_format == BSS) {
+    output_format = SS;
+    binary_ss = TRUE;
+  }
+  if (input_format == BSS) input_format = SS;
+
   if (stats_only) {             /* this simplifies the case handling below  */
     output_format = SS; 
     ordered_stats = FALSE; 
@@ -670,7 +692,7 @@ int main(int argc, char* argv[]) {
     if (output_format == SS && !ordered_stats) {
       msa = ss_aggregate_from_files(msa_fname_list, 
                                     aggregate_list, tuple_size, 
-                                    cats_to_do, cycle_size);
+                                    cats_to_do, cycle_size, FALSE);
                                 /* avoid creating aggregate alignment
                                    explicitly, if possible */
       cats_done = TRUE;         /* in this case, cats are taken care of */
@@ -904,7 +926,8 @@ int main(int argc, char* argv[]) {
     
     else {                         /* print alignment */
       msa_update_length(sub_msa);
-      msa_print(stdout, sub_msa, output_format, pretty_print);
+      msa_print(stdout, sub_msa, binary_ss ? BSS : output_format, 
+                pretty_print);
     }
   }
 
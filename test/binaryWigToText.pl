@@ -0,0 +1,86 @@
+#!/usr/bin/perl -w
+
+# Convert a binary score track, as written by phyloP --binary-scores or
+# phastCons --binary-post-probs, back to fixedStep wig text.  Values
+# are printed with the given number of decimal places (default 3).
+# Blocks that continue the previous block are joined, as in the text
+# output.  Dies if the track is malformed or truncated.
+#
+# If the text output of the same command is given as well, compare the
+# track with it instead, and report the lines that differ by more than
+# the precision of the text and of 32-bit floats allow (header lines
+# starting with '#' are skipped).
+#
+# usage: perl binaryWigToText.pl [ndigits [text.wig]] < track
+
+use strict;
+
+my $ndigits = (@ARGV ? $ARGV[0] : 3);
+my $textfile = $ARGV[1];
+my ($buf, $pos) = ("", 0);
+binmode STDIN;
+{ local $/; $buf = <STDIN>; }
+
+sub take {
+    my ($n) = @_;
+    die "ERROR: track truncated at byte $pos\n" if $pos + $n > length($buf);
+    my $s = substr($buf, $pos, $n);
+    $pos += $n;
+    return $s;
+}
+
+die "ERROR: not a binary score track\n" if take(8) ne "PHASTF32";
+my ($version, $bom) = unpack("l l", take(8));
+die "ERROR: unknown version $version\n" if $version != 1;
+die "ERROR: track written with a different byte order\n"
+    if $bom != 0x01020304;
+
+my @lines;                      # one array ref per line
+my ($prevchrom, $nextstart, $prevncols) = ("", -1, -1);
+while ($pos < length($buf)) {
+    my ($clen) = unpack("l", take(4));
+    my $chrom = take($clen);
+    my ($start, $ncols, $nrows) = unpack("l l l", take(12));
+    my @vals = unpack("f*", take(4 * $ncols * $nrows));
+    push @lines, ["fixedStep chrom=$chrom start=$start step=1"]
+        unless ($chrom eq $prevchrom && $start == $nextstart &&
+                $ncols == $prevncols);
+    for (my $i = 0; $i < $nrows; $i++) {
+        push @lines, [@vals[$i * $ncols .. ($i + 1) * $ncols - 1]];
+    }
+    ($prevchrom, $nextstart, $prevncols) = ($chrom, $start + $nrows, $ncols);
+}
+
+if (!defined($textfile)) {
+    foreach my $l (@lines) {
+        if ($l->[0] =~ /^fixedStep/) { print "$l->[0]\n"; }
+        else { print join("\t", map { sprintf("%.${ndigits}f", $_) } @$l), "\n"; }
+    }
+    exit 0;
+}
+
+open(TEXT, $textfile) or die "ERROR: cannot open $textfile\n";
+my $n = 0;
+while (my $line = <TEXT>) {
+    chomp $line;
+    next if $line =~ /^#/;
+    my $l = $lines[$n++];
+    if (!defined($l)) {
+        print "track ends before line: $line\n";
+        last;
+    }
+    if ($line =~ /^fixedStep/ || $l->[0] =~ /^fixedStep/) {
+        print "text: $line\ttrack: $l->[0]\n" if $line ne $l->[0];
+        next;
+    }
+    my @t = split(/\t/, $line);
+    my $ok = (scalar(@t) == scalar(@$l));
+    for (my $i = 0; $ok && $i < @t; $i++) {
+        $ok = (abs($t[$i] - $l->[$i]) <=
+               0.5 * 10**-$ndigits + abs($l->[$i]) * 2**-23 + 1e-12);
+    }
+    print "text: $line\ttrack: ", join("\t", @$l), "\n" if !$ok;
+}
+close TEXT;
+print "track has ", scalar(@lines) - $n, " more lines than text\n"
+    if $n < @lines;
@@ -71,7 +71,110 @@ tree_doctor --name-ancestors phyloFit.mod > phyloFit-named.mod
 @phyloP  --seed 123 --method SPH --subtree mouse-rat --mode CONACC --base-by-base phyloFit-named.mod hmrc.ss
 @phyloP  --seed 123 --method SPH --subtree mouse-rat --mode CONACC --features temp.bed phyloFit-named.mod hmrc.ss
 
-rm -f hmrc_short.ss phyloFit.mod phyloFit-named.mod temp.bed
+# alignment rows not in the order of the leaves of the tree; SCORE
+# results should match those for hmrc.ss (tests will fail against
+# versions that let the FIM simulation reset the row mapping)
+msa_view --order human,cow,rat,mouse -i SS -o SS hmrc.ss > hmrc_reordered.ss
+@phyloP  --seed 123 -d 12345 --method SCORE --wig-scores phyloFit.mod hmrc_reordered.ss
+@phyloP  --seed 123 --method SCORE --subtree mouse-rat --mode CONACC --wig-scores phyloFit-named.mod hmrc_reordered.ss
+
+# on a deep tree, SPH caps the number of substitutions considered;
+# results should match those computed without caps
+sed "s/^TREE:.*/TREE: (((((((((((((((s0:0.05,s1:0.05):0.02,s2:0.05):0.02,s3:0.05):0.02,s4:0.05):0.02,s5:0.05):0.02,s6:0.05):0.02,s7:0.05):0.02,s8:0.05):0.02,s9:0.05):0.02,s10:0.05):0.02,s11:0.05):0.02,s12:0.05):0.02,s13:0.05):0.02,s14:0.05):0.02,s15:0.05);/" rev.mod > deep.mod
+base_evolve --nsites 500 deep.mod > deep.fa
+@phyloP  --method SPH --base-by-base deep.mod deep.fa
+@phyloP  --method SPH --features temp.bed deep.mod deep.fa
+
+# --rescale should not change the results unless the likelihoods
+# underflow, as they do without it on a tree of 1024 leaves
+phyloP  --method LRT --mode CONACC --wig-scores hpmrc-rev-dg-global.mod hpmrc.ss > temp-text.txt
+@phyloP  -Z --method LRT --mode CONACC --wig-scores hpmrc-rev-dg-global.mod hpmrc.ss | diff - temp-text.txt
+phyloP  --method SPH --mode CONACC --wig-scores hpmrc-rev-dg-global.mod hpmrc.ss > temp-text.txt
+@phyloP  -Z --method SPH --mode CONACC --wig-scores hpmrc-rev-dg-global.mod hpmrc.ss | diff - temp-text.txt
+(grep -v "^TREE" rev.mod; perl -e 'sub t { return "s" . $n++ if !$_[0]; return "(" . t($_[0]-1) . ":0.3," . t($_[0]-1) . ":0.3)"; } print "TREE: ", t(10), ";\n"') > temp-big.mod
+base_evolve --nsites 200 --seed 1 temp-big.mod > temp-big.fa
+@phyloP  --method LRT --wig-scores temp-big.mod temp-big.fa
+@phyloP  -Z --method LRT --wig-scores temp-big.mod temp-big.fa
+rm -f temp-big.mod temp-big.fa
+
+# --threads: results should match those of a single thread, for a
+# model with rate variation too.  Warnings from the subtree score test
+# come in no fixed order with threads, so only its scores are compared
+phyloFit hmrc.ss -D 12345 --subst-mod REV -k 4 --tree "(human, (mouse,rat), cow)" -o phyloFit-k4 --quiet
+tree_doctor --name-ancestors phyloFit-k4.mod > phyloFit-k4-named.mod
+phyloP  --method LRT --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss > temp-j1.txt
+@phyloP  -j 4 --method LRT --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss | diff - temp-j1.txt
+phyloP  --method LRT --subtree mouse-rat --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss > temp-j1.txt
+@phyloP  -j 4 --method LRT --subtree mouse-rat --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss | diff - temp-j1.txt
+phyloP  -d 12345 --method SCORE --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss > temp-j1.txt
+@phyloP  -j 4 -d 12345 --method SCORE --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss | diff - temp-j1.txt
+phyloP  -d 12345 --method SCORE --subtree mouse-rat --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss 2> /dev/null > temp-j1.txt
+@phyloP  -j 4 -d 12345 --method SCORE --subtree mouse-rat --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss 2> /dev/null | diff - temp-j1.txt
+phyloP  --method SPH --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss > temp-j1.txt
+@phyloP  -j 4 --method SPH --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss | diff - temp-j1.txt
+phyloP  --method SPH --subtree mouse-rat --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss > temp-j1.txt
+@phyloP  -j 4 --method SPH --subtree mouse-rat --mode CONACC --base-by-base phyloFit-k4-named.mod hmrc.ss | diff - temp-j1.txt
+
+# --binary-scores: converted back to text, the binary track should
+# match the text output to within the precision of 32-bit floats.  The
+# second track is long enough to be written in more than one block
+phyloP  --method LRT --mode CONACC --wig-scores phyloFit.mod hmrc.ss > temp-text.txt
+@phyloP  -W --method LRT --mode CONACC --wig-scores phyloFit.mod hmrc.ss | perl binaryWigToText.pl 3 temp-text.txt
+phyloP  --method SPH --subtree mouse-rat --mode CONACC --base-by-base phyloFit-named.mod hmrc.ss > temp-text.txt
+@phyloP  -W --method SPH --subtree mouse-rat --mode CONACC --base-by-base phyloFit-named.mod hmrc.ss | perl binaryWigToText.pl 5 temp-text.txt
+
+# persistent tuple cache: the first of the two runs of each test fills
+# the cache and the second reads it; both should match a run without it
+rm -rf tcache; mkdir tcache
+phyloP --method LRT --mode CONACC --wig-scores phyloFit.mod hmrc.ss > tcache-direct.wig
+@phyloP  --method LRT --mode CONACC --wig-scores -K tcache phyloFit.mod hmrc.ss
+@phyloP  --method LRT --mode CONACC --wig-scores -K tcache phyloFit.mod hmrc.ss | diff - tcache-direct.wig
+
+# Fisher information cache: as above, the first run of each test saves
+# the FIM (or grid of FIMs) next to a copy of the model and the second
+# reads it; the scores should not change.  Non-default grids are saved
+# separately (one file of each kind is listed), and bad grids are
+# rejected
+cp phyloFit-named.mod fimcache.mod
+phyloP  --seed 123 --method SCORE --subtree mouse-rat --mode CONACC --wig-scores fimcache.mod hmrc.ss > fim-direct.wig
+@phyloP  --seed 123 --method SCORE --subtree mouse-rat --mode CONACC --wig-scores -X fimcache.mod hmrc.ss | diff - fim-direct.wig; ls fimcache.mod.*.fimgrid | wc -l
+phyloP  --seed 123 --method SCORE --subtree mouse-rat --mode CONACC --wig-scores -G 0.05,0.1,2 fimcache.mod hmrc.ss > fim-direct.wig
+@phyloP  --seed 123 --method SCORE --subtree mouse-rat --mode CONACC --wig-scores -X -G 0.05,0.1,2 fimcache.mod hmrc.ss | diff - fim-direct.wig; ls fimcache.mod.*.grid0.05,0.1,2.fimgrid | wc -l
+phyloP  --seed 123 --method SCORE --mode CONACC --wig-scores fimcache.mod hmrc.ss > fim-direct.wig
+@phyloP  --seed 123 --method SCORE --mode CONACC --wig-scores -X fimcache.mod hmrc.ss | diff - fim-direct.wig; ls fimcache.mod.*.fim | wc -l
+@phyloP  --seed 123 --method SCORE --subtree mouse-rat -G 0,0.05,3 fimcache.mod hmrc_short.ss
+@phyloP  --seed 123 --method SCORE --subtree mouse-rat -G 0.02,0.05 fimcache.mod hmrc_short.ss
+rm -f fimcache.mod* fim-direct.wig
+
+# long elements on a scaled tree give distributions large enough to be
+# convolved by FFT; p-values come from their far tails
+tree_doctor --scale 3 rev.mod > rev-scaled.mod
+echo -e "chr1\t0\t20000\nchr1\t20000\t60000\nchr1\t60000\t61000" > temp-long.bed
+@phyloP  --features temp-long.bed -g rev-scaled.mod hmrc.ss
+
+# with --features, only the MAF blocks spanned by the features are
+# read, using an index; results should match those of a full read
+# (from stdin, which cannot be indexed).  The blocks of this MAF are
+# not sorted, and the second feature starts inside a block that a full
+# read ignores as out of order, so each feature should get the same
+# result whichever other features are given
+phyloFit --tree "((hg17,(mm5,rn3)),galGal2,fr1)" -o chr22 chr22.14500000-15500000.maf --quiet
+echo -e "hg17.chr22\t0\t10\nhg17.chr22\t2000\t5000\nhg17.chr22\t400000\t400500" > temp-maf.bed
+phyloP --method LRT --features temp-maf.bed -i MAF chr22.mod - < chr22.14500000-15500000.maf > temp-maf-full.txt
+@phyloP  --method LRT --features temp-maf.bed chr22.mod chr22.14500000-15500000.maf | diff - temp-maf-full.txt
+@phyloP  --method SPH --features temp-maf.bed chr22.mod chr22.14500000-15500000.maf
+tail -n +2 temp-maf.bed > temp-maf2.bed
+awk '$2 == 2000' temp-maf-full.txt | cut -f 1-3,5- > temp-maf-2000.txt
+@phyloP  --method LRT --features temp-maf2.bed chr22.mod chr22.14500000-15500000.maf | awk '$2 == 2000' | cut -f 1-3,5- | diff - temp-maf-2000.txt
+gzip -c chr22.14500000-15500000.maf > temp.maf.gz
+@phyloP  --method LRT --features temp-maf.bed chr22.mod temp.maf.gz | diff - temp-maf-full.txt; test ! -e temp.maf.gz.idx || echo "index saved"; rm -f temp.maf.gz.idx
+# an index saved by maf_parse is used; phyloP never saves one itself
+maf_parse --start 1 --end 10 chr22.14500000-15500000.maf > /dev/null
+@phyloP  --method LRT --features temp-maf.bed chr22.mod chr22.14500000-15500000.maf | diff - temp-maf-full.txt
+rm -f chr22.14500000-15500000.maf.idx
+
+rm -rf tcache
+rm -f hmrc_short.ss hmrc_reordered.ss deep.mod deep.fa tcache-direct.wig phyloFit.mod phyloFit-named.mod phyloFit-k4.mod phyloFit-k4-named.mod temp-j1.txt temp-text.txt temp.bed rev-scaled.mod temp-long.bed chr22.mod temp-maf.bed temp-maf2.bed temp-maf-full.txt temp-maf-2000.txt temp.maf.gz
 
 
 
@@ -121,6 +224,43 @@ phyloFit --quiet --tree "((hg16, panTro1), (mm3, rn3))" -o hpmr-ratevar --alpha
 #--no-post-probs
 !likeFile.txt @phastCons --lnl likeFile.txt --no-post-probs hpmrc.ss hpmr.mod
 !elements.bed @phastCons --most-conserved elements.bed --no-post-probs hpmrc.ss hpmr.mod
+#compressed output
+phastCons --most-conserved temp-elements.bed hpmrc.ss hpmr.mod > /dev/null
+@phastCons --most-conserved temp-elements.bed.gz hpmrc.ss hpmr.mod > /dev/null; gunzip -c temp-elements.bed.gz | diff - temp-elements.bed
+rm -f temp-elements.bed temp-elements.bed.gz
+#--windows.  With an overlap long compared with the expected lengths of
+#conserved and nonconserved regions, output should match that of a
+#run without windows
+phastCons --most-conserved temp-elements.bed hpmrc.ss hpmr.mod > temp-scores.wig
+@phastCons --most-conserved temp-win.bed --windows 2000,1000 hpmrc.ss hpmr.mod | diff - temp-scores.wig; diff temp-win.bed temp-elements.bed
+!temp-win.bed @phastCons --most-conserved temp-win.bed --windows 2000,100 hpmrc.ss hpmr.mod
+rm -f temp-elements.bed temp-win.bed temp-scores.wig
+#--threads.  Output should not depend on the number of threads
+phastCons --target-coverage 0.25 --expected-length 12 --estimate-trees temp-j1 --most-conserved temp-elements.bed hpmrc.ss hpmr.mod > temp-scores.wig
+@phastCons -j 4 --target-coverage 0.25 --expected-length 12 --estimate-trees temp-j4 --most-conserved temp-j4.bed hpmrc.ss hpmr.mod | diff - temp-scores.wig; diff temp-j4.bed temp-elements.bed; diff temp-j4.cons.mod temp-j1.cons.mod; diff temp-j4.noncons.mod temp-j1.noncons.mod
+phastCons --nrates 20 --transitions .08,.008 hpmrc.ss hpmrc-rev-dg-global.mod > temp-scores.wig
+@phastCons -j 4 --nrates 20 --transitions .08,.008 hpmrc.ss hpmrc-rev-dg-global.mod | diff - temp-scores.wig
+rm -f temp-elements.bed temp-j4.bed temp-scores.wig temp-j1.cons.mod temp-j1.noncons.mod temp-j4.cons.mod temp-j4.noncons.mod
+#--checkpoint-cells.  Checkpointed dynamic programming, forced here for
+#the whole alignment, should give the same results as the default
+phastCons --target-coverage 0.25 --expected-length 12 --most-conserved temp-elements.bed hpmrc.ss hpmr.mod > temp-scores.wig
+@phastCons -K 0 --target-coverage 0.25 --expected-length 12 --most-conserved temp-K.bed hpmrc.ss hpmr.mod | diff - temp-scores.wig; diff temp-K.bed temp-elements.bed
+phastCons -k 10 --transitions .08,.008 --most-conserved temp-elements.bed hpmrc.ss hpmr.mod > temp-scores.wig
+@phastCons -K 0 -k 10 --transitions .08,.008 --most-conserved temp-K.bed hpmrc.ss hpmr.mod | diff - temp-scores.wig; diff temp-K.bed temp-elements.bed
+rm -f temp-elements.bed temp-K.bed temp-scores.wig
+#--binary-post-probs (see the phyloP tests of --binary-scores)
+phastCons hpmrc.ss hpmr.mod > temp-scores.wig
+@phastCons -W hpmrc.ss hpmr.mod | perl binaryWigToText.pl 3 temp-scores.wig
+rm -f temp-scores.wig
+#--rescale (see the phyloP tests).  Without it, the posteriors on the
+#large tree are all 0.5
+phastCons --estimate-trees temp-norescale --most-conserved temp-elements.bed hpmrc.ss hpmrc-rev-dg-global.mod > temp-scores.wig
+@phastCons -Z --estimate-trees temp-rescale --most-conserved temp-rescale.bed hpmrc.ss hpmrc-rev-dg-global.mod | diff - temp-scores.wig; diff temp-rescale.bed temp-elements.bed; diff temp-rescale.cons.mod temp-norescale.cons.mod; diff temp-rescale.noncons.mod temp-norescale.noncons.mod
+(grep -v "^TREE" rev.mod; perl -e 'sub t { return "s" . $n++ if !$_[0]; return "(" . t($_[0]-1) . ":0.3," . t($_[0]-1) . ":0.3)"; } print "TREE: ", t(10), ";\n"') > temp-big.mod
+base_evolve --nsites 200 --seed 1 temp-big.mod > temp-big.fa
+@phastCons temp-big.fa temp-big.mod
+@phastCons -Z temp-big.fa temp-big.mod
+rm -f temp-scores.wig temp-elements.bed temp-rescale.bed temp-rescale.cons.mod temp-rescale.noncons.mod temp-norescale.cons.mod temp-norescale.noncons.mod temp-big.mod temp-big.fa
 #--log.  But don't compare the log files because they include runtime information.
 !tempTree.cons.mod !tempTree.noncons.mod  @phastCons --estimate-trees tempTree --log log.txt hpmrc_short.ss hpmr.mod
 rm -f log.txt
@@ -270,6 +410,13 @@ tree_doctor --name-ancestors rev-em.mod --scale 2.0 > rev-em-scaled-named.mod
 #--rate-constants
 !phyloFit.mod @phyloFit hmrc.ss --init-mod rev-em.mod --nrates 4 --rate-constants 10.0,6.0,1.0,0.1
 
+#--analytic-grad; should give the same fit as numerical derivatives, to
+#within the precision of the optimizer
+phyloFit hmrc.ss -D 12345 --subst-mod REV -k 4 --tree "((human,(mouse,rat)),cow)" -o phyloFit-num
+grep "^TRAINING_LNL\|^TREE" phyloFit-num.mod | grep -o "[-0-9.]\{4,\}" > temp-num.txt
+!phyloFit.mod @phyloFit hmrc.ss -D 12345 --subst-mod REV -k 4 --tree "((human,(mouse,rat)),cow)" --analytic-grad; grep "^TRAINING_LNL\|^TREE" phyloFit.mod | grep -o "[-0-9.]\{4,\}" | paste - temp-num.txt | awk '{d = $1 - $2; if (d < 0) d = -d; if (d > 0.001 * ($2 < 0 ? -$2 : $2)) print "differs:", $0}'
+rm -f phyloFit-num.mod temp-num.txt
+
 #--features
 !phyloFit.bed_feature.mod !phyloFit.background.mod @phyloFit hpmrc.ss -D 12345 --tree "(((hg16,panTro2),(rn3,mm3)),galGal2)" --features elements_correct.bed
 
@@ -304,6 +451,22 @@ tree_doctor --name-ancestors rev-em.mod --scale 2.0 > rev-em-scaled-named.mod
 echo -e "1\t20\n25\t45" > windows.txt
 !phyloFit.win-1.mod !phyloFit.win-2.mod @phyloFit  --tree "((human,(mouse,rat)mouse-rat),cow)" --windows-explicit '*windows.txt' simulated.fa --min-informative 15 -D 12345
 rm -f windows.txt
+#--threads.  Results should not depend on the number of threads
+phyloFit hmrc.ss -D 12345 --subst-mod REV -k 4 --tree "((human,(mouse,rat)),cow)" -o phyloFit-j1
+@phyloFit hmrc.ss -D 12345 --subst-mod REV -k 4 --tree "((human,(mouse,rat)),cow)" -j 4; diff phyloFit.mod phyloFit-j1.mod
+phyloFit hmrc.ss -D 12345 --subst-mod HKY85 -k 4 -E --tree "((human,(mouse,rat)),cow)" -o phyloFit-j1
+@phyloFit hmrc.ss -D 12345 --subst-mod HKY85 -k 4 -E --tree "((human,(mouse,rat)),cow)" -j 4; diff phyloFit.mod phyloFit-j1.mod
+rm -f phyloFit-j1.mod
+#a comma-separated list of alignments should give the same fit as the
+#aggregate of the alignments, read in parallel or not
+msa_view hmrc.ss --end 30000 -o SS > temp-agg1.ss
+msa_view hmrc.ss --start 30001 --end 60000 --seqs human,mouse,cow -o SS > temp-agg2.ss
+msa_view hmrc.ss --start 60001 --seqs human,rat,cow > temp-agg3.fa
+msa_view --aggregate human,mouse,rat,cow --unordered-ss -o SS temp-agg1.ss temp-agg2.ss temp-agg3.fa > temp-agg.ss 2> /dev/null
+phyloFit temp-agg.ss -D 12345 --subst-mod REV --tree "((human,(mouse,rat)),cow)" -o phyloFit-agg -q
+@phyloFit temp-agg1.ss,temp-agg2.ss,temp-agg3.fa -D 12345 --subst-mod REV --tree "((human,(mouse,rat)),cow)" -q; diff phyloFit.mod phyloFit-agg.mod
+@phyloFit temp-agg1.ss,temp-agg2.ss,temp-agg3.fa -D 12345 --subst-mod REV --tree "((human,(mouse,rat)),cow)" -q -j 3; diff phyloFit.mod phyloFit-agg.mod
+rm -f temp-agg1.ss temp-agg2.ss temp-agg3.fa temp-agg.ss phyloFit-agg.mod
 
 
 rm -f phyloFit.mod phyloFit.postprob hmr.ss hm.ss rev-em-scaled-named.mod simulated.fa
@@ -357,12 +520,60 @@ msa_view hmrc.fa -o SS > hmrc_short_a.ss
 @msa_view -o SS chr22.14500000-15500000.maf
 @msa_view -o SS --refseq chr22.14500000-15500000.fa chr22.14500000-15500000.maf
 @msa_view -o SS --gap-strip 1 chr22.14500000-15500000.maf
+#compressed input
+gzip -c chr22.14500000-15500000.maf > temp.maf.gz
+msa_view -o SS chr22.14500000-15500000.maf > temp-plain.ss
+@msa_view -o SS temp.maf.gz | diff - temp-plain.ss
+#--aggregate with threads should give the same result, and list the
+#files in the same order, as without
+msa_view hmrc.ss --end 30000 -o SS > temp-agg1.ss
+msa_view hmrc.ss --start 30001 --end 60000 --seqs human,mouse,cow -o SS > temp-agg2.ss
+msa_view hmrc.ss --start 60001 --seqs human,rat,cow > temp-agg3.fa
+msa_view --aggregate human,mouse,rat,cow --unordered-ss -o SS temp-agg1.ss temp-agg2.ss temp-agg3.fa hmrc.fa > temp-agg.ss 2> temp-agg.txt
+@msa_view --aggregate human,mouse,rat,cow --unordered-ss -o SS -j 3 temp-agg1.ss temp-agg2.ss temp-agg3.fa hmrc.fa 2> temp-agg-j3.txt | diff - temp-agg.ss; diff temp-agg-j3.txt temp-agg.txt
+rm -f temp-agg1.ss temp-agg2.ss temp-agg3.fa temp-agg.ss temp-agg.txt temp-agg-j3.txt
+#binary SS (BSS) should convert back to the same text SS, ordered or
+#not, and with padding after the names and after the tuple order
+msa_view hmrc.ss -o SS > temp-text.ss
+@msa_view hmrc.ss -o BSS | msa_view - -o SS | diff - temp-text.ss
+msa_view hmrc.ss --unordered -o SS > temp-text.ss
+@msa_view hmrc.ss --unordered -o BSS | msa_view - -o SS | diff - temp-text.ss
+msa_view hmrc.ss --seqs human,rat,cow --end 10001 -o SS > temp-text.ss
+@msa_view hmrc.ss --seqs human,rat,cow --end 10001 -o BSS | msa_view - -o SS | diff - temp-text.ss
+#truncated or damaged BSS files should be rejected, and write errors
+#reported
+msa_view hmrc.ss -o BSS > temp.bss
+head -c 40 temp.bss > temp-bad.bss
+@msa_view temp-bad.bss -o SS
+head -c 1000 temp.bss > temp-bad.bss
+@msa_view temp-bad.bss -o SS
+head -c 389000 temp.bss > temp-bad.bss
+@msa_view temp-bad.bss -o SS
+# first entry of the tuple order (after the 64-byte header, 24 bytes
+# of alphabet and names, and 533 counts) set out of range
+cp temp.bss temp-bad.bss; printf '\377\377\377\177' | dd of=temp-bad.bss bs=1 seek=4352 conv=notrunc 2> /dev/null
+@msa_view temp-bad.bss -o SS
+@msa_view hmrc.ss -o BSS > /dev/full
+rm -f temp-text.ss temp.bss temp-bad.bss
 
 refeature chr22.14500000-15500000.gp | awk -v OFS="\t" '{start=$4-14500000; end=$5-14500000; print "hg17."$1,$2,$3,start,end,$6,$7,$8,$9}' > temp.gff
 @msa_view -o SS --features temp.gff chr22.14500000-15500000.maf
 @msa_view -o SS --features temp.gff --4d chr22.14500000-15500000.maf
 
-rm -f hmrc.fa hmrc.ph hmrc.mpm hmrc_short_a.ss temp.gff
+rm -f hmrc.fa hmrc.ph hmrc.mpm hmrc_short_a.ss temp.gff temp.maf.gz temp-plain.ss
+
+
+******************** maf_parse ********************
+
+#--threads.  Output should not depend on the number of threads, apart
+#from the command line echoed in the header
+maf_parse chr22.14500000-15500000.maf 2> /dev/null | grep -v "^# maf_parse" > temp-j1.maf
+@maf_parse -j 4 chr22.14500000-15500000.maf | grep -v "^# maf_parse" | diff - temp-j1.maf
+maf_parse --seqs hg17,mm5,rn3 -E -I chr22.14500000-15500000.maf 2> /dev/null | grep -v "^# maf_parse" > temp-j1.maf
+@maf_parse -j 4 --seqs hg17,mm5,rn3 -E -I chr22.14500000-15500000.maf | grep -v "^# maf_parse" | diff - temp-j1.maf
+maf_parse --start 100000 --end 300000 chr22.14500000-15500000.maf 2> /dev/null | grep -v "^# maf_parse" > temp-j1.maf
+@maf_parse -j 4 --start 100000 --end 300000 chr22.14500000-15500000.maf | grep -v "^# maf_parse" | diff - temp-j1.maf
+rm -f temp-j1.maf chr22.14500000-15500000.maf.idx
 
 
 ******************** tree_doctor ********************